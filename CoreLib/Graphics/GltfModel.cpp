@@ -0,0 +1,765 @@
+#include "GltfModel.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <wchar.h>
+using namespace CoreLib::Basic;
+using namespace CoreLib::IO;
+using namespace VectorMath;
+
+namespace CoreLib
+{
+	namespace Graphics
+	{
+		// Document tree of the JSON part of a glTF file
+		struct JsonValue
+		{
+			enum class ValueType
+			{
+				Null, Bool, Number, String, Array, Object
+			};
+			ValueType Type;
+			double Number; // also 0 or 1 for Bool
+			String Str;
+			List<String> Keys; // of an object, one per element
+			List<JsonValue> Elements; // of an array, or the values of an object
+			JsonValue()
+				: Type(ValueType::Null), Number(0.0)
+			{}
+			const JsonValue * Get(const wchar_t * key) const
+			{
+				for (int i = 0; i < Keys.Count(); i++)
+					if (Keys[i] == key)
+						return &Elements[i];
+				return nullptr;
+			}
+			int GetInt(const wchar_t * key, int defaultValue) const
+			{
+				auto value = Get(key);
+				return value && value->Type == ValueType::Number ? (int)value->Number : defaultValue;
+			}
+			double GetNumber(const wchar_t * key, double defaultValue) const
+			{
+				auto value = Get(key);
+				return value && (value->Type == ValueType::Number || value->Type == ValueType::Bool) ? value->Number : defaultValue;
+			}
+			String GetString(const wchar_t * key) const
+			{
+				auto value = Get(key);
+				return value && value->Type == ValueType::String ? value->Str : String();
+			}
+			// Elements of an array member, none if the member is missing or not an array
+			const List<JsonValue> & GetArray(const wchar_t * key) const
+			{
+				static const List<JsonValue> empty;
+				auto value = Get(key);
+				return value && value->Type == ValueType::Array ? value->Elements : empty;
+			}
+		};
+
+		// Recursive descent over a JSON text that need not be null-terminated
+		class JsonReader
+		{
+		private:
+			const char * cur, * end;
+			int depth;
+			void Fail(const wchar_t * reason)
+			{
+				throw IOException(String(L"Malformed glTF JSON: ") + reason);
+			}
+			void SkipSpace()
+			{
+				while (cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\n' || *cur == '\r'))
+					cur++;
+			}
+			void Expect(const char * word)
+			{
+				int length = (int)strlen(word);
+				if (end - cur < length || strncmp(cur, word, length) != 0)
+					Fail(L"unexpected token");
+				cur += length;
+			}
+			int ReadHexDigits()
+			{
+				if (end - cur < 4)
+					Fail(L"truncated escape");
+				int code = 0;
+				for (int i = 0; i < 4; i++)
+				{
+					char c = *cur++;
+					code <<= 4;
+					if (c >= '0' && c <= '9')
+						code |= c - '0';
+					else if (c >= 'a' && c <= 'f')
+						code |= c - 'a' + 10;
+					else if (c >= 'A' && c <= 'F')
+						code |= c - 'A' + 10;
+					else
+						Fail(L"bad escape");
+				}
+				return code;
+			}
+			String ReadString()
+			{
+				cur++;
+				List<char> utf8;
+				while (true)
+				{
+					if (cur >= end)
+						Fail(L"unterminated string");
+					char c = *cur++;
+					if (c == '"')
+						break;
+					if (c != '\\')
+					{
+						utf8.Add(c);
+						continue;
+					}
+					if (cur >= end)
+						Fail(L"unterminated string");
+					c = *cur++;
+					switch (c)
+					{
+					case 'b': utf8.Add('\b'); break;
+					case 'f': utf8.Add('\f'); break;
+					case 'n': utf8.Add('\n'); break;
+					case 'r': utf8.Add('\r'); break;
+					case 't': utf8.Add('\t'); break;
+					case 'u':
+					{
+						int code = ReadHexDigits();
+						if (code >= 0xD800 && code < 0xDC00 && end - cur >= 6 && cur[0] == '\\' && cur[1] == 'u')
+						{
+							cur += 2;
+							code = 0x10000 + ((code - 0xD800) << 10) + (ReadHexDigits() - 0xDC00);
+						}
+						if (code < 0x80)
+							utf8.Add((char)code);
+						else if (code < 0x800)
+						{
+							utf8.Add((char)(0xC0 | (code >> 6)));
+							utf8.Add((char)(0x80 | (code & 0x3F)));
+						}
+						else if (code < 0x10000)
+						{
+							utf8.Add((char)(0xE0 | (code >> 12)));
+							utf8.Add((char)(0x80 | ((code >> 6) & 0x3F)));
+							utf8.Add((char)(0x80 | (code & 0x3F)));
+						}
+						else
+						{
+							utf8.Add((char)(0xF0 | (code >> 18)));
+							utf8.Add((char)(0x80 | ((code >> 12) & 0x3F)));
+							utf8.Add((char)(0x80 | ((code >> 6) & 0x3F)));
+							utf8.Add((char)(0x80 | (code & 0x3F)));
+						}
+						break;
+					}
+					default:
+						utf8.Add(c);
+					}
+				}
+				utf8.Add(0);
+				return String(utf8.Buffer());
+			}
+			double ReadNumber()
+			{
+				// copied out first, strtod would read past the end of an unterminated text
+				char number[64];
+				int length = 0;
+				while (cur < end && length < 63 && (isdigit((unsigned char)*cur) || *cur == '-' || *cur == '+' ||
+					*cur == '.' || *cur == 'e' || *cur == 'E'))
+					number[length++] = *cur++;
+				number[length] = 0;
+				char * numberEnd;
+				double value = strtod(number, &numberEnd);
+				if (length == 0 || numberEnd != number + length)
+					Fail(L"bad number");
+				return value;
+			}
+		public:
+			JsonReader(const char * text, int length)
+				: cur(text), end(text + length), depth(0)
+			{}
+			void Read(JsonValue & value)
+			{
+				SkipSpace();
+				if (cur >= end)
+					Fail(L"unexpected end of text");
+				if (++depth > 256)
+					Fail(L"nested too deeply");
+				char c = *cur;
+				if (c == '{' || c == '[')
+				{
+					bool isObject = c == '{';
+					value.Type = isObject ? JsonValue::ValueType::Object : JsonValue::ValueType::Array;
+					char close = isObject ? '}' : ']';
+					cur++;
+					SkipSpace();
+					if (cur < end && *cur == close)
+						cur++;
+					else
+					{
+						while (true)
+						{
+							if (isObject)
+							{
+								SkipSpace();
+								if (cur >= end || *cur != '"')
+									Fail(L"object key expected");
+								value.Keys.Add(ReadString());
+								SkipSpace();
+								if (cur >= end || *cur != ':')
+									Fail(L"':' expected");
+								cur++;
+							}
+							value.Elements.Add(JsonValue());
+							Read(value.Elements.Last());
+							SkipSpace();
+							if (cur < end && *cur == ',')
+								cur++;
+							else if (cur < end && *cur == close)
+							{
+								cur++;
+								break;
+							}
+							else
+								Fail(L"',' expected");
+						}
+					}
+				}
+				else if (c == '"')
+				{
+					value.Type = JsonValue::ValueType::String;
+					value.Str = ReadString();
+				}
+				else if (c == 't')
+				{
+					Expect("true");
+					value.Type = JsonValue::ValueType::Bool;
+					value.Number = 1.0;
+				}
+				else if (c == 'f')
+				{
+					Expect("false");
+					value.Type = JsonValue::ValueType::Bool;
+				}
+				else if (c == 'n')
+					Expect("null");
+				else
+				{
+					value.Type = JsonValue::ValueType::Number;
+					value.Number = ReadNumber();
+				}
+				depth--;
+			}
+		};
+
+		int GetComponentSize(GltfComponentType type)
+		{
+			switch (type)
+			{
+			case GltfComponentType::Byte:
+			case GltfComponentType::UnsignedByte:
+				return 1;
+			case GltfComponentType::Short:
+			case GltfComponentType::UnsignedShort:
+				return 2;
+			default:
+				return 4;
+			}
+		}
+
+		int GetComponentCount(const String & type)
+		{
+			if (type == L"SCALAR")
+				return 1;
+			if (type == L"VEC2")
+				return 2;
+			if (type == L"VEC3")
+				return 3;
+			if (type == L"VEC4" || type == L"MAT2")
+				return 4;
+			if (type == L"MAT3")
+				return 9;
+			if (type == L"MAT4")
+				return 16;
+			return 0;
+		}
+
+		bool HasPrefix(const String & str, const wchar_t * prefix)
+		{
+			int length = (int)wcslen(prefix);
+			return str.Length() >= length && wcsncmp(str.Buffer(), prefix, length) == 0;
+		}
+
+		int DecodeBase64Digit(char c)
+		{
+			if (c >= 'A' && c <= 'Z')
+				return c - 'A';
+			if (c >= 'a' && c <= 'z')
+				return c - 'a' + 26;
+			if (c >= '0' && c <= '9')
+				return c - '0' + 52;
+			if (c == '+' || c == '-')
+				return 62;
+			if (c == '/' || c == '_')
+				return 63;
+			return -1;
+		}
+
+		// Payload of a data: URI; false if uri is not one
+		bool DecodeDataUri(const String & uri, List<unsigned char> & data)
+		{
+			if (!HasPrefix(uri, L"data:"))
+				return false;
+			int comma = uri.IndexOf(L',');
+			if (comma == -1 || uri.SubString(0, comma).IndexOf(String(L";base64")) == -1)
+				throw IOException(L"Unsupported data URI in glTF file, only base64 is supported");
+			int bits = 0, bitCount = 0;
+			for (int i = comma + 1; i < uri.Length(); i++)
+			{
+				int digit = DecodeBase64Digit((char)uri[i]);
+				if (digit == -1)
+					continue;
+				bits = (bits << 6) | digit;
+				bitCount += 6;
+				if (bitCount >= 8)
+				{
+					bitCount -= 8;
+					data.Add((unsigned char)(bits >> bitCount));
+					bits &= (1 << bitCount) - 1;
+				}
+			}
+			return true;
+		}
+
+		// File name of a relative URI, with %XX escapes decoded
+		String GetUriFileName(const String & modelFileName, const String & uri)
+		{
+			List<char> path;
+			const char * mbUri = uri.ToMultiByteString();
+			int length = (int)strlen(mbUri);
+			for (int i = 0; i < length; i++)
+			{
+				if (mbUri[i] == '%' && i + 2 < length && isxdigit((unsigned char)mbUri[i + 1]) && isxdigit((unsigned char)mbUri[i + 2]))
+				{
+					char hex[3] = {mbUri[i + 1], mbUri[i + 2], 0};
+					path.Add((char)strtol(hex, nullptr, 16));
+					i += 2;
+				}
+				else
+					path.Add(mbUri[i]);
+			}
+			path.Add(0);
+			String directory = Path::GetDirectoryName(modelFileName);
+			return directory.Length() ? Path::Combine(directory, String(path.Buffer())) : String(path.Buffer());
+		}
+
+		Matrix4 GetNodeTransform(const JsonValue & node)
+		{
+			Matrix4 transform;
+			Matrix4::CreateIdentityMatrix(transform);
+			auto & matrix = node.GetArray(L"matrix");
+			if (matrix.Count() == 16)
+			{
+				// column-major, like Matrix4
+				for (int i = 0; i < 16; i++)
+					transform.values[i] = (float)matrix[i].Number;
+				return transform;
+			}
+			auto & t = node.GetArray(L"translation");
+			auto & r = node.GetArray(L"rotation");
+			auto & s = node.GetArray(L"scale");
+			float x = 0.0f, y = 0.0f, z = 0.0f, w = 1.0f;
+			if (r.Count() == 4)
+			{
+				x = (float)r[0].Number;
+				y = (float)r[1].Number;
+				z = (float)r[2].Number;
+				w = (float)r[3].Number;
+			}
+			// translation * rotation * scale
+			transform.m[0][0] = 1.0f - 2.0f * (y * y + z * z);
+			transform.m[0][1] = 2.0f * (x * y + z * w);
+			transform.m[0][2] = 2.0f * (x * z - y * w);
+			transform.m[1][0] = 2.0f * (x * y - z * w);
+			transform.m[1][1] = 1.0f - 2.0f * (x * x + z * z);
+			transform.m[1][2] = 2.0f * (y * z + x * w);
+			transform.m[2][0] = 2.0f * (x * z + y * w);
+			transform.m[2][1] = 2.0f * (y * z - x * w);
+			transform.m[2][2] = 1.0f - 2.0f * (x * x + y * y);
+			if (s.Count() == 3)
+			{
+				for (int col = 0; col < 3; col++)
+					for (int row = 0; row < 3; row++)
+						transform.m[col][row] *= (float)s[col].Number;
+			}
+			if (t.Count() == 3)
+			{
+				transform.m[3][0] = (float)t[0].Number;
+				transform.m[3][1] = (float)t[1].Number;
+				transform.m[3][2] = (float)t[2].Number;
+			}
+			return transform;
+		}
+
+		GltfModel::GltfModel(const String & fileName)
+			: FileName(fileName)
+		{
+			RefPtr<MemoryMappedFile> file = new MemoryMappedFile(fileName);
+			files.Add(file);
+			const unsigned char * data = file->Buffer();
+			Int64 size = file->Size();
+			if (size >= 12 && memcmp(data, "glTF", 4) == 0)
+			{
+				// binary container: a 12-byte header, a JSON chunk and an optional binary chunk
+				unsigned int header[3], chunk[2];
+				memcpy(header, data, sizeof(header));
+				if (header[1] != 2 || header[2] > size || header[2] < 20)
+					throw IOException(L"Unsupported or truncated glb file '" + fileName + L"'");
+				Int64 length = header[2];
+				memcpy(chunk, data + 12, sizeof(chunk));
+				if (chunk[1] != 0x4E4F534A || 20 + (Int64)chunk[0] > length)
+					throw IOException(L"Malformed glb file '" + fileName + L"'");
+				const char * json = (const char*)data + 20;
+				int jsonLength = (int)chunk[0];
+				const unsigned char * binary = nullptr;
+				Int64 binaryLength = 0;
+				Int64 binaryChunk = (20 + jsonLength + 3) & ~(Int64)3;
+				if (binaryChunk + 8 <= length)
+				{
+					memcpy(chunk, data + binaryChunk, sizeof(chunk));
+					if (chunk[1] == 0x004E4942 && binaryChunk + 8 + (Int64)chunk[0] <= length)
+					{
+						binary = data + binaryChunk + 8;
+						binaryLength = chunk[0];
+					}
+				}
+				Parse(json, jsonLength, binary, binaryLength);
+			}
+			else
+			{
+				if (size > 0x7FFFFFFF)
+					throw IOException(L"glTF file '" + fileName + L"' is too large");
+				Parse((const char*)data, (int)size, nullptr, 0);
+			}
+		}
+
+		void GltfModel::Parse(const char * json, int length, const unsigned char * binaryChunk, Int64 binaryChunkLength)
+		{
+			JsonValue root;
+			JsonReader(json, length).Read(root);
+			if (root.Type != JsonValue::ValueType::Object)
+				throw IOException(L"Malformed glTF JSON: object expected");
+			auto asset = root.Get(L"asset");
+			if (!asset || !HasPrefix(asset->GetString(L"version"), L"2"))
+				throw IOException(L"Unsupported glTF version in '" + FileName + L"', only 2.x is supported");
+			auto & requiredExtensions = root.GetArray(L"extensionsRequired");
+			if (requiredExtensions.Count())
+				throw IOException(L"glTF file '" + FileName + L"' requires the unsupported extension " + requiredExtensions[0].Str);
+			auto malformed = [&](const wchar_t * what)
+			{
+				return IOException(L"Malformed glTF file '" + FileName + L"': bad " + what);
+			};
+
+			// buffers, with data: URIs decoded and the others mapped
+			List<int> decodedIndex;
+			for (auto & buffer : root.GetArray(L"buffers"))
+			{
+				Int64 byteLength = (Int64)buffer.GetNumber(L"byteLength", 0.0);
+				String uri = buffer.GetString(L"uri");
+				List<unsigned char> decoded;
+				const unsigned char * data = nullptr;
+				Int64 dataLength = 0;
+				decodedIndex.Add(-1);
+				if (uri.Length() == 0)
+				{
+					if (buffers.Count() != 0 || !binaryChunk)
+						throw malformed(L"buffer");
+					data = binaryChunk;
+					dataLength = binaryChunkLength;
+				}
+				else if (DecodeDataUri(uri, decoded))
+				{
+					decodedIndex.Last() = decodedBuffers.Count();
+					dataLength = decoded.Count();
+					decodedBuffers.Add(_Move(decoded));
+				}
+				else
+				{
+					RefPtr<MemoryMappedFile> file = new MemoryMappedFile(GetUriFileName(FileName, uri));
+					files.Add(file);
+					data = file->Buffer();
+					dataLength = file->Size();
+				}
+				if (dataLength < byteLength)
+					throw IOException(L"glTF buffer in '" + FileName + L"' is shorter than its byteLength");
+				buffers.Add(data);
+				bufferLengths.Add(byteLength);
+			}
+			for (auto & view : root.GetArray(L"bufferViews"))
+			{
+				GltfBufferView bufferView;
+				bufferView.Buffer = view.GetInt(L"buffer", -1);
+				bufferView.Offset = (Int64)view.GetNumber(L"byteOffset", 0.0);
+				bufferView.Length = (Int64)view.GetNumber(L"byteLength", 0.0);
+				bufferView.Stride = view.GetInt(L"byteStride", 0);
+				if (bufferView.Buffer < 0 || bufferView.Buffer >= buffers.Count() || bufferView.Offset < 0 || bufferView.Length < 0 ||
+					bufferView.Stride < 0 || bufferView.Offset + bufferView.Length > bufferLengths[bufferView.Buffer])
+					throw malformed(L"buffer view");
+				BufferViews.Add(bufferView);
+			}
+			for (auto & accessor : root.GetArray(L"accessors"))
+			{
+				if (accessor.Get(L"sparse"))
+					throw IOException(L"glTF file '" + FileName + L"' uses sparse accessors, which are not supported");
+				GltfAccessor rs;
+				rs.BufferView = accessor.GetInt(L"bufferView", -1);
+				rs.Offset = (Int64)accessor.GetNumber(L"byteOffset", 0.0);
+				rs.ComponentType = (GltfComponentType)accessor.GetInt(L"componentType", 0);
+				rs.ComponentCount = GetComponentCount(accessor.GetString(L"type"));
+				rs.Count = accessor.GetInt(L"count", 0);
+				rs.Normalized = accessor.GetNumber(L"normalized", 0.0) != 0.0;
+				int componentType = (int)rs.ComponentType;
+				if (componentType < (int)GltfComponentType::Byte || componentType > (int)GltfComponentType::Float ||
+					componentType == 5124 || rs.ComponentCount == 0 || rs.Count < 0 || rs.Offset < 0 || rs.BufferView >= BufferViews.Count())
+					throw malformed(L"accessor");
+				if (rs.BufferView != -1 && rs.Count > 0)
+				{
+					auto & view = BufferViews[rs.BufferView];
+					Int64 elementSize = GetComponentSize(rs.ComponentType) * rs.ComponentCount;
+					Int64 stride = view.Stride ? view.Stride : elementSize;
+					if (rs.Offset + stride * (rs.Count - 1) + elementSize > view.Length)
+						throw malformed(L"accessor");
+				}
+				Accessors.Add(rs);
+			}
+			auto checkAccessor = [&](int accessor)
+			{
+				if (accessor < -1 || accessor >= Accessors.Count())
+					throw malformed(L"accessor index");
+				return accessor;
+			};
+			for (auto & mesh : root.GetArray(L"meshes"))
+			{
+				GltfMesh rs;
+				for (auto & primitive : mesh.GetArray(L"primitives"))
+				{
+					GltfPrimitive prim;
+					auto attributes = primitive.Get(L"attributes");
+					if (!attributes)
+						throw malformed(L"primitive");
+					prim.Position = checkAccessor(attributes->GetInt(L"POSITION", -1));
+					prim.Normal = checkAccessor(attributes->GetInt(L"NORMAL", -1));
+					prim.TexCoord = checkAccessor(attributes->GetInt(L"TEXCOORD_0", -1));
+					prim.Indices = checkAccessor(primitive.GetInt(L"indices", -1));
+					prim.Material = primitive.GetInt(L"material", -1);
+					prim.Mode = (GltfPrimitiveMode)primitive.GetInt(L"mode", (int)GltfPrimitiveMode::Triangles);
+					if (prim.Material < -1 || prim.Material >= root.GetArray(L"materials").Count())
+						throw malformed(L"material index");
+					rs.Primitives.Add(prim);
+				}
+				Meshes.Add(_Move(rs));
+			}
+			auto & nodes = root.GetArray(L"nodes");
+			List<bool> isChild;
+			isChild.SetSize(nodes.Count());
+			for (int i = 0; i < nodes.Count(); i++)
+				isChild[i] = false;
+			for (auto & node : nodes)
+			{
+				GltfNode rs;
+				rs.Mesh = node.GetInt(L"mesh", -1);
+				if (rs.Mesh < -1 || rs.Mesh >= Meshes.Count())
+					throw malformed(L"mesh index");
+				for (auto & child : node.GetArray(L"children"))
+				{
+					int index = (int)child.Number;
+					if (index < 0 || index >= nodes.Count() || isChild[index])
+						throw malformed(L"node hierarchy");
+					isChild[index] = true;
+					rs.Children.Add(index);
+				}
+				rs.Transform = GetNodeTransform(node);
+				Nodes.Add(_Move(rs));
+			}
+			auto & scenes = root.GetArray(L"scenes");
+			if (scenes.Count())
+			{
+				int scene = root.GetInt(L"scene", 0);
+				if (scene < 0 || scene >= scenes.Count())
+					throw malformed(L"scene index");
+				for (auto & node : scenes[scene].GetArray(L"nodes"))
+				{
+					int index = (int)node.Number;
+					if (index < 0 || index >= Nodes.Count() || isChild[index])
+						throw malformed(L"scene");
+					SceneNodes.Add(index);
+				}
+			}
+			else
+			{
+				// no scene given, draw every tree
+				for (int i = 0; i < Nodes.Count(); i++)
+					if (!isChild[i])
+						SceneNodes.Add(i);
+			}
+
+			// images, with those in data: URIs appended as extra buffers and buffer views
+			for (auto & image : root.GetArray(L"images"))
+			{
+				GltfImage rs;
+				rs.BufferView = image.GetInt(L"bufferView", -1);
+				String uri = image.GetString(L"uri");
+				List<unsigned char> decoded;
+				if (uri.Length() && DecodeDataUri(uri, decoded))
+				{
+					GltfBufferView view;
+					view.Buffer = buffers.Count();
+					view.Offset = 0;
+					view.Length = decoded.Count();
+					view.Stride = 0;
+					rs.BufferView = BufferViews.Count();
+					BufferViews.Add(view);
+					decodedIndex.Add(decodedBuffers.Count());
+					buffers.Add(nullptr);
+					bufferLengths.Add(decoded.Count());
+					decodedBuffers.Add(_Move(decoded));
+				}
+				else if (uri.Length())
+					rs.FileName = GetUriFileName(FileName, uri);
+				else if (rs.BufferView < 0 || rs.BufferView >= BufferViews.Count())
+					throw malformed(L"image");
+				Images.Add(rs);
+			}
+			// the decoded buffers do not move any more
+			for (int i = 0; i < buffers.Count(); i++)
+				if (decodedIndex[i] != -1)
+					buffers[i] = decodedBuffers[decodedIndex[i]].Buffer();
+
+			List<int> textureImages;
+			for (auto & texture : root.GetArray(L"textures"))
+			{
+				int source = texture.GetInt(L"source", -1);
+				textureImages.Add(source >= 0 && source < Images.Count() ? source : -1);
+			}
+			auto getImage = [&](const JsonValue * textureInfo)
+			{
+				if (!textureInfo)
+					return -1;
+				int texture = textureInfo->GetInt(L"index", -1);
+				return texture >= 0 && texture < textureImages.Count() ? textureImages[texture] : -1;
+			};
+			for (auto & material : root.GetArray(L"materials"))
+			{
+				GltfMaterial rs;
+				rs.BaseColorFactor = Vec4(1.0f, 1.0f, 1.0f, 1.0f);
+				rs.BaseColorImage = -1;
+				auto pbr = material.Get(L"pbrMetallicRoughness");
+				if (pbr)
+				{
+					auto & factor = pbr->GetArray(L"baseColorFactor");
+					if (factor.Count() == 4)
+						rs.BaseColorFactor = Vec4((float)factor[0].Number, (float)factor[1].Number, (float)factor[2].Number, (float)factor[3].Number);
+					rs.BaseColorImage = getImage(pbr->Get(L"baseColorTexture"));
+				}
+				auto normalTexture = material.Get(L"normalTexture");
+				rs.NormalImage = getImage(normalTexture);
+				rs.NormalScale = normalTexture ? (float)normalTexture->GetNumber(L"scale", 1.0) : 1.0f;
+				String alphaMode = material.GetString(L"alphaMode");
+				rs.AlphaMode = alphaMode == L"BLEND" ? GltfAlphaMode::Blend : alphaMode == L"MASK" ? GltfAlphaMode::Mask : GltfAlphaMode::Opaque;
+				rs.AlphaCutoff = (float)material.GetNumber(L"alphaCutoff", 0.5);
+				rs.DoubleSided = material.GetNumber(L"doubleSided", 0.0) != 0.0;
+				Materials.Add(rs);
+			}
+		}
+
+		const unsigned char * GltfModel::GetBufferViewData(int bufferView) const
+		{
+			auto & view = BufferViews[bufferView];
+			return buffers[view.Buffer] + view.Offset;
+		}
+
+		const unsigned char * GltfModel::GetAccessorData(int accessor, int & stride) const
+		{
+			auto & rs = Accessors[accessor];
+			stride = GetComponentSize(rs.ComponentType) * rs.ComponentCount;
+			if (rs.BufferView == -1)
+				return nullptr;
+			if (BufferViews[rs.BufferView].Stride)
+				stride = BufferViews[rs.BufferView].Stride;
+			return GetBufferViewData(rs.BufferView) + rs.Offset;
+		}
+
+		void GltfModel::ReadFloats(int accessor, int element, float * result) const
+		{
+			auto & rs = Accessors[accessor];
+			int stride;
+			const unsigned char * data = GetAccessorData(accessor, stride);
+			if (!data)
+			{
+				for (int i = 0; i < rs.ComponentCount; i++)
+					result[i] = 0.0f;
+				return;
+			}
+			data += (Int64)stride * element;
+			for (int i = 0; i < rs.ComponentCount; i++)
+			{
+				switch (rs.ComponentType)
+				{
+				case GltfComponentType::Float:
+					memcpy(result + i, data + i * 4, 4);
+					break;
+				case GltfComponentType::UnsignedByte:
+					result[i] = rs.Normalized ? data[i] * (1.0f / 255.0f) : data[i];
+					break;
+				case GltfComponentType::Byte:
+					result[i] = rs.Normalized ? Math::Max(((signed char*)data)[i] * (1.0f / 127.0f), -1.0f) : ((signed char*)data)[i];
+					break;
+				case GltfComponentType::UnsignedShort:
+				{
+					unsigned short value;
+					memcpy(&value, data + i * 2, 2);
+					result[i] = rs.Normalized ? value * (1.0f / 65535.0f) : value;
+					break;
+				}
+				case GltfComponentType::Short:
+				{
+					short value;
+					memcpy(&value, data + i * 2, 2);
+					result[i] = rs.Normalized ? Math::Max(value * (1.0f / 32767.0f), -1.0f) : value;
+					break;
+				}
+				default:
+				{
+					unsigned int value;
+					memcpy(&value, data + i * 4, 4);
+					result[i] = (float)value;
+				}
+				}
+			}
+		}
+
+		int GltfModel::ReadIndex(int accessor, int element) const
+		{
+			auto & rs = Accessors[accessor];
+			int stride;
+			const unsigned char * data = GetAccessorData(accessor, stride);
+			if (!data)
+				return 0;
+			data += (Int64)stride * element;
+			if (rs.ComponentType == GltfComponentType::UnsignedByte)
+				return data[0];
+			if (rs.ComponentType == GltfComponentType::UnsignedShort)
+			{
+				unsigned short value;
+				memcpy(&value, data, 2);
+				return value;
+			}
+			unsigned int value;
+			memcpy(&value, data, 4);
+			return (int)value;
+		}
+	}
+}
@@ -0,0 +1,105 @@
+#ifndef CORE_LIB_GLTF_MODEL_H
+#define CORE_LIB_GLTF_MODEL_H
+
+#include "../Basic.h"
+#include "../VectorMath.h"
+#include "../LibIO.h"
+
+namespace CoreLib
+{
+	namespace Graphics
+	{
+		enum class GltfComponentType
+		{
+			Byte = 5120, UnsignedByte = 5121, Short = 5122, UnsignedShort = 5123, UnsignedInt = 5125, Float = 5126
+		};
+		enum class GltfPrimitiveMode
+		{
+			Points = 0, Lines = 1, LineLoop = 2, LineStrip = 3, Triangles = 4, TriangleStrip = 5, TriangleFan = 6
+		};
+		enum class GltfAlphaMode
+		{
+			Opaque, Mask, Blend
+		};
+		struct GltfBufferView
+		{
+			int Buffer;
+			Int64 Offset, Length;
+			int Stride; // 0 if the elements are tightly packed
+		};
+		struct GltfAccessor
+		{
+			int BufferView; // -1 if all elements are zero
+			Int64 Offset;
+			GltfComponentType ComponentType;
+			int ComponentCount; // 1 for SCALAR up to 16 for MAT4
+			int Count;
+			bool Normalized;
+		};
+		struct GltfPrimitive
+		{
+			int Position, Normal, TexCoord, Indices; // accessors, -1 if absent
+			int Material; // -1 for the default material
+			GltfPrimitiveMode Mode;
+		};
+		struct GltfMesh
+		{
+			Basic::List<GltfPrimitive> Primitives;
+		};
+		struct GltfNode
+		{
+			int Mesh; // -1 for nodes that only group their children
+			Basic::List<int> Children;
+			VectorMath::Matrix4 Transform; // to the parent's space
+		};
+		struct GltfImage
+		{
+			Basic::String FileName; // empty if the image is stored in BufferView
+			int BufferView;
+		};
+		struct GltfMaterial
+		{
+			VectorMath::Vec4 BaseColorFactor;
+			int BaseColorImage, NormalImage; // -1 for none
+			float NormalScale;
+			GltfAlphaMode AlphaMode;
+			float AlphaCutoff;
+			bool DoubleSided;
+		};
+
+		// A glTF 2.0 model, from a .gltf file with external or data: URI buffers or from a .glb file.
+		// Files are memory mapped and accessors are read in place. Textures are resolved to the images
+		// they sample; samplers and texture coordinate sets other than the first are not used.
+		class GltfModel
+		{
+		private:
+			Basic::List<Basic::RefPtr<IO::MemoryMappedFile>> files;
+			Basic::List<Basic::List<unsigned char>> decodedBuffers; // of data: URIs
+			Basic::List<const unsigned char *> buffers;
+			Basic::List<Int64> bufferLengths;
+			void Parse(const char * json, int length, const unsigned char * binaryChunk, Int64 binaryChunkLength);
+		public:
+			Basic::String FileName;
+			Basic::List<GltfBufferView> BufferViews;
+			Basic::List<GltfAccessor> Accessors;
+			Basic::List<GltfMesh> Meshes;
+			Basic::List<GltfNode> Nodes;
+			Basic::List<GltfImage> Images;
+			Basic::List<GltfMaterial> Materials;
+			Basic::List<int> SceneNodes; // roots of the default scene
+			// Throws IOException if the file cannot be read, is malformed, or needs sparse accessors or
+			// an extension listed in extensionsRequired
+			GltfModel(const Basic::String & fileName);
+			const unsigned char * GetBufferViewData(int bufferView) const;
+			// First element of an accessor and the distance between elements; null if the accessor
+			// has no buffer view
+			const unsigned char * GetAccessorData(int accessor, int & stride) const;
+			// Components of one element of an accessor as floats, normalized integers mapped to [0, 1]
+			// or [-1, 1]
+			void ReadFloats(int accessor, int element, float * result) const;
+			int ReadIndex(int accessor, int element) const;
+		};
+	}
+}
+
+#endif
@@ -1,7 +1,13 @@
 #include "ObjModel.h"
 #include "../LibIO.h"
-#include "../SecureCRT.h"
-#include <map>
+#include "../Threading.h"
+#include "../NumberParsing.h"
+#include <ctype.h>
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 using namespace CoreLib::Basic;
 using namespace CoreLib::IO;
 using namespace VectorMath;
@@ -15,34 +21,6 @@ namespace CoreLib
 			int vid, nid, tid;
 		};
 
-		struct Vec3_Less
-		{
-			bool operator()(const Vec3 & v1, const Vec3 & v2) const
-			{
-				if (v1.x < v2.x)
-					return true;
-				else if (v1.x > v2.x)
-					return false;
-				else
-				{
-					if (v1.y < v2.y)
-						return true;
-					else if (v1.y > v2.y)
-						return false;
-					else
-						return v1.z < v2.z;
-				}
-			}
-		};
-
-#ifdef _MSC_VER
-#define SafeScan fscanf_s
-#define SafeSScan sscanf_s
-#else
-#define SafeScan fscanf
-#define SafeSScan sscanf
-#endif
-
 		void LoadObjMaterialLib(ObjModel & mdl, const String & filename, Dictionary<String, int> & matLookup);
 		String RemoveLineBreakAndQuote(String name)
 		{
@@ -60,114 +38,278 @@ namespace CoreLib
 				end--;
 			return name.SubString(pos, end-pos+1);
 		}
-		bool LoadObj(ObjModel & mdl, const char * fileName, PolygonType polygonType)
+
+		// Line scanning shared by the obj and mtl parsers. Lines are ranges of the mapped file, not
+		// null-terminated strings.
+		inline bool IsObjSpace(char c)
+		{
+			return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+		}
+
+		// Returns the line at pos in [line, lineEnd) and moves pos past its line break
+		inline void NextLine(const char *& pos, const char * end, const char *& line, const char *& lineEnd)
+		{
+			line = pos;
+			const char * lineBreak = (const char *)memchr(pos, '\n', end - pos);
+			lineEnd = lineBreak ? lineBreak : end;
+			pos = lineBreak ? lineBreak + 1 : end;
+		}
+
+		inline int ReadToken(const char *& pos, const char * end, const char *& token)
+		{
+			while (pos < end && IsObjSpace(*pos))
+				pos++;
+			token = pos;
+			while (pos < end && !IsObjSpace(*pos))
+				pos++;
+			return (int)(pos - token);
+		}
+
+		// case-insensitive like the _stricmp the keywords used to be matched with, keyword in lower case
+		inline bool IsKeyword(const char * token, int length, const char * keyword)
+		{
+			for (int i = 0; i < length; i++)
+				if (keyword[i] == 0 || tolower(token[i]) != keyword[i])
+					return false;
+			return keyword[length] == 0;
+		}
+
+		// The rest of a usemtl, mtllib, newmtl or map_* line, read as fgets into a 199-byte buffer did
+		String ReadName(const char * pos, const char * end)
+		{
+			char buffer[200];
+			int length = Math::Min((int)(end - pos), 198);
+			memcpy(buffer, pos, length);
+			buffer[length] = 0;
+			return RemoveLineBreakAndQuote(buffer);
+		}
+
+		// Parses a float to the same correctly rounded value as scanf's %f. A plain decimal is converted
+		// with one exact double operation by ParseExactDecimal. Rounding that double to float again is
+		// exact unless it lands on a midpoint between two floats; those cases, and any other syntax
+		// (inf, nan, hex), go to strtof.
+		bool ParseObjFloat(const char *& pos, const char * end, float & value)
 		{
-			FILE * f = 0;
-			fopen_s(&f, fileName, "rt");
-			if (f == 0)
+			while (pos < end && IsObjSpace(*pos))
+				pos++;
+			const char * p = pos;
+			double d;
+			if (Text::ParseExactDecimal(p, end, d) && (p == end || IsObjSpace(*p)))
+			{
+				float f = (float)d;
+				bool midpoint = false;
+				if ((double)f != d)
+				{
+					float neighbor = nextafterf(f, d > f ? FLT_MAX : -FLT_MAX);
+					midpoint = ((double)f + (double)neighbor) * 0.5 == d;
+				}
+				if (!midpoint)
+				{
+					value = f;
+					pos = p;
+					return true;
+				}
+			}
+			char buffer[64];
+			int length = 0;
+			while (pos + length < end && length < 63 && !IsObjSpace(pos[length]))
+				length++;
+			memcpy(buffer, pos, length);
+			buffer[length] = 0;
+			char * stop;
+			value = strtof(buffer, &stop);
+			if (stop == buffer)
 				return false;
-			bool retVal = true;
-			String matFileName;
-			const int bufferSize = 4096;
-			char buf[bufferSize];
-			int smoothGroup = 0;
-			int matId = -1;
-			List<FaceVertex> vertices;
-			Dictionary<String, int> matLookup;
-#define checkResult(succ) if (!(succ)){retVal = false; break;}
-			while (!feof(f))
+			pos += stop - buffer;
+			return true;
+		}
+
+		// Fails only if the first value is missing, like the scanf("%f %f %f") it replaces; later
+		// missing values are zero
+		bool ParseObjFloats(const char *& pos, const char * end, float * values, int count)
+		{
+			for (int i = 0; i < count; i++)
 			{
-#ifdef _MSC_VER
-				checkResult(fscanf_s(f, "%s", buf, bufferSize));
-#else
-				checkResult(fscanf(f, "%s", buf));
-#endif
+				if (!ParseObjFloat(pos, end, values[i]))
+				{
+					if (i == 0)
+						return false;
+					for (; i < count; i++)
+						values[i] = 0.0f;
+				}
+			}
+			return true;
+		}
+
+		inline bool ParseObjIndex(const char *& pos, const char * end, int & value)
+		{
+			bool negative = false;
+			if (pos < end && (*pos == '-' || *pos == '+'))
+			{
+				negative = *pos == '-';
+				pos++;
+			}
+			if (pos == end || (unsigned)(*pos - '0') >= 10)
+				return false;
+			int v = 0;
+			for (; pos < end && (unsigned)(*pos - '0') < 10; pos++)
+				v = v * 10 + (*pos - '0');
+			value = negative ? -v : v;
+			return true;
+		}
 
-				if (_stricmp(buf, "v") == 0)
+		struct ObjStateChange
+		{
+			enum class ChangeType
+			{
+				MaterialLib, Material, SmoothGroup
+			} Type;
+			int Face; // chunk face the change applies from
+			String Name;
+			// the state after the change, resolved by BeginMerge
+			int MaterialId, SmoothGroup;
+		};
+
+		struct ObjChunk
+		{
+			const char * Begin, * End;
+			List<Vec3> Vertices, Normals;
+			List<Vec2> TexCoords;
+			List<ObjFace> Faces;
+			List<ObjStateChange> StateChanges;
+			// face * 12 + attribute * 4 + slot of the ids given relative to the chunk's first element,
+			// attribute 0 for vertex, 1 for normal and 2 for tex coord ids
+			List<int> RelativeIds;
+			bool Failed;
+			int VertexBase, NormalBase, TexCoordBase, FaceBase;
+			int MaterialId, SmoothGroup; // state at the start of the chunk
+		};
+
+		const int ObjChunkSize = 1 << 20;
+
+		ObjParser::ObjParser(const char * fileName, PolygonType polygonType)
+			: fileName(fileName), polygonType(polygonType)
+		{
+			file = new MemoryMappedFile(this->fileName);
+			const char * pos = (const char *)file->Buffer();
+			const char * end = pos + file->Size();
+			while (pos < end)
+			{
+				const char * chunkEnd = end - pos > ObjChunkSize ? pos + ObjChunkSize : end;
+				if (chunkEnd < end)
+				{
+					const char * lineBreak = (const char *)memchr(chunkEnd, '\n', end - chunkEnd);
+					chunkEnd = lineBreak ? lineBreak + 1 : end;
+				}
+				RefPtr<ObjChunk> chunk = new ObjChunk();
+				chunk->Begin = pos;
+				chunk->End = chunkEnd;
+				chunk->Failed = false;
+				chunks.Add(chunk);
+				pos = chunkEnd;
+			}
+		}
+
+		ObjParser::~ObjParser()
+		{
+		}
+
+		// Resolves a face id to a zero-based index. Relative ids are taken from the chunk's own element
+		// count and flagged in relativeMask for MergeChunk to offset
+		inline int ResolveObjId(int id, int count, int & relativeMask, int attribute)
+		{
+			if (id >= 0)
+				return id - 1;
+			relativeMask |= 1 << attribute;
+			return count + id;
+		}
+
+		// Adds a face built from the given polygon corners and records its relative ids
+		inline void AddObjFace(ObjChunk & chunk, const ObjFace & face, const List<int> & relativeMasks, const int * corners, int cornerCount)
+		{
+			for (int slot = 0; slot < cornerCount; slot++)
+			{
+				int mask = relativeMasks[corners[slot]];
+				for (int attribute = 0; attribute < 3; attribute++)
+					if (mask & (1 << attribute))
+						chunk.RelativeIds.Add(chunk.Faces.Count() * 12 + attribute * 4 + slot);
+			}
+			chunk.Faces.Add(face);
+		}
+
+		void ObjParser::ParseChunk(int chunkId)
+		{
+			ObjChunk & chunk = *chunks[chunkId];
+			List<FaceVertex> vertices;
+			List<int> relativeMasks;
+			const char * pos = chunk.Begin;
+			while (pos < chunk.End)
+			{
+				const char * line, * lineEnd, * token;
+				NextLine(pos, chunk.End, line, lineEnd);
+				int length = ReadToken(line, lineEnd, token);
+				if (length == 0)
+					continue;
+				if (IsKeyword(token, length, "v"))
 				{
 					Vec3 v;
-					checkResult(SafeScan(f, "%f %f %f", &v.x, &v.y, &v.z));
-					mdl.Vertices.Add(v);
+					if (!ParseObjFloats(line, lineEnd, &v.x, 3))
+					{
+						chunk.Failed = true;
+						return;
+					}
+					chunk.Vertices.Add(v);
 				}
-				else if (_stricmp(buf, "vn") == 0)
+				else if (IsKeyword(token, length, "vn"))
 				{
 					Vec3 v;
-					checkResult(SafeScan(f, "%f %f %f", &v.x, &v.y, &v.z));
-					mdl.Normals.Add(v);
+					if (!ParseObjFloats(line, lineEnd, &v.x, 3))
+					{
+						chunk.Failed = true;
+						return;
+					}
+					chunk.Normals.Add(v);
 				}
-				else if (_stricmp(buf, "vt") == 0)
+				else if (IsKeyword(token, length, "vt"))
 				{
 					Vec2 v;
-					checkResult(SafeScan(f, "%f %f", &v.x, &v.y));
-					//v.y = -v.y;
-					mdl.TexCoords.Add(v);
+					if (!ParseObjFloats(line, lineEnd, &v.x, 2))
+					{
+						chunk.Failed = true;
+						return;
+					}
+					chunk.TexCoords.Add(v);
 				}
-				else if (_stricmp(buf, "f") == 0)
+				else if (IsKeyword(token, length, "f"))
 				{
-					checkResult(fgets(buf, bufferSize, f));
-					int len = (int)strlen(buf);
-					buf[len] = '\0';
-					int startPos = 0;
 					vertices.Clear();
-					for (int i = 0; i<=len; i++)
+					relativeMasks.Clear();
+					bool anyRelative = false;
+					const char * vertex;
+					while (ReadToken(line, lineEnd, vertex))
 					{
-						if (buf[i] != ' ' && buf[i] != '\t' && buf[i] != '\n' && buf[i] != '\r' && buf[i] != '\0')
-						{
+						// v, v/t, v//n or v/t/n
+						FaceVertex vtx;
+						int id, relativeMask = 0;
+						if (!ParseObjIndex(vertex, line, id))
 							continue;
-						}
-						else if (i == startPos)
+						vtx.vid = ResolveObjId(id, chunk.Vertices.Count(), relativeMask, 0);
+						vtx.tid = vtx.nid = -1;
+						if (vertex < line && *vertex == '/')
 						{
-							startPos++;
-							continue;
-						}
-						char str[50];
-						memset(str, 0, 50);
-						memcpy(str, buf+startPos, i-startPos);
-						if (strstr(str, "//"))
-						{
-							int vid, nid;
-							SafeSScan(str, "%d//%d", &vid, &nid);
-							FaceVertex vtx;
-							vtx.vid = vid - 1;
-							vtx.nid = nid - 1;
-							vtx.tid = -1;
-							vertices.Add(vtx);
-						}
-						else
-						{
-							int slashCount = 0;
-							for (int j = 0; j<i-startPos; j++)
-							{
-								if (str[j] == '/') slashCount ++;
-							}
-							if (slashCount == 0)
+							vertex++;
+							if (ParseObjIndex(vertex, line, id))
+								vtx.tid = ResolveObjId(id, chunk.TexCoords.Count(), relativeMask, 2);
+							if (vertex < line && *vertex == '/')
 							{
-								FaceVertex vtx;
-								vtx.nid = vtx.tid = -1;
-								SafeSScan(str, "%d", &vtx.vid);
-								vtx.vid --;
-								vertices.Add(vtx);
-							}
-							else if (slashCount == 3)
-							{
-								FaceVertex vtx;
-								vtx.nid = -1;
-								SafeSScan(str, "%d/%d", &vtx.vid, &vtx.tid);
-								vtx.vid --;
-								vtx.tid --;
-								vertices.Add(vtx);
-							}
-							else
-							{
-								FaceVertex vtx;
-								SafeSScan(str, "%d/%d/%d", &vtx.vid, &vtx.tid, &vtx.nid);
-								vtx.vid --;
-								vtx.tid --;
-								vtx.nid --;
-								vertices.Add(vtx);
+								vertex++;
+								if (ParseObjIndex(vertex, line, id))
+									vtx.nid = ResolveObjId(id, chunk.Normals.Count(), relativeMask, 1);
 							}
 						}
-						startPos = i+1;
+						vertices.Add(vtx);
+						relativeMasks.Add(relativeMask);
+						anyRelative |= relativeMask != 0;
 					}
 					// simple triangulation
 					if (vertices.Count() == 4 && polygonType == PolygonType::Quad)
@@ -179,9 +321,11 @@ namespace CoreLib
 							face.NormalIds[k] = vertices[k].nid;
 							face.TexCoordIds[k] = vertices[k].tid;
 						}
-						face.SmoothGroup = smoothGroup;
-						face.MaterialId = matId;
-						mdl.Faces.Add(face);
+						const int corners[] = {0, 1, 2, 3};
+						if (anyRelative)
+							AddObjFace(chunk, face, relativeMasks, corners, 4);
+						else
+							chunk.Faces.Add(face);
 					}
 					else
 					{
@@ -200,147 +344,193 @@ namespace CoreLib
 							face.TexCoordIds[1] = vertices[i-1].tid;
 							face.TexCoordIds[2] = vertices[i].tid;
 							face.TexCoordIds[3] = -1;
-							face.SmoothGroup = smoothGroup;
-							face.MaterialId = matId;
-							mdl.Faces.Add(face);
+							const int corners[] = {0, i-1, i};
+							if (anyRelative)
+								AddObjFace(chunk, face, relativeMasks, corners, 3);
+							else
+								chunk.Faces.Add(face);
 						}
 					}
 				}
-				else if (_stricmp(buf, "usemtl") == 0)
+				else if (IsKeyword(token, length, "usemtl") || IsKeyword(token, length, "mtllib"))
 				{
-					String mtlName;
-					checkResult(fgets(buf, 199, f));
-					mtlName = buf;
-					mtlName = RemoveLineBreakAndQuote(mtlName);
-					matLookup.TryGetValue(mtlName, matId);
+					ObjStateChange change;
+					change.Type = tolower(token[0]) == 'u' ? ObjStateChange::ChangeType::Material : ObjStateChange::ChangeType::MaterialLib;
+					change.Face = chunk.Faces.Count();
+					change.Name = ReadName(line, lineEnd);
+					chunk.StateChanges.Add(change);
 				}
-				else if (_stricmp(buf, "s") == 0)
+				else if (IsKeyword(token, length, "s"))
 				{
-#ifdef _MSC_VER
-					checkResult(fscanf_s(f, "%s", buf, 200));
-#else
-					checkResult(fscanf(f, "%s", buf));
-#endif
-					if (buf[0] >= '0' && buf[0] <= '9')
+					ObjStateChange change;
+					change.Type = ObjStateChange::ChangeType::SmoothGroup;
+					change.Face = chunk.Faces.Count();
+					change.SmoothGroup = 0;
+					const char * group;
+					if (ReadToken(line, lineEnd, group) && *group >= '0' && *group <= '9')
+						ParseObjIndex(group, lineEnd, change.SmoothGroup);
+					chunk.StateChanges.Add(change);
+				}
+			}
+		}
+
+		bool ObjParser::BeginMerge(ObjModel & mdl)
+		{
+			for (auto & chunk : chunks)
+				if (chunk->Failed)
+					return false;
+			Dictionary<String, int> matLookup;
+			int materialId = -1, smoothGroup = 0;
+			int vertexCount = mdl.Vertices.Count(), normalCount = mdl.Normals.Count();
+			int texCoordCount = mdl.TexCoords.Count(), faceCount = mdl.Faces.Count();
+			for (auto & chunk : chunks)
+			{
+				chunk->MaterialId = materialId;
+				chunk->SmoothGroup = smoothGroup;
+				chunk->VertexBase = vertexCount;
+				chunk->NormalBase = normalCount;
+				chunk->TexCoordBase = texCoordCount;
+				chunk->FaceBase = faceCount;
+				vertexCount += chunk->Vertices.Count();
+				normalCount += chunk->Normals.Count();
+				texCoordCount += chunk->TexCoords.Count();
+				faceCount += chunk->Faces.Count();
+				for (auto & change : chunk->StateChanges)
+				{
+					if (change.Type == ObjStateChange::ChangeType::MaterialLib)
 					{
-						checkResult(SafeSScan(buf, "%d", &smoothGroup));
+						String materialLib = Path::Combine(Path::GetDirectoryName(fileName), change.Name);
+						LoadObjMaterialLib(mdl, materialLib, matLookup);
+						mdl.MaterialLibs.Add(materialLib);
 					}
+					else if (change.Type == ObjStateChange::ChangeType::Material)
+						matLookup.TryGetValue(change.Name, materialId);
 					else
-						smoothGroup = 0;
+						smoothGroup = change.SmoothGroup;
+					change.MaterialId = materialId;
+					change.SmoothGroup = smoothGroup;
 				}
-				else if (_stricmp(buf, "mtllib") == 0)
+			}
+			mdl.Vertices.SetSize(vertexCount);
+			mdl.Normals.SetSize(normalCount);
+			mdl.TexCoords.SetSize(texCoordCount);
+			mdl.Faces.SetSize(faceCount);
+			return true;
+		}
+
+		void ObjParser::MergeChunk(ObjModel & mdl, int chunkId)
+		{
+			ObjChunk & chunk = *chunks[chunkId];
+			for (int code : chunk.RelativeIds)
+			{
+				ObjFace & face = chunk.Faces[code / 12];
+				int slot = code % 4;
+				switch (code % 12 / 4)
 				{
-					checkResult(fgets(buf, 199, f));
-					matFileName = buf;
-					matFileName = RemoveLineBreakAndQuote(matFileName);
-					String path = Path::GetDirectoryName(fileName);
-					LoadObjMaterialLib(mdl, Path::Combine(path, matFileName), matLookup);
+				case 0:
+					face.VertexIds[slot] += chunk.VertexBase;
+					break;
+				case 1:
+					face.NormalIds[slot] += chunk.NormalBase;
+					break;
+				default:
+					face.TexCoordIds[slot] += chunk.TexCoordBase;
+					break;
 				}
-				else
+			}
+			memcpy(mdl.Vertices.Buffer() + chunk.VertexBase, chunk.Vertices.Buffer(), chunk.Vertices.Count() * sizeof(Vec3));
+			memcpy(mdl.Normals.Buffer() + chunk.NormalBase, chunk.Normals.Buffer(), chunk.Normals.Count() * sizeof(Vec3));
+			memcpy(mdl.TexCoords.Buffer() + chunk.TexCoordBase, chunk.TexCoords.Buffer(), chunk.TexCoords.Count() * sizeof(Vec2));
+			int materialId = chunk.MaterialId, smoothGroup = chunk.SmoothGroup;
+			int change = 0;
+			for (int i = 0; i < chunk.Faces.Count(); i++)
+			{
+				for (; change < chunk.StateChanges.Count() && chunk.StateChanges[change].Face == i; change++)
 				{
-					while (!feof(f) && fgetc(f) != '\n');
+					materialId = chunk.StateChanges[change].MaterialId;
+					smoothGroup = chunk.StateChanges[change].SmoothGroup;
 				}
+				ObjFace & face = mdl.Faces[chunk.FaceBase + i];
+				face = chunk.Faces[i];
+				face.MaterialId = materialId;
+				face.SmoothGroup = smoothGroup;
 			}
+			chunks[chunkId] = nullptr;
+		}
 
-			fclose(f);
-			return retVal;
+		bool LoadObj(ObjModel & mdl, const char * fileName, PolygonType polygonType)
+		{
+			return LoadObj(mdl, fileName, polygonType, Threading::SerialFor());
 		}
 
 		void LoadObjMaterialLib(ObjModel & mdl, const String & filename, Dictionary<String, int> & matLookup)
 		{
-			FILE * f = 0;
-			fopen_s(&f, filename.ToMultiByteString(), "rt");
-			if (!f)
+			RefPtr<MemoryMappedFile> file;
+			try
+			{
+				file = new MemoryMappedFile(filename);
+			}
+			catch (IOException &)
 			{
 				printf("Error loading obj material library \'%s\'", filename.ToMultiByteString());
 				return;
 			}
-			char buf[200];
 			ObjMaterial* curMat = 0;
-			int succ = 0;
-			while (!feof(f))
+			const char * pos = (const char *)file->Buffer();
+			const char * end = pos + file->Size();
+			while (pos < end)
 			{
-#ifdef _MSC_VER
-				succ = fscanf_s(f, "%s", buf, 200);
-#else
-				succ = fscanf(f, "%s", buf);
-#endif
-				if (!succ)
-					break;
-				if (_stricmp(buf, "newmtl") == 0)
+				const char * line, * lineEnd, * token;
+				NextLine(pos, end, line, lineEnd);
+				int length = ReadToken(line, lineEnd, token);
+				if (length == 0)
+					continue;
+				if (IsKeyword(token, length, "newmtl"))
 				{
 					curMat = new ObjMaterial();
 					mdl.Materials.Add(curMat);
-					char *succ = fgets(buf, 199, f);
-					if (!succ)
-						break;
-					String matName = buf;
-					matName = RemoveLineBreakAndQuote(matName);
-					matLookup[matName] = mdl.Materials.Count()-1;
+					matLookup[ReadName(line, lineEnd)] = mdl.Materials.Count()-1;
 				}
-				else if (_stricmp(buf, "kd") == 0)
+				else if (IsKeyword(token, length, "kd"))
 				{
 					Vec3 v;
-					succ = SafeScan(f, "%f %f %f", &v.x, &v.y, &v.z);
-					if (!succ)
+					if (!ParseObjFloats(line, lineEnd, &v.x, 3))
 						break;
 					if (curMat)
 						curMat->Diffuse = v;
 				}
-				else if (_stricmp(buf, "ks") == 0)
+				else if (IsKeyword(token, length, "ks"))
 				{
 					Vec3 v;
-					succ = SafeScan(f, "%f %f %f", &v.x, &v.y, &v.z);
-					if (!succ)
+					if (!ParseObjFloats(line, lineEnd, &v.x, 3))
 						break;
 					if (curMat)
 						curMat->Specular = v;
 				}
-				else if (_stricmp(buf, "ns") == 0)
+				else if (IsKeyword(token, length, "ns"))
 				{
 					float s;
-					succ = SafeScan(f, "%f", &s);
-					if (!succ)
+					if (!ParseObjFloats(line, lineEnd, &s, 1))
 						break;
 					if (curMat)
 						curMat->SpecularRate = s;
 				}
-				else if (_stricmp(buf, "map_kd") == 0)
+				else if (IsKeyword(token, length, "map_kd"))
 				{
-					char * succ = fgets(buf, 199, f);
-					if (!succ)
-						break;
-					String name = buf;
-					name = RemoveLineBreakAndQuote(name);
 					if (curMat)
-						curMat->DiffuseMap = name;
+						curMat->DiffuseMap = ReadName(line, lineEnd);
 				}
-				else if (_stricmp(buf, "map_bump") == 0)
+				else if (IsKeyword(token, length, "map_bump"))
 				{
-					char *succ = fgets(buf, 199, f);
-					if (!succ)
-						break;
-					String name = buf;
-					name = RemoveLineBreakAndQuote(name);
 					if (curMat)
-						curMat->BumpMap = name;
+						curMat->BumpMap = ReadName(line, lineEnd);
 				}
-				else if (_stricmp(buf, "map_d") == 0)
+				else if (IsKeyword(token, length, "map_d"))
 				{
-					char *succ = fgets(buf, 199, f);
-					if (!succ)
-						break;
-					String name = buf;
-					name = RemoveLineBreakAndQuote(name);
 					if (curMat)
-						curMat->AlphaMap = name;
-				}
-				else
-				{
-					while (!feof(f) && fgetc(f) != '\n');
+						curMat->AlphaMap = ReadName(line, lineEnd);
 				}
 			}
-			fclose(f);
 		}
 
 		void ObjModel::SaveToBinary(IO::BinaryWriter & writer)
@@ -431,78 +621,351 @@ namespace CoreLib
 			}
 		}
 
-		void RecomputeNormals(ObjModel & mdl)
+		const int ObjFrameFaceChunkSize = 1 << 14;
+		const int ObjFrameVertexChunkSize = 1 << 14;
+
+		struct ObjTangentFrameData
+		{
+			List<Vec3> FaceNormals;
+			List<Vec3> FaceTangents; // unit, along increasing u; zero if the tex coords are degenerate
+			List<char> FaceOrientations; // 1 if the tex coords keep the winding of the positions
+			List<float> CornerAngles; // four per face
+			std::unique_ptr<std::atomic<int>[]> CornerCursors; // per vertex, next free slot in VertexCorners
+			List<int> CornerStart; // per vertex and one past the last, first slot in VertexCorners
+			List<int> VertexCorners; // face * 4 + corner, grouped by vertex
+			List<Vec4> CornerFrames; // four per face, the frame vector of the corner's key
+			List<int> CornerKeys; // four per face, index of the corner's key among those of its vertex
+			List<int> KeyStart; // per vertex, number of keys until BeginAssignment, then the id of the first
+		};
+
+		inline int GetObjCornerCount(const ObjFace & face)
 		{
-			mdl.Normals.Clear();
-			std::map<Vec3, int, Vec3_Less> normalMap;
-			//Dictionary<Vec3, int> normalMap;
-			List<Vec3> faceNormals;
-			faceNormals.SetSize(mdl.Faces.Count());
-			for (int i = 0; i<mdl.Faces.Count(); i++)
+			return face.VertexIds[3] == -1 ? 3 : 4;
+		}
+
+		// Any unit vector orthogonal to n
+		inline Vec3 GetObjPerpendicular(const Vec3 & n)
+		{
+			Vec3 axis(0.0f, 0.0f, 0.0f);
+			if (fabs(n.x) <= fabs(n.y) && fabs(n.x) <= fabs(n.z))
+				axis.x = 1.0f;
+			else if (fabs(n.y) <= fabs(n.z))
+				axis.y = 1.0f;
+			else
+				axis.z = 1.0f;
+			Vec3 rs;
+			Vec3::Cross(rs, n, axis);
+			float len = rs.Length();
+			return len > 0.0f ? rs * (1.0f / len) : Vec3(1.0f, 0.0f, 0.0f);
+		}
+
+		// Unit normal of a face from its first three corners
+		Vec3 GetObjFaceNormal(const ObjModel & mdl, const ObjFace & face)
+		{
+			Vec3 v1 = mdl.Vertices[face.VertexIds[0]];
+			Vec3 v2 = mdl.Vertices[face.VertexIds[1]];
+			Vec3 v3 = mdl.Vertices[face.VertexIds[2]];
+			Vec3 ab, ac;
+			Vec3::Subtract(ab, v2, v1);
+			Vec3::Subtract(ac, v3, v1);
+			Vec3 n;
+			Vec3::Cross(n, ab, ac);
+			float len = n.Length();
+			if (len > 1e-8f)
+				return n * (1.0f / len);
+			len = ab.Length();
+			return len > 0.0f ? ab * (1.0f / len) : Vec3(0.0f, 0.0f, 0.0f);
+		}
+
+		ObjTangentFrameBuilder::ObjTangentFrameBuilder(ObjModel & mdl)
+			: model(mdl), data(new ObjTangentFrameData())
+		{
+			int faceCount = mdl.Faces.Count();
+			int vertexCount = mdl.Vertices.Count();
+			data->FaceNormals.SetSize(faceCount);
+			data->FaceTangents.SetSize(faceCount);
+			data->FaceOrientations.SetSize(faceCount);
+			data->CornerAngles.SetSize(faceCount * 4);
+			data->CornerFrames.SetSize(faceCount * 4);
+			data->CornerKeys.SetSize(faceCount * 4);
+			data->CornerStart.SetSize(vertexCount + 1);
+			data->KeyStart.SetSize(vertexCount);
+			data->CornerCursors.reset(new std::atomic<int>[vertexCount]);
+			for (int i = 0; i < vertexCount; i++)
+				data->CornerCursors[i].store(0, std::memory_order_relaxed);
+		}
+
+		ObjTangentFrameBuilder::~ObjTangentFrameBuilder()
+		{
+		}
+
+		int ObjTangentFrameBuilder::GetFaceChunkCount() const
+		{
+			return (model.Faces.Count() + ObjFrameFaceChunkSize - 1) / ObjFrameFaceChunkSize;
+		}
+
+		int ObjTangentFrameBuilder::GetVertexChunkCount() const
+		{
+			return (model.Vertices.Count() + ObjFrameVertexChunkSize - 1) / ObjFrameVertexChunkSize;
+		}
+
+		void ObjTangentFrameBuilder::ComputeFaceNormals(int chunk)
+		{
+			int last = Math::Min((chunk + 1) * ObjFrameFaceChunkSize, model.Faces.Count());
+			for (int f = chunk * ObjFrameFaceChunkSize; f < last; f++)
 			{
-				Vec3 v1 = mdl.Vertices[mdl.Faces[i].VertexIds[0]];
-				Vec3 v2 = mdl.Vertices[mdl.Faces[i].VertexIds[1]];
-				Vec3 v3 = mdl.Vertices[mdl.Faces[i].VertexIds[2]];
-				Vec3 ab, ac;
-				Vec3::Subtract(ab, v2, v1);
-				Vec3::Subtract(ac, v3, v1);
-				Vec3 n;
-				Vec3::Cross(n, ab, ac);
-				float len = n.Length();
-				if (len > 1e-8f)
-					Vec3::Scale(n, n, 1.0f/len);
-				else
-					n = ab.Normalize();
-				faceNormals[i] = n;
+				ObjFace & face = model.Faces[f];
+				data->FaceNormals[f] = GetObjFaceNormal(model, face);
+				int cornerCount = GetObjCornerCount(face);
+				for (int j = 0; j < cornerCount; j++)
+				{
+					// interior angle at the corner, 0 for corners with a zero-length edge
+					Vec3 toPrev, toNext;
+					Vec3::Subtract(toPrev, model.Vertices[face.VertexIds[(j + cornerCount - 1) % cornerCount]], model.Vertices[face.VertexIds[j]]);
+					Vec3::Subtract(toNext, model.Vertices[face.VertexIds[(j + 1) % cornerCount]], model.Vertices[face.VertexIds[j]]);
+					float lengths = toPrev.Length() * toNext.Length();
+					float angle = 0.0f;
+					if (lengths > 0.0f)
+						angle = acosf(Math::Max(-1.0f, Math::Min(1.0f, Vec3::Dot(toPrev, toNext) / lengths)));
+					data->CornerAngles[f * 4 + j] = angle;
+					data->CornerCursors[face.VertexIds[j]].fetch_add(1, std::memory_order_relaxed);
+				}
 			}
+		}
 
-			List<int> vertShare;
-			List<int> vertFaces;
+		void ObjTangentFrameBuilder::ComputeFaceTangents(int chunk)
+		{
+			ComputeFaceNormals(chunk);
+			int last = Math::Min((chunk + 1) * ObjFrameFaceChunkSize, model.Faces.Count());
+			for (int f = chunk * ObjFrameFaceChunkSize; f < last; f++)
+			{
+				ObjFace & face = model.Faces[f];
+				// as in MikkTSpace: the direction of increasing u in the plane of the face, flipped
+				// where the tex coords mirror the face
+				Vec3 tangent(0.0f, 0.0f, 0.0f);
+				char orientation = 1;
+				if (face.TexCoordIds[0] != -1 && face.TexCoordIds[1] != -1 && face.TexCoordIds[2] != -1)
+				{
+					Vec3 d1, d2;
+					Vec3::Subtract(d1, model.Vertices[face.VertexIds[1]], model.Vertices[face.VertexIds[0]]);
+					Vec3::Subtract(d2, model.Vertices[face.VertexIds[2]], model.Vertices[face.VertexIds[0]]);
+					Vec2 t0 = model.TexCoords[face.TexCoordIds[0]];
+					Vec2 t1 = model.TexCoords[face.TexCoordIds[1]];
+					Vec2 t2 = model.TexCoords[face.TexCoordIds[2]];
+					float t21x = t1.x - t0.x, t21y = t1.y - t0.y, t31x = t2.x - t0.x, t31y = t2.y - t0.y;
+					float signedArea = t21x * t31y - t21y * t31x;
+					orientation = signedArea > 0.0f;
+					Vec3 os = d1 * t31y - d2 * t21y;
+					float len = os.Length();
+					if (signedArea != 0.0f && len > 0.0f)
+						tangent = os * ((orientation ? 1.0f : -1.0f) / len);
+				}
+				data->FaceTangents[f] = tangent;
+				data->FaceOrientations[f] = orientation;
+			}
+		}
 
-			mdl.ConstructPerVertexFaceList(vertShare, vertFaces);
+		void ObjTangentFrameBuilder::BeginGrouping()
+		{
+			int vertexCount = model.Vertices.Count();
 			int start = 0;
-			for (int i = 0; i<mdl.Faces.Count(); i++)
+			for (int i = 0; i < vertexCount; i++)
+			{
+				data->CornerStart[i] = start;
+				start += data->CornerCursors[i].load(std::memory_order_relaxed);
+				data->CornerCursors[i].store(data->CornerStart[i], std::memory_order_relaxed);
+			}
+			data->CornerStart[vertexCount] = start;
+			data->VertexCorners.SetSize(start);
+		}
+
+		void ObjTangentFrameBuilder::GroupCorners(int chunk)
+		{
+			int last = Math::Min((chunk + 1) * ObjFrameFaceChunkSize, model.Faces.Count());
+			for (int f = chunk * ObjFrameFaceChunkSize; f < last; f++)
 			{
-				ObjFace & face = mdl.Faces[i];
-				for (int j = 0; j < 4; j++)
+				ObjFace & face = model.Faces[f];
+				int cornerCount = GetObjCornerCount(face);
+				for (int j = 0; j < cornerCount; j++)
+					data->VertexCorners[data->CornerCursors[face.VertexIds[j]].fetch_add(1, std::memory_order_relaxed)] = f * 4 + j;
+			}
+		}
+
+		void ObjTangentFrameBuilder::ComputeVertexNormals(int chunk)
+		{
+			int last = Math::Min((chunk + 1) * ObjFrameVertexChunkSize, model.Vertices.Count());
+			List<int> keyCorners; // first corner of each key
+			for (int v = chunk * ObjFrameVertexChunkSize; v < last; v++)
+			{
+				// GroupCorners fills the lists in whatever order the chunks ran, sums go in corner order
+				int * corners = data->VertexCorners.Buffer() + data->CornerStart[v];
+				int count = data->CornerStart[v + 1] - data->CornerStart[v];
+				std::sort(corners, corners + count);
+				keyCorners.Clear();
+				for (int i = 0; i < count; i++)
 				{
-					int vid = face.VertexIds[j];
-					if (vid == -1)
+					int corner = corners[i];
+					int face = corner >> 2;
+					unsigned int group = model.Faces[face].SmoothGroup;
+					// corners share a key if they share the smoothing group, or outside smoothing groups
+					// if their faces have the same normal
+					int key = -1;
+					for (int k = 0; k < keyCorners.Count() && key == -1; k++)
+					{
+						int keyFace = keyCorners[k] >> 2;
+						if (model.Faces[keyFace].SmoothGroup != group)
+							continue;
+						if (group != 0 || (data->FaceNormals[keyFace].x == data->FaceNormals[face].x &&
+							data->FaceNormals[keyFace].y == data->FaceNormals[face].y && data->FaceNormals[keyFace].z == data->FaceNormals[face].z))
+							key = k;
+					}
+					if (key != -1)
+					{
+						data->CornerKeys[corner] = key;
+						data->CornerFrames[corner] = data->CornerFrames[keyCorners[key]];
 						continue;
-					if (vid == 0)
-						start = 0;
-					else
-						start = vertShare[vid-1];
-					int count = 0;
-					Vec3 n;
-					n.SetZero();
-					for (int k = start; k < vertShare[vid]; k++)
+					}
+					Vec3 normal = data->FaceNormals[face];
+					if (group != 0)
 					{
-						int fid = vertFaces[k];
-						if (mdl.Faces[fid].SmoothGroup & face.SmoothGroup)
+						Vec3 sum(0.0f, 0.0f, 0.0f);
+						for (int j = 0; j < count; j++)
 						{
-							Vec3::Add(n, faceNormals[fid], n);
-							count ++;
+							int other = corners[j];
+							if (model.Faces[other >> 2].SmoothGroup & group)
+								sum += data->FaceNormals[other >> 2] * data->CornerAngles[other];
 						}
+						float len = sum.Length();
+						if (len > 1e-20f)
+							normal = sum * (1.0f / len);
 					}
-					if (count == 0)
-						n = faceNormals[i];
-					else
-						Vec3::Scale(n, n, 1.0f/count);
+					data->CornerKeys[corner] = keyCorners.Count();
+					data->CornerFrames[corner] = Vec4(normal.x, normal.y, normal.z, 0.0f);
+					keyCorners.Add(corner);
+				}
+				data->KeyStart[v] = keyCorners.Count();
+			}
+		}
 
-					std::map<Vec3, int, Vec3_Less>::iterator iter = normalMap.find(n);
-					if (iter != normalMap.end())
+		void ObjTangentFrameBuilder::ComputeVertexTangents(int chunk)
+		{
+			int last = Math::Min((chunk + 1) * ObjFrameVertexChunkSize, model.Vertices.Count());
+			List<int> keyCorners;
+			auto getNormal = [&](int corner)
+			{
+				int normalId = model.Faces[corner >> 2].NormalIds[corner & 3];
+				return normalId != -1 ? model.Normals[normalId] : data->FaceNormals[corner >> 2];
+			};
+			auto sameKey = [&](int a, int b)
+			{
+				auto & faceA = model.Faces[a >> 2];
+				auto & faceB = model.Faces[b >> 2];
+				return faceA.NormalIds[a & 3] == faceB.NormalIds[b & 3] && faceA.TexCoordIds[a & 3] == faceB.TexCoordIds[b & 3] &&
+					data->FaceOrientations[a >> 2] == data->FaceOrientations[b >> 2] &&
+					(faceA.NormalIds[a & 3] != -1 || (a >> 2) == (b >> 2));
+			};
+			for (int v = chunk * ObjFrameVertexChunkSize; v < last; v++)
+			{
+				int * corners = data->VertexCorners.Buffer() + data->CornerStart[v];
+				int count = data->CornerStart[v + 1] - data->CornerStart[v];
+				std::sort(corners, corners + count);
+				keyCorners.Clear();
+				for (int i = 0; i < count; i++)
+				{
+					int corner = corners[i];
+					int key = -1;
+					for (int k = 0; k < keyCorners.Count() && key == -1; k++)
+						if (sameKey(keyCorners[k], corner))
+							key = k;
+					if (key != -1)
 					{
-						face.NormalIds[j] = iter->second;
+						data->CornerKeys[corner] = key;
+						data->CornerFrames[corner] = data->CornerFrames[keyCorners[key]];
+						continue;
 					}
-					else
+					Vec3 normal = getNormal(corner);
+					Vec3 sum(0.0f, 0.0f, 0.0f);
+					for (int j = i; j < count; j++)
 					{
-						mdl.Normals.Add(n);
-						face.NormalIds[j] = mdl.Normals.Count()-1;
-						normalMap[n] = mdl.Normals.Count()-1;
+						int other = corners[j];
+						if (!sameKey(corner, other))
+							continue;
+						// each face tangent is taken into the plane of the corner normal first
+						Vec3 tangent = data->FaceTangents[other >> 2];
+						tangent -= normal * Vec3::Dot(normal, tangent);
+						float len = tangent.Length();
+						if (len > 0.0f)
+							sum += tangent * (data->CornerAngles[other] / len);
 					}
+					sum -= normal * Vec3::Dot(normal, sum);
+					float len = sum.Length();
+					Vec3 tangent = len > 1e-20f ? sum * (1.0f / len) : GetObjPerpendicular(normal);
+					data->CornerKeys[corner] = keyCorners.Count();
+					data->CornerFrames[corner] = Vec4(tangent.x, tangent.y, tangent.z, data->FaceOrientations[corner >> 2] ? 1.0f : -1.0f);
+					keyCorners.Add(corner);
 				}
+				data->KeyStart[v] = keyCorners.Count();
 			}
 		}
+
+		void ObjTangentFrameBuilder::BeginAssignment(bool tangents)
+		{
+			int start = 0;
+			for (int i = 0; i < data->KeyStart.Count(); i++)
+			{
+				int count = data->KeyStart[i];
+				data->KeyStart[i] = start;
+				start += count;
+			}
+			if (tangents)
+			{
+				model.Tangents.SetSize(start);
+				model.TangentIds.SetSize(model.Faces.Count() * 4);
+				for (auto & id : model.TangentIds)
+					id = -1;
+			}
+			else
+				model.Normals.SetSize(start);
+		}
+
+		void ObjTangentFrameBuilder::AssignNormals(int chunk)
+		{
+			int last = Math::Min((chunk + 1) * ObjFrameVertexChunkSize, model.Vertices.Count());
+			for (int v = chunk * ObjFrameVertexChunkSize; v < last; v++)
+			{
+				for (int i = data->CornerStart[v]; i < data->CornerStart[v + 1]; i++)
+				{
+					int corner = data->VertexCorners[i];
+					int id = data->KeyStart[v] + data->CornerKeys[corner];
+					model.Faces[corner >> 2].NormalIds[corner & 3] = id;
+					model.Normals[id] = data->CornerFrames[corner].xyz();
+				}
+			}
+		}
+
+		void ObjTangentFrameBuilder::AssignTangents(int chunk)
+		{
+			int last = Math::Min((chunk + 1) * ObjFrameVertexChunkSize, model.Vertices.Count());
+			for (int v = chunk * ObjFrameVertexChunkSize; v < last; v++)
+			{
+				for (int i = data->CornerStart[v]; i < data->CornerStart[v + 1]; i++)
+				{
+					int corner = data->VertexCorners[i];
+					int id = data->KeyStart[v] + data->CornerKeys[corner];
+					model.TangentIds[corner] = id;
+					model.Tangents[id] = data->CornerFrames[corner];
+				}
+			}
+		}
+
+		void RecomputeNormals(ObjModel & mdl)
+		{
+			RecomputeNormals(mdl, Threading::SerialFor());
+		}
+
+		void ComputeTangents(ObjModel & mdl)
+		{
+			ComputeTangents(mdl, Threading::SerialFor());
+		}
 	}
 }
@@ -34,12 +34,130 @@ namespace CoreLib
 			Basic::List<VectorMath::Vec3> Vertices, Normals;
 			Basic::List<VectorMath::Vec2> TexCoords;
 			Basic::List<ObjFace> Faces;
+			Basic::List<Basic::String> MaterialLibs; // mtl files read by LoadObj, not saved by SaveToBinary
+			// Filled by ComputeTangents and not saved by SaveToBinary: unit tangents with the sign of the
+			// bitangent in w (bitangent = cross(normal, tangent) * w), and four ids per face like NormalIds
+			Basic::List<VectorMath::Vec4> Tangents;
+			Basic::List<int> TangentIds;
 			void ConstructPerVertexFaceList(Basic::List<int> & faceCountAtVert, Basic::List<int> & vertFaceList);
 			void SaveToBinary(IO::BinaryWriter & writer);
 			bool LoadFromBinary(IO::BinaryReader & reader);
 		};
+
+		struct ObjChunk;
+
+		// Parses a memory-mapped obj file in line-aligned chunks that do not depend on each other, then
+		// merges the chunks in file order. Material and smoothing group changes are replayed and relative
+		// (negative) indices resolved during the merge, so the result does not depend on the chunking.
+		class ObjParser
+		{
+		private:
+			Basic::RefPtr<IO::MemoryMappedFile> file;
+			Basic::String fileName;
+			PolygonType polygonType;
+			Basic::List<Basic::RefPtr<ObjChunk>> chunks;
+		public:
+			// throws IOException if the file cannot be opened
+			ObjParser(const char * fileName, PolygonType polygonType);
+			~ObjParser();
+			int GetChunkCount() const
+			{
+				return chunks.Count();
+			}
+			void ParseChunk(int chunk);
+			// loads the material libraries and sizes the model's lists. Returns false if a chunk
+			// had a malformed line
+			bool BeginMerge(ObjModel & mdl);
+			void MergeChunk(ObjModel & mdl, int chunk);
+		};
+
 		bool LoadObj(ObjModel & mdl, const char * fileName, PolygonType polygonType = PolygonType::Triangle);
+
+		// Same as above with the chunks parsed and merged through parallelFor(count, body), see
+		// Threading::SerialFor
+		template<typename ParallelFor>
+		bool LoadObj(ObjModel & mdl, const char * fileName, PolygonType polygonType, const ParallelFor & parallelFor)
+		{
+			try
+			{
+				ObjParser parser(fileName, polygonType);
+				parallelFor(parser.GetChunkCount(), [&](int chunk) { parser.ParseChunk(chunk); });
+				if (!parser.BeginMerge(mdl))
+					return false;
+				parallelFor(parser.GetChunkCount(), [&](int chunk) { parser.MergeChunk(mdl, chunk); });
+				return true;
+			}
+			catch (IO::IOException &)
+			{
+				return false;
+			}
+		}
+		struct ObjTangentFrameData;
+
+		// Builds per-corner normals or tangents in fixed-size chunks of faces and of vertices. Each step
+		// only writes to its own chunk's faces or vertices and the corners around a vertex are always
+		// combined in corner order, so the result is bitwise identical however the chunks are scheduled.
+		// Steps run in the order RecomputeNormals and ComputeTangents call them.
+		class ObjTangentFrameBuilder
+		{
+		private:
+			ObjModel & model;
+			Basic::RefPtr<ObjTangentFrameData> data;
+		public:
+			ObjTangentFrameBuilder(ObjModel & mdl);
+			~ObjTangentFrameBuilder();
+			int GetFaceChunkCount() const;
+			int GetVertexChunkCount() const;
+			// Face normals and corner angles, and the number of corners at each vertex
+			void ComputeFaceNormals(int chunk);
+			// Same for tangent space, from the model's normals and tex coords
+			void ComputeFaceTangents(int chunk);
+			// Sizes the lists of corners around each vertex
+			void BeginGrouping();
+			void GroupCorners(int chunk);
+			// Sums the corners of each vertex into one frame vector per distinct corner key
+			void ComputeVertexNormals(int chunk);
+			void ComputeVertexTangents(int chunk);
+			// Numbers the frame vectors of all vertices and sizes the model's list of them
+			void BeginAssignment(bool tangents);
+			void AssignNormals(int chunk);
+			void AssignTangents(int chunk);
+		};
+
+		// Replaces the normals with per-corner normals: the angle-weighted average of the normals of the
+		// faces around the corner's vertex that share a smoothing group with the corner's face. Faces
+		// outside any smoothing group (s off) keep their face normal. Chunks run through parallelFor
+		// (count, body), see Threading::SerialFor; the result does not depend on it.
+		template<typename ParallelFor>
+		void RecomputeNormals(ObjModel & mdl, const ParallelFor & parallelFor)
+		{
+			ObjTangentFrameBuilder builder(mdl);
+			parallelFor(builder.GetFaceChunkCount(), [&](int chunk) { builder.ComputeFaceNormals(chunk); });
+			builder.BeginGrouping();
+			parallelFor(builder.GetFaceChunkCount(), [&](int chunk) { builder.GroupCorners(chunk); });
+			parallelFor(builder.GetVertexChunkCount(), [&](int chunk) { builder.ComputeVertexNormals(chunk); });
+			builder.BeginAssignment(false);
+			parallelFor(builder.GetVertexChunkCount(), [&](int chunk) { builder.AssignNormals(chunk); });
+		}
 		void RecomputeNormals(ObjModel & mdl);
+
+		// Fills Tangents and TangentIds with MikkTSpace-style tangents: the tangent of each face, from
+		// its tex coords, is projected onto the plane of each corner's normal and averaged by corner
+		// angle over the corners that share a vertex, normal, tex coord and tangent space orientation,
+		// then made orthogonal to the normal. Faces without tex coords or with degenerate ones get an
+		// arbitrary tangent orthogonal to their normals. Needs normals on every face.
+		template<typename ParallelFor>
+		void ComputeTangents(ObjModel & mdl, const ParallelFor & parallelFor)
+		{
+			ObjTangentFrameBuilder builder(mdl);
+			parallelFor(builder.GetFaceChunkCount(), [&](int chunk) { builder.ComputeFaceTangents(chunk); });
+			builder.BeginGrouping();
+			parallelFor(builder.GetFaceChunkCount(), [&](int chunk) { builder.GroupCorners(chunk); });
+			parallelFor(builder.GetVertexChunkCount(), [&](int chunk) { builder.ComputeVertexTangents(chunk); });
+			builder.BeginAssignment(true);
+			parallelFor(builder.GetVertexChunkCount(), [&](int chunk) { builder.AssignTangents(chunk); });
+		}
+		void ComputeTangents(ObjModel & mdl);
 	}
 }
 
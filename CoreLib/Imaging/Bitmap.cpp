@@ -28,6 +28,15 @@ namespace CoreLib
 				throw IO::IOException(L"Cannot load image \"" + fileName + L"\"");
 		}
 
+		Bitmap::Bitmap(const unsigned char * data, int size)
+		{
+			int channel;
+			pixels = stbi_load_from_memory(data, size, &width, &height, &channel, 4);
+			isTransparent = (channel == 4);
+			if (!pixels)
+				throw IO::IOException(L"Cannot decode image");
+		}
+
 		void ImageRef::SaveAsBmpFile(Basic::String fileName, bool reverseY)
 		{
 			FILE *f = 0;
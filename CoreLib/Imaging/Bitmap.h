@@ -119,6 +119,8 @@ namespace CoreLib
 			}
 
 			Bitmap(Basic::String fileName);
+			// Decodes an image file held in memory
+			Bitmap(const unsigned char * data, int size);
 		};
 
 		void WriteBitmask(int * bits, int width, int height, Basic::String fileName);
@@ -0,0 +1,797 @@
+#include "ImageEncoding.h"
+#include "../LibIO.h"
+#include <string.h>
+
+namespace CoreLib
+{
+	namespace Imaging
+	{
+		using namespace CoreLib::Basic;
+
+		ImageFileFormat GetImageFileFormat(const String & fileName)
+		{
+			String extension = IO::Path::GetFileExt(fileName).ToLower();
+			if (extension == L"png")
+				return ImageFileFormat::Png;
+			if (extension == L"qoi")
+				return ImageFileFormat::Qoi;
+			return ImageFileFormat::Bmp;
+		}
+
+		static inline void WriteBigEndian(unsigned char * dst, unsigned int value)
+		{
+			dst[0] = (unsigned char)(value >> 24);
+			dst[1] = (unsigned char)(value >> 16);
+			dst[2] = (unsigned char)(value >> 8);
+			dst[3] = (unsigned char)value;
+		}
+
+		// Rows of about this many bytes make a strip, enough for the matches of a strip to find most
+		// of what a whole-image deflate would
+		static const int StripBytes = 1 << 18;
+
+		static int GetStripRows(int rowBytes)
+		{
+			return Math::Max(1, StripBytes / Math::Max(rowBytes, 1));
+		}
+
+		// PNG
+
+		static unsigned int Crc32(unsigned int crc, const unsigned char * data, int size)
+		{
+			struct CrcTable
+			{
+				unsigned int Entries[256];
+				CrcTable()
+				{
+					for (unsigned int i = 0; i < 256; i++)
+					{
+						unsigned int c = i;
+						for (int k = 0; k < 8; k++)
+							c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+						Entries[i] = c;
+					}
+				}
+			};
+			static const CrcTable table;
+			crc = ~crc;
+			for (int i = 0; i < size; i++)
+				crc = table.Entries[(crc ^ data[i]) & 255] ^ (crc >> 8);
+			return ~crc;
+		}
+
+		static const unsigned int AdlerBase = 65521;
+
+		static unsigned int Adler32(const unsigned char * data, int size)
+		{
+			unsigned int a = 1, b = 0;
+			while (size > 0)
+			{
+				// the most bytes before b can overflow
+				int count = Math::Min(size, 5552);
+				for (int i = 0; i < count; i++)
+				{
+					a += data[i];
+					b += a;
+				}
+				a %= AdlerBase;
+				b %= AdlerBase;
+				data += count;
+				size -= count;
+			}
+			return (b << 16) | a;
+		}
+
+		// The Adler-32 of two pieces of data joined, from their own and the length of the second
+		static unsigned int CombineAdler32(unsigned int adler1, unsigned int adler2, unsigned int length2)
+		{
+			unsigned int remainder = length2 % AdlerBase;
+			unsigned int a = adler1 & 0xFFFF;
+			unsigned int b = (remainder * a) % AdlerBase;
+			a += (adler2 & 0xFFFF) + AdlerBase - 1;
+			b += (adler1 >> 16) + (adler2 >> 16) + AdlerBase - remainder;
+			if (a >= AdlerBase)
+				a -= AdlerBase;
+			if (a >= AdlerBase)
+				a -= AdlerBase;
+			if (b >= AdlerBase * 2)
+				b -= AdlerBase * 2;
+			if (b >= AdlerBase)
+				b -= AdlerBase;
+			return (b << 16) | a;
+		}
+
+		static inline int Paeth(int a, int b, int c)
+		{
+			int p = a + b - c;
+			int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+			if (pa <= pb && pa <= pc)
+				return a;
+			return pb <= pc ? b : c;
+		}
+
+		void PngEncoder::FilterRows(Strip & strip, int firstRow, int rows)
+		{
+			int rowBytes = width * 3;
+			strip.Filtered.SetSize((rowBytes + 1) * rows);
+			List<unsigned char> zeros;
+			for (int r = 0; r < rows; r++)
+			{
+				int y = firstRow + r;
+				const unsigned char * row = image + (size_t)y * stride;
+				const unsigned char * above = y > 0 ? row - stride : nullptr;
+				if (!above)
+				{
+					zeros.SetSize(rowBytes);
+					memset(zeros.Buffer(), 0, rowBytes);
+					above = zeros.Buffer();
+				}
+				// sums of the residuals as signed bytes
+				int sums[3] = {0, 0, 0};
+				for (int i = 0; i < rowBytes; i++)
+				{
+					int a = i >= 3 ? row[i - 3] : 0, b = above[i], c = i >= 3 ? above[i - 3] : 0;
+					sums[0] += abs((signed char)(row[i] - a));
+					sums[1] += abs((signed char)(row[i] - b));
+					sums[2] += abs((signed char)(row[i] - Paeth(a, b, c)));
+				}
+				int filter = sums[0] <= sums[1] ? (sums[0] <= sums[2] ? 1 : 4) : (sums[1] <= sums[2] ? 2 : 4);
+				unsigned char * dst = strip.Filtered.Buffer() + (rowBytes + 1) * r;
+				*dst++ = (unsigned char)filter;
+				for (int i = 0; i < rowBytes; i++)
+				{
+					int a = i >= 3 ? row[i - 3] : 0, b = above[i], c = i >= 3 ? above[i - 3] : 0;
+					int predictor = filter == 1 ? a : (filter == 2 ? b : Paeth(a, b, c));
+					dst[i] = (unsigned char)(row[i] - predictor);
+				}
+			}
+		}
+
+		namespace
+		{
+			// Symbols and extra bits of the deflate lengths and distances
+			struct DeflateTables
+			{
+				unsigned short LengthBase[29], DistanceBase[30];
+				unsigned char LengthExtra[29], DistanceExtra[30];
+				unsigned char LengthCode[256];   // of length - 3
+				unsigned char DistanceCode[512]; // of distance - 1 below 256, then of (distance - 1) >> 7
+				DeflateTables()
+				{
+					int length = 3;
+					for (int code = 0; code < 28; code++)
+					{
+						LengthExtra[code] = (unsigned char)(code < 8 ? 0 : (code - 4) / 4);
+						LengthBase[code] = (unsigned short)length;
+						for (int i = 0; i < (1 << LengthExtra[code]); i++)
+							LengthCode[length - 3 + i] = (unsigned char)code;
+						length += 1 << LengthExtra[code];
+					}
+					// 258 has a code of its own
+					LengthExtra[28] = 0;
+					LengthBase[28] = 258;
+					LengthCode[255] = 28;
+					int distance = 1;
+					for (int code = 0; code < 30; code++)
+					{
+						DistanceExtra[code] = (unsigned char)(code < 4 ? 0 : (code - 2) / 2);
+						DistanceBase[code] = (unsigned short)distance;
+						for (int i = 0; i < (1 << DistanceExtra[code]); i++)
+						{
+							int d = distance - 1 + i;
+							if (d < 256)
+								DistanceCode[d] = (unsigned char)code;
+							else if ((d & 127) == 0)
+								DistanceCode[256 + (d >> 7)] = (unsigned char)code;
+						}
+						distance += 1 << DistanceExtra[code];
+					}
+				}
+				inline int GetDistanceCode(int distance) const
+				{
+					int d = distance - 1;
+					return d < 256 ? DistanceCode[d] : DistanceCode[256 + (d >> 7)];
+				}
+			};
+
+			const DeflateTables & GetDeflateTables()
+			{
+				static const DeflateTables tables;
+				return tables;
+			}
+
+			// Deflate bits, least significant first
+			class BitWriter
+			{
+			private:
+				unsigned long long bits;
+				int count;
+			public:
+				unsigned char * Output;
+				BitWriter(unsigned char * output)
+					: bits(0), count(0), Output(output)
+				{}
+				inline void Put(unsigned int value, int length)
+				{
+					bits |= (unsigned long long)value << count;
+					count += length;
+					while (count >= 8)
+					{
+						*Output++ = (unsigned char)bits;
+						bits >>= 8;
+						count -= 8;
+					}
+				}
+				inline void AlignToByte()
+				{
+					if (count)
+						Put(0, 8 - count);
+				}
+			};
+
+			// Code lengths of at most limit bits for the symbols with nonzero frequencies. At least two
+			// symbols get codes, so that every code is complete.
+			void BuildCodeLengths(const unsigned int * frequencies, int count, int limit, unsigned char * lengths)
+			{
+				unsigned int freq[286];
+				int used = 0;
+				for (int i = 0; i < count; i++)
+				{
+					freq[i] = frequencies[i];
+					if (freq[i])
+						used++;
+				}
+				for (int i = 0; i < count && used < 2; i++)
+				{
+					if (!freq[i])
+					{
+						freq[i] = 1;
+						used++;
+					}
+				}
+				int symbols[286], parent[572], depth[572];
+				unsigned int weight[572];
+				for (;;)
+				{
+					int n = 0;
+					for (int i = 0; i < count; i++)
+						if (freq[i])
+							symbols[n++] = i;
+					// insertion sort by frequency; there are at most 286 symbols
+					for (int i = 1; i < n; i++)
+					{
+						int s = symbols[i], j = i;
+						for (; j > 0 && freq[symbols[j - 1]] > freq[s]; j--)
+							symbols[j] = symbols[j - 1];
+						symbols[j] = s;
+					}
+					for (int i = 0; i < n; i++)
+						weight[i] = freq[symbols[i]];
+					// the internal nodes are made in order of weight, so the leaves and the nodes made
+					// so far are two sorted queues
+					int leaf = 0, node = n;
+					for (int next = n; next < n * 2 - 1; next++)
+					{
+						int children[2];
+						for (int c = 0; c < 2; c++)
+						{
+							if (leaf < n && (node >= next || weight[leaf] <= weight[node]))
+								children[c] = leaf++;
+							else
+								children[c] = node++;
+						}
+						weight[next] = weight[children[0]] + weight[children[1]];
+						parent[children[0]] = parent[children[1]] = next;
+					}
+					int maxDepth = 0;
+					depth[n * 2 - 2] = 0;
+					for (int i = n * 2 - 3; i >= 0; i--)
+					{
+						depth[i] = depth[parent[i]] + 1;
+						if (i < n)
+							maxDepth = Math::Max(maxDepth, depth[i]);
+					}
+					if (maxDepth <= limit)
+					{
+						memset(lengths, 0, count);
+						for (int i = 0; i < n; i++)
+							lengths[symbols[i]] = (unsigned char)depth[i];
+						return;
+					}
+					// flatten the frequencies until the tree fits
+					for (int i = 0; i < count; i++)
+						if (freq[i])
+							freq[i] = (freq[i] >> 1) | 1;
+				}
+			}
+
+			// Canonical codes of the lengths, bit reversed for BitWriter
+			void BuildCodes(const unsigned char * lengths, int count, unsigned short * codes)
+			{
+				int lengthCounts[16] = {0}, nextCode[16];
+				for (int i = 0; i < count; i++)
+					lengthCounts[lengths[i]]++;
+				lengthCounts[0] = 0;
+				int code = 0;
+				for (int bits = 1; bits < 16; bits++)
+				{
+					code = (code + lengthCounts[bits - 1]) << 1;
+					nextCode[bits] = code;
+				}
+				for (int i = 0; i < count; i++)
+				{
+					int length = lengths[i];
+					if (!length)
+					{
+						codes[i] = 0;
+						continue;
+					}
+					int c = nextCode[length]++, reversed = 0;
+					for (int b = 0; b < length; b++)
+						reversed |= ((c >> b) & 1) << (length - 1 - b);
+					codes[i] = (unsigned short)reversed;
+				}
+			}
+
+			const int MatchFlag = 1 << 31;
+			const int HashBits = 15;
+			const int WindowSize = 32768;
+			const int BlockTokens = 1 << 15;
+
+			inline unsigned int Hash3(const unsigned char * p)
+			{
+				return (((unsigned int)p[0] << 16 | (unsigned int)p[1] << 8 | p[2]) * 2654435761u) >> (32 - HashBits);
+			}
+
+			// Writes tokens, which cover data, as one block: dynamic Huffman, or stored if that is smaller
+			void WriteBlock(BitWriter & writer, const unsigned int * tokens, int tokenCount, const unsigned char * data,
+				int size, bool final)
+			{
+				const DeflateTables & tables = GetDeflateTables();
+				unsigned int literalFreq[286] = {0}, distanceFreq[30] = {0};
+				for (int i = 0; i < tokenCount; i++)
+				{
+					unsigned int token = tokens[i];
+					if (token & MatchFlag)
+					{
+						literalFreq[257 + tables.LengthCode[(token >> 16) & 255]]++;
+						distanceFreq[tables.GetDistanceCode((token & 0xFFFF) + 1)]++;
+					}
+					else
+						literalFreq[token]++;
+				}
+				literalFreq[256] = 1;
+				unsigned char literalLengths[286], distanceLengths[30];
+				BuildCodeLengths(literalFreq, 286, 15, literalLengths);
+				BuildCodeLengths(distanceFreq, 30, 15, distanceLengths);
+				int literalCount = 286, distanceCount = 30;
+				while (literalCount > 257 && !literalLengths[literalCount - 1])
+					literalCount--;
+				while (distanceCount > 1 && !distanceLengths[distanceCount - 1])
+					distanceCount--;
+				unsigned char lengths[286 + 30];
+				memcpy(lengths, literalLengths, literalCount);
+				memcpy(lengths + literalCount, distanceLengths, distanceCount);
+
+				// the lengths, run-length coded: 16 repeats the last length, 17 and 18 give runs of zeros
+				unsigned short lengthSymbols[286 + 30];
+				unsigned int lengthFreq[19] = {0};
+				int symbolCount = 0, total = literalCount + distanceCount;
+				for (int i = 0; i < total; )
+				{
+					int value = lengths[i], run = 1;
+					while (i + run < total && lengths[i + run] == value)
+						run++;
+					i += run;
+					if (value == 0)
+					{
+						for (; run >= 11; )
+						{
+							int r = Math::Min(run, 138);
+							lengthSymbols[symbolCount++] = (unsigned short)(18 | (r - 11) << 8);
+							run -= r;
+						}
+						if (run >= 3)
+						{
+							lengthSymbols[symbolCount++] = (unsigned short)(17 | (run - 3) << 8);
+							run = 0;
+						}
+					}
+					else
+					{
+						lengthSymbols[symbolCount++] = (unsigned short)value;
+						run--;
+						for (; run >= 3; )
+						{
+							int r = Math::Min(run, 6);
+							lengthSymbols[symbolCount++] = (unsigned short)(16 | (r - 3) << 8);
+							run -= r;
+						}
+					}
+					for (; run > 0; run--)
+						lengthSymbols[symbolCount++] = (unsigned short)value;
+				}
+				for (int i = 0; i < symbolCount; i++)
+					lengthFreq[lengthSymbols[i] & 31]++;
+				unsigned char lengthLengths[19];
+				BuildCodeLengths(lengthFreq, 19, 7, lengthLengths);
+				static const unsigned char lengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+				int lengthCodeCount = 19;
+				while (lengthCodeCount > 4 && !lengthLengths[lengthOrder[lengthCodeCount - 1]])
+					lengthCodeCount--;
+
+				// size of the dynamic block in bits, against the stored blocks
+				static const unsigned char lengthSymbolExtra[3] = {2, 3, 7};
+				long long bits = 3 + 14 + lengthCodeCount * 3;
+				for (int i = 0; i < symbolCount; i++)
+				{
+					int symbol = lengthSymbols[i] & 31;
+					bits += lengthLengths[symbol] + (symbol >= 16 ? lengthSymbolExtra[symbol - 16] : 0);
+				}
+				for (int i = 0; i < 286; i++)
+					bits += (long long)literalFreq[i] * (literalLengths[i] + (i > 256 ? tables.LengthExtra[i - 257] : 0));
+				for (int i = 0; i < 30; i++)
+					bits += (long long)distanceFreq[i] * (distanceLengths[i] + tables.DistanceExtra[i]);
+				long long storedBits = ((long long)size + 5 * ((size + 65534) / 65535)) * 8 + 7;
+				if (bits >= storedBits)
+				{
+					int offset = 0;
+					do
+					{
+						int length = Math::Min(size - offset, 65535);
+						bool last = offset + length == size;
+						writer.Put((final && last) ? 1 : 0, 3);
+						writer.AlignToByte();
+						writer.Put(length | (~length & 0xFFFF) << 16, 32);
+						memcpy(writer.Output, data + offset, length);
+						writer.Output += length;
+						offset += length;
+					} while (offset < size);
+					return;
+				}
+
+				unsigned short literalCodes[286], distanceCodes[30], lengthCodes[19];
+				BuildCodes(literalLengths, 286, literalCodes);
+				BuildCodes(distanceLengths, 30, distanceCodes);
+				BuildCodes(lengthLengths, 19, lengthCodes);
+				writer.Put(final ? 5 : 4, 3);
+				writer.Put(literalCount - 257, 5);
+				writer.Put(distanceCount - 1, 5);
+				writer.Put(lengthCodeCount - 4, 4);
+				for (int i = 0; i < lengthCodeCount; i++)
+					writer.Put(lengthLengths[lengthOrder[i]], 3);
+				for (int i = 0; i < symbolCount; i++)
+				{
+					int symbol = lengthSymbols[i] & 31;
+					writer.Put(lengthCodes[symbol], lengthLengths[symbol]);
+					if (symbol >= 16)
+						writer.Put(lengthSymbols[i] >> 8, lengthSymbolExtra[symbol - 16]);
+				}
+				for (int i = 0; i < tokenCount; i++)
+				{
+					unsigned int token = tokens[i];
+					if (token & MatchFlag)
+					{
+						int length = ((token >> 16) & 255) + 3, distance = (token & 0xFFFF) + 1;
+						int lengthCode = tables.LengthCode[length - 3];
+						writer.Put(literalCodes[257 + lengthCode], literalLengths[257 + lengthCode]);
+						writer.Put(length - tables.LengthBase[lengthCode], tables.LengthExtra[lengthCode]);
+						int distanceCode = tables.GetDistanceCode(distance);
+						writer.Put(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+						writer.Put(distance - tables.DistanceBase[distanceCode], tables.DistanceExtra[distanceCode]);
+					}
+					else
+						writer.Put(literalCodes[token], literalLengths[token]);
+				}
+				writer.Put(literalCodes[256], literalLengths[256]);
+			}
+		}
+
+		void PngEncoder::Deflate(Strip & strip, bool first, bool last)
+		{
+			const unsigned char * data = strip.Filtered.Buffer();
+			int size = strip.Filtered.Count();
+			// stored blocks bound the size; 8 bytes of chunk header, 2 of zlib header, the sync
+			// flush and the CRC
+			strip.Chunk.SetSize(size + 5 * (size / 65535 + size / BlockTokens + 2) + 32);
+			unsigned char * chunk = strip.Chunk.Buffer();
+			memcpy(chunk + 4, "IDAT", 4);
+			BitWriter writer(chunk + 8);
+			if (first)
+			{
+				// deflate, 32K window, fastest compression
+				writer.Put(0x78, 8);
+				writer.Put(0x01, 8);
+			}
+
+			strip.Hash.SetSize(1 << HashBits);
+			int * head = strip.Hash.Buffer();
+			for (int i = 0; i < (1 << HashBits); i++)
+				head[i] = -1;
+			strip.Tokens.Reserve(BlockTokens);
+			strip.Tokens.Clear();
+			int blockStart = 0;
+			for (int pos = 0; pos < size; )
+			{
+				int length = 1;
+				if (pos + 3 <= size)
+				{
+					unsigned int hash = Hash3(data + pos);
+					int candidate = head[hash];
+					head[hash] = pos;
+					if (candidate >= 0 && pos - candidate <= WindowSize && data[candidate] == data[pos] &&
+						data[candidate + 1] == data[pos + 1] && data[candidate + 2] == data[pos + 2])
+					{
+						int maxLength = Math::Min(258, size - pos);
+						length = 3;
+						while (length < maxLength && data[candidate + length] == data[pos + length])
+							length++;
+						strip.Tokens.Add(MatchFlag | (length - 3) << 16 | (pos - candidate - 1));
+						// the positions inside short matches are worth finding again
+						if (length < 32)
+						{
+							for (int i = pos + 1; i < pos + length && i + 3 <= size; i++)
+								head[Hash3(data + i)] = i;
+						}
+					}
+				}
+				if (length == 1)
+					strip.Tokens.Add(data[pos]);
+				pos += length;
+				if (strip.Tokens.Count() >= BlockTokens || pos == size)
+				{
+					WriteBlock(writer, strip.Tokens.Buffer(), strip.Tokens.Count(), data + blockStart, pos - blockStart,
+						last && pos == size);
+					strip.Tokens.Clear();
+					blockStart = pos;
+				}
+			}
+			if (!last)
+			{
+				// an empty stored block brings the strip to a byte boundary, where the next one starts
+				writer.Put(0, 3);
+				writer.AlignToByte();
+				writer.Put(0xFFFF0000u, 32);
+			}
+			writer.AlignToByte();
+			int dataSize = (int)(writer.Output - (chunk + 8));
+			WriteBigEndian(chunk, dataSize);
+			WriteBigEndian(writer.Output, Crc32(0, chunk + 4, dataSize + 4));
+			strip.Chunk.UnsafeShrinkToSize(dataSize + 12);
+		}
+
+		int PngEncoder::Begin(const unsigned char * rgb, int width, int height, int stride)
+		{
+			image = rgb;
+			this->width = width;
+			this->height = height;
+			this->stride = stride;
+			stripRows = GetStripRows(width * 3 + 1);
+			int count = (height + stripRows - 1) / stripRows;
+			if (strips.Count() < count)
+				strips.SetSize(count);
+			return count;
+		}
+
+		void PngEncoder::EncodeStrip(int index)
+		{
+			int firstRow = index * stripRows;
+			int rows = Math::Min(stripRows, height - firstRow);
+			Strip & strip = strips[index];
+			FilterRows(strip, firstRow, rows);
+			strip.Adler = Adler32(strip.Filtered.Buffer(), strip.Filtered.Count());
+			Deflate(strip, index == 0, firstRow + rows == height);
+		}
+
+		void PngEncoder::End(List<unsigned char> & file)
+		{
+			int count = (height + stripRows - 1) / stripRows;
+			int size = 8 + 25 + 16 + 12;
+			unsigned int adler = 1;
+			for (int i = 0; i < count; i++)
+			{
+				size += strips[i].Chunk.Count();
+				adler = i == 0 ? strips[i].Adler : CombineAdler32(adler, strips[i].Adler, strips[i].Filtered.Count());
+			}
+			file.SetSize(size);
+			unsigned char * dst = file.Buffer();
+			static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+			memcpy(dst, signature, 8);
+			dst += 8;
+
+			// 8-bit RGB, no interlacing
+			WriteBigEndian(dst, 13);
+			memcpy(dst + 4, "IHDR", 4);
+			WriteBigEndian(dst + 8, width);
+			WriteBigEndian(dst + 12, height);
+			dst[16] = 8;
+			dst[17] = 2;
+			dst[18] = dst[19] = dst[20] = 0;
+			WriteBigEndian(dst + 21, Crc32(0, dst + 4, 17));
+			dst += 25;
+
+			for (int i = 0; i < count; i++)
+			{
+				memcpy(dst, strips[i].Chunk.Buffer(), strips[i].Chunk.Count());
+				dst += strips[i].Chunk.Count();
+			}
+
+			// the zlib stream ends with the Adler-32 of all strips
+			WriteBigEndian(dst, 4);
+			memcpy(dst + 4, "IDAT", 4);
+			WriteBigEndian(dst + 8, adler);
+			WriteBigEndian(dst + 12, Crc32(0, dst + 4, 8));
+			dst += 16;
+
+			WriteBigEndian(dst, 0);
+			memcpy(dst + 4, "IEND", 4);
+			WriteBigEndian(dst + 8, Crc32(0, dst + 4, 4));
+		}
+
+		int PngEncoder::GetMemorySize()
+		{
+			int size = 0;
+			for (auto & strip : strips)
+				size += strip.Filtered.Capacity() + strip.Chunk.Capacity() + strip.Tokens.Capacity() * (int)sizeof(unsigned int) +
+					strip.Hash.Capacity() * (int)sizeof(int);
+			return size;
+		}
+
+		// QOI
+
+		static const unsigned int QoiStartPixel = 0xFF000000u; // black, opaque
+
+		static inline unsigned int LoadPixel(const unsigned char * p)
+		{
+			return p[0] | (unsigned int)p[1] << 8 | (unsigned int)p[2] << 16 | 0xFF000000u;
+		}
+
+		static inline int QoiHash(unsigned int pixel)
+		{
+			return ((pixel & 255) * 3 + ((pixel >> 8) & 255) * 5 + ((pixel >> 16) & 255) * 7 + (pixel >> 24) * 11) & 63;
+		}
+
+		int QoiEncoder::Begin(const unsigned char * rgb, int width, int height, int stride)
+		{
+			image = rgb;
+			this->width = width;
+			this->height = height;
+			this->stride = stride;
+			stripRows = GetStripRows(width * 4);
+			int count = (height + stripRows - 1) / stripRows;
+			if (strips.Count() < count)
+				strips.SetSize(count);
+			return count;
+		}
+
+		void QoiEncoder::IndexStrip(int index)
+		{
+			Strip & strip = strips[index];
+			strip.Seen = 0;
+			int firstRow = index * stripRows, endRow = Math::Min(firstRow + stripRows, height);
+			for (int y = firstRow; y < endRow; y++)
+			{
+				const unsigned char * row = image + (size_t)y * stride;
+				for (int x = 0; x < width; x++)
+				{
+					unsigned int pixel = LoadPixel(row + x * 3);
+					int hash = QoiHash(pixel);
+					strip.Last[hash] = pixel;
+					strip.Seen |= 1ull << hash;
+				}
+			}
+		}
+
+		void QoiEncoder::LinkStrips()
+		{
+			int count = (height + stripRows - 1) / stripRows;
+			unsigned int table[64];
+			memset(table, 0, sizeof(table));
+			for (int i = 0; i < count; i++)
+			{
+				Strip & strip = strips[i];
+				memcpy(strip.Start, table, sizeof(table));
+				for (int hash = 0; hash < 64; hash++)
+					if (strip.Seen & (1ull << hash))
+						table[hash] = strip.Last[hash];
+			}
+		}
+
+		void QoiEncoder::EncodeStrip(int index)
+		{
+			Strip & strip = strips[index];
+			int firstRow = index * stripRows, endRow = Math::Min(firstRow + stripRows, height);
+			// QOI_OP_RGB, the longest chunk, takes 4 bytes
+			strip.Data.SetSize((endRow - firstRow) * width * 4);
+			unsigned char * dst = strip.Data.Buffer();
+			unsigned int table[64];
+			memcpy(table, strip.Start, sizeof(table));
+			unsigned int previous = firstRow == 0 ? QoiStartPixel : LoadPixel(image + (size_t)(firstRow - 1) * stride + (width - 1) * 3);
+			int run = 0;
+			for (int y = firstRow; y < endRow; y++)
+			{
+				const unsigned char * row = image + (size_t)y * stride;
+				for (int x = 0; x < width; x++)
+				{
+					unsigned int pixel = LoadPixel(row + x * 3);
+					if (pixel == previous)
+					{
+						run++;
+						if (run == 62)
+						{
+							*dst++ = (unsigned char)(0xC0 | (run - 1));
+							run = 0;
+						}
+						continue;
+					}
+					if (run > 0)
+					{
+						*dst++ = (unsigned char)(0xC0 | (run - 1));
+						run = 0;
+					}
+					int hash = QoiHash(pixel);
+					if (table[hash] == pixel)
+						*dst++ = (unsigned char)hash;
+					else
+					{
+						table[hash] = pixel;
+						int dr = (signed char)((pixel & 255) - (previous & 255));
+						int dg = (signed char)(((pixel >> 8) & 255) - ((previous >> 8) & 255));
+						int db = (signed char)(((pixel >> 16) & 255) - ((previous >> 16) & 255));
+						int drg = dr - dg, dbg = db - dg;
+						if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2)
+							*dst++ = (unsigned char)(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+						else if (drg > -9 && drg < 8 && dg > -33 && dg < 32 && dbg > -9 && dbg < 8)
+						{
+							*dst++ = (unsigned char)(0x80 | (dg + 32));
+							*dst++ = (unsigned char)((drg + 8) << 4 | (dbg + 8));
+						}
+						else
+						{
+							*dst++ = 0xFE;
+							*dst++ = (unsigned char)pixel;
+							*dst++ = (unsigned char)(pixel >> 8);
+							*dst++ = (unsigned char)(pixel >> 16);
+						}
+					}
+					previous = pixel;
+				}
+			}
+			// a run does not go on into the next strip, which starts a new one
+			if (run > 0)
+				*dst++ = (unsigned char)(0xC0 | (run - 1));
+			strip.Data.UnsafeShrinkToSize((int)(dst - strip.Data.Buffer()));
+		}
+
+		void QoiEncoder::End(List<unsigned char> & file)
+		{
+			int count = (height + stripRows - 1) / stripRows;
+			int size = 14 + 8;
+			for (int i = 0; i < count; i++)
+				size += strips[i].Data.Count();
+			file.SetSize(size);
+			unsigned char * dst = file.Buffer();
+			memcpy(dst, "qoif", 4);
+			WriteBigEndian(dst + 4, width);
+			WriteBigEndian(dst + 8, height);
+			dst[12] = 3; // RGB
+			dst[13] = 0; // sRGB
+			dst += 14;
+			for (int i = 0; i < count; i++)
+			{
+				memcpy(dst, strips[i].Data.Buffer(), strips[i].Data.Count());
+				dst += strips[i].Data.Count();
+			}
+			static const unsigned char endMarker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+			memcpy(dst, endMarker, 8);
+		}
+
+		int QoiEncoder::GetMemorySize()
+		{
+			int size = 0;
+			for (auto & strip : strips)
+				size += (int)sizeof(Strip) + strip.Data.Capacity();
+			return size;
+		}
+	}
+}
@@ -0,0 +1,121 @@
+#ifndef CORE_LIB_IMAGE_ENCODING_H
+#define CORE_LIB_IMAGE_ENCODING_H
+
+#include "../Basic.h"
+
+namespace CoreLib
+{
+	namespace Imaging
+	{
+		enum class ImageFileFormat
+		{
+			Bmp, Png, Qoi
+		};
+
+		// .png and .qoi name their formats, in any case; every other extension is BMP
+		ImageFileFormat GetImageFileFormat(const Basic::String & fileName);
+
+		// Lossless encoders of 24-bit RGB images held as rows from the top of the image, stride bytes
+		// apart. Both cut the image into strips of rows that encode independently, so that the strips
+		// can be encoded in parallel, and join the strips into one file. An encoder keeps its buffers
+		// from one image to the next.
+
+		// PNG with the Sub, Up or Paeth filter picked per row by the smallest sum of absolute
+		// residuals, and a fast deflate: greedy LZ77 matches from a single-entry hash table and
+		// dynamic Huffman blocks, or stored blocks where those come out larger. Each strip is
+		// deflated on its own and ends on a byte boundary, so that the strips' streams join into one
+		// zlib stream, and goes into an IDAT chunk of its own.
+		class PngEncoder
+		{
+		public:
+			struct Strip
+			{
+				Basic::List<unsigned char> Filtered; // the filter byte and residuals of each row
+				Basic::List<unsigned char> Chunk;    // the IDAT chunk, length and CRC included
+				Basic::List<unsigned int> Tokens;    // literals and matches of the deflate block being written
+				Basic::List<int> Hash;               // start of the last 3 bytes with each hash, or -1
+				unsigned int Adler;                  // of Filtered
+			};
+		private:
+			Basic::List<Strip> strips;
+			const unsigned char * image;
+			int width, height, stride, stripRows;
+			void FilterRows(Strip & strip, int firstRow, int rows);
+			void Deflate(Strip & strip, bool first, bool last);
+		public:
+			PngEncoder()
+				: image(nullptr), width(0), height(0), stride(0), stripRows(1)
+			{}
+			// Starts an image and returns its number of strips
+			int Begin(const unsigned char * rgb, int width, int height, int stride);
+			void EncodeStrip(int strip);
+			// Writes the file of the image begun last, once all of its strips are encoded
+			void End(Basic::List<unsigned char> & file);
+			// Encodes the strips through parallelFor(count, body), which calls body(0) ... body(count - 1)
+			template<typename ParallelFor>
+			void Encode(const unsigned char * rgb, int width, int height, int stride, Basic::List<unsigned char> & file,
+				const ParallelFor & parallelFor)
+			{
+				int count = Begin(rgb, width, height, stride);
+				parallelFor(count, [this](int strip)
+				{
+					EncodeStrip(strip);
+				});
+				End(file);
+			}
+			int GetMemorySize();
+		};
+
+		// QOI, whose chunks each depend on the pixel before them and the 64-entry table of recently
+		// seen pixels. A strip starts from the state the decoder reaches at its first pixel: the last
+		// pixel of the strip above and, in every table entry, the last pixel above the strip that
+		// hashes to it. A first parallel pass notes the last pixel of each hash in each strip, and
+		// LinkStrips carries those down the strips.
+		class QoiEncoder
+		{
+		public:
+			struct Strip
+			{
+				unsigned int Last[64];   // last pixel of each hash in the strip
+				unsigned long long Seen; // hashes that occur in the strip
+				unsigned int Start[64];  // the decoder's table at the start of the strip
+				Basic::List<unsigned char> Data;
+			};
+		private:
+			Basic::List<Strip> strips;
+			const unsigned char * image;
+			int width, height, stride, stripRows;
+		public:
+			QoiEncoder()
+				: image(nullptr), width(0), height(0), stride(0), stripRows(1)
+			{}
+			// Starts an image and returns its number of strips
+			int Begin(const unsigned char * rgb, int width, int height, int stride);
+			void IndexStrip(int strip);
+			// Sets the tables the strips start from, once all strips are indexed
+			void LinkStrips();
+			void EncodeStrip(int strip);
+			// Writes the file of the image begun last, once all of its strips are encoded
+			void End(Basic::List<unsigned char> & file);
+			template<typename ParallelFor>
+			void Encode(const unsigned char * rgb, int width, int height, int stride, Basic::List<unsigned char> & file,
+				const ParallelFor & parallelFor)
+			{
+				int count = Begin(rgb, width, height, stride);
+				parallelFor(count, [this](int strip)
+				{
+					IndexStrip(strip);
+				});
+				LinkStrips();
+				parallelFor(count, [this](int strip)
+				{
+					EncodeStrip(strip);
+				});
+				End(file);
+			}
+			int GetMemorySize();
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,325 @@
+#include "TextureCompression.h"
+#include <math.h>
+#include <stdlib.h>
+
+namespace CoreLib
+{
+	namespace Imaging
+	{
+		static inline int ClampByte(int x)
+		{
+			return x < 0 ? 0 : (x > 255 ? 255 : x);
+		}
+
+		static inline int Channel(unsigned int texel, int channel)
+		{
+			return (texel >> (channel * 8)) & 255;
+		}
+
+		static inline unsigned int PackColor(int r, int g, int b, int a)
+		{
+			return (unsigned int)r | ((unsigned int)g << 8) | ((unsigned int)b << 16) | ((unsigned int)a << 24);
+		}
+
+		static int ToRGB565(const float * color)
+		{
+			int r = (int)(color[0] * (31.0f / 255.0f) + 0.5f);
+			int g = (int)(color[1] * (63.0f / 255.0f) + 0.5f);
+			int b = (int)(color[2] * (31.0f / 255.0f) + 0.5f);
+			r = r < 0 ? 0 : (r > 31 ? 31 : r);
+			g = g < 0 ? 0 : (g > 63 ? 63 : g);
+			b = b < 0 ? 0 : (b > 31 ? 31 : b);
+			return (r << 11) | (g << 5) | b;
+		}
+
+		// expands the endpoints to the 4-entry palette exactly as the decoder does
+		static void BuildColorPalette(int palette[4][3], int c0, int c1)
+		{
+			int e[2][3];
+			int c[2] = {c0, c1};
+			for (int i = 0; i < 2; i++)
+			{
+				int r = (c[i] >> 11) & 31, g = (c[i] >> 5) & 63, b = c[i] & 31;
+				e[i][0] = (r << 3) | (r >> 2);
+				e[i][1] = (g << 2) | (g >> 4);
+				e[i][2] = (b << 3) | (b >> 2);
+			}
+			for (int k = 0; k < 3; k++)
+			{
+				palette[0][k] = e[0][k];
+				palette[1][k] = e[1][k];
+				palette[2][k] = (2 * e[0][k] + e[1][k]) / 3;
+				palette[3][k] = (e[0][k] + 2 * e[1][k]) / 3;
+			}
+		}
+
+		// picks the nearest palette entry for every texel and returns the total squared error
+		static int ChooseColorIndices(int indices[16], const int colors[16][3], int c0, int c1)
+		{
+			int palette[4][3];
+			BuildColorPalette(palette, c0, c1);
+			int error = 0;
+			for (int i = 0; i < 16; i++)
+			{
+				int best = 0, bestDist = 0x7FFFFFFF;
+				for (int p = 0; p < 4; p++)
+				{
+					int dr = colors[i][0] - palette[p][0];
+					int dg = colors[i][1] - palette[p][1];
+					int db = colors[i][2] - palette[p][2];
+					int dist = dr * dr + dg * dg + db * db;
+					if (dist < bestDist)
+					{
+						bestDist = dist;
+						best = p;
+					}
+				}
+				indices[i] = best;
+				error += bestDist;
+			}
+			return error;
+		}
+
+		// least-squares endpoints for fixed indices; returns false when the system is singular
+		static bool FitColorEndpoints(float e0[3], float e1[3], const int indices[16], const int colors[16][3])
+		{
+			const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+			float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+			float ax[3] = {0.0f, 0.0f, 0.0f}, bx[3] = {0.0f, 0.0f, 0.0f};
+			for (int i = 0; i < 16; i++)
+			{
+				float w = weights[indices[i]];
+				float iw = 1.0f - w;
+				aa += w * w;
+				bb += iw * iw;
+				ab += w * iw;
+				for (int k = 0; k < 3; k++)
+				{
+					ax[k] += w * colors[i][k];
+					bx[k] += iw * colors[i][k];
+				}
+			}
+			float det = aa * bb - ab * ab;
+			if (fabsf(det) < 1e-6f)
+				return false;
+			float invDet = 1.0f / det;
+			for (int k = 0; k < 3; k++)
+			{
+				e0[k] = (ax[k] * bb - bx[k] * ab) * invDet;
+				e1[k] = (bx[k] * aa - ax[k] * ab) * invDet;
+			}
+			return true;
+		}
+
+		// Fits the endpoints along the principal axis of the block's colors, then refines them
+		// once by least squares. Always emits the 4-color mode (c0 > c1), or c0 == c1 with all
+		// indices 0 for flat blocks, so the block decodes the same as BC1 and as BC3 color.
+		static unsigned long long EncodeColorBlock(const unsigned int * texels)
+		{
+			int colors[16][3];
+			float mean[3] = {0.0f, 0.0f, 0.0f};
+			for (int i = 0; i < 16; i++)
+				for (int k = 0; k < 3; k++)
+				{
+					colors[i][k] = Channel(texels[i], k);
+					mean[k] += colors[i][k];
+				}
+			for (int k = 0; k < 3; k++)
+				mean[k] *= 1.0f / 16.0f;
+			float cov[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+			for (int i = 0; i < 16; i++)
+			{
+				float r = colors[i][0] - mean[0], g = colors[i][1] - mean[1], b = colors[i][2] - mean[2];
+				cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+				cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+			}
+			float axis[3] = {1.0f, 1.0f, 1.0f};
+			for (int iter = 0; iter < 4; iter++)
+			{
+				float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+				float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+				float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+				float len = fmaxf(fabsf(x), fmaxf(fabsf(y), fabsf(z)));
+				if (len < 1e-6f)
+					break;
+				axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+			}
+			float axisLen2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+			float minT = 0.0f, maxT = 0.0f;
+			for (int i = 0; i < 16; i++)
+			{
+				float t = ((colors[i][0] - mean[0]) * axis[0] + (colors[i][1] - mean[1]) * axis[1] + (colors[i][2] - mean[2]) * axis[2]) / axisLen2;
+				minT = fminf(minT, t);
+				maxT = fmaxf(maxT, t);
+			}
+			// inset the endpoints slightly, the extremes are rarely worth a whole palette entry
+			float inset = (maxT - minT) * (1.0f / 16.0f);
+			maxT -= inset;
+			minT += inset;
+			float e0[3], e1[3];
+			for (int k = 0; k < 3; k++)
+			{
+				e0[k] = mean[k] + axis[k] * maxT;
+				e1[k] = mean[k] + axis[k] * minT;
+			}
+			int c0 = ToRGB565(e0), c1 = ToRGB565(e1);
+			if (c0 < c1)
+			{
+				int t = c0; c0 = c1; c1 = t;
+			}
+			int indices[16];
+			int error = ChooseColorIndices(indices, colors, c0, c1);
+			if (c0 != c1 && FitColorEndpoints(e0, e1, indices, colors))
+			{
+				int r0 = ToRGB565(e0), r1 = ToRGB565(e1);
+				if (r0 < r1)
+				{
+					int t = r0; r0 = r1; r1 = t;
+				}
+				int refinedIndices[16];
+				int refinedError = ChooseColorIndices(refinedIndices, colors, r0, r1);
+				if (refinedError < error)
+				{
+					c0 = r0;
+					c1 = r1;
+					error = refinedError;
+					for (int i = 0; i < 16; i++)
+						indices[i] = refinedIndices[i];
+				}
+			}
+			unsigned long long indexBits = 0;
+			if (c0 != c1)
+			{
+				for (int i = 0; i < 16; i++)
+					indexBits |= (unsigned long long)indices[i] << (i * 2);
+			}
+			return (unsigned long long)c0 | ((unsigned long long)c1 << 16) | (indexBits << 32);
+		}
+
+		// 8-value mode (a0 > a1) fitted to the value range, or a flat block
+		static unsigned long long EncodeChannelBlock(const unsigned int * texels, int channel)
+		{
+			int values[16];
+			int a0 = 0, a1 = 255;
+			for (int i = 0; i < 16; i++)
+			{
+				values[i] = Channel(texels[i], channel);
+				a0 = values[i] > a0 ? values[i] : a0;
+				a1 = values[i] < a1 ? values[i] : a1;
+			}
+			unsigned long long block = (unsigned long long)a0 | ((unsigned long long)a1 << 8);
+			if (a0 == a1)
+				return block;
+			int palette[8];
+			palette[0] = a0;
+			palette[1] = a1;
+			for (int i = 1; i < 7; i++)
+				palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+			for (int i = 0; i < 16; i++)
+			{
+				int best = 0, bestDist = 256;
+				for (int p = 0; p < 8; p++)
+				{
+					int dist = abs(values[i] - palette[p]);
+					if (dist < bestDist)
+					{
+						bestDist = dist;
+						best = p;
+					}
+				}
+				block |= (unsigned long long)best << (16 + i * 3);
+			}
+			return block;
+		}
+
+		static void DecodeColorBlock(unsigned int * texels, unsigned long long block, bool fourColorOnly)
+		{
+			int c0 = (int)(block & 0xFFFF), c1 = (int)((block >> 16) & 0xFFFF);
+			int palette[4][3];
+			BuildColorPalette(palette, c0, c1);
+			unsigned int colors[4];
+			colors[0] = PackColor(palette[0][0], palette[0][1], palette[0][2], 255);
+			colors[1] = PackColor(palette[1][0], palette[1][1], palette[1][2], 255);
+			if (c0 > c1 || fourColorOnly)
+			{
+				colors[2] = PackColor(palette[2][0], palette[2][1], palette[2][2], 255);
+				colors[3] = PackColor(palette[3][0], palette[3][1], palette[3][2], 255);
+			}
+			else
+			{
+				colors[2] = PackColor((palette[0][0] + palette[1][0]) >> 1, (palette[0][1] + palette[1][1]) >> 1, (palette[0][2] + palette[1][2]) >> 1, 255);
+				colors[3] = 0;
+			}
+			unsigned int indexBits = (unsigned int)(block >> 32);
+			for (int i = 0; i < 16; i++)
+				texels[i] = colors[(indexBits >> (i * 2)) & 3];
+		}
+
+		static void DecodeChannelBlock(int * values, unsigned long long block)
+		{
+			int palette[8];
+			int a0 = (int)(block & 255), a1 = (int)((block >> 8) & 255);
+			palette[0] = a0;
+			palette[1] = a1;
+			if (a0 > a1)
+			{
+				for (int i = 1; i < 7; i++)
+					palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+			}
+			else
+			{
+				for (int i = 1; i < 5; i++)
+					palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+				palette[6] = 0;
+				palette[7] = 255;
+			}
+			for (int i = 0; i < 16; i++)
+				values[i] = palette[(block >> (16 + i * 3)) & 7];
+		}
+
+		void EncodeBC1Block(unsigned long long * block, const unsigned int * texels)
+		{
+			block[0] = EncodeColorBlock(texels);
+		}
+
+		void EncodeBC3Block(unsigned long long * block, const unsigned int * texels)
+		{
+			block[0] = EncodeChannelBlock(texels, 3);
+			block[1] = EncodeColorBlock(texels);
+		}
+
+		void EncodeBC5Block(unsigned long long * block, const unsigned int * texels)
+		{
+			block[0] = EncodeChannelBlock(texels, 0);
+			block[1] = EncodeChannelBlock(texels, 1);
+		}
+
+		void DecodeBC1Block(unsigned int * texels, const unsigned long long * block)
+		{
+			DecodeColorBlock(texels, block[0], false);
+		}
+
+		void DecodeBC3Block(unsigned int * texels, const unsigned long long * block)
+		{
+			int alpha[16];
+			DecodeColorBlock(texels, block[1], true);
+			DecodeChannelBlock(alpha, block[0]);
+			for (int i = 0; i < 16; i++)
+				texels[i] = (texels[i] & 0xFFFFFF) | ((unsigned int)alpha[i] << 24);
+		}
+
+		void DecodeBC5Block(unsigned int * texels, const unsigned long long * block)
+		{
+			int x[16], y[16];
+			DecodeChannelBlock(x, block[0]);
+			DecodeChannelBlock(y, block[1]);
+			for (int i = 0; i < 16; i++)
+			{
+				float nx = x[i] * (2.0f / 255.0f) - 1.0f;
+				float ny = y[i] * (2.0f / 255.0f) - 1.0f;
+				float nz = sqrtf(fmaxf(0.0f, 1.0f - nx * nx - ny * ny));
+				texels[i] = PackColor(x[i], y[i], ClampByte((int)((nz * 0.5f + 0.5f) * 255.0f + 0.5f)), 255);
+			}
+		}
+	}
+}
@@ -0,0 +1,23 @@
+#ifndef CORE_LIB_TEXTURE_COMPRESSION_H
+#define CORE_LIB_TEXTURE_COMPRESSION_H
+
+namespace CoreLib
+{
+	namespace Imaging
+	{
+		// Codecs for single 4x4 blocks of the BCn formats. Texels are packed RGBA8 values (R in
+		// the low byte) in row-major order within the block.
+		//   BC1: one 64-bit color block, opaque
+		//   BC3: a 64-bit alpha block followed by a 64-bit color block
+		//   BC5: two 64-bit single-channel blocks holding the X and Y of a unit normal. Z is
+		//        reconstructed on decode and returned in B, A is opaque.
+		void EncodeBC1Block(unsigned long long * block, const unsigned int * texels);
+		void EncodeBC3Block(unsigned long long * block, const unsigned int * texels);
+		void EncodeBC5Block(unsigned long long * block, const unsigned int * texels);
+		void DecodeBC1Block(unsigned int * texels, const unsigned long long * block);
+		void DecodeBC3Block(unsigned int * texels, const unsigned long long * block);
+		void DecodeBC5Block(unsigned int * texels, const unsigned long long * block);
+	}
+}
+
+#endif
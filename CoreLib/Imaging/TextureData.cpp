@@ -1,7 +1,13 @@
 #include "TextureData.h"
+#include "TextureCompression.h"
+#include "../LibIO.h"
+#include <atomic>
+#include <float.h>
+#include <limits.h>
 
 using namespace CoreLib::Basic;
 using namespace CoreLib::Imaging;
+using namespace CoreLib::IO;
 
 namespace CoreLib
 {
@@ -18,6 +24,120 @@ namespace CoreLib
 			return rs;
 		}
 
+		TextureLayout TextureData::DefaultLayout = TextureLayout::Linear;
+		bool TextureData::CompressOnLoad = false;
+		MipmapFilter TextureData::DefaultMipmapFilter = MipmapFilter::Box;
+		bool TextureData::UseCache = false;
+		String TextureData::CacheDirectory;
+
+		// Direct-mapped cache of decoded blocks. Every compressed level gets a fresh BlockCacheId,
+		// so entries of a released level can never be mistaken for those of a new one.
+		struct DecodedBlock
+		{
+			int LevelId;
+			int Block;
+			unsigned int Texels[16];
+		};
+		const int DecodedBlockCacheSize = 1024;
+		static thread_local DecodedBlock decodedBlocks[DecodedBlockCacheSize];
+		static std::atomic<int> nextBlockCacheId(1);
+
+		inline unsigned int FetchDecodedTexel(DecodedBlock * cache, const TextureLevel & level, int index)
+		{
+			int block = index >> (TextureTileShift * 2);
+			DecodedBlock & entry = cache[(block ^ (int)((unsigned int)level.BlockCacheId * 0x9E3779B1u)) & (DecodedBlockCacheSize - 1)];
+			if (entry.LevelId != level.BlockCacheId || entry.Block != block)
+			{
+				switch (level.Format)
+				{
+				case TextureFormat::BC1:
+					DecodeBC1Block(entry.Texels, level.Blocks.Buffer() + block);
+					break;
+				case TextureFormat::BC3:
+					DecodeBC3Block(entry.Texels, level.Blocks.Buffer() + block * 2);
+					break;
+				default:
+					DecodeBC5Block(entry.Texels, level.Blocks.Buffer() + block * 2);
+					break;
+				}
+				entry.LevelId = level.BlockCacheId;
+				entry.Block = block;
+			}
+			return entry.Texels[index & (TextureTileSize * TextureTileSize - 1)];
+		}
+
+		Color FetchCompressedTexel(const TextureLevel & level, int index)
+		{
+			Color c;
+			c.Value = (int)FetchDecodedTexel(decodedBlocks, level, index);
+			return c;
+		}
+
+		void FetchCompressedTexels(int * texels, const TextureLevel & level, const int * indices, int count)
+		{
+			DecodedBlock * cache = decodedBlocks;
+			for (int i = 0; i < count; i++)
+				texels[i] = (int)FetchDecodedTexel(cache, level, indices[i]);
+		}
+
+		void TextureLevel::Compress(TextureFormat format)
+		{
+			if (Format != TextureFormat::RGBA8 || format == TextureFormat::RGBA8 || !Resident)
+				return;
+			int tilesPerRow = (Width + TextureTileSize - 1) >> TextureTileShift;
+			int tileRows = (Height + TextureTileSize - 1) >> TextureTileShift;
+			int blockSize = format == TextureFormat::BC1 ? 1 : 2;
+			Blocks.SetSize(tilesPerRow * tileRows * blockSize);
+			unsigned int texels[TextureTileSize * TextureTileSize];
+			for (int ty = 0; ty < tileRows; ty++)
+				for (int tx = 0; tx < tilesPerRow; tx++)
+				{
+					// edge blocks of odd-sized levels repeat the last row/column
+					for (int y = 0; y < TextureTileSize; y++)
+						for (int x = 0; x < TextureTileSize; x++)
+						{
+							int px = Math::Min((tx << TextureTileShift) + x, Width - 1);
+							int py = Math::Min((ty << TextureTileShift) + y, Height - 1);
+							texels[(y << TextureTileShift) + x] = (unsigned int)Texel(px, py).Value;
+						}
+					unsigned long long * block = Blocks.Buffer() + (ty * tilesPerRow + tx) * blockSize;
+					if (format == TextureFormat::BC1)
+						EncodeBC1Block(block, texels);
+					else if (format == TextureFormat::BC3)
+						EncodeBC3Block(block, texels);
+					else
+						EncodeBC5Block(block, texels);
+				}
+			Pixels = Basic::List<Color, Basic::AlignedAllocator<64>>();
+			Format = format;
+			Layout = TextureLayout::Tiled;
+			TilesPerRow = tilesPerRow;
+			BlockCacheId = nextBlockCacheId++;
+		}
+
+		void TextureLevel::SetLayout(TextureLayout layout)
+		{
+			if (layout == Layout || Format != TextureFormat::RGBA8 || !Resident)
+				return;
+			TextureLevel result;
+			result.Width = Width;
+			result.Height = Height;
+			result.Layout = layout;
+			result.TilesPerRow = (Width + TextureTileSize - 1) >> TextureTileShift;
+			if (layout == TextureLayout::Tiled)
+			{
+				int tileRows = (Height + TextureTileSize - 1) >> TextureTileShift;
+				result.Pixels.SetSize(result.TilesPerRow * tileRows * TextureTileSize * TextureTileSize);
+				memset(result.Pixels.Buffer(), 0, result.Pixels.Count() * sizeof(Color));
+			}
+			else
+				result.Pixels.SetSize(Width * Height);
+			for (int y = 0; y < Height; y++)
+				for (int x = 0; x < Width; x++)
+					result.Texel(x, y) = Texel(x, y);
+			*this = _Move(result);
+		}
+
 		TextureData::TextureData()
 		{
 			Levels.SetSize(2);
@@ -31,80 +151,700 @@ namespace CoreLib
 			Levels[1].Pixels.SetSize(1);
 			Levels[1].Pixels[0] = Color(127, 127, 127, 255);
 			Width = Height = 2;
+			InvWidth = InvHeight = 0.5f;
 			IsTransparent = false;
+			SetLayout(DefaultLayout);
+			if (CompressOnLoad)
+				Compress(TextureFormat::BC1);
 		}
 
 		TextureData::TextureData(const String & fileName)
+			: TextureData(fileName, Threading::SerialFor())
 		{
-			// Read file to Levels[0]
-			Bitmap image(fileName);
-			Levels.SetSize(CeilLog2(Math::Max(image.GetWidth(), image.GetHeight())));
-			Levels[0].Pixels.Reserve(image.GetWidth()*image.GetHeight());
-			for (int i = image.GetHeight()-1; i>=0; i--)
-				Levels[0].Pixels.AddRange((Color*)image.GetPixels() + i *image.GetWidth(), image.GetWidth());
-			Levels[0].Width = image.GetWidth();
-			Levels[0].Height = image.GetHeight();
-			Width = image.GetWidth();
-			Height = image.GetHeight();
-			IsTransparent = image.GetIsTransparent();
-			// Generate mipmaps
-			int level = 0;
-			int lwidth = Width, lheight = Height;
+		}
+
+		// Texture cache file: a header, one TextureCacheLevel per level, then the texels or
+		// blocks of each level at the offset given by its entry, 64-byte aligned
+		const unsigned int TextureCacheMagic = 0x31435854; // "TXC1"
+		const int TextureCacheVersion = 1;
+		const int TextureCacheAlignment = 64;
+		const int MaxTextureLevels = 32;
+
+		struct TextureCacheHeader
+		{
+			unsigned int Magic;
+			int Version;
+			unsigned long long SourceHash;
+			Int64 SourceSize;
+			int Filter, Layout, Compressed;
+			int Width, Height, IsTransparent, LevelCount, Reserved;
+		};
+
+		struct TextureCacheLevel
+		{
+			int Width, Height, Layout, Format, TilesPerRow, Reserved;
+			Int64 Offset, Size;
+		};
+
+		Int64 AlignCacheOffset(Int64 offset)
+		{
+			return (offset + TextureCacheAlignment - 1) & ~(Int64)(TextureCacheAlignment - 1);
+		}
+
+		// Bytes a level of the given shape holds, for validating the sizes in a cache file
+		Int64 GetLevelDataSize(int width, int height, TextureLayout layout, TextureFormat format)
+		{
+			Int64 tiles = (Int64)((width + TextureTileSize - 1) >> TextureTileShift) * ((height + TextureTileSize - 1) >> TextureTileShift);
+			if (format == TextureFormat::BC1)
+				return tiles * 8;
+			if (format != TextureFormat::RGBA8)
+				return tiles * 16;
+			if (layout == TextureLayout::Tiled)
+				return tiles * TextureTileSize * TextureTileSize * sizeof(Color);
+			return (Int64)width * height * sizeof(Color);
+		}
+
+		Int64 TextureLevel::GetResidentSize() const
+		{
+			return GetLevelDataSize(Width, Height, Layout, Format);
+		}
+
+		bool TextureData::GetCacheEntry(const String & fileName, const unsigned char * data, int size, TextureCacheEntry & entry)
+		{
+			if (data)
+			{
+				entry.SourceHash = ComputeHash64(data, size);
+				entry.SourceSize = size;
+			}
+			else
+			{
+				try
+				{
+					MemoryMappedFile source(fileName);
+					entry.SourceHash = ComputeHash64(source.Buffer(), source.Size());
+					entry.SourceSize = source.Size();
+				}
+				catch (IOException &)
+				{
+					return false;
+				}
+			}
+			const char * filterNames[] = {"box", "gamma", "kaiser"};
+			char key[96];
+			sprintf(key, ".%016llx.%s.%s%s.texcache", entry.SourceHash, filterNames[(int)DefaultMipmapFilter],
+				DefaultLayout == TextureLayout::Tiled ? "tiled" : "linear", CompressOnLoad ? ".bc" : "");
+			String directory = CacheDirectory.Length() ? CacheDirectory : Path::GetDirectoryName(fileName);
+			String cacheName = Path::GetFileName(fileName) + String(key);
+			entry.FileName = directory.Length() ? Path::Combine(directory, cacheName) : cacheName;
+			return true;
+		}
+
+		bool TextureData::ReadCache(const String & fileName, const TextureCacheEntry & entry)
+		{
+			RefPtr<MemoryMappedFile> cache;
+			try
+			{
+				cache = new MemoryMappedFile(entry.FileName);
+			}
+			catch (IOException &)
+			{
+				return false;
+			}
+			// everything is checked before anything is copied, so a stale, truncated or foreign
+			// file is rebuilt rather than trusted
+			const unsigned char * data = cache->Buffer();
+			Int64 fileSize = cache->Size();
+			if (fileSize < (Int64)sizeof(TextureCacheHeader))
+				return false;
+			TextureCacheHeader header;
+			memcpy(&header, data, sizeof(header));
+			if (header.Magic != TextureCacheMagic || header.Version != TextureCacheVersion ||
+				header.SourceHash != entry.SourceHash || header.SourceSize != entry.SourceSize ||
+				header.Filter != (int)DefaultMipmapFilter || header.Layout != (int)DefaultLayout ||
+				header.Compressed != (int)CompressOnLoad || header.LevelCount < 1 || header.LevelCount > MaxTextureLevels ||
+				fileSize < (Int64)(sizeof(TextureCacheHeader) + header.LevelCount * sizeof(TextureCacheLevel)))
+				return false;
+			if (header.Width <= 0 || header.Height <= 0 || header.LevelCount != CeilLog2(Math::Max(header.Width, header.Height)))
+				return false;
+			TextureCacheLevel levels[MaxTextureLevels];
+			memcpy(levels, data + sizeof(TextureCacheHeader), header.LevelCount * sizeof(TextureCacheLevel));
+			// the levels must form the mip chain of the header's size, and every texel or block a
+			// sampler can address (through TilesPerRow for tiled levels) must lie inside the file
+			Int64 tableEnd = sizeof(TextureCacheHeader) + header.LevelCount * sizeof(TextureCacheLevel);
+			for (int i = 0; i < header.LevelCount; i++)
+			{
+				TextureCacheLevel & level = levels[i];
+				int width = i == 0 ? header.Width : Math::Max(levels[i - 1].Width >> 1, 1);
+				int height = i == 0 ? header.Height : Math::Max(levels[i - 1].Height >> 1, 1);
+				if (level.Width != width || level.Height != height || level.Layout < 0 || level.Layout > (int)TextureLayout::Tiled ||
+					level.Format < 0 || level.Format > (int)TextureFormat::BC5 ||
+					(level.Format != (int)TextureFormat::RGBA8 && level.Layout != (int)TextureLayout::Tiled) ||
+					(level.Layout == (int)TextureLayout::Tiled && level.TilesPerRow != (width + TextureTileSize - 1) >> TextureTileShift) ||
+					level.Offset < tableEnd || level.Offset % TextureCacheAlignment != 0 ||
+					level.Size != GetLevelDataSize(width, height, (TextureLayout)level.Layout, (TextureFormat)level.Format) ||
+					level.Size > fileSize - level.Offset || level.Size / (Int64)sizeof(Color) > INT_MAX)
+					return false;
+			}
+
+			FileName = fileName;
+			Width = header.Width;
+			Height = header.Height;
 			InvWidth = 1.0f / Width;
 			InvHeight = 1.0f / Height;
-			do
-			{
-				int oldWidth = lwidth;
-				int oldHeight = lheight;
-				int oldLevel = level;
-				level++;
-				lwidth >>= 1;
-				lheight >>= 1;
-				if (lwidth == 0) lwidth = 1;
-				if (lheight == 0) lheight = 1;
-				Levels[level].Width = lwidth;
-				Levels[level].Height = lheight;
-				Levels[level].Pixels.SetSize(lwidth * lheight);
-				for (int i = 0; i<lheight; i++)
-				{
-					int i1, i2;
-					if (lheight < oldHeight)
+			IsTransparent = header.IsTransparent != 0;
+			Levels = List<TextureLevel>();
+			Levels.SetSize(header.LevelCount);
+			backingFile = cache;
+			bool managed = TextureResidency::Budget > 0;
+			for (int i = 0; i < header.LevelCount; i++)
+			{
+				TextureLevel & level = Levels[i];
+				level.Width = levels[i].Width;
+				level.Height = levels[i].Height;
+				level.Layout = (TextureLayout)levels[i].Layout;
+				level.Format = (TextureFormat)levels[i].Format;
+				level.TilesPerRow = levels[i].TilesPerRow;
+				level.BackingOffset = levels[i].Offset;
+				level.Resident = false;
+				if (level.Format != TextureFormat::RGBA8)
+					level.BlockCacheId = nextBlockCacheId++;
+				if (!managed || levels[i].Size <= TextureResidency::PinnedLevelSize || i == header.LevelCount - 1)
+					PageIn(i);
+			}
+			if (managed)
+				TextureResidency::Register(this);
+			else
+				backingFile = nullptr;
+			return true;
+		}
+
+		void TextureData::PageIn(int level)
+		{
+			TextureLevel & dst = Levels[level];
+			const unsigned char * texels = backingFile->Buffer() + dst.BackingOffset;
+			Int64 size = dst.GetResidentSize();
+			if (dst.Format == TextureFormat::RGBA8)
+			{
+				dst.Pixels.SetSize((int)(size / sizeof(Color)));
+				memcpy(dst.Pixels.Buffer(), texels, (size_t)size);
+			}
+			else
+			{
+				dst.Blocks.SetSize((int)(size / sizeof(unsigned long long)));
+				memcpy(dst.Blocks.Buffer(), texels, (size_t)size);
+			}
+			dst.Resident = true;
+		}
+
+		void TextureData::PageOut(int level)
+		{
+			TextureLevel & dst = Levels[level];
+			dst.Pixels = List<Color, AlignedAllocator<64>>();
+			dst.Blocks = List<unsigned long long, AlignedAllocator<64>>();
+			dst.Resident = false;
+		}
+
+		TextureData::~TextureData()
+		{
+			if (backingFile)
+				TextureResidency::Unregister(this);
+		}
+
+		bool TextureData::WriteCache(const TextureCacheEntry & entry)
+		{
+			if (entry.FileName.Length() == 0 || Levels.Count() > MaxTextureLevels)
+				return false;
+			if (CacheDirectory.Length() && !Directory::Create(CacheDirectory))
+				return false;
+			TextureCacheHeader header;
+			memset(&header, 0, sizeof(header));
+			header.Magic = TextureCacheMagic;
+			header.Version = TextureCacheVersion;
+			header.SourceHash = entry.SourceHash;
+			header.SourceSize = entry.SourceSize;
+			header.Filter = (int)DefaultMipmapFilter;
+			header.Layout = (int)DefaultLayout;
+			header.Compressed = (int)CompressOnLoad;
+			header.Width = Width;
+			header.Height = Height;
+			header.IsTransparent = IsTransparent;
+			header.LevelCount = Levels.Count();
+			TextureCacheLevel levels[MaxTextureLevels];
+			memset(levels, 0, sizeof(levels));
+			Int64 offset = AlignCacheOffset(sizeof(TextureCacheHeader) + Levels.Count() * sizeof(TextureCacheLevel));
+			for (int i = 0; i < Levels.Count(); i++)
+			{
+				levels[i].Width = Levels[i].Width;
+				levels[i].Height = Levels[i].Height;
+				levels[i].Layout = (int)Levels[i].Layout;
+				levels[i].Format = (int)Levels[i].Format;
+				levels[i].TilesPerRow = Levels[i].TilesPerRow;
+				levels[i].Offset = offset;
+				levels[i].Size = Levels[i].GetMemorySize();
+				offset = AlignCacheOffset(offset + levels[i].Size);
+			}
+
+			// written under a name of its own and renamed into place, so processes filling the
+			// cache at the same time never see each other's partial files
+			String tempName = File::GetTemporaryName(entry.FileName);
+			bool written = false;
+			try
+			{
+				FileStream stream(tempName, FileMode::Create);
+				const char padding[TextureCacheAlignment] = {};
+				Int64 position = sizeof(TextureCacheHeader) + Levels.Count() * sizeof(TextureCacheLevel);
+				written = stream.Write(&header, sizeof(header)) == sizeof(header) &&
+					stream.Write(levels, Levels.Count() * sizeof(TextureCacheLevel)) == (int)(Levels.Count() * sizeof(TextureCacheLevel));
+				for (int i = 0; written && i < Levels.Count(); i++)
+				{
+					int paddingSize = (int)(levels[i].Offset - position);
+					const void * texels = Levels[i].Format == TextureFormat::RGBA8 ? (const void*)Levels[i].Pixels.Buffer() : (const void*)Levels[i].Blocks.Buffer();
+					written = stream.Write(padding, paddingSize) == paddingSize &&
+						stream.Write(texels, (int)levels[i].Size) == (int)levels[i].Size;
+					position = levels[i].Offset + levels[i].Size;
+				}
+				stream.Close();
+			}
+			catch (IOException &)
+			{
+				written = false;
+			}
+			if (written && File::Replace(tempName, entry.FileName))
+				return true;
+			File::Delete(tempName);
+			return false;
+		}
+
+		void TextureData::ReadImage(const String & fileName, const unsigned char * data, int size)
+		{
+			// Read file to Levels[0]
+			RefPtr<Bitmap> image = data ? new Bitmap(data, size) : new Bitmap(fileName);
+			FileName = fileName;
+			Levels.SetSize(CeilLog2(Math::Max(image->GetWidth(), image->GetHeight())));
+			Levels[0].Pixels.Reserve(image->GetWidth()*image->GetHeight());
+			for (int i = image->GetHeight()-1; i>=0; i--)
+				Levels[0].Pixels.AddRange((Color*)image->GetPixels() + i *image->GetWidth(), image->GetWidth());
+			Levels[0].Width = image->GetWidth();
+			Levels[0].Height = image->GetHeight();
+			Width = image->GetWidth();
+			Height = image->GetHeight();
+			IsTransparent = image->GetIsTransparent();
+		}
+
+		void TextureData::FinishLoading()
+		{
+			SetLayout(DefaultLayout);
+			if (CompressOnLoad)
+				Compress(IsTransparent ? TextureFormat::BC3 : TextureFormat::BC1);
+		}
+
+		TextureData::TextureData(int width, int height, const Color * pixels)
+		{
+			Levels.SetSize(CeilLog2(Math::Max(width, height)));
+			Levels[0].Pixels.AddRange(pixels, width * height);
+			Levels[0].Width = width;
+			Levels[0].Height = height;
+			Width = width;
+			Height = height;
+			IsTransparent = false;
+			for (int i = 0; i < width * height; i++)
+				if (pixels[i].A != 255)
+				{
+					IsTransparent = true;
+					break;
+				}
+			GenerateMipmaps(Threading::SerialFor());
+			FinishLoading();
+		}
+
+		void TextureData::SetLayout(TextureLayout layout)
+		{
+			for (int i = 0; i < Levels.Count(); i++)
+				Levels[i].SetLayout(layout);
+		}
+
+		void TextureData::Compress(TextureFormat format)
+		{
+			for (int i = 0; i < Levels.Count(); i++)
+				Levels[i].Compress(format);
+		}
+
+		int TextureData::GetMemorySize() const
+		{
+			int size = 0;
+			for (int i = 0; i < Levels.Count(); i++)
+				size += Levels[i].GetMemorySize();
+			return size;
+		}
+
+		int TextureData::AllocateMipmapLevel(int level)
+		{
+			TextureLevel & dst = Levels[level];
+			dst.Width = Math::Max(Levels[level - 1].Width >> 1, 1);
+			dst.Height = Math::Max(Levels[level - 1].Height >> 1, 1);
+			dst.Pixels.SetSize(dst.Width * dst.Height);
+			return (dst.Height + MipmapRowBlock - 1) / MipmapRowBlock;
+		}
+
+		float SrgbToLinear(float c)
+		{
+			return c <= 0.04045f ? c * (1.0f / 12.92f) : powf((c + 0.055f) * (1.0f / 1.055f), 2.4f);
+		}
+
+		// Conversion tables of the gamma-correct filters. Encoding returns the 8-bit value whose
+		// interval in linear light contains the input, which rounds exactly like evaluating the
+		// sRGB curve: the table gives the value at the start of one of 4096 equal steps of the
+		// input, and no step spans more than one interval boundary, so one compare corrects it.
+		struct SrgbTables
+		{
+			static const int EncodeSteps = 4096;
+			float ToLinear[256];
+			float Boundaries[256];
+			unsigned char FromLinear[EncodeSteps];
+			SrgbTables()
+			{
+				for (int i = 0; i < 256; i++)
+				{
+					ToLinear[i] = SrgbToLinear(i / 255.0f);
+					Boundaries[i] = i < 255 ? SrgbToLinear((i + 0.5f) / 255.0f) : FLT_MAX;
+				}
+				int value = 0;
+				for (int i = 0; i < EncodeSteps; i++)
+				{
+					while (Boundaries[value] <= i / (float)EncodeSteps)
+						value++;
+					FromLinear[i] = (unsigned char)value;
+				}
+			}
+			inline int Encode(float linear) const
+			{
+				int step = (int)(Math::Clamp(linear, 0.0f, 1.0f) * EncodeSteps);
+				int value = FromLinear[Math::Min(step, EncodeSteps - 1)];
+				return value + (Boundaries[value] <= linear);
+			}
+		};
+		static SrgbTables srgbTables;
+
+		float BesselI0(float x)
+		{
+			float sum = 1.0f, term = 1.0f;
+			for (int k = 1; k < 20; k++)
+			{
+				term *= (x * 0.5f / k) * (x * 0.5f / k);
+				sum += term;
+			}
+			return sum;
+		}
+
+		// Weights of the 8 source texels under a destination texel of a 2:1 reduction, at
+		// -3.5 ... 3.5 source texels from its center: a half-band sinc under a Kaiser window
+		// (alpha 4) reaching 4 texels out
+		struct KaiserKernel
+		{
+			float Weights[8];
+			KaiserKernel()
+			{
+				const float pi = 3.141592654f;
+				const float alpha = 4.0f, radius = 4.0f;
+				float sum = 0.0f;
+				for (int i = 0; i < 8; i++)
+				{
+					float d = i - 3.5f;
+					float r = d / radius;
+					Weights[i] = sinf(d * 0.5f * pi) / (d * 0.5f * pi) * BesselI0(alpha * sqrtf(1.0f - r * r)) / BesselI0(alpha);
+					sum += Weights[i];
+				}
+				for (int i = 0; i < 8; i++)
+					Weights[i] /= sum;
+			}
+		};
+		static KaiserKernel kaiserKernel;
+
+		inline __m128 ToLinear(Color c)
+		{
+			return _mm_setr_ps(srgbTables.ToLinear[c.R], srgbTables.ToLinear[c.G], srgbTables.ToLinear[c.B], c.A * (1.0f / 255.0f));
+		}
+
+		inline Color FromLinear(__m128 c)
+		{
+			CORE_LIB_ALIGN_16(float v[4]);
+			_mm_store_ps(v, c);
+			return Color(srgbTables.Encode(v[0]), srgbTables.Encode(v[1]), srgbTables.Encode(v[2]),
+				(int)(Math::Clamp(v[3], 0.0f, 1.0f) * 255.0f + 0.5f));
+		}
+
+		void DownsampleBox(TextureLevel & dst, const TextureLevel & src, int firstRow, int lastRow)
+		{
+			bool shrinkX = dst.Width < src.Width;
+			bool shrinkY = dst.Height < src.Height;
+			__m128i zero = _mm_setzero_si128();
+			for (int y = firstRow; y < lastRow; y++)
+			{
+				int y1 = shrinkY ? y * 2 : y;
+				int y2 = shrinkY ? y1 + 1 : y1;
+				const Color * row1 = src.Pixels.Buffer() + y1 * src.Width;
+				const Color * row2 = src.Pixels.Buffer() + y2 * src.Width;
+				Color * out = dst.Pixels.Buffer() + y * dst.Width;
+				int x = 0;
+				if (shrinkX)
+				{
+					// 4 destination texels at a time: add the two source rows in 16-bit lanes, then
+					// the left texel of every pair to the right one
+					for (; x + 4 <= dst.Width; x += 4)
+					{
+						__m128i a0 = _mm_loadu_si128((const __m128i*)(row1 + x * 2));
+						__m128i a1 = _mm_loadu_si128((const __m128i*)(row1 + x * 2 + 4));
+						__m128i b0 = _mm_loadu_si128((const __m128i*)(row2 + x * 2));
+						__m128i b1 = _mm_loadu_si128((const __m128i*)(row2 + x * 2 + 4));
+						__m128i s01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+						__m128i s23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+						__m128i s45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+						__m128i s67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+						__m128i d01 = _mm_add_epi16(_mm_unpacklo_epi64(s01, s23), _mm_unpackhi_epi64(s01, s23));
+						__m128i d23 = _mm_add_epi16(_mm_unpacklo_epi64(s45, s67), _mm_unpackhi_epi64(s45, s67));
+						_mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(_mm_srli_epi16(d01, 2), _mm_srli_epi16(d23, 2)));
+					}
+				}
+				for (; x < dst.Width; x++)
+				{
+					int x1 = shrinkX ? x * 2 : x;
+					int x2 = shrinkX ? x1 + 1 : x1;
+					Color c1 = row1[x1], c2 = row1[x2], c3 = row2[x1], c4 = row2[x2];
+					Color c;
+					c.R = (c1.R+c2.R+c3.R+c4.R)>>2;
+					c.G = (c1.G+c2.G+c3.G+c4.G)>>2;
+					c.B = (c1.B+c2.B+c3.B+c4.B)>>2;
+					c.A = (c1.A+c2.A+c3.A+c4.A)>>2;
+					out[x] = c;
+				}
+			}
+		}
+
+		void DownsampleGammaBox(TextureLevel & dst, const TextureLevel & src, int firstRow, int lastRow)
+		{
+			bool shrinkX = dst.Width < src.Width;
+			bool shrinkY = dst.Height < src.Height;
+			__m128 quarter = _mm_set1_ps(0.25f);
+			for (int y = firstRow; y < lastRow; y++)
+			{
+				int y1 = shrinkY ? y * 2 : y;
+				int y2 = shrinkY ? y1 + 1 : y1;
+				const Color * row1 = src.Pixels.Buffer() + y1 * src.Width;
+				const Color * row2 = src.Pixels.Buffer() + y2 * src.Width;
+				Color * out = dst.Pixels.Buffer() + y * dst.Width;
+				for (int x = 0; x < dst.Width; x++)
+				{
+					int x1 = shrinkX ? x * 2 : x;
+					int x2 = shrinkX ? x1 + 1 : x1;
+					__m128 sum = _mm_add_ps(_mm_add_ps(ToLinear(row1[x1]), ToLinear(row1[x2])),
+						_mm_add_ps(ToLinear(row2[x1]), ToLinear(row2[x2])));
+					out[x] = FromLinear(_mm_mul_ps(sum, quarter));
+				}
+			}
+		}
+
+		// Filters the source rows under the block horizontally into a linear-light buffer, then
+		// the buffer vertically. Axes that do not shrink (1 texel wide or high) are copied.
+		void DownsampleKaiser(TextureLevel & dst, const TextureLevel & src, int firstRow, int lastRow)
+		{
+			bool shrinkX = dst.Width < src.Width;
+			bool shrinkY = dst.Height < src.Height;
+			const int taps = 8;
+			int srcFirstRow = shrinkY ? firstRow * 2 - taps / 2 + 1 : firstRow;
+			int srcLastRow = shrinkY ? lastRow * 2 + taps / 2 - 1 : lastRow;
+			int rowCount = srcLastRow - srcFirstRow;
+			// 4 floats per texel
+			Basic::List<float, Basic::AlignedAllocator<16>> linearRow, horizontal;
+			linearRow.SetSize(src.Width * 4);
+			horizontal.SetSize(rowCount * dst.Width * 4);
+			__m128 weights[taps];
+			for (int i = 0; i < taps; i++)
+				weights[i] = _mm_set1_ps(kaiserKernel.Weights[i]);
+			for (int r = 0; r < rowCount; r++)
+			{
+				int sy = Math::Clamp(srcFirstRow + r, 0, src.Height - 1);
+				const Color * row = src.Pixels.Buffer() + sy * src.Width;
+				float * out = horizontal.Buffer() + r * dst.Width * 4;
+				if (!shrinkX)
+				{
+					for (int x = 0; x < dst.Width; x++)
+						_mm_store_ps(out + x * 4, ToLinear(row[x]));
+					continue;
+				}
+				const float * in = linearRow.Buffer();
+				for (int x = 0; x < src.Width; x++)
+					_mm_store_ps(linearRow.Buffer() + x * 4, ToLinear(row[x]));
+				for (int x = 0; x < dst.Width; x++)
+				{
+					int sx = x * 2 - taps / 2 + 1;
+					__m128 sum = _mm_setzero_ps();
+					if (sx >= 0 && sx + taps <= src.Width)
 					{
-						i1 = i*2;
-						i2 = i1 + 1;
+						for (int i = 0; i < taps; i++)
+							sum = _mm_add_ps(sum, _mm_mul_ps(weights[i], _mm_load_ps(in + (sx + i) * 4)));
 					}
 					else
 					{
+						for (int i = 0; i < taps; i++)
+							sum = _mm_add_ps(sum, _mm_mul_ps(weights[i], _mm_load_ps(in + Math::Clamp(sx + i, 0, src.Width - 1) * 4)));
+					}
+					_mm_store_ps(out + x * 4, sum);
+				}
+			}
+			for (int y = firstRow; y < lastRow; y++)
+			{
+				Color * out = dst.Pixels.Buffer() + y * dst.Width;
+				if (!shrinkY)
+				{
+					const float * in = horizontal.Buffer() + (y - srcFirstRow) * dst.Width * 4;
+					for (int x = 0; x < dst.Width; x++)
+						out[x] = FromLinear(_mm_load_ps(in + x * 4));
+					continue;
+				}
+				const float * in = horizontal.Buffer() + (y * 2 - taps / 2 + 1 - srcFirstRow) * dst.Width * 4;
+				for (int x = 0; x < dst.Width; x++)
+				{
+					__m128 sum = _mm_setzero_ps();
+					for (int i = 0; i < taps; i++)
+						sum = _mm_add_ps(sum, _mm_mul_ps(weights[i], _mm_load_ps(in + (i * dst.Width + x) * 4)));
+					out[x] = FromLinear(sum);
+				}
+			}
+		}
+
+		void TextureData::DownsampleRows(int level, int block, MipmapFilter filter)
+		{
+			TextureLevel & dst = Levels[level];
+			const TextureLevel & src = Levels[level - 1];
+			int firstRow = block * MipmapRowBlock;
+			int lastRow = Math::Min(firstRow + MipmapRowBlock, dst.Height);
+			if (filter == MipmapFilter::Kaiser)
+				DownsampleKaiser(dst, src, firstRow, lastRow);
+			else if (filter == MipmapFilter::GammaBox)
+				DownsampleGammaBox(dst, src, firstRow, lastRow);
+			else
+				DownsampleBox(dst, src, firstRow, lastRow);
+		}
+
+		Int64 TextureResidency::Budget = 0;
+		int TextureResidency::PinnedLevelSize = 64 * 1024;
+		int TextureResidency::CurrentFrame = 0;
+		int TextureResidency::Generation = 0;
+		static Threading::SpinLock residencyLock;
+		static List<TextureData*> managedTextures;
+		static TextureResidencyStats lastResidencyStats;
 
-						i1 = i2 = i;
+		void TextureResidency::Register(TextureData * texture)
+		{
+			residencyLock.Lock();
+			managedTextures.Add(texture);
+			residencyLock.Unlock();
+		}
+
+		void TextureResidency::Unregister(TextureData * texture)
+		{
+			residencyLock.Lock();
+			if (managedTextures.Contains(texture))
+				managedTextures.FastRemove(texture);
+			residencyLock.Unlock();
+		}
+
+		struct ResidentLevelRef
+		{
+			TextureData * Texture;
+			int Level;
+			int LastSampledFrame;
+			Int64 Size;
+		};
+
+		TextureResidencyStats TextureResidency::Update()
+		{
+			TextureResidencyStats stats;
+			memset(&stats, 0, sizeof(stats));
+			int frame = CurrentFrame;
+			residencyLock.Lock();
+			List<ResidentLevelRef> requested, evictable;
+			Int64 reclaimableBytes = 0;
+			for (auto texture : managedTextures)
+			{
+				for (int i = 0; i < texture->Levels.Count(); i++)
+				{
+					TextureLevel & level = texture->Levels[i];
+					ResidentLevelRef ref;
+					ref.Texture = texture;
+					ref.Level = i;
+					ref.LastSampledFrame = level.LastSampledFrame.Load();
+					ref.Size = level.GetResidentSize();
+					if (ref.LastSampledFrame == frame)
+					{
+						stats.SampledLevels++;
+						stats.SampledBytes += ref.Size;
 					}
-					for (int j = 0; j<lwidth; j++)
+					if (level.Resident)
 					{
-						int j1, j2;
-						if (lwidth < oldWidth)
-						{
-							j1 = j*2;
-							j2 = j1 + 1;
-						}
-						else
+						stats.ResidentBytes += ref.Size;
+						if (ref.Size > PinnedLevelSize && i != texture->Levels.Count() - 1)
 						{
-							j1 = j2 = j;
+							evictable.Add(ref);
+							if (ref.LastSampledFrame != frame)
+								reclaimableBytes += ref.Size;
 						}
-						Color c1,c2,c3,c4;
-						c1 = Levels[oldLevel].Pixels[i1*oldWidth + j1];
-						c2 = Levels[oldLevel].Pixels[i1*oldWidth + j2];
-						c3 = Levels[oldLevel].Pixels[i2*oldWidth + j1];
-						c4 = Levels[oldLevel].Pixels[i2*oldWidth + j2];
-						Color c;
-						c.R = (c1.R+c2.R+c3.R+c4.R)>>2;
-						c.G = (c1.G+c2.G+c3.G+c4.G)>>2;
-						c.B = (c1.B+c2.B+c3.B+c4.B)>>2;
-						c.A = (c1.A+c2.A+c3.A+c4.A)>>2;
-						Levels[level].Pixels[i*lwidth + j] = c;
 					}
+					else if (ref.LastSampledFrame == frame)
+						requested.Add(ref);
 				}
 			}
-			while (lwidth != 1 || lheight != 1);
+			// small (coarse) levels first: they are cheap and other requests fall back to them.
+			// Levels the frame sampled are never evicted.
+			requested.Sort([](ResidentLevelRef & a, ResidentLevelRef & b) { return a.Size < b.Size; });
+			evictable.Sort([](ResidentLevelRef & a, ResidentLevelRef & b)
+			{
+				return a.LastSampledFrame < b.LastSampledFrame || (a.LastSampledFrame == b.LastSampledFrame && a.Size > b.Size);
+			});
+			int nextEviction = 0;
+			auto evictUntil = [&](Int64 bytes)
+			{
+				while (stats.ResidentBytes + bytes > Budget && nextEviction < evictable.Count() &&
+					evictable[nextEviction].LastSampledFrame != frame)
+				{
+					ResidentLevelRef & victim = evictable[nextEviction++];
+					victim.Texture->PageOut(victim.Level);
+					stats.ResidentBytes -= victim.Size;
+					stats.EvictedBytes += victim.Size;
+					reclaimableBytes -= victim.Size;
+				}
+			};
+			for (auto & request : requested)
+			{
+				// do not evict anything for a level that would not fit anyway
+				if (stats.ResidentBytes - reclaimableBytes + request.Size > Budget)
+				{
+					stats.DeferredLevels++;
+					continue;
+				}
+				evictUntil(request.Size);
+				if (stats.ResidentBytes + request.Size > Budget)
+				{
+					stats.DeferredLevels++;
+					continue;
+				}
+				request.Texture->PageIn(request.Level);
+				stats.ResidentBytes += request.Size;
+				stats.PagedInBytes += request.Size;
+			}
+			// the budget may have been lowered since the last frame
+			evictUntil(0);
+			if (stats.PagedInBytes || stats.EvictedBytes)
+				Generation++;
+			CurrentFrame++;
+			lastResidencyStats = stats;
+			residencyLock.Unlock();
+			return stats;
+		}
+
+		TextureResidencyStats TextureResidency::GetLastStats()
+		{
+			return lastResidencyStats;
 		}
 	}
 }
\ No newline at end of file
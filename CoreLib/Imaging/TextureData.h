@@ -4,7 +4,11 @@
 #include "../Basic.h"
 #include "../VectorMath.h"
 #include "../LibMath.h"
+#include "../LibIO.h"
+#include "../Threading.h"
 #include "Bitmap.h"
+#include <smmintrin.h>
+#include <atomic>
 
 #ifdef _MSC_VER
 #define FORCE_INLINE __forceinline
@@ -39,14 +43,235 @@ namespace CoreLib
 			}
 		};
 
+		// Order of the texels of a level in memory. Linear is row-major. Tiled stores 4x4 texel
+		// blocks (one 64-byte cache line) contiguously, row-major inside a block and across
+		// blocks, so the taps of a bilinear footprint usually share a line and an anisotropic
+		// walk touches about the same number of lines whatever its direction.
+		enum class TextureLayout
+		{
+			Linear, Tiled
+		};
+
+		const int TextureTileShift = 2;
+		const int TextureTileSize = 1 << TextureTileShift;
+
+		// Storage format of a level. Block-compressed levels keep 8 (BC1) or 16 (BC3, BC5) bytes
+		// per 4x4 block in Blocks instead of Pixels and are always addressed as Tiled, so the
+		// tile index of a texel is its block index. See TextureCompression.h for the formats.
+		enum class TextureFormat
+		{
+			RGBA8, BC1, BC3, BC5
+		};
+
+		struct TextureLevel;
+		// Returns texels (by Tiled index) of a compressed level through a per-thread cache of
+		// decoded blocks
+		Color FetchCompressedTexel(const TextureLevel & level, int index);
+		void FetchCompressedTexels(int * texels, const TextureLevel & level, const int * indices, int count);
+
+		// A frame number that samplers on several threads store to at once. Relaxed order is
+		// enough: TextureResidency::Update reads it after the frame's tasks have joined.
+		// Copies take the current value, so levels can still be moved around in lists.
+		struct SampledFrameCounter
+		{
+			std::atomic<int> Value;
+			SampledFrameCounter(int value)
+				: Value(value)
+			{}
+			SampledFrameCounter(const SampledFrameCounter & other)
+				: Value(other.Load())
+			{}
+			SampledFrameCounter & operator = (const SampledFrameCounter & other)
+			{
+				Store(other.Load());
+				return *this;
+			}
+			inline int Load() const
+			{
+				return Value.load(std::memory_order_relaxed);
+			}
+			inline void Store(int value)
+			{
+				Value.store(value, std::memory_order_relaxed);
+			}
+		};
+
 		struct TextureLevel
 		{
-			Basic::List<Color> Pixels;
+			Basic::List<Color, Basic::AlignedAllocator<64>> Pixels;
+			Basic::List<unsigned long long, Basic::AlignedAllocator<64>> Blocks;
 			int Width, Height;
+			TextureLayout Layout;
+			TextureFormat Format;
+			int TilesPerRow;
+			int BlockCacheId; // identifies the level's blocks in the decoded block caches
+			bool Resident; // false while the texels are paged out to the texture's cache file
+			SampledFrameCounter LastSampledFrame; // TextureResidency frame in which a sampler last asked for the level
+			Int64 BackingOffset; // of the texels in the cache file
+			TextureLevel()
+				: Width(0), Height(0), Layout(TextureLayout::Linear), Format(TextureFormat::RGBA8), TilesPerRow(0), BlockCacheId(0),
+				  Resident(true), LastSampledFrame(-1), BackingOffset(-1)
+			{}
+			inline int TexelIndex(int x, int y) const
+			{
+				if (Layout == TextureLayout::Linear)
+					return y * Width + x;
+				int tile = (y >> TextureTileShift) * TilesPerRow + (x >> TextureTileShift);
+				return (tile << (TextureTileShift * 2)) + ((y & (TextureTileSize - 1)) << TextureTileShift) + (x & (TextureTileSize - 1));
+			}
+			// The index of texel (x, y) is ColumnOffset(x) + RowOffset(y) in both layouts, so a
+			// bilinear footprint needs two offsets per axis instead of four full indices
+			inline __m128i ColumnOffset(__m128i x) const
+			{
+				if (Layout == TextureLayout::Linear)
+					return x;
+				__m128i inner = _mm_and_si128(x, _mm_set1_epi32(TextureTileSize - 1));
+				return _mm_add_epi32(_mm_slli_epi32(_mm_srli_epi32(x, TextureTileShift), TextureTileShift * 2), inner);
+			}
+			inline __m128i RowOffset(__m128i y) const
+			{
+				if (Layout == TextureLayout::Linear)
+					return _mm_mullo_epi32(y, _mm_set1_epi32(Width));
+				__m128i inner = _mm_slli_epi32(_mm_and_si128(y, _mm_set1_epi32(TextureTileSize - 1)), TextureTileShift);
+				__m128i tileRow = _mm_mullo_epi32(_mm_srli_epi32(y, TextureTileShift), _mm_set1_epi32(TilesPerRow << (TextureTileShift * 2)));
+				return _mm_add_epi32(tileRow, inner);
+			}
+			// Texel access for writing, RGBA8 levels only
+			inline Color & Texel(int x, int y)
+			{
+				return Pixels[TexelIndex(x, y)];
+			}
+			inline Color Fetch(int index) const
+			{
+				if (Format == TextureFormat::RGBA8)
+					return Pixels[index];
+				return FetchCompressedTexel(*this, index);
+			}
+			inline Color Fetch(int x, int y) const
+			{
+				return Fetch(TexelIndex(x, y));
+			}
+			int GetMemorySize() const
+			{
+				return Pixels.Count() * (int)sizeof(Color) + Blocks.Count() * (int)sizeof(unsigned long long);
+			}
+			// Bytes the level holds when resident
+			Int64 GetResidentSize() const;
+			// Reorders the texels in place; tiled levels are padded to whole tiles. Compressed
+			// levels are always tiled and are left unchanged.
+			void SetLayout(TextureLayout layout);
+			// Encodes an RGBA8 level into 'format' and releases its pixels
+			void Compress(TextureFormat format);
+		};
+		// Filter that builds each mip level from the one above it.
+		//   Box: average of 2x2 texels of the stored (sRGB) values
+		//   GammaBox: average of 2x2 texels in linear light, so mips do not darken
+		//   Kaiser: separable 8-tap Kaiser-windowed sinc in linear light, sharper distant
+		//           levels with less aliasing than the box
+		enum class MipmapFilter
+		{
+			Box, GammaBox, Kaiser
+		};
+
+		// Output rows of a mip level filtered by one task of GenerateMipmaps
+		const int MipmapRowBlock = 8;
+
+		class TextureData;
+
+		// Counts of the last TextureResidency::Update, in bytes of texels
+		struct TextureResidencyStats
+		{
+			int SampledLevels; // levels the frame asked for, resident or not
+			Int64 SampledBytes;
+			Int64 ResidentBytes; // after paging, pinned levels included
+			Int64 PagedInBytes;
+			Int64 EvictedBytes;
+			int DeferredLevels; // asked for but left out because they did not fit the budget
+		};
+
+		// Keeps the mip levels of textures loaded from images resident on demand. With a Budget
+		// set, textures are backed by their cache file (see TextureData::UseCache) and only keep
+		// levels of up to PinnedLevelSize bytes, which always include the coarsest, resident from
+		// the start. Samplers record the frame in which they asked for each level and read the
+		// nearest resident coarser level in place of one that is paged out. Between frames,
+		// Update pages in the levels the frame asked for, evicting the least recently sampled
+		// levels to stay within the budget, and starts the next frame. Levels never change while
+		// a frame renders, so sampling needs no locks.
+		class TextureResidency
+		{
+		public:
+			// Bytes of texels the managed textures may keep resident; 0 keeps all levels of new
+			// textures resident and unmanaged
+			static Int64 Budget;
+			static int PinnedLevelSize;
+			static int CurrentFrame;
+			// Changes whenever Update pages a level in or out, and with it the texels samplers
+			// read; images drawn from managed textures and kept across frames are stale after it
+			static int Generation;
+			static void Register(TextureData * texture);
+			static void Unregister(TextureData * texture);
+			// Call between frames, when no sampler runs
+			static TextureResidencyStats Update();
+			static TextureResidencyStats GetLastStats();
 		};
+
+		// Cache file of an image and the hash identifying the image contents
+		struct TextureCacheEntry
+		{
+			Basic::String FileName;
+			unsigned long long SourceHash;
+			Int64 SourceSize;
+			TextureCacheEntry()
+				: SourceHash(0), SourceSize(0)
+			{}
+		};
+
 		class TextureData
 		{
+			friend class TextureResidency;
+		private:
+			RefPtr<IO::MemoryMappedFile> backingFile; // cache file that paged-out levels are read back from
+			// Names the cache file of an image by its contents; false if the image cannot be read.
+			// The image is read from data if it is not null, fileName then only names it.
+			bool GetCacheEntry(const Basic::String & fileName, const unsigned char * data, int size, TextureCacheEntry & entry);
+			// Loads the texture from its cache file; false if the file is missing, stale or
+			// damaged. Under a residency budget only the pinned levels are read.
+			bool ReadCache(const Basic::String & fileName, const TextureCacheEntry & entry);
+			bool WriteCache(const TextureCacheEntry & entry);
+			void PageIn(int level);
+			void PageOut(int level);
+			void ReadImage(const Basic::String & fileName, const unsigned char * data, int size);
+			void FinishLoading();
+			// Sizes Levels[level] and returns the number of row blocks DownsampleRows has to fill
+			int AllocateMipmapLevel(int level);
+			// Filters Levels[level - 1] into one row block of Levels[level]
+			void DownsampleRows(int level, int block, MipmapFilter filter);
+			template<typename ParallelFor>
+			void Load(const Basic::String & fileName, const unsigned char * data, int size, const ParallelFor & parallelFor)
+			{
+				TextureCacheEntry cacheEntry;
+				bool useCache = (UseCache || TextureResidency::Budget > 0) && GetCacheEntry(fileName, data, size, cacheEntry);
+				if (useCache && ReadCache(fileName, cacheEntry))
+					return;
+				ReadImage(fileName, data, size);
+				GenerateMipmaps(parallelFor);
+				FinishLoading();
+				// a managed texture continues from the file it just wrote, so its levels can be paged out
+				if (useCache && WriteCache(cacheEntry) && TextureResidency::Budget > 0)
+					ReadCache(fileName, cacheEntry);
+			}
 		public:
+			// Layout given to textures when they are created
+			static TextureLayout DefaultLayout;
+			// Compress textures when they are created, to BC3 if they have alpha and BC1 otherwise
+			static bool CompressOnLoad;
+			// Filter used for the mip chains of textures when they are created
+			static MipmapFilter DefaultMipmapFilter;
+			// Keep the finished mip chains of loaded images in .texcache files, named by a hash of
+			// the image contents and the load settings, and map those instead of decoding again
+			static bool UseCache;
+			// Directory of the cache files; empty puts them next to the images
+			static Basic::String CacheDirectory;
 			int RefCount;
 			Basic::String FileName;
 			int Width, Height;
@@ -55,7 +280,70 @@ namespace CoreLib
 			Basic::List<TextureLevel> Levels;
 			TextureData();
 			TextureData(const Basic::String & fileName);
+			// Loads an image, filtering the row blocks of each mip level through parallelFor
+			template<typename ParallelFor>
+			TextureData(const Basic::String & fileName, const ParallelFor & parallelFor)
+			{
+				Load(fileName, nullptr, 0, parallelFor);
+			}
+			// Loads an image from an encoded file in memory, such as one embedded in a model. name
+			// stands in for the file name, it places the cache file and identifies the texture.
+			template<typename ParallelFor>
+			TextureData(const Basic::String & name, const unsigned char * data, int size, const ParallelFor & parallelFor)
+			{
+				Load(name, data, size, parallelFor);
+			}
+			~TextureData();
+			// Creates a texture from row-major pixels, bottom row first
+			TextureData(int width, int height, const Color * pixels);
+			// Rebuilds levels 1 and up from level 0, which must be linear RGBA8. Levels depend on
+			// each other, the row blocks within a level do not.
+			template<typename ParallelFor>
+			void GenerateMipmaps(const ParallelFor & parallelFor)
+			{
+				MipmapFilter filter = DefaultMipmapFilter;
+				InvWidth = 1.0f / Width;
+				InvHeight = 1.0f / Height;
+				for (int level = 1; level < Levels.Count(); level++)
+				{
+					int blocks = AllocateMipmapLevel(level);
+					parallelFor(blocks, [this, level, filter](int block)
+					{
+						DownsampleRows(level, block, filter);
+					});
+				}
+			}
+			void SetLayout(TextureLayout layout);
+			void Compress(TextureFormat format);
+			// Bytes held by all levels
+			int GetMemorySize() const;
+			// Records that a sampler asks for level lod in the current frame and returns the
+			// level to read instead: lod itself or the nearest resident coarser one
+			inline int SampledLevel(int lod)
+			{
+				TextureLevel * level = Levels.Buffer() + lod;
+				int frame = TextureResidency::CurrentFrame;
+				if (level->LastSampledFrame.Load() != frame)
+					level->LastSampledFrame.Store(frame);
+				while (!level->Resident)
+				{
+					level++;
+					lod++;
+				}
+				return lod;
+			}
+		};
+		enum class TextureAddressMode
+		{
+			Wrap, Clamp
 		};
+
+		// Colors of the 4 fragments of a pixel quad, one channel per register
+		struct QuadColor
+		{
+			__m128 R, G, B, A;
+		};
+
 		class Cubemap
 		{
 		public:
@@ -63,19 +351,28 @@ namespace CoreLib
 			Matrix4 Transforms[6];
 		};
 
-		inline void SampleTextureLevel_Neareast(VectorMath::Vec4 * result, TextureData * texture, int lod, VectorMath::Vec2 & _uv)
+		inline void SampleTextureLevel_Neareast(VectorMath::Vec4 * result, TextureData * texture, int lod, VectorMath::Vec2 & _uv, TextureAddressMode address = TextureAddressMode::Wrap)
 		{
 			Vec2 uv = _uv;
-			TextureLevel & level = texture->Levels[lod];
+			TextureLevel & level = texture->Levels[texture->SampledLevel(lod)];
 			uv.x *= level.Width;
 			uv.y *= level.Height;
-			if (uv.x < 0.0f) uv.x += level.Width;
-			if (uv.y < 0.0f) uv.y += level.Height;
-			int i0 = (int)(uv.x);
-			int j0 = (int)(uv.y);
-			i0 = Basic::Math::Min(i0, level.Width - 1);
-			j0 = Basic::Math::Min(j0, level.Height - 1);
-			Color c = level.Pixels[j0 * level.Width + i0];
+			int i0, j0;
+			if (address == TextureAddressMode::Clamp)
+			{
+				i0 = (int)Basic::Math::Min(Basic::Math::Max(uv.x, 0.0f), (float)(level.Width - 1));
+				j0 = (int)Basic::Math::Min(Basic::Math::Max(uv.y, 0.0f), (float)(level.Height - 1));
+			}
+			else
+			{
+				if (uv.x < 0.0f) uv.x += level.Width;
+				if (uv.y < 0.0f) uv.y += level.Height;
+				i0 = (int)(uv.x);
+				j0 = (int)(uv.y);
+				i0 = Basic::Math::Min(i0, level.Width - 1);
+				j0 = Basic::Math::Min(j0, level.Height - 1);
+			}
+			Color c = level.Fetch(i0, j0);
 			const float inv255 = 1.0f / 255.0f;
 			result->x = c.R * inv255;
 			result->y = c.G * inv255;
@@ -83,27 +380,40 @@ namespace CoreLib
 			result->w = c.A * inv255;
 		}
 
-		FORCE_INLINE void SampleTextureLevel(VectorMath::Vec4 * result, TextureData * texture, int lod, VectorMath::Vec2 & _uv)
+		FORCE_INLINE void SampleTextureLevel(VectorMath::Vec4 * result, TextureData * texture, int lod, VectorMath::Vec2 & _uv, TextureAddressMode address = TextureAddressMode::Wrap)
 		{
 			Vec2 uv = _uv;
-			TextureLevel & level = texture->Levels[lod];
-			uv.x -= floor(uv.x);
-			uv.y -= floor(uv.y);
-			uv.x *= level.Width;
-			uv.y *= level.Height;
-			/*if (uv.x < 0.0f) uv.x += level.Width;
-			if (uv.y < 0.0f) uv.y += level.Height;*/
-			int i0 = (int)(uv.x);
-			int i1 = i0 + 1 >= level.Width ? 0 : i0 + 1;
-			int j0 = (int)(uv.y);
-			int j1 = j0 + 1 >= level.Height ? 0 : j0 + 1;
-			i0 = Basic::Math::Min(i0, level.Width - 1);
-			j0 = Basic::Math::Min(j0, level.Height - 1);
+			TextureLevel & level = texture->Levels[texture->SampledLevel(lod)];
+			int i0, i1, j0, j1;
+			if (address == TextureAddressMode::Clamp)
+			{
+				uv.x = Basic::Math::Min(Basic::Math::Max(uv.x * level.Width, 0.0f), (float)(level.Width - 1));
+				uv.y = Basic::Math::Min(Basic::Math::Max(uv.y * level.Height, 0.0f), (float)(level.Height - 1));
+				i0 = (int)(uv.x);
+				i1 = Basic::Math::Min(i0 + 1, level.Width - 1);
+				j0 = (int)(uv.y);
+				j1 = Basic::Math::Min(j0 + 1, level.Height - 1);
+			}
+			else
+			{
+				uv.x -= floor(uv.x);
+				uv.y -= floor(uv.y);
+				uv.x *= level.Width;
+				uv.y *= level.Height;
+				/*if (uv.x < 0.0f) uv.x += level.Width;
+				if (uv.y < 0.0f) uv.y += level.Height;*/
+				i0 = (int)(uv.x);
+				i1 = i0 + 1 >= level.Width ? 0 : i0 + 1;
+				j0 = (int)(uv.y);
+				j1 = j0 + 1 >= level.Height ? 0 : j0 + 1;
+				i0 = Basic::Math::Min(i0, level.Width - 1);
+				j0 = Basic::Math::Min(j0, level.Height - 1);
+			}
 			Color c1, c2, c3, c4;
-			c1 = level.Pixels[j0 * level.Width + i0];
-			c2 = level.Pixels[j0 * level.Width + i1];
-			c3 = level.Pixels[j1 * level.Width + i0];
-			c4 = level.Pixels[j1 * level.Width + i1];
+			c1 = level.Fetch(i0, j0);
+			c2 = level.Fetch(i1, j0);
+			c3 = level.Fetch(i0, j1);
+			c4 = level.Fetch(i1, j1);
 			Color ci0, ci1;
 			float it = uv.x - i0;
 			float jt = uv.y - j0;
@@ -132,15 +442,15 @@ namespace CoreLib
 		}
 
 		// Texture lookup: return value of nearest texel
-		inline void NearestSampling(Vec4 * result, TextureData * texture, Vec2 uv)
+		inline void NearestSampling(Vec4 * result, TextureData * texture, Vec2 uv, TextureAddressMode address = TextureAddressMode::Wrap)
 		{
-			SampleTextureLevel_Neareast(result, texture, 0, uv);
+			SampleTextureLevel_Neareast(result, texture, 0, uv, address);
 		}
 
-		inline void LinearSampling(Vec4 * result, TextureData * texture, Vec2 uv)
+		inline void LinearSampling(Vec4 * result, TextureData * texture, Vec2 uv, TextureAddressMode address = TextureAddressMode::Wrap)
 		{
 			if (_finite(uv.x) && _finite(uv.y))
-				SampleTextureLevel(result, texture, 0, uv);
+				SampleTextureLevel(result, texture, 0, uv, address);
 		}
 
 		inline float fast_log2(float val)
@@ -157,7 +467,7 @@ namespace CoreLib
 			return (val + log_2);
 		}
 
-		inline void TrilinearSampling(Vec4 * result, TextureData * texture, float du, float dv, Vec2 & uv, int minLod = 0)
+		inline void TrilinearSampling(Vec4 * result, TextureData * texture, float du, float dv, Vec2 & uv, int minLod = 0, TextureAddressMode address = TextureAddressMode::Wrap)
 		{
 			if (_finite(du) && _finite(dv) && _finite(uv.x) && _finite(uv.y))
 			{
@@ -181,15 +491,15 @@ namespace CoreLib
 				lod2 = Basic::Math::Max(lod2, minLod);
 				if (lod1 == lod2)
 				{
-					SampleTextureLevel(result, texture, lod1, uv);
+					SampleTextureLevel(result, texture, lod1, uv, address);
 				}
 				else
 				{
 					float lodt = lod - lod1;
 					float invLodt = 1.0f - lodt;
 					Vec4 v1, v2;
-					SampleTextureLevel(&v1, texture, lod1, uv);
-					SampleTextureLevel(&v2, texture, lod2, uv);
+					SampleTextureLevel(&v1, texture, lod1, uv, address);
+					SampleTextureLevel(&v2, texture, lod2, uv, address);
 					result->x = v1.x * invLodt + v2.x * lodt;
 					result->y = v1.y * invLodt + v2.y * lodt;
 					result->z = v1.z * invLodt + v2.z * lodt;
@@ -205,17 +515,8 @@ namespace CoreLib
 			}
 		}
 
-		inline void AnisotropicSampling(Vec4 * result, TextureData * texture, int maxRate, float dudx, float dvdx, float dudy, float dvdy, Vec2 & uv)
+		inline void AnisotropicSampling(Vec4 * result, TextureData * texture, int maxRate, float dudx, float dvdx, float dudy, float dvdy, Vec2 & uv, TextureAddressMode address = TextureAddressMode::Wrap)
 		{
-			float A = dvdx * dvdx + dvdy * dvdy;
-			float B = -2.0f * (dudx * dvdx + dudy * dvdy);
-			float C = dudx * dudx + dudy * dudy;
-			float F = (dudx * dvdy - dudy * dvdx);
-			F *= F;
-			float p = A - C;
-			float q = A + C;
-			float t = sqrt(p * p + B * B);
-
 			dudx *= texture->Width; dudy *= texture->Width;
 			dvdx *= texture->Height; dvdy *= texture->Height;
 
@@ -224,6 +525,12 @@ namespace CoreLib
 			float determinant = abs(dudx*dvdy - dvdx*dudy);
 			bool isMajorX = squaredLengthX > squaredLengthY;
 			float squaredLengthMajor = isMajorX ? squaredLengthX : squaredLengthY;
+			// no change of the coordinates across the quad: a single tap at the top level
+			if (squaredLengthMajor == 0.0f)
+			{
+				SampleTextureLevel(result, texture, 0, uv, address);
+				return;
+			}
 			float lengthMajor = sqrt(squaredLengthMajor);
 			float normMajor = 1.f / lengthMajor;
 
@@ -273,14 +580,14 @@ namespace CoreLib
 				if (lod1 == lod2)
 				{
 					Vec4 rs;
-					SampleTextureLevel(&rs, texture, lod1, uv);
+					SampleTextureLevel(&rs, texture, lod1, uv, address);
 					(*result) += rs;
 				}
 				else
 				{
 					Vec4 v1, v2;
-					SampleTextureLevel(&v1, texture, lod1, uv);
-					SampleTextureLevel(&v2, texture, lod2, uv);
+					SampleTextureLevel(&v1, texture, lod1, uv, address);
+					SampleTextureLevel(&v2, texture, lod2, uv, address);
 					result->x += v1.x * invLodt + v2.x * lodt;
 					result->y += v1.y * invLodt + v2.y * lodt;
 					result->z += v1.z * invLodt + v2.z * lodt;
@@ -289,6 +596,323 @@ namespace CoreLib
 			}
 			(*result) *= invRate;
 		}
+
+		// Quad versions of the samplers above. u and v hold the coordinates of the 4 fragments
+		// of a pixel quad; texel addresses and filter weights are computed for all lanes at once,
+		// the texels are gathered with scalar loads and unpacked to one channel per register, and
+		// the filtering is done in float. The footprint (LOD, anisotropy) comes from the quad's
+		// shared derivatives and is computed once. Results are quantized to 8 bits per level like
+		// the scalar path and stay within one step of it (the scalar path also truncates after
+		// the horizontal lerp).
+
+		// i0/i1 are the two texels to blend along one axis, t is the weight of i1
+		FORCE_INLINE void ComputeTexelAddress(__m128i & i0, __m128i & i1, __m128 & t, __m128 coord, int size, TextureAddressMode address)
+		{
+			__m128i maxIndex = _mm_set1_epi32(size - 1);
+			__m128 x;
+			if (address == TextureAddressMode::Clamp)
+			{
+				// maxps returns the second operand for NaN, so NaN clamps to texel 0
+				x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(coord, _mm_set1_ps((float)size)), _mm_setzero_ps()), _mm_set1_ps((float)(size - 1)));
+				i0 = _mm_cvttps_epi32(x);
+				i1 = _mm_min_epi32(_mm_add_epi32(i0, _mm_set1_epi32(1)), maxIndex);
+			}
+			else
+			{
+				x = _mm_mul_ps(_mm_sub_ps(coord, _mm_floor_ps(coord)), _mm_set1_ps((float)size));
+				x = _mm_and_ps(x, _mm_cmpord_ps(x, x));
+				i0 = _mm_cvttps_epi32(x);
+				i1 = _mm_add_epi32(i0, _mm_set1_epi32(1));
+				i1 = _mm_andnot_si128(_mm_cmpgt_epi32(i1, maxIndex), i1);
+				i0 = _mm_min_epi32(i0, maxIndex);
+			}
+			t = _mm_sub_ps(x, _mm_cvtepi32_ps(i0));
+		}
+
+		FORCE_INLINE void GatherTexels(QuadColor & result, const TextureLevel & level, __m128i index)
+		{
+			CORE_LIB_ALIGN_16(int id[4]);
+			_mm_store_si128((__m128i*)id, index);
+			__m128i c;
+			if (level.Format == TextureFormat::RGBA8)
+			{
+				const int * pixels = (const int*)level.Pixels.Buffer();
+				c = _mm_set_epi32(pixels[id[3]], pixels[id[2]], pixels[id[1]], pixels[id[0]]);
+			}
+			else
+			{
+				FetchCompressedTexels(id, level, id, 4);
+				c = _mm_load_si128((__m128i*)id);
+			}
+			__m128i byteMask = _mm_set1_epi32(0xFF);
+			result.R = _mm_cvtepi32_ps(_mm_and_si128(c, byteMask));
+			result.G = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c, 8), byteMask));
+			result.B = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c, 16), byteMask));
+			result.A = _mm_cvtepi32_ps(_mm_srli_epi32(c, 24));
+		}
+
+		FORCE_INLINE __m128 BilerpQuantized(__m128 c1, __m128 c2, __m128 c3, __m128 c4, __m128 it, __m128 invIt, __m128 jt, __m128 invJt)
+		{
+			__m128 ci0 = _mm_add_ps(_mm_mul_ps(c1, invIt), _mm_mul_ps(c2, it));
+			__m128 ci1 = _mm_add_ps(_mm_mul_ps(c3, invIt), _mm_mul_ps(c4, it));
+			__m128 c = _mm_add_ps(_mm_mul_ps(ci0, invJt), _mm_mul_ps(ci1, jt));
+			return _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(c)), _mm_set1_ps(1.0f / 255.0f));
+		}
+
+		inline void SampleTextureLevelQuad_Nearest(QuadColor & result, TextureData * texture, int lod, __m128 u, __m128 v, TextureAddressMode address = TextureAddressMode::Wrap)
+		{
+			TextureLevel & level = texture->Levels[texture->SampledLevel(lod)];
+			__m128i i0, i1, j0, j1;
+			__m128 it, jt;
+			ComputeTexelAddress(i0, i1, it, u, level.Width, address);
+			ComputeTexelAddress(j0, j1, jt, v, level.Height, address);
+			GatherTexels(result, level, _mm_add_epi32(level.RowOffset(j0), level.ColumnOffset(i0)));
+			__m128 inv255 = _mm_set1_ps(1.0f / 255.0f);
+			result.R = _mm_mul_ps(result.R, inv255);
+			result.G = _mm_mul_ps(result.G, inv255);
+			result.B = _mm_mul_ps(result.B, inv255);
+			result.A = _mm_mul_ps(result.A, inv255);
+		}
+
+		FORCE_INLINE void SampleTextureLevelQuad(QuadColor & result, TextureData * texture, int lod, __m128 u, __m128 v, TextureAddressMode address = TextureAddressMode::Wrap)
+		{
+			TextureLevel & level = texture->Levels[texture->SampledLevel(lod)];
+			__m128i i0, i1, j0, j1;
+			__m128 it, jt;
+			ComputeTexelAddress(i0, i1, it, u, level.Width, address);
+			ComputeTexelAddress(j0, j1, jt, v, level.Height, address);
+			__m128i row0 = level.RowOffset(j0);
+			__m128i row1 = level.RowOffset(j1);
+			__m128i column0 = level.ColumnOffset(i0);
+			__m128i column1 = level.ColumnOffset(i1);
+			QuadColor c1, c2, c3, c4;
+			GatherTexels(c1, level, _mm_add_epi32(row0, column0));
+			GatherTexels(c2, level, _mm_add_epi32(row0, column1));
+			GatherTexels(c3, level, _mm_add_epi32(row1, column0));
+			GatherTexels(c4, level, _mm_add_epi32(row1, column1));
+			__m128 one = _mm_set1_ps(1.0f);
+			__m128 invIt = _mm_sub_ps(one, it);
+			__m128 invJt = _mm_sub_ps(one, jt);
+			result.R = BilerpQuantized(c1.R, c2.R, c3.R, c4.R, it, invIt, jt, invJt);
+			result.G = BilerpQuantized(c1.G, c2.G, c3.G, c4.G, it, invIt, jt, invJt);
+			result.B = BilerpQuantized(c1.B, c2.B, c3.B, c4.B, it, invIt, jt, invJt);
+			result.A = BilerpQuantized(c1.A, c2.A, c3.A, c4.A, it, invIt, jt, invJt);
+		}
+
+		FORCE_INLINE void LerpQuad(QuadColor & result, const QuadColor & c1, const QuadColor & c2, float t)
+		{
+			__m128 t1 = _mm_set1_ps(t);
+			__m128 t0 = _mm_set1_ps(1.0f - t);
+			result.R = _mm_add_ps(_mm_mul_ps(c1.R, t0), _mm_mul_ps(c2.R, t1));
+			result.G = _mm_add_ps(_mm_mul_ps(c1.G, t0), _mm_mul_ps(c2.G, t1));
+			result.B = _mm_add_ps(_mm_mul_ps(c1.B, t0), _mm_mul_ps(c2.B, t1));
+			result.A = _mm_add_ps(_mm_mul_ps(c1.A, t0), _mm_mul_ps(c2.A, t1));
+		}
+
+		inline void NearestSamplingQuad(QuadColor & result, TextureData * texture, __m128 u, __m128 v, TextureAddressMode address = TextureAddressMode::Wrap)
+		{
+			SampleTextureLevelQuad_Nearest(result, texture, 0, u, v, address);
+		}
+
+		// lanes with a NaN coordinate keep their previous value, as in LinearSampling
+		inline void LinearSamplingQuad(QuadColor & result, TextureData * texture, __m128 u, __m128 v, TextureAddressMode address = TextureAddressMode::Wrap)
+		{
+			QuadColor c;
+			SampleTextureLevelQuad(c, texture, 0, u, v, address);
+			__m128 valid = _mm_and_ps(_mm_cmpord_ps(u, u), _mm_cmpord_ps(v, v));
+			result.R = _mm_blendv_ps(result.R, c.R, valid);
+			result.G = _mm_blendv_ps(result.G, c.G, valid);
+			result.B = _mm_blendv_ps(result.B, c.B, valid);
+			result.A = _mm_blendv_ps(result.A, c.A, valid);
+		}
+
+		inline void TrilinearSamplingQuad(QuadColor & result, TextureData * texture, float du, float dv, __m128 u, __m128 v, int minLod = 0, TextureAddressMode address = TextureAddressMode::Wrap)
+		{
+			__m128 zero = _mm_setzero_ps();
+			if (!(_finite(du) && _finite(dv)))
+			{
+				result.R = result.G = result.B = result.A = zero;
+				return;
+			}
+			du *= texture->Width;
+			dv *= texture->Height;
+			float maxDudv = Basic::Math::Max(du, dv);
+			float lod;
+			int lod1, lod2;
+			if (maxDudv < 0.0001f)
+			{
+				lod = 0.0f;
+				lod1 = lod2 = 0;
+			}
+			else
+			{
+				lod = Basic::Math::Max(0.0f, fast_log2(maxDudv));
+				lod1 = Basic::Math::Min((int)lod, texture->Levels.Count() - 1);
+				lod2 = (lod == lod1 ? lod1 : Basic::Math::Min(lod1 + 1, texture->Levels.Count() - 1));
+			}
+			lod1 = Basic::Math::Max(lod1, minLod);
+			lod2 = Basic::Math::Max(lod2, minLod);
+			if (lod1 == lod2)
+			{
+				SampleTextureLevelQuad(result, texture, lod1, u, v, address);
+			}
+			else
+			{
+				QuadColor v1, v2;
+				SampleTextureLevelQuad(v1, texture, lod1, u, v, address);
+				SampleTextureLevelQuad(v2, texture, lod2, u, v, address);
+				LerpQuad(result, v1, v2, lod - lod1);
+			}
+			__m128 valid = _mm_and_ps(_mm_cmpord_ps(u, u), _mm_cmpord_ps(v, v));
+			result.R = _mm_and_ps(result.R, valid);
+			result.G = _mm_and_ps(result.G, valid);
+			result.B = _mm_and_ps(result.B, valid);
+			result.A = _mm_and_ps(result.A, valid);
+		}
+
+		// Texture coordinate derivatives of a 2x2 quad, lanes (x, y) = (0, 0), (1, 0), (0, 1), (1, 1).
+		// Each lane takes its x difference from the other fragment of its row and its y difference
+		// from the other fragment of its column, made positive.
+		struct QuadDerivatives
+		{
+			__m128 DuDx, DvDx, DuDy, DvDy;
+		};
+
+		FORCE_INLINE void ComputeQuadDerivatives(QuadDerivatives & derivatives, __m128 u, __m128 v)
+		{
+			__m128 sign = _mm_set1_ps(-0.0f);
+			derivatives.DuDx = _mm_andnot_ps(sign, _mm_sub_ps(_mm_shuffle_ps(u, u, _MM_SHUFFLE(2, 3, 0, 1)), u));
+			derivatives.DvDx = _mm_andnot_ps(sign, _mm_sub_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)), v));
+			derivatives.DuDy = _mm_andnot_ps(sign, _mm_sub_ps(_mm_shuffle_ps(u, u, _MM_SHUFFLE(1, 0, 3, 2)), u));
+			derivatives.DvDy = _mm_andnot_ps(sign, _mm_sub_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)), v));
+		}
+
+		// Largest of the quad's four lanes, in every lane
+		FORCE_INLINE __m128 QuadMax(__m128 x)
+		{
+			x = _mm_max_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1)));
+			return _mm_max_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 0, 3, 2)));
+		}
+
+		// Trilinear filtering of a quad at the coarsest level any of its lanes asks for
+		inline void TrilinearSamplingQuad(QuadColor & result, TextureData * texture, const QuadDerivatives & derivatives, __m128 u, __m128 v, int minLod = 0, TextureAddressMode address = TextureAddressMode::Wrap)
+		{
+			__m128 du = QuadMax(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(derivatives.DuDx, derivatives.DuDx), _mm_mul_ps(derivatives.DuDy, derivatives.DuDy))));
+			__m128 dv = QuadMax(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(derivatives.DvDx, derivatives.DvDx), _mm_mul_ps(derivatives.DvDy, derivatives.DvDy))));
+			TrilinearSamplingQuad(result, texture, _mm_cvtss_f32(du), _mm_cvtss_f32(dv), u, v, minLod, address);
+		}
+
+		// Footprint of the anisotropic filter for up to 4 sets of derivatives (in texels), one per
+		// lane. SampleCount taps are spread along the major axis (MajorU, MajorV) around the sample
+		// point and read from mip level LOD. As in AnisotropicSampling, zero derivatives give one
+		// tap at the top level and NaN derivatives give no taps.
+		struct AnisotropicFootprint
+		{
+			__m128 MajorU, MajorV;
+			__m128 LOD;
+			__m128i SampleCount;
+		};
+
+		FORCE_INLINE void ComputeAnisotropicFootprint(AnisotropicFootprint & footprint, int maxRate, __m128 dudx, __m128 dvdx, __m128 dudy, __m128 dvdy)
+		{
+			__m128 one = _mm_set1_ps(1.0f);
+			__m128 rate = _mm_set1_ps((float)maxRate);
+			__m128 squaredLengthX = _mm_add_ps(_mm_mul_ps(dudx, dudx), _mm_mul_ps(dvdx, dvdx));
+			__m128 squaredLengthY = _mm_add_ps(_mm_mul_ps(dudy, dudy), _mm_mul_ps(dvdy, dvdy));
+			__m128 determinant = _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(_mm_mul_ps(dudx, dvdy), _mm_mul_ps(dvdx, dudy)));
+			__m128 isMajorX = _mm_cmpgt_ps(squaredLengthX, squaredLengthY);
+			__m128 squaredLengthMajor = _mm_blendv_ps(squaredLengthY, squaredLengthX, isMajorX);
+			__m128 lengthMajor = _mm_sqrt_ps(squaredLengthMajor);
+			footprint.MajorU = _mm_blendv_ps(dudy, dudx, isMajorX);
+			footprint.MajorV = _mm_blendv_ps(dvdy, dvdx, isMajorX);
+
+			// clamp ratio and compute LOD
+			__m128 ratioOfAnisotropy = _mm_div_ps(squaredLengthMajor, determinant);
+			__m128 clampRatio = _mm_cmpgt_ps(ratioOfAnisotropy, rate);
+			__m128 lengthMinor = _mm_blendv_ps(_mm_div_ps(determinant, lengthMajor), _mm_div_ps(lengthMajor, rate), clampRatio);
+			ratioOfAnisotropy = _mm_blendv_ps(ratioOfAnisotropy, rate, clampRatio);
+
+			// clamp to top LOD
+			__m128 belowTop = _mm_cmplt_ps(lengthMinor, one);
+			ratioOfAnisotropy = _mm_blendv_ps(ratioOfAnisotropy, _mm_max_ps(_mm_mul_ps(ratioOfAnisotropy, lengthMinor), one), belowTop);
+			lengthMinor = _mm_blendv_ps(lengthMinor, one, belowTop);
+
+			__m128 point = _mm_cmpeq_ps(squaredLengthMajor, _mm_setzero_ps());
+			footprint.LOD = _mm_andnot_ps(point, _mm_max_ps(_mm_log2_ps(lengthMinor), _mm_setzero_ps()));
+			footprint.SampleCount = _mm_cvttps_epi32(_mm_blendv_ps(ratioOfAnisotropy, one, point));
+		}
+
+		// The footprints of the four lanes are computed together from the quad's derivatives, and
+		// the one with the coarsest LOD drives the taps of all four lanes, so the tap count is
+		// uniform across the quad and no lane is filtered from too fine a level
+		inline void AnisotropicSamplingQuad(QuadColor & result, TextureData * texture, int maxRate, const QuadDerivatives & derivatives, __m128 u, __m128 v, TextureAddressMode address = TextureAddressMode::Wrap)
+		{
+			if (address == TextureAddressMode::Wrap)
+			{
+				u = _mm_sub_ps(u, _mm_floor_ps(u));
+				v = _mm_sub_ps(v, _mm_floor_ps(v));
+			}
+			__m128 width = _mm_set1_ps((float)texture->Width);
+			__m128 height = _mm_set1_ps((float)texture->Height);
+			AnisotropicFootprint footprint;
+			ComputeAnisotropicFootprint(footprint, maxRate, _mm_mul_ps(derivatives.DuDx, width), _mm_mul_ps(derivatives.DvDx, height),
+				_mm_mul_ps(derivatives.DuDy, width), _mm_mul_ps(derivatives.DvDy, height));
+			int coarsest = _mm_movemask_ps(_mm_cmpeq_ps(footprint.LOD, QuadMax(footprint.LOD)));
+			int lane = 0;
+			while (lane < 3 && !(coarsest & (1 << lane)))
+				lane++;
+			CORE_LIB_ALIGN_16(float lods[4]);
+			CORE_LIB_ALIGN_16(float majorUs[4]);
+			CORE_LIB_ALIGN_16(float majorVs[4]);
+			CORE_LIB_ALIGN_16(int sampleCounts[4]);
+			_mm_store_ps(lods, footprint.LOD);
+			_mm_store_ps(majorUs, footprint.MajorU);
+			_mm_store_ps(majorVs, footprint.MajorV);
+			_mm_store_si128((__m128i*)sampleCounts, footprint.SampleCount);
+			float LOD = lods[lane];
+			float majorU = majorUs[lane];
+			float majorV = majorVs[lane];
+			int sampleCount = sampleCounts[lane];
+			float invRate = 1.0f / sampleCount;
+			__m128 startU = _mm_sub_ps(_mm_mul_ps(u, width), _mm_set1_ps(majorU*0.5f));
+			__m128 startV = _mm_sub_ps(_mm_mul_ps(v, height), _mm_set1_ps(majorV*0.5f));
+			float stepU = majorU*invRate;
+			float stepV = majorV*invRate;
+			__m128 zero = _mm_setzero_ps();
+			result.R = result.G = result.B = result.A = zero;
+			int lod1, lod2;
+			lod1 = Basic::Math::Min((int)LOD, texture->Levels.Count() - 1);
+			lod2 = Basic::Math::Min((int)ceil(LOD), texture->Levels.Count() - 1);
+			float lodt = LOD - lod1;
+			__m128 invWidth = _mm_set1_ps(texture->InvWidth);
+			__m128 invHeight = _mm_set1_ps(texture->InvHeight);
+			for (int i = 0; i<sampleCount; i++)
+			{
+				__m128 su = _mm_mul_ps(_mm_add_ps(startU, _mm_set1_ps(stepU * (i + 0.5f))), invWidth);
+				__m128 sv = _mm_mul_ps(_mm_add_ps(startV, _mm_set1_ps(stepV * (i + 0.5f))), invHeight);
+				QuadColor rs;
+				if (lod1 == lod2)
+				{
+					SampleTextureLevelQuad(rs, texture, lod1, su, sv, address);
+				}
+				else
+				{
+					QuadColor v1, v2;
+					SampleTextureLevelQuad(v1, texture, lod1, su, sv, address);
+					SampleTextureLevelQuad(v2, texture, lod2, su, sv, address);
+					LerpQuad(rs, v1, v2, lodt);
+				}
+				result.R = _mm_add_ps(result.R, rs.R);
+				result.G = _mm_add_ps(result.G, rs.G);
+				result.B = _mm_add_ps(result.B, rs.B);
+				result.A = _mm_add_ps(result.A, rs.A);
+			}
+			__m128 rate = _mm_set1_ps(invRate);
+			result.R = _mm_mul_ps(result.R, rate);
+			result.G = _mm_mul_ps(result.G, rate);
+			result.B = _mm_mul_ps(result.B, rate);
+			result.A = _mm_mul_ps(result.A, rate);
+		}
 	}
 }
 
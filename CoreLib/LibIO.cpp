@@ -1,6 +1,20 @@
 #include "LibIO.h"
 #include "Exception.h"
 #include <sys/stat.h>
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace CoreLib
 {
@@ -83,5 +97,145 @@ namespace CoreLib
 			StreamReader reader(new FileStream(fileName, FileMode::Open, FileAccess::Read, FileShare::ReadWrite));
 			return reader.ReadToEnd();
 		}
+
+		bool File::Delete(const String & fileName)
+		{
+			return remove(((String)fileName).ToMultiByteString()) == 0;
+		}
+
+		bool File::Replace(const String & sourceFile, const String & destFile)
+		{
+#ifdef WIN32
+			return MoveFileExW(sourceFile.Buffer(), destFile.Buffer(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+			String source = sourceFile;
+			String dest = destFile;
+			return rename(source.ToMultiByteString(), dest.ToMultiByteString()) == 0;
+#endif
+		}
+
+		String File::GetTemporaryName(const String & fileName)
+		{
+			static std::atomic<int> counter(0);
+#ifdef WIN32
+			int processId = _getpid();
+#else
+			int processId = (int)getpid();
+#endif
+			return fileName + L".tmp" + String(processId) + L"_" + String(counter++);
+		}
+
+		bool Directory::Create(const String & path)
+		{
+			String dir = path;
+#ifdef WIN32
+			_wmkdir(dir.Buffer());
+#else
+			mkdir(dir.ToMultiByteString(), 0777);
+#endif
+			struct stat sts;
+			return stat(dir.ToMultiByteString(), &sts) == 0 && (sts.st_mode & S_IFDIR);
+		}
+
+		MemoryMappedFile::MemoryMappedFile(const String & fileName)
+		{
+			buffer = nullptr;
+			size = 0;
+#ifdef WIN32
+			mappingHandle = nullptr;
+			fileHandle = CreateFileW(fileName.Buffer(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+				OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (fileHandle == INVALID_HANDLE_VALUE)
+				throw IOException(L"Cannot open file \"" + fileName + L"\"");
+			LARGE_INTEGER fileSize;
+			GetFileSizeEx(fileHandle, &fileSize);
+			size = fileSize.QuadPart;
+			if (size == 0)
+				return;
+			mappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mappingHandle)
+				buffer = (unsigned char *)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+			if (!buffer)
+			{
+				if (mappingHandle)
+					CloseHandle(mappingHandle);
+				CloseHandle(fileHandle);
+				throw IOException(L"Cannot map file \"" + fileName + L"\"");
+			}
+#else
+			String name = fileName;
+			int fd = open(name.ToMultiByteString(), O_RDONLY);
+			if (fd == -1)
+				throw IOException(L"Cannot open file \"" + fileName + L"\"");
+			struct stat sts;
+			if (fstat(fd, &sts) != 0)
+			{
+				close(fd);
+				throw IOException(L"Cannot open file \"" + fileName + L"\"");
+			}
+			size = sts.st_size;
+			if (size > 0)
+			{
+				void * mapped = mmap(nullptr, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (mapped == MAP_FAILED)
+				{
+					close(fd);
+					throw IOException(L"Cannot map file \"" + fileName + L"\"");
+				}
+				buffer = (unsigned char *)mapped;
+			}
+			// the mapping keeps the file referenced
+			close(fd);
+#endif
+		}
+
+		MemoryMappedFile::~MemoryMappedFile()
+		{
+#ifdef WIN32
+			if (buffer)
+				UnmapViewOfFile(buffer);
+			if (mappingHandle)
+				CloseHandle(mappingHandle);
+			CloseHandle(fileHandle);
+#else
+			if (buffer)
+				munmap(buffer, (size_t)size);
+#endif
+		}
+
+		unsigned long long ComputeHash64(const void * data, Int64 size, unsigned long long seed)
+		{
+			const unsigned long long m = 0xc6a4a7935bd1e995ull;
+			const int r = 47;
+			unsigned long long h = seed ^ ((unsigned long long)size * m);
+			const unsigned char * bytes = (const unsigned char *)data;
+			Int64 wordCount = size / 8;
+			for (Int64 i = 0; i < wordCount; i++)
+			{
+				unsigned long long k;
+				memcpy(&k, bytes + i * 8, 8);
+				k *= m;
+				k ^= k >> r;
+				k *= m;
+				h ^= k;
+				h *= m;
+			}
+			const unsigned char * tail = bytes + wordCount * 8;
+			switch (size & 7)
+			{
+			case 7: h ^= (unsigned long long)tail[6] << 48;
+			case 6: h ^= (unsigned long long)tail[5] << 40;
+			case 5: h ^= (unsigned long long)tail[4] << 32;
+			case 4: h ^= (unsigned long long)tail[3] << 24;
+			case 3: h ^= (unsigned long long)tail[2] << 16;
+			case 2: h ^= (unsigned long long)tail[1] << 8;
+			case 1: h ^= (unsigned long long)tail[0];
+				h *= m;
+			}
+			h ^= h >> r;
+			h *= m;
+			h ^= h >> r;
+			return h;
+		}
 	}
 }
\ No newline at end of file
@@ -14,8 +14,49 @@ namespace CoreLib
 		public:
 			static bool Exists(const CoreLib::Basic::String & fileName);
 			static CoreLib::Basic::String ReadAllText(const CoreLib::Basic::String & fileName);
+			static bool Delete(const CoreLib::Basic::String & fileName);
+			// Renames sourceFile to destFile in one step, replacing destFile if it exists, so
+			// other processes see either the old destFile or the complete new one
+			static bool Replace(const CoreLib::Basic::String & sourceFile, const CoreLib::Basic::String & destFile);
+			// A name next to fileName that no other thread or process picks, for writing a file
+			// that Replace then moves into place
+			static CoreLib::Basic::String GetTemporaryName(const CoreLib::Basic::String & fileName);
 		};
 
+		class Directory
+		{
+		public:
+			// Creates the directory if it does not exist yet; false if it still does not
+			static bool Create(const CoreLib::Basic::String & path);
+		};
+
+		// Read-only view of a whole file mapped into memory. Throws IOException if the file
+		// cannot be opened; an empty file maps to a null buffer of size 0.
+		class MemoryMappedFile : public CoreLib::Basic::Object
+		{
+		private:
+			unsigned char * buffer;
+			Int64 size;
+#ifdef WIN32
+			void * fileHandle;
+			void * mappingHandle;
+#endif
+		public:
+			MemoryMappedFile(const CoreLib::Basic::String & fileName);
+			~MemoryMappedFile();
+			const unsigned char * Buffer() const
+			{
+				return buffer;
+			}
+			Int64 Size() const
+			{
+				return size;
+			}
+		};
+
+		// 64-bit hash of a byte range (MurmurHash64A), for keying files by their contents
+		unsigned long long ComputeHash64(const void * data, Int64 size, unsigned long long seed = 0);
+
 		class Path
 		{
 		public:
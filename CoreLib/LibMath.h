@@ -1,6 +1,10 @@
 #ifndef CORE_LIB_MATH_H
 #define CORE_LIB_MATH_H
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace CoreLib
 {
 	namespace Basic
@@ -41,6 +45,18 @@ namespace CoreLib
 				return(x & 0x0000003f);
 			}
 
+			// Index of the lowest set bit; x must not be 0
+			static inline int CountTrailingZeros(unsigned int x)
+			{
+#ifdef _MSC_VER
+				unsigned long index;
+				_BitScanForward(&index, x);
+				return (int)index;
+#else
+				return __builtin_ctz(x);
+#endif
+			}
+
 			static inline unsigned int Log2Floor(register unsigned int x)
 			{
 				x |= (x >> 1);
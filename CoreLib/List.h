@@ -122,30 +122,30 @@ namespace CoreLib
 				: buffer(0), _count(0), bufferSize(0)
 			{
 			}
-			List(const List<T> & list)
+			List(const List<T, TAllocator> & list)
 				: buffer(0), _count(0), bufferSize(0)
 			{
 				this->operator=(list);
 			}
-			List(List<T> && list)
+			List(List<T, TAllocator> && list)
 				: buffer(0), _count(0), bufferSize(0)
 			{
 				//int t = static_cast<int>(1.0f); reinterpret_cast<double*>(&t), dynamic_cast<> 
-				this->operator=(static_cast<List<T>&&>(list));
+				this->operator=(static_cast<List<T, TAllocator>&&>(list));
 			}
 			~List()
 			{
 				Free();
 			}
-			List<T> & operator=(const List<T> & list)
+			List<T, TAllocator> & operator=(const List<T, TAllocator> & list)
 			{
 				Free();
-				AddRange(list);
+				AddRange(list.Buffer(), list.Count());
 
 				return *this;
 			}
 
-			List<T> & operator=(List<T> && list)
+			List<T, TAllocator> & operator=(List<T, TAllocator> && list)
 			{
 				Free();
 				_count = list._count;
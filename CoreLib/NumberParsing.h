@@ -0,0 +1,89 @@
+#ifndef CORE_LIB_NUMBER_PARSING_H
+#define CORE_LIB_NUMBER_PARSING_H
+
+#include "LibMath.h"
+
+namespace CoreLib
+{
+	namespace Text
+	{
+		// Powers of 10 that are exact in a double
+		const double ExactPowersOf10[] =
+		{
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+
+		// Reads [+-]digits[.digits][(e|E)[+-]digits] at pos into the correctly rounded double strtod
+		// returns, when one exact double operation gives it: a mantissa of at most 2^53 (and 19
+		// significant digits) scaled by 10^-22 to 10^22. Returns false and leaves pos alone for
+		// anything else, such as longer mantissas, larger exponents, inf, nan or hex, which the
+		// caller hands to strtod or strtof. Leading blanks are not skipped; on success pos is left
+		// after the number, and the caller checks what follows it.
+		inline bool ParseExactDecimal(const char *& pos, const char * end, double & value)
+		{
+			const char * p = pos;
+			bool negative = false;
+			if (p < end && (*p == '-' || *p == '+'))
+			{
+				negative = *p == '-';
+				p++;
+			}
+			unsigned long long mantissa = 0;
+			int digits = 0, exponent = 0;
+			bool anyDigit = false, exact = true;
+			for (; p < end && (unsigned)(*p - '0') < 10; p++)
+			{
+				anyDigit = true;
+				if (digits == 19)
+				{
+					exact = false;
+					continue;
+				}
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa)
+					digits++;
+			}
+			if (p < end && *p == '.')
+			{
+				for (p++; p < end && (unsigned)(*p - '0') < 10; p++)
+				{
+					anyDigit = true;
+					if (digits == 19)
+					{
+						exact = false;
+						continue;
+					}
+					mantissa = mantissa * 10 + (*p - '0');
+					exponent--;
+					if (mantissa)
+						digits++;
+				}
+			}
+			if (p < end && (*p == 'e' || *p == 'E'))
+			{
+				p++;
+				bool negativeExponent = false;
+				if (p < end && (*p == '-' || *p == '+'))
+				{
+					negativeExponent = *p == '-';
+					p++;
+				}
+				if (p == end || (unsigned)(*p - '0') >= 10)
+					exact = false;
+				int e = 0;
+				for (; p < end && (unsigned)(*p - '0') < 10; p++)
+					e = Basic::Math::Min(e * 10 + (*p - '0'), 1000);
+				exponent += negativeExponent ? -e : e;
+			}
+			if (!anyDigit || !exact || mantissa > (1ull << 53) || exponent < -22 || exponent > 22)
+				return false;
+			double d = exponent < 0 ? (double)mantissa / ExactPowersOf10[-exponent] : (double)mantissa * ExactPowersOf10[exponent];
+			value = negative ? -d : d;
+			pos = p;
+			return true;
+		}
+	}
+}
+
+#endif
@@ -209,6 +209,11 @@ namespace CoreLib
 			{
 				return pointer;
 			}
+			// Number of RefPtrs sharing the object, 0 for a null pointer
+			int GetReferenceCount() const
+			{
+				return refCount ? *refCount : 0;
+			}
 		private:
 			class _BoolConversionClass
 			{
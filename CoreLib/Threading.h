@@ -30,6 +30,19 @@ namespace CoreLib
 				lock.exchange(0, std::memory_order_relaxed);
 			}
 		};
+
+		// Runs body(0) ... body(count - 1) in order. Loaders that split their work into independent
+		// items (TextureData::GenerateMipmaps, LoadObj) take any functor with this call signature, so
+		// a caller with a thread pool can pass one that runs the calls concurrently.
+		struct SerialFor
+		{
+			template<typename Func>
+			void operator()(int count, const Func & body) const
+			{
+				for (int i = 0; i < count; i++)
+					body(i);
+			}
+		};
 	}
 }
 
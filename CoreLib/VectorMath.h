@@ -1105,6 +1105,45 @@ namespace VectorMath
                _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
 		return _mm_xor_ps(v, SIGNMASK);
 	}
+	// Vectorized log2 for positive finite inputs.
+	// Splits off the exponent and fits log2 of the mantissa in [1, 2) with a
+	// degree 5 polynomial (max relative error about 1e-6).
+	inline __m128 _mm_log2_ps(const __m128 & x)
+	{
+		__m128i bits = _mm_castps_si128(x);
+		__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+		__m128 m = _mm_or_ps(_mm_castsi128_ps(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF))), _mm_set1_ps(1.0f));
+		__m128 p = _mm_set1_ps(0.0596515482674574969533f);
+		p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-0.465725644288844778798f));
+		p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(1.48116647521213171641f));
+		p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-2.52074962577807006663f));
+		p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(2.8882704548164776201f));
+		return _mm_add_ps(_mm_mul_ps(p, _mm_sub_ps(m, _mm_set1_ps(1.0f))), e);
+	}
+
+	// Vectorized 2^x. x is clamped to [-127, 129]: results below about 2^-126 come out as 0,
+	// and from 2^128 up as infinity
+	inline __m128 _mm_exp2_ps(const __m128 & v)
+	{
+		__m128 x = _mm_max_ps(_mm_min_ps(v, _mm_set1_ps(129.0f)), _mm_set1_ps(-126.99999f));
+		__m128i ipart = _mm_cvtps_epi32(_mm_sub_ps(x, _mm_set1_ps(0.5f)));
+		__m128 fpart = _mm_sub_ps(x, _mm_cvtepi32_ps(ipart));
+		__m128 expipart = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(ipart, _mm_set1_epi32(127)), 23));
+		__m128 p = _mm_set1_ps(1.8775767e-3f);
+		p = _mm_add_ps(_mm_mul_ps(p, fpart), _mm_set1_ps(8.9893397e-3f));
+		p = _mm_add_ps(_mm_mul_ps(p, fpart), _mm_set1_ps(5.5826318e-2f));
+		p = _mm_add_ps(_mm_mul_ps(p, fpart), _mm_set1_ps(2.4015361e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, fpart), _mm_set1_ps(6.9315308e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, fpart), _mm_set1_ps(9.9999994e-1f));
+		return _mm_mul_ps(expipart, p);
+	}
+
+	// Vectorized x^y with a fixed instruction count; returns 0 where x <= 0
+	inline __m128 _mm_pow_ps(const __m128 & x, const __m128 & y)
+	{
+		__m128 positive = _mm_cmpgt_ps(x, _mm_setzero_ps());
+		return _mm_and_ps(positive, _mm_exp2_ps(_mm_mul_ps(y, _mm_log2_ps(x))));
+	}
 // GCC does not allow overloading sse vectors
 #define M128_OPERATOR_OVERLOADS
 #ifndef M128_OPERATOR_OVERLOADS
@@ -1,6 +1,7 @@
 #include "RendererImplBase.h"
 #include "CommonTraceCollection.h"
 #include "GBuffer.h"
+#include "DirtyTiles.h"
 #include "GeometryPassShader.h"
 #include "LightingPassShader.h"
 #include "ForwardLightingShader.h"
@@ -22,12 +23,15 @@ namespace RasterRenderer
         int gridWidth, gridHeight;
         FrameBuffer * frameBuffer;
         GBuffer * gbuffer;
+        GBuffer staticGBuffer; // G-Buffer of the static layer
         
         // Lighting data
         ForwardLightingShader::Light* lights;
         int lightCount;
         Vec3 cameraPosition;
         List<ForwardLightingShader::Light> lightsCopy; 
+        const LightClusterGrid * lightGrid;   // cluster light lists, null to light with every light
+        const int * lightSlotSource;          // packed light slot -> index into lights, -1 for padding
         
         struct TiledTriangle {
             ProjectedTriangle triangle;
@@ -37,6 +41,16 @@ namespace RasterRenderer
         
         vector<vector<TiledTriangle>> tileBins;
         vector<vector<TiledTriangle>> localTileBins[Cores];
+        DirtyTileSet dirtyTiles;
+        bool trackDirtyTiles;
+        
+        inline void GetTileRect(int tileId, int & x, int & y, int & w, int & h)
+        {
+            x = (tileId % gridWidth) * TileSize;
+            y = (tileId / gridWidth) * TileSize;
+            w = min(TileSize, frameBuffer->GetWidth() - x);
+            h = min(TileSize, frameBuffer->GetHeight() - y);
+        }
         
         // Shaders
         RefPtr<GeometryPassShader> geometryShader;
@@ -48,6 +62,9 @@ namespace RasterRenderer
             gbuffer = nullptr;
             lights = nullptr;
             lightCount = 0;
+            lightGrid = nullptr;
+            lightSlotSource = nullptr;
+            trackDirtyTiles = false;
             geometryShader = new GeometryPassShader();
             lightingShader = new LightingPassShader();
         }
@@ -72,6 +89,7 @@ namespace RasterRenderer
                 frameBuffer->Clear(clearColor, color, depth);
             if (gbuffer)
                 gbuffer->Clear();
+            dirtyTiles.Invalidate();
             
             // Also clear tile bins to ensure clean state between frames
             for (auto& bin : tileBins) {
@@ -99,6 +117,7 @@ namespace RasterRenderer
             for (int threadId = 0; threadId < Cores; threadId++) {
                 localTileBins[threadId].assign(numTiles, vector<TiledTriangle>());
             }
+            dirtyTiles.SetTileCount(numTiles);
             
             // Allocate G-Buffer
             if (gbuffer)
@@ -113,7 +132,87 @@ namespace RasterRenderer
 
         inline void Finish()
         {
-            // Cleanup if needed
+            // tiles that only the previous frame drew into get the static layer back
+            dirtyTiles.EndFrame([&](int tileId, FrameBuffer & layer)
+            {
+                RestoreTile(layer, tileId);
+            });
+        }
+
+        inline void RestoreTile(FrameBuffer & layer, int tileId)
+        {
+            int x, y, w, h;
+            GetTileRect(tileId, x, y, w, h);
+            frameBuffer->CopyRect(layer, x, y, w, h);
+            gbuffer->CopyRect(staticGBuffer, x, y, w, h);
+        }
+
+        // The lighting pass relights every tile from the G-Buffer, so the static layer keeps the
+        // G-Buffer along with the frame buffer
+        inline void SaveStaticLayer(FrameBuffer & layer)
+        {
+            staticGBuffer.SetSize(gbuffer->GetWidth(), gbuffer->GetHeight());
+            Parallel::For(0, gridWidth*gridHeight, 1, [&](int tileId)
+            {
+                int x, y, w, h;
+                GetTileRect(tileId, x, y, w, h);
+                layer.CopyRect(*frameBuffer, x, y, w, h);
+                staticGBuffer.CopyRect(*gbuffer, x, y, w, h);
+            });
+            if (trackDirtyTiles)
+                dirtyTiles.BeginFrame(&layer, false);
+        }
+
+        inline void RestoreStaticLayer(FrameBuffer & layer)
+        {
+            bool continued = trackDirtyTiles && dirtyTiles.CanContinue();
+            if (!continued)
+            {
+                Parallel::For(0, gridWidth*gridHeight, 1, [&](int tileId)
+                {
+                    RestoreTile(layer, tileId);
+                });
+            }
+            if (trackDirtyTiles)
+                dirtyTiles.BeginFrame(&layer, continued);
+            else
+                dirtyTiles.Invalidate();
+        }
+
+        inline void SetDirtyTileTracking(bool enable)
+        {
+            trackDirtyTiles = enable;
+            dirtyTiles.Invalidate();
+        }
+
+        inline bool GetChangedRegion(List<PixelRect> & rects)
+        {
+            List<int> tiles;
+            rects.Clear();
+            if (!dirtyTiles.GetChangedTiles(tiles))
+                return false;
+            for (int tileId : tiles)
+            {
+                PixelRect rect;
+                GetTileRect(tileId, rect.X, rect.Y, rect.Width, rect.Height);
+                rects.Add(rect);
+            }
+            return true;
+        }
+
+        inline int GetMemorySize()
+        {
+            size_t size = 0;
+            auto addBins = [&](const vector<vector<TiledTriangle>> & bins)
+            {
+                size += bins.capacity() * sizeof(vector<TiledTriangle>);
+                for (auto & bin : bins)
+                    size += bin.capacity() * sizeof(TiledTriangle);
+            };
+            addBins(tileBins);
+            for (int threadId = 0; threadId < Cores; threadId++)
+                addBins(localTileBins[threadId]);
+            return (int)size + (gbuffer ? gbuffer->GetMemorySize() : 0) + staticGBuffer.GetMemorySize();
         }
 
         inline void BinTriangles(RenderState & state, ProjectedTriangleInput & input, int vertexOutputSize, int threadId)
@@ -183,6 +282,11 @@ namespace RasterRenderer
             static __m128i xOffset = _mm_set_epi32(24, 8, 24, 8);
             static __m128i yOffset = _mm_set_epi32(24, 24, 8, 8);
             
+            if (tileBins[tileId].empty())
+                return;
+            if (FrameBuffer * layer = dirtyTiles.Draw(tileId))
+                RestoreTile(*layer, tileId);
+            
             // Store original shader
             Shader* originalShader = state.Shader;
             if (!geometryShader.Ptr())
@@ -409,7 +513,7 @@ namespace RasterRenderer
                     }
                     
                     // Process each light
-                    for (int lightIdx = 0; lightIdx < lightCount; lightIdx++) {
+                    auto shadeLight = [&](int lightIdx) {
                         const ForwardLightingShader::Light& light = lights[lightIdx];
                         
                         Vec3 lightDir;
@@ -491,7 +595,22 @@ namespace RasterRenderer
                         color.y += light.Color.y * light.Ambient;
                         color.z += light.Color.z * light.Ambient;
                     }
-                }
+                };
+
+                    if (lightGrid) {
+                        // only the lights of this pixel's cluster can contribute
+                        ClusterRange range;
+                        lightGrid->GetPointRange(range, worldPos);
+                        lightGrid->ForEachLight(range, [&](int slot)
+                        {
+                            int lightIdx = lightSlotSource[slot];
+                            if (lightIdx != -1)
+                                shadeLight(lightIdx);
+                        });
+                    } else {
+                        for (int lightIdx = 0; lightIdx < lightCount; lightIdx++)
+                            shadeLight(lightIdx);
+                    }
                     
                     // Clamp and write to framebuffer
                     color.x = fminf(1.0f, fmaxf(0.0f, color.x));
@@ -535,12 +654,18 @@ namespace RasterRenderer
                 lightingShader->cameraPosition = cameraPosition;
                 lightingShader->shininess = forwardShader->Shininess;
                 lightingShader->specularColor = forwardShader->SpecularColor;
+
+                // Light grid is built by RendererImplBase::Draw for the current frame
+                lightGrid = forwardShader->IsLightGridActive() ? &forwardShader->LightGrid : nullptr;
+                lightSlotSource = forwardShader->Packed.SourceIndex.Buffer();
             }
             else
             {
                 // No lights - skip lighting pass
                 lights = nullptr;
                 lightCount = 0;
+                lightGrid = nullptr;
+                lightSlotSource = nullptr;
             }
             
             // Clear bins
@@ -581,9 +706,11 @@ namespace RasterRenderer
             // Only do lighting pass if we have lights
             if (lightCount > 0 && lights != nullptr)
             {
+                // over a static layer, tiles no draw of this frame reached are still lit
                 Parallel::For(0, gridWidth*gridHeight, 1, [&](int tileId)
                 {
-                    ProcessBinLightingPass(state, tileId);
+                    if (dirtyTiles.IsDrawn(tileId))
+                        ProcessBinLightingPass(state, tileId);
                 });
             }
         }
@@ -0,0 +1,114 @@
+#ifndef RASTER_RENDERER_DIRTY_TILES_H
+#define RASTER_RENDERER_DIRTY_TILES_H
+
+#include "CoreLib/Basic.h"
+#include "FrameBuffer.h"
+
+namespace RasterRenderer
+{
+    using namespace CoreLib::Basic;
+
+    // Tiles drawn into by the current and the previous frame of a frame buffer, for tiled renderers
+    // that draw frames over a static layer (see IRasterRenderer::SetDirtyTileTracking).
+    //
+    // Outside the tiles the previous frame drew into, the frame buffer still holds the static
+    // layer, so a frame does not restore the whole layer: a tile gets it back when the frame first
+    // draws into it (Draw), or at the end of the frame if the previous frame drew into it and this
+    // one did not (EndFrame). Every other tile is left as it is. A tile is processed by one task
+    // at a time, so the flags need no locks.
+    class DirtyTileSet
+    {
+    private:
+        List<unsigned char> drawn, drawnBefore;
+        bool overStaticLayer; // the frame buffer holds the static layer outside drawnBefore
+        bool allChanged;      // the last frame did not start from the frame before it
+        FrameBuffer * staticLayer; // the layer of the frame being drawn, null if it is not tracked
+    public:
+        DirtyTileSet()
+            : overStaticLayer(false), allChanged(true), staticLayer(nullptr)
+        {}
+        void SetTileCount(int count)
+        {
+            drawn.SetSize(count);
+            drawnBefore.SetSize(count);
+            Invalidate();
+        }
+        // The frame buffer was cleared or replaced
+        void Invalidate()
+        {
+            overStaticLayer = false;
+            allChanged = true;
+            staticLayer = nullptr;
+        }
+        // Whether the frame buffer holds the last tracked frame, so that a frame can start from it
+        bool CanContinue() const
+        {
+            return overStaticLayer;
+        }
+        // Starts tracking the draws of a frame over layer. Unless continued is set, the frame buffer
+        // holds just the layer, as after restoring or saving it.
+        void BeginFrame(FrameBuffer * layer, bool continued)
+        {
+            if (!continued)
+            {
+                for (int i = 0; i < drawnBefore.Count(); i++)
+                    drawnBefore[i] = 0;
+                allChanged = true;
+            }
+            else
+                allChanged = false;
+            for (int i = 0; i < drawn.Count(); i++)
+                drawn[i] = 0;
+            staticLayer = layer;
+        }
+        // Records a draw into the tile; returns the static layer if the tile must be restored from
+        // it first, else null
+        FrameBuffer * Draw(int tile)
+        {
+            if (!staticLayer || drawn[tile])
+                return nullptr;
+            drawn[tile] = 1;
+            return drawnBefore[tile] ? staticLayer : nullptr;
+        }
+        bool IsDrawn(int tile) const
+        {
+            return !staticLayer || drawn[tile] != 0;
+        }
+        // Ends the frame; restoreTile(tile, layer) is called for the tiles only the previous frame
+        // drew into
+        template<typename RestoreFunc>
+        void EndFrame(const RestoreFunc & restoreTile)
+        {
+            if (!staticLayer)
+                return;
+            Parallel::For(0, drawn.Count(), 16, [&](int tile)
+            {
+                if (drawnBefore[tile] && !drawn[tile])
+                    restoreTile(tile, *staticLayer);
+            });
+            // the changed tiles stay in drawnBefore | drawn until the next frame begins
+            for (int i = 0; i < drawn.Count(); i++)
+            {
+                unsigned char changed = drawnBefore[i] | drawn[i];
+                drawnBefore[i] = drawn[i];
+                drawn[i] = changed;
+            }
+            overStaticLayer = true;
+            staticLayer = nullptr;
+        }
+        // Tiles the last frame changed relative to the frame before it; false if it may have
+        // changed any tile
+        bool GetChangedTiles(List<int> & tiles) const
+        {
+            tiles.Clear();
+            if (allChanged || !overStaticLayer)
+                return false;
+            for (int i = 0; i < drawn.Count(); i++)
+                if (drawn[i])
+                    tiles.Add(i);
+            return true;
+        }
+    };
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "Shader.h"
 #include "RenderState.h"
+#include "LightCluster.h"
 #include "CoreLib/VectorMath.h"
 #include <immintrin.h>
 
@@ -10,6 +11,74 @@ namespace RasterRenderer
 {
     using namespace VectorMath;
 
+    // Per-fragment lighting kernel used by ForwardLightingShader
+    //   Reference:     original loop over the Light array, branching on the light type
+    //   FragmentLanes: packed lights, one light broadcast against the 4 fragments of a quad
+    //   LightLanes:    packed lights, 4 lights at a time against one fragment
+    enum class LightKernel
+    {
+        Reference, FragmentLanes, LightLanes
+    };
+
+    // Structure-of-arrays copy of a light list, grouped by light type. Each group
+    // starts on a multiple of 4 and is padded with null lights (zero color) so that
+    // the light-lane kernel can use aligned loads without a remainder loop.
+    struct PackedLights
+    {
+        typedef List<float, AlignedAllocator<16>> FloatArray;
+        FloatArray PosX, PosY, PosZ;
+        FloatArray DirX, DirY, DirZ;                // negated light direction
+        FloatArray DiffuseR, DiffuseG, DiffuseB;    // Color * (1 - Ambient)
+        FloatArray SpecularR, SpecularG, SpecularB; // SpecularColor * Color * Intensity
+        FloatArray InvDecay;                        // 0 when the light does not decay
+        FloatArray ConeOuter, InvConeRange;
+        List<int> SourceIndex;                      // index into the Light array, -1 for padding
+        int DirectionalBegin, DirectionalEnd;
+        int PointBegin, PointEnd;
+        int SpotBegin, SpotEnd;
+        int NullLight;                              // first slot of a block of 4 null lights
+
+        PackedLights()
+        {
+            DirectionalBegin = DirectionalEnd = PointBegin = PointEnd = SpotBegin = SpotEnd = 0;
+            NullLight = 0;
+        }
+        inline int Count() const
+        {
+            return SourceIndex.Count();
+        }
+        void Clear()
+        {
+            PosX.Clear(); PosY.Clear(); PosZ.Clear();
+            DirX.Clear(); DirY.Clear(); DirZ.Clear();
+            DiffuseR.Clear(); DiffuseG.Clear(); DiffuseB.Clear();
+            SpecularR.Clear(); SpecularG.Clear(); SpecularB.Clear();
+            InvDecay.Clear(); ConeOuter.Clear(); InvConeRange.Clear();
+            SourceIndex.Clear();
+        }
+        void Add(int sourceIndex, const Vec3 & pos, const Vec3 & dir, const Vec3 & diffuse, const Vec3 & specular,
+            float invDecay, float coneOuter, float invConeRange)
+        {
+            PosX.Add(pos.x); PosY.Add(pos.y); PosZ.Add(pos.z);
+            DirX.Add(dir.x); DirY.Add(dir.y); DirZ.Add(dir.z);
+            DiffuseR.Add(diffuse.x); DiffuseG.Add(diffuse.y); DiffuseB.Add(diffuse.z);
+            SpecularR.Add(specular.x); SpecularG.Add(specular.y); SpecularB.Add(specular.z);
+            InvDecay.Add(invDecay); ConeOuter.Add(coneOuter); InvConeRange.Add(invConeRange);
+            SourceIndex.Add(sourceIndex);
+        }
+        void AddNullLight()
+        {
+            // far away along +z so that point/spot math stays finite
+            Add(-1, Vec3(0.0f, 0.0f, 1e18f), Vec3(0.0f, 0.0f, 1.0f), Vec3(0.0f, 0.0f, 0.0f), Vec3(0.0f, 0.0f, 0.0f),
+                0.0f, -2.0f, 0.0f);
+        }
+        void PadToQuad()
+        {
+            while (Count() & 3)
+                AddNullLight();
+        }
+    };
+
     // Forward lighting shader with Blinn-Phong specular highlights
     // Supports point lights, directional lights, and spot lights
     class ForwardLightingShader : public DefaultShader
@@ -36,142 +105,449 @@ namespace RasterRenderer
         float Shininess;            // Specular shininess exponent (Blinn-Phong)
         Vec3 SpecularColor;         // Specular color (usually white or material color)
 
+        // Lights is repacked into Packed once per frame by the renderer (see UpdateLights).
+        // Code that edits Lights after that calls InvalidateLights, which sends shading back
+        // to the Lights array until the next UpdateLights.
+        // When culling is enabled, fragments only evaluate the lights listed in their
+        // cluster; the grid is indexed by packed slot, not by Lights index.
+        LightKernel Kernel;
+        LightCullingMode LightCulling;
+        LightClusterGrid LightGrid;
+        PackedLights Packed;
+        Vec3 AmbientSum;            // sum of all lights' ambient terms, in light order
+
         ForwardLightingShader()
         {
             CameraPosition = Vec3(0.0f, 0.0f, 0.0f);
             Shininess = 32.0f;
             SpecularColor = Vec3(0.5f, 0.5f, 0.5f);
+            Kernel = LightKernel::FragmentLanes;
+            LightCulling = LightCullingMode::Clustered;
+            AmbientSum = Vec3(0.0f, 0.0f, 0.0f);
+            packedSourceCount = -1;
+            lightsVersion = packedVersion = 0;
         }
 
-        virtual void ShadeFragment(RenderState & state, float * output, __m128 * input, int id)
+        // Bounding sphere of a light's influence; radius 0 means unbounded
+        static inline Vec4 GetLightBounds(const Light & light)
         {
-            // input layout (from DefaultShader::ComputeVertex):
-            // input[0-3]:   Clip space position (not used in fragment shader)
-            // input[4-6]:   World-space normal (interpolated)
-            // input[7-9]:   World-space position (view space in current code, but we treat as world)
-            // input[10-11]: UV coordinates
+            if (light.LightType == Light::DIRECTIONAL || light.Decay <= 0.01f)
+                return Vec4(light.Position, 0.0f);
+            return Vec4(light.Position, light.Decay);
+        }
+
+        // Repacks Lights into Packed and, if culling is enabled, rebuilds the light grid
+        // for the current projection
+        void UpdateLights(RenderState & state)
+        {
+            AmbientSum = Vec3(0.0f, 0.0f, 0.0f);
+            for (auto & light : Lights)
+            {
+                AmbientSum.x += light.Color.x * light.Ambient;
+                AmbientSum.y += light.Color.y * light.Ambient;
+                AmbientSum.z += light.Color.z * light.Ambient;
+            }
+
+            // stable partition by type, so lights of one type keep their relative order
+            Packed.Clear();
+            auto packGroup = [&](Light::Type type, int & begin, int & end)
+            {
+                begin = Packed.Count();
+                for (int i = 0; i < Lights.Count(); i++)
+                {
+                    auto & light = Lights[i];
+                    if (light.LightType != type)
+                        continue;
+                    Vec3 diffuse = light.Color * (1.0f - light.Ambient);
+                    Vec3 specular = Vec3(SpecularColor.x * light.Color.x, SpecularColor.y * light.Color.y,
+                        SpecularColor.z * light.Color.z) * light.Intensity;
+                    float invDecay = light.Decay > 0.01f ? 1.0f / light.Decay : 0.0f;
+                    float invConeRange = 1.0f / (light.InnerConeAngle - light.OuterConeAngle);
+                    Packed.Add(i, light.Position, -light.Direction, diffuse, specular, invDecay,
+                        light.OuterConeAngle, invConeRange);
+                }
+                end = Packed.Count();
+                Packed.PadToQuad();
+            };
+            packGroup(Light::DIRECTIONAL, Packed.DirectionalBegin, Packed.DirectionalEnd);
+            packGroup(Light::POINT, Packed.PointBegin, Packed.PointEnd);
+            packGroup(Light::SPOT, Packed.SpotBegin, Packed.SpotEnd);
+            Packed.NullLight = Packed.Count();
+            for (int i = 0; i < 4; i++)
+                Packed.AddNullLight();
+            packedSourceCount = Lights.Count();
+            packedVersion = lightsVersion;
+
+            if (LightCulling == LightCullingMode::None)
+                return;
+            lightBounds.SetSize(Packed.Count());
+            for (int i = 0; i < Packed.Count(); i++)
+            {
+                int source = Packed.SourceIndex[i];
+                lightBounds[i] = source == -1 ? Vec4(0.0f, 0.0f, 0.0f, -1.0f) : GetLightBounds(Lights[source]);
+            }
+            LightGrid.Build(lightBounds.Buffer(), lightBounds.Count(), state.ProjectionTransform,
+                state.ViewportWidth, state.ViewportHeight, LightCulling);
+        }
+
+        // Marks Packed and the light grid stale after an edit of Lights
+        inline void InvalidateLights()
+        {
+            lightsVersion++;
+        }
+
+        // Lights added without InvalidateLights still change the count
+        inline bool IsPackedValid() const
+        {
+            return packedVersion == lightsVersion && packedSourceCount == Lights.Count();
+        }
+
+        inline bool IsLightGridActive() const
+        {
+            return LightCulling != LightCullingMode::None && IsPackedValid() && LightGrid.IsValid() &&
+                LightGrid.GetLightCount() == Packed.Count();
+        }
+
+    private:
+        struct SurfaceSIMD
+        {
+            __m128 NormalX, NormalY, NormalZ;
+            __m128 PosX, PosY, PosZ;
+            __m128 ViewX, ViewY, ViewZ;
+        };
+        struct LightSIMD
+        {
+            __m128 PosX, PosY, PosZ;
+            __m128 DirX, DirY, DirZ;
+            __m128 DiffuseR, DiffuseG, DiffuseB;
+            __m128 SpecularR, SpecularG, SpecularB;
+            __m128 InvDecay, ConeOuter, InvConeRange;
+        };
+        // Shininess as a SIMD exponent. Integer exponents are evaluated exactly by square-and-
+        // multiply (5 multiplies for the default 32), anything else falls back to the fixed
+        // cost exp2(y * log2(x)). Bases whose power would drop below 2^-100 are flushed to zero
+        // first: the result is invisible anyway, and the intermediate squares would otherwise
+        // go denormal, which costs far more than the whole light evaluation.
+        struct SpecularExponent
+        {
+            __m128 Value;
+            __m128 Cutoff;
+            int Integer;            // 0 if Shininess is not an integer in [1, 4096]
+        };
+        inline SpecularExponent GetSpecularExponent() const
+        {
+            SpecularExponent e;
+            e.Value = _mm_set1_ps(Shininess);
+            e.Cutoff = _mm_set1_ps(Shininess > 0.0f ? powf(2.0f, -100.0f / Shininess) : 0.0f);
+            e.Integer = (Shininess >= 1.0f && Shininess <= 4096.0f && floorf(Shininess) == Shininess) ? (int)Shininess : 0;
+            return e;
+        }
+        static inline __m128 SpecularPower(__m128 x, const SpecularExponent & e)
+        {
+            x = _mm_and_ps(x, _mm_cmpge_ps(x, e.Cutoff));
+            if (e.Integer == 0)
+                return _mm_pow_ps(x, e.Value);
+            int n = e.Integer;
+            while (!(n & 1))
+            {
+                x = _mm_mul_ps(x, x);
+                n >>= 1;
+            }
+            __m128 result = x;
+            while (n >>= 1)
+            {
+                x = _mm_mul_ps(x, x);
+                if (n & 1)
+                    result = _mm_mul_ps(result, x);
+            }
+            return result;
+        }
+        struct LightingSum
+        {
+            __m128 DiffuseR, DiffuseG, DiffuseB;
+            __m128 SpecularR, SpecularG, SpecularB;
+            LightingSum()
+            {
+                DiffuseR = DiffuseG = DiffuseB = SpecularR = SpecularG = SpecularB = _mm_setzero_ps();
+            }
+        };
+
+        // The light functions below are written entirely in terms of SIMD lanes, so the
+        // same code serves both kernels: with FragmentLanes the lanes are the quad's 4
+        // fragments and the light is broadcast, with LightLanes the lanes are 4 lights
+        // and the fragment is broadcast.
+        inline void BroadcastLight(LightSIMD & l, int slot) const
+        {
+            l.PosX = _mm_set1_ps(Packed.PosX[slot]); l.PosY = _mm_set1_ps(Packed.PosY[slot]); l.PosZ = _mm_set1_ps(Packed.PosZ[slot]);
+            l.DirX = _mm_set1_ps(Packed.DirX[slot]); l.DirY = _mm_set1_ps(Packed.DirY[slot]); l.DirZ = _mm_set1_ps(Packed.DirZ[slot]);
+            l.DiffuseR = _mm_set1_ps(Packed.DiffuseR[slot]); l.DiffuseG = _mm_set1_ps(Packed.DiffuseG[slot]); l.DiffuseB = _mm_set1_ps(Packed.DiffuseB[slot]);
+            l.SpecularR = _mm_set1_ps(Packed.SpecularR[slot]); l.SpecularG = _mm_set1_ps(Packed.SpecularG[slot]); l.SpecularB = _mm_set1_ps(Packed.SpecularB[slot]);
+            l.InvDecay = _mm_set1_ps(Packed.InvDecay[slot]); l.ConeOuter = _mm_set1_ps(Packed.ConeOuter[slot]); l.InvConeRange = _mm_set1_ps(Packed.InvConeRange[slot]);
+        }
+        // slot must be a multiple of 4
+        inline void LoadLights(LightSIMD & l, int slot) const
+        {
+            l.PosX = _mm_load_ps(Packed.PosX.Buffer() + slot); l.PosY = _mm_load_ps(Packed.PosY.Buffer() + slot); l.PosZ = _mm_load_ps(Packed.PosZ.Buffer() + slot);
+            l.DirX = _mm_load_ps(Packed.DirX.Buffer() + slot); l.DirY = _mm_load_ps(Packed.DirY.Buffer() + slot); l.DirZ = _mm_load_ps(Packed.DirZ.Buffer() + slot);
+            l.DiffuseR = _mm_load_ps(Packed.DiffuseR.Buffer() + slot); l.DiffuseG = _mm_load_ps(Packed.DiffuseG.Buffer() + slot); l.DiffuseB = _mm_load_ps(Packed.DiffuseB.Buffer() + slot);
+            l.SpecularR = _mm_load_ps(Packed.SpecularR.Buffer() + slot); l.SpecularG = _mm_load_ps(Packed.SpecularG.Buffer() + slot); l.SpecularB = _mm_load_ps(Packed.SpecularB.Buffer() + slot);
+            l.InvDecay = _mm_load_ps(Packed.InvDecay.Buffer() + slot); l.ConeOuter = _mm_load_ps(Packed.ConeOuter.Buffer() + slot); l.InvConeRange = _mm_load_ps(Packed.InvConeRange.Buffer() + slot);
+        }
+        inline void GatherLights(LightSIMD & l, const int * s) const
+        {
+            #define GATHER_LIGHT_FIELD(field) l.field = _mm_set_ps(Packed.field[s[3]], Packed.field[s[2]], Packed.field[s[1]], Packed.field[s[0]])
+            GATHER_LIGHT_FIELD(PosX); GATHER_LIGHT_FIELD(PosY); GATHER_LIGHT_FIELD(PosZ);
+            GATHER_LIGHT_FIELD(DirX); GATHER_LIGHT_FIELD(DirY); GATHER_LIGHT_FIELD(DirZ);
+            GATHER_LIGHT_FIELD(DiffuseR); GATHER_LIGHT_FIELD(DiffuseG); GATHER_LIGHT_FIELD(DiffuseB);
+            GATHER_LIGHT_FIELD(SpecularR); GATHER_LIGHT_FIELD(SpecularG); GATHER_LIGHT_FIELD(SpecularB);
+            GATHER_LIGHT_FIELD(InvDecay); GATHER_LIGHT_FIELD(ConeOuter); GATHER_LIGHT_FIELD(InvConeRange);
+            #undef GATHER_LIGHT_FIELD
+        }
+        static inline void BroadcastSurface(SurfaceSIMD & dst, const SurfaceSIMD & src, int lane)
+        {
+            CORE_LIB_ALIGN_16(float f[9][4]);
+            const __m128 * vecs = &src.NormalX;
+            __m128 * dstVecs = &dst.NormalX;
+            for (int i = 0; i < 9; i++)
+            {
+                _mm_store_ps(f[i], vecs[i]);
+                dstVecs[i] = _mm_set1_ps(f[i][lane]);
+            }
+        }
+
+        // Diffuse and specular terms given the (unit) direction to the light and its attenuation
+        static inline void AccumulateLight(LightingSum & sum, const SurfaceSIMD & s, const LightSIMD & l,
+            __m128 lightDirX, __m128 lightDirY, __m128 lightDirZ, __m128 attenuation, const SpecularExponent & shininess)
+        {
+            __m128 zero = _mm_setzero_ps();
+            __m128 NdotL = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s.NormalX, lightDirX), _mm_mul_ps(s.NormalY, lightDirY)), _mm_mul_ps(s.NormalZ, lightDirZ));
+            __m128 effectiveLight = _mm_mul_ps(_mm_max_ps(zero, NdotL), attenuation);
+            sum.DiffuseR = _mm_add_ps(sum.DiffuseR, _mm_mul_ps(l.DiffuseR, effectiveLight));
+            sum.DiffuseG = _mm_add_ps(sum.DiffuseG, _mm_mul_ps(l.DiffuseG, effectiveLight));
+            sum.DiffuseB = _mm_add_ps(sum.DiffuseB, _mm_mul_ps(l.DiffuseB, effectiveLight));
 
+            // Blinn-Phong: H = normalize(L + V)
+            __m128 halfX = _mm_add_ps(lightDirX, s.ViewX);
+            __m128 halfY = _mm_add_ps(lightDirY, s.ViewY);
+            __m128 halfZ = _mm_add_ps(lightDirZ, s.ViewZ);
+            __m128 halfLen2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(halfX, halfX), _mm_mul_ps(halfY, halfY)), _mm_mul_ps(halfZ, halfZ));
+            __m128 invHalfLen = _mm_rsqrt_ps(halfLen2);
+            __m128 NdotH = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s.NormalX, halfX), _mm_mul_ps(s.NormalY, halfY)), _mm_mul_ps(s.NormalZ, halfZ)), invHalfLen);
+            __m128 specular = _mm_mul_ps(SpecularPower(_mm_max_ps(zero, NdotH), shininess), effectiveLight);
+            sum.SpecularR = _mm_add_ps(sum.SpecularR, _mm_mul_ps(l.SpecularR, specular));
+            sum.SpecularG = _mm_add_ps(sum.SpecularG, _mm_mul_ps(l.SpecularG, specular));
+            sum.SpecularB = _mm_add_ps(sum.SpecularB, _mm_mul_ps(l.SpecularB, specular));
+        }
+        static inline void ShadeDirectional(LightingSum & sum, const SurfaceSIMD & s, const LightSIMD & l, const SpecularExponent & shininess)
+        {
+            AccumulateLight(sum, s, l, l.DirX, l.DirY, l.DirZ, _mm_set1_ps(1.0f), shininess);
+        }
+        template<bool spot>
+        static inline void ShadeLocal(LightingSum & sum, const SurfaceSIMD & s, const LightSIMD & l, const SpecularExponent & shininess)
+        {
             __m128 zero = _mm_setzero_ps();
             __m128 one = _mm_set1_ps(1.0f);
-            
-            // Accumulate lighting contributions
-            __m128 sumDiffuseR = zero, sumDiffuseG = zero, sumDiffuseB = zero;
-            __m128 sumSpecularR = zero, sumSpecularG = zero, sumSpecularB = zero;
-            __m128 ambientR = zero, ambientG = zero, ambientB = zero;
+            __m128 lightX = _mm_sub_ps(l.PosX, s.PosX);
+            __m128 lightY = _mm_sub_ps(l.PosY, s.PosY);
+            __m128 lightZ = _mm_sub_ps(l.PosZ, s.PosZ);
+            __m128 lightLen2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lightX, lightX), _mm_mul_ps(lightY, lightY)), _mm_mul_ps(lightZ, lightZ));
+            // rsqrt refined by one Newton-Raphson step instead of sqrt + div
+            __m128 invLightLen = _mm_rsqrt_ps(lightLen2);
+            invLightLen = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), invLightLen),
+                _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_mul_ps(lightLen2, invLightLen), invLightLen)));
+            __m128 lightLen = _mm_mul_ps(lightLen2, invLightLen);
+            __m128 lightDirX = _mm_mul_ps(lightX, invLightLen);
+            __m128 lightDirY = _mm_mul_ps(lightY, invLightLen);
+            __m128 lightDirZ = _mm_mul_ps(lightZ, invLightLen);
+            // InvDecay == 0 gives attenuation 1 for lights without decay
+            __m128 attenuation = _mm_max_ps(zero, _mm_sub_ps(one, _mm_mul_ps(lightLen, l.InvDecay)));
+            if (spot)
+            {
+                __m128 spotDot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lightDirX, l.DirX), _mm_mul_ps(lightDirY, l.DirY)), _mm_mul_ps(lightDirZ, l.DirZ));
+                __m128 coneFactor = _mm_mul_ps(_mm_sub_ps(spotDot, l.ConeOuter), l.InvConeRange);
+                attenuation = _mm_mul_ps(attenuation, _mm_max_ps(zero, _mm_min_ps(one, coneFactor)));
+            }
+            AccumulateLight(sum, s, l, lightDirX, lightDirY, lightDirZ, attenuation, shininess);
+        }
 
-            // Normalize normal (input[4-6])
-            __m128 nx2 = _mm_mul_ps(input[4], input[4]);
-            __m128 ny2 = _mm_mul_ps(input[5], input[5]);
-            __m128 nz2 = _mm_mul_ps(input[6], input[6]);
-            __m128 normalLen = _mm_rsqrt_ps(_mm_add_ps(_mm_add_ps(nx2, ny2), nz2));
-            __m128 normalX = _mm_mul_ps(input[4], normalLen);
-            __m128 normalY = _mm_mul_ps(input[5], normalLen);
-            __m128 normalZ = _mm_mul_ps(input[6], normalLen);
+        // 4 fragments per lane group, one light at a time; each light type in its own loop
+        void ShadeFragmentLanes(LightingSum & sum, const SurfaceSIMD & s, const ClusterRange * range)
+        {
+            SpecularExponent shininess = GetSpecularExponent();
+            LightSIMD l;
+            if (range)
+            {
+                LightGrid.ForEachLight(*range, Packed.DirectionalBegin, Packed.DirectionalEnd, [&](int slot)
+                {
+                    BroadcastLight(l, slot);
+                    ShadeDirectional(sum, s, l, shininess);
+                });
+                LightGrid.ForEachLight(*range, Packed.PointBegin, Packed.PointEnd, [&](int slot)
+                {
+                    BroadcastLight(l, slot);
+                    ShadeLocal<false>(sum, s, l, shininess);
+                });
+                LightGrid.ForEachLight(*range, Packed.SpotBegin, Packed.SpotEnd, [&](int slot)
+                {
+                    BroadcastLight(l, slot);
+                    ShadeLocal<true>(sum, s, l, shininess);
+                });
+                return;
+            }
+            for (int i = Packed.DirectionalBegin; i < Packed.DirectionalEnd; i++)
+            {
+                BroadcastLight(l, i);
+                ShadeDirectional(sum, s, l, shininess);
+            }
+            for (int i = Packed.PointBegin; i < Packed.PointEnd; i++)
+            {
+                BroadcastLight(l, i);
+                ShadeLocal<false>(sum, s, l, shininess);
+            }
+            for (int i = Packed.SpotBegin; i < Packed.SpotEnd; i++)
+            {
+                BroadcastLight(l, i);
+                ShadeLocal<true>(sum, s, l, shininess);
+            }
+        }
 
-            // Calculate view direction (from fragment to camera)
-            __m128 viewX = _mm_sub_ps(_mm_set1_ps(CameraPosition.x), input[7]);
-            __m128 viewY = _mm_sub_ps(_mm_set1_ps(CameraPosition.y), input[8]);
-            __m128 viewZ = _mm_sub_ps(_mm_set1_ps(CameraPosition.z), input[9]);
-            __m128 viewLen2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(viewX, viewX), _mm_mul_ps(viewY, viewY)), _mm_mul_ps(viewZ, viewZ));
-            __m128 viewLen = _mm_sqrt_ps(viewLen2);
-            __m128 invViewLen = _mm_div_ps(one, viewLen);
-            viewX = _mm_mul_ps(viewX, invViewLen);
-            viewY = _mm_mul_ps(viewY, invViewLen);
-            viewZ = _mm_mul_ps(viewZ, invViewLen);
+        // 4 lights per lane group against each fragment of the quad in turn. Without culling
+        // the padded groups are read with aligned loads; with culling the cluster's lights
+        // are gathered 4 at a time and the last batch is filled with null lights.
+        template<int type>
+        inline void ShadeLightBatch(LightingSum * sums, const SurfaceSIMD * s, const LightSIMD & l, const SpecularExponent & shininess)
+        {
+            for (int f = 0; f < 4; f++)
+            {
+                if (type == Light::DIRECTIONAL)
+                    ShadeDirectional(sums[f], s[f], l, shininess);
+                else
+                    ShadeLocal<type == Light::SPOT>(sums[f], s[f], l, shininess);
+            }
+        }
+        template<int type>
+        inline void ShadeLightGroup(LightingSum * sums, const SurfaceSIMD * s, int begin, int end, const ClusterRange * range, const SpecularExponent & shininess)
+        {
+            LightSIMD l;
+            if (!range)
+            {
+                for (int i = begin; i < end; i += 4)
+                {
+                    LoadLights(l, i);
+                    ShadeLightBatch<type>(sums, s, l, shininess);
+                }
+                return;
+            }
+            int batch[4];
+            int batchSize = 0;
+            LightGrid.ForEachLight(*range, begin, end, [&](int slot)
+            {
+                batch[batchSize++] = slot;
+                if (batchSize == 4)
+                {
+                    GatherLights(l, batch);
+                    ShadeLightBatch<type>(sums, s, l, shininess);
+                    batchSize = 0;
+                }
+            });
+            if (batchSize)
+            {
+                for (int i = batchSize; i < 4; i++)
+                    batch[i] = Packed.NullLight;
+                GatherLights(l, batch);
+                ShadeLightBatch<type>(sums, s, l, shininess);
+            }
+        }
+        static inline float HorizontalSum(__m128 v)
+        {
+            CORE_LIB_ALIGN_16(float f[4]);
+            _mm_store_ps(f, v);
+            return (f[0] + f[1]) + (f[2] + f[3]);
+        }
+        void ShadeLightLanes(LightingSum & sum, const SurfaceSIMD & quad, const ClusterRange * range)
+        {
+            SpecularExponent shininess = GetSpecularExponent();
+            SurfaceSIMD s[4];
+            LightingSum sums[4];
+            for (int f = 0; f < 4; f++)
+                BroadcastSurface(s[f], quad, f);
+            ShadeLightGroup<Light::DIRECTIONAL>(sums, s, Packed.DirectionalBegin, Packed.DirectionalEnd, range, shininess);
+            ShadeLightGroup<Light::POINT>(sums, s, Packed.PointBegin, Packed.PointEnd, range, shininess);
+            ShadeLightGroup<Light::SPOT>(sums, s, Packed.SpotBegin, Packed.SpotEnd, range, shininess);
+            #define REDUCE_LIGHT_SUM(field) sum.field = _mm_set_ps(HorizontalSum(sums[3].field), HorizontalSum(sums[2].field), HorizontalSum(sums[1].field), HorizontalSum(sums[0].field))
+            REDUCE_LIGHT_SUM(DiffuseR); REDUCE_LIGHT_SUM(DiffuseG); REDUCE_LIGHT_SUM(DiffuseB);
+            REDUCE_LIGHT_SUM(SpecularR); REDUCE_LIGHT_SUM(SpecularG); REDUCE_LIGHT_SUM(SpecularB);
+            #undef REDUCE_LIGHT_SUM
+        }
 
-            // Process each light
+        // The original kernel: loops over Lights and branches on the light type per light.
+        // Kept as the baseline for benchmarks and as the fallback before lights are packed.
+        void ShadeReference(LightingSum & sum, __m128 & ambientR, __m128 & ambientG, __m128 & ambientB, const SurfaceSIMD & s)
+        {
+            __m128 zero = _mm_setzero_ps();
+            __m128 one = _mm_set1_ps(1.0f);
             for (auto &light : Lights)
             {
                 __m128 lightDirX, lightDirY, lightDirZ;
                 __m128 attenuation = one;
-                __m128 spotFactor = one;
 
                 if (light.LightType == Light::DIRECTIONAL)
                 {
-                    // Directional light: direction is constant
                     lightDirX = _mm_set1_ps(-light.Direction.x);
                     lightDirY = _mm_set1_ps(-light.Direction.y);
                     lightDirZ = _mm_set1_ps(-light.Direction.z);
-                    attenuation = one; // No attenuation for directional lights
                 }
                 else
                 {
-                    // Point or spot light: calculate direction from position
-                    __m128 lightX = _mm_sub_ps(_mm_set1_ps(light.Position.x), input[7]);
-                    __m128 lightY = _mm_sub_ps(_mm_set1_ps(light.Position.y), input[8]);
-                    __m128 lightZ = _mm_sub_ps(_mm_set1_ps(light.Position.z), input[9]);
-                    
+                    __m128 lightX = _mm_sub_ps(_mm_set1_ps(light.Position.x), s.PosX);
+                    __m128 lightY = _mm_sub_ps(_mm_set1_ps(light.Position.y), s.PosY);
+                    __m128 lightZ = _mm_sub_ps(_mm_set1_ps(light.Position.z), s.PosZ);
                     __m128 lightLen2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lightX, lightX), _mm_mul_ps(lightY, lightY)), _mm_mul_ps(lightZ, lightZ));
                     __m128 lightLen = _mm_sqrt_ps(lightLen2);
                     __m128 invLightLen = _mm_div_ps(one, lightLen);
-                    
                     lightDirX = _mm_mul_ps(lightX, invLightLen);
                     lightDirY = _mm_mul_ps(lightY, invLightLen);
                     lightDirZ = _mm_mul_ps(lightZ, invLightLen);
 
                     // Distance attenuation for point lights
                     if (light.Decay > 0.01f)
-                    {
                         attenuation = _mm_max_ps(zero, _mm_sub_ps(one, _mm_div_ps(lightLen, _mm_set_ps1(light.Decay))));
-                    }
 
                     // Spot light cone
                     if (light.LightType == Light::SPOT)
                     {
-                        __m128 spotDirX = _mm_set1_ps(-light.Direction.x);
-                        __m128 spotDirY = _mm_set1_ps(-light.Direction.y);
-                        __m128 spotDirZ = _mm_set1_ps(-light.Direction.z);
-                        
-                        __m128 spotDot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lightDirX, spotDirX), _mm_mul_ps(lightDirY, spotDirY)), _mm_mul_ps(lightDirZ, spotDirZ));
-                        __m128 innerCone = _mm_set1_ps(light.InnerConeAngle);
+                        __m128 spotDot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lightDirX, _mm_set1_ps(-light.Direction.x)),
+                            _mm_mul_ps(lightDirY, _mm_set1_ps(-light.Direction.y))), _mm_mul_ps(lightDirZ, _mm_set1_ps(-light.Direction.z)));
                         __m128 outerCone = _mm_set1_ps(light.OuterConeAngle);
-                        
-                        // Smooth falloff from inner to outer cone
-                        __m128 coneRange = _mm_sub_ps(innerCone, outerCone);
+                        __m128 coneRange = _mm_sub_ps(_mm_set1_ps(light.InnerConeAngle), outerCone);
                         __m128 coneFactor = _mm_div_ps(_mm_sub_ps(spotDot, outerCone), coneRange);
-                        spotFactor = _mm_max_ps(zero, _mm_min_ps(one, coneFactor));
-                        attenuation = _mm_mul_ps(attenuation, spotFactor);
+                        attenuation = _mm_mul_ps(attenuation, _mm_max_ps(zero, _mm_min_ps(one, coneFactor)));
                     }
                 }
 
                 // Diffuse lighting: N·L
-                __m128 NdotL = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normalX, lightDirX), _mm_mul_ps(normalY, lightDirY)), _mm_mul_ps(normalZ, lightDirZ));
-                NdotL = _mm_max_ps(zero, NdotL);
-
-                // Apply attenuation
-                __m128 effectiveLight = _mm_mul_ps(NdotL, attenuation);
-
-                // Diffuse contribution
+                __m128 NdotL = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s.NormalX, lightDirX), _mm_mul_ps(s.NormalY, lightDirY)), _mm_mul_ps(s.NormalZ, lightDirZ));
+                __m128 effectiveLight = _mm_mul_ps(_mm_max_ps(zero, NdotL), attenuation);
                 __m128 diffuseContrib = _mm_mul_ps(effectiveLight, _mm_set_ps1(1.0f - light.Ambient));
-                sumDiffuseR = _mm_add_ps(sumDiffuseR, _mm_mul_ps(_mm_set1_ps(light.Color.x), diffuseContrib));
-                sumDiffuseG = _mm_add_ps(sumDiffuseG, _mm_mul_ps(_mm_set1_ps(light.Color.y), diffuseContrib));
-                sumDiffuseB = _mm_add_ps(sumDiffuseB, _mm_mul_ps(_mm_set1_ps(light.Color.z), diffuseContrib));
-
-                // Specular lighting: Blinn-Phong (N·H)^shininess
-                // Half-vector H = normalize(L + V)
-                __m128 halfX = _mm_add_ps(lightDirX, viewX);
-                __m128 halfY = _mm_add_ps(lightDirY, viewY);
-                __m128 halfZ = _mm_add_ps(lightDirZ, viewZ);
-                
+                sum.DiffuseR = _mm_add_ps(sum.DiffuseR, _mm_mul_ps(_mm_set1_ps(light.Color.x), diffuseContrib));
+                sum.DiffuseG = _mm_add_ps(sum.DiffuseG, _mm_mul_ps(_mm_set1_ps(light.Color.y), diffuseContrib));
+                sum.DiffuseB = _mm_add_ps(sum.DiffuseB, _mm_mul_ps(_mm_set1_ps(light.Color.z), diffuseContrib));
+
+                // Specular lighting: Blinn-Phong (N·H)^shininess, H = normalize(L + V)
+                __m128 halfX = _mm_add_ps(lightDirX, s.ViewX);
+                __m128 halfY = _mm_add_ps(lightDirY, s.ViewY);
+                __m128 halfZ = _mm_add_ps(lightDirZ, s.ViewZ);
                 __m128 halfLen2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(halfX, halfX), _mm_mul_ps(halfY, halfY)), _mm_mul_ps(halfZ, halfZ));
                 __m128 halfLen = _mm_rsqrt_ps(halfLen2);
-                
                 halfX = _mm_mul_ps(halfX, halfLen);
                 halfY = _mm_mul_ps(halfY, halfLen);
                 halfZ = _mm_mul_ps(halfZ, halfLen);
-
-                // N·H
-                __m128 NdotH = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normalX, halfX), _mm_mul_ps(normalY, halfY)), _mm_mul_ps(normalZ, halfZ));
+                __m128 NdotH = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s.NormalX, halfX), _mm_mul_ps(s.NormalY, halfY)), _mm_mul_ps(s.NormalZ, halfZ));
                 NdotH = _mm_max_ps(zero, NdotH);
 
-                // (N·H)^shininess using fast approximation
-                // For integer shininess, we can use repeated multiplication
-                // For now, use pow approximation
-                __m128 shininessVec = _mm_set1_ps(Shininess);
+                // Approximate power function: repeated squaring, i.e. the exponent is
+                // rounded up to a power of two
                 __m128 specularPower = NdotH;
-                
-                // Approximate power function (for performance)
-                // For shininess = 32, we can use: x^32 ≈ (x^2)^16
                 if (Shininess >= 16.0f)
                 {
                     specularPower = _mm_mul_ps(specularPower, specularPower); // x^2
@@ -183,25 +559,87 @@ namespace RasterRenderer
                 }
                 else
                 {
-                    // For smaller shininess, use fewer multiplications
                     int powCount = (int)Shininess;
                     for (int i = 1; i < powCount; i *= 2)
-                    {
                         specularPower = _mm_mul_ps(specularPower, specularPower);
-                    }
                 }
 
-                // Specular contribution
                 __m128 specularContrib = _mm_mul_ps(_mm_mul_ps(specularPower, effectiveLight), _mm_set_ps1(light.Intensity));
-                sumSpecularR = _mm_add_ps(sumSpecularR, _mm_mul_ps(_mm_set1_ps(SpecularColor.x * light.Color.x), specularContrib));
-                sumSpecularG = _mm_add_ps(sumSpecularG, _mm_mul_ps(_mm_set1_ps(SpecularColor.y * light.Color.y), specularContrib));
-                sumSpecularB = _mm_add_ps(sumSpecularB, _mm_mul_ps(_mm_set1_ps(SpecularColor.z * light.Color.z), specularContrib));
+                sum.SpecularR = _mm_add_ps(sum.SpecularR, _mm_mul_ps(_mm_set1_ps(SpecularColor.x * light.Color.x), specularContrib));
+                sum.SpecularG = _mm_add_ps(sum.SpecularG, _mm_mul_ps(_mm_set1_ps(SpecularColor.y * light.Color.y), specularContrib));
+                sum.SpecularB = _mm_add_ps(sum.SpecularB, _mm_mul_ps(_mm_set1_ps(SpecularColor.z * light.Color.z), specularContrib));
 
                 // Ambient contribution
                 ambientR = _mm_add_ps(ambientR, _mm_set1_ps(light.Color.x * light.Ambient));
                 ambientG = _mm_add_ps(ambientG, _mm_set1_ps(light.Color.y * light.Ambient));
                 ambientB = _mm_add_ps(ambientB, _mm_set1_ps(light.Color.z * light.Ambient));
             }
+        }
+
+    public:
+        virtual void ShadeFragment(RenderState & state, float * output, __m128 * input, int id)
+        {
+            // input layout (from DefaultShader::ComputeVertex):
+            // input[0-3]:   Clip space position (not used in fragment shader)
+            // input[4-6]:   World-space normal (interpolated)
+            // input[7-9]:   World-space position (view space in current code, but we treat as world)
+            // input[10-11]: UV coordinates
+
+            __m128 zero = _mm_setzero_ps();
+            __m128 one = _mm_set1_ps(1.0f);
+            SurfaceSIMD surface;
+
+            // Normalize normal (input[4-6])
+            __m128 nx2 = _mm_mul_ps(input[4], input[4]);
+            __m128 ny2 = _mm_mul_ps(input[5], input[5]);
+            __m128 nz2 = _mm_mul_ps(input[6], input[6]);
+            __m128 normalLen = _mm_rsqrt_ps(_mm_add_ps(_mm_add_ps(nx2, ny2), nz2));
+            surface.NormalX = _mm_mul_ps(input[4], normalLen);
+            surface.NormalY = _mm_mul_ps(input[5], normalLen);
+            surface.NormalZ = _mm_mul_ps(input[6], normalLen);
+            surface.PosX = input[7];
+            surface.PosY = input[8];
+            surface.PosZ = input[9];
+
+            // Calculate view direction (from fragment to camera)
+            __m128 viewX = _mm_sub_ps(_mm_set1_ps(CameraPosition.x), input[7]);
+            __m128 viewY = _mm_sub_ps(_mm_set1_ps(CameraPosition.y), input[8]);
+            __m128 viewZ = _mm_sub_ps(_mm_set1_ps(CameraPosition.z), input[9]);
+            __m128 viewLen2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(viewX, viewX), _mm_mul_ps(viewY, viewY)), _mm_mul_ps(viewZ, viewZ));
+            __m128 viewLen = _mm_sqrt_ps(viewLen2);
+            __m128 invViewLen = _mm_div_ps(one, viewLen);
+            surface.ViewX = _mm_mul_ps(viewX, invViewLen);
+            surface.ViewY = _mm_mul_ps(viewY, invViewLen);
+            surface.ViewZ = _mm_mul_ps(viewZ, invViewLen);
+
+            // Accumulate lighting contributions
+            LightingSum sum;
+            __m128 ambientR = zero, ambientG = zero, ambientB = zero;
+            if (Kernel == LightKernel::Reference || !IsPackedValid())
+            {
+                ShadeReference(sum, ambientR, ambientG, ambientB, surface);
+            }
+            else
+            {
+                // Culled lights contribute exactly zero diffuse/specular, but their
+                // ambient term applies everywhere.
+                ClusterRange range;
+                const ClusterRange * clusterRange = nullptr;
+                if (IsLightGridActive())
+                {
+                    LightGrid.GetQuadRange(range, input[7], input[8], input[9]);
+                    clusterRange = &range;
+                }
+                if (Kernel == LightKernel::LightLanes)
+                    ShadeLightLanes(sum, surface, clusterRange);
+                else
+                    ShadeFragmentLanes(sum, surface, clusterRange);
+                ambientR = _mm_set1_ps(AmbientSum.x);
+                ambientG = _mm_set1_ps(AmbientSum.y);
+                ambientB = _mm_set1_ps(AmbientSum.z);
+            }
+            __m128 sumDiffuseR = sum.DiffuseR, sumDiffuseG = sum.DiffuseG, sumDiffuseB = sum.DiffuseB;
+            __m128 sumSpecularR = sum.SpecularR, sumSpecularG = sum.SpecularG, sumSpecularB = sum.SpecularB;
 
             // Combine ambient, diffuse, and specular
             __m128 finalR = _mm_add_ps(_mm_add_ps(ambientR, sumDiffuseR), sumSpecularR);
@@ -213,56 +651,28 @@ namespace RasterRenderer
             finalG = _mm_min_ps(_mm_max_ps(finalG, zero), one);
             finalB = _mm_min_ps(_mm_max_ps(finalB, zero), one);
 
-            // Store results (4 fragments in SIMD)
-            CORE_LIB_ALIGN_16(float r[4]);
-            CORE_LIB_ALIGN_16(float g[4]);
-            CORE_LIB_ALIGN_16(float b[4]);
-            CORE_LIB_ALIGN_16(float u[4]);
-            CORE_LIB_ALIGN_16(float v[4]);
-
-            _mm_store_ps(r, finalR);
-            _mm_store_ps(g, finalG);
-            _mm_store_ps(b, finalB);
-            _mm_store_ps(u, input[10]);
-            _mm_store_ps(v, input[11]);
-
-            // Texture sampling (if needed)
-            float dudx = fabs(u[1] - u[0]);
-            float dudy = fabs(u[2] - u[0]);
-            float dvdx = fabs(v[1] - v[0]);
-            float dvdy = fabs(v[2] - v[0]);
-
-            for (int i = 0; i < 4; i++)
+            // Sample texture if available
+            QuadColor diffuseMap;
+            diffuseMap.R = diffuseMap.G = diffuseMap.B = diffuseMap.A = one;
+            Vec4 diffRate = Vec4(1.0f, 1.0f, 1.0f, 1.0f);
+            if (state.ConstantBuffer)
             {
-                Vec2 uv = Vec2(u[i], v[i]);
-                
-                // Sample texture if available
-                Vec4 diffuseMap = Vec4(1.0f, 1.0f, 1.0f, 1.0f);
-                Vec4 diffRate = Vec4(1.0f, 1.0f, 1.0f, 1.0f);
-                
-                if (state.ConstantBuffer)
-                {
-                    TextureData * texture = *(TextureData **)((int*)state.ConstantBuffer + id*(4 + sizeof(TextureData*) / 4));
-                    if (texture)
-                    {
-                        uv.x -= floor(uv.x);
-                        uv.y -= floor(uv.y);
-                        state.SampleTexture(&diffuseMap, texture, 16, dudx, dvdx, dudy, dvdy, uv);
-                    }
-                    diffRate = *(Vec4*)((int*)state.ConstantBuffer + id*(4 + sizeof(TextureData*) / 4) + sizeof(TextureData*) / 4);
-                }
-                
-                // Apply lighting to texture
-                diffuseMap *= Vec4(r[i], g[i], b[i], 1.0f);
-                diffuseMap *= diffRate;
-                
-                // Output RGBA for 4 fragments
-                output[i] = diffuseMap.x;
-                output[i + 4] = diffuseMap.y;
-                output[i + 8] = diffuseMap.z;
-                output[i + 12] = diffuseMap.w;
+                TextureData * texture = *(TextureData **)((int*)state.ConstantBuffer + id*(4 + sizeof(TextureData*) / 4));
+                if (texture)
+                    state.SampleTextureQuad(&diffuseMap, texture, input[10], input[11]);
+                diffRate = *(Vec4*)((int*)state.ConstantBuffer + id*(4 + sizeof(TextureData*) / 4) + sizeof(TextureData*) / 4);
             }
+
+            // Apply lighting to texture and output RGBA for 4 fragments
+            _mm_storeu_ps(output, _mm_mul_ps(_mm_mul_ps(diffuseMap.R, finalR), _mm_set1_ps(diffRate.x)));
+            _mm_storeu_ps(output + 4, _mm_mul_ps(_mm_mul_ps(diffuseMap.G, finalG), _mm_set1_ps(diffRate.y)));
+            _mm_storeu_ps(output + 8, _mm_mul_ps(_mm_mul_ps(diffuseMap.B, finalB), _mm_set1_ps(diffRate.z)));
+            _mm_storeu_ps(output + 12, _mm_mul_ps(diffuseMap.A, _mm_set1_ps(diffRate.w)));
         }
+    private:
+        List<Vec4> lightBounds;
+        int packedSourceCount;
+        int lightsVersion, packedVersion;   // packedVersion is lightsVersion as of the last UpdateLights
     };
 }
 
@@ -1,5 +1,6 @@
 #include "FrameBuffer.h"
 #include "CoreLib/Imaging/Bitmap.h"
+#include "CoreLib/LibIO.h"
 
 using namespace CoreLib::Imaging;
 
@@ -92,8 +93,130 @@ namespace RasterRenderer
     };
     void FrameBuffer::SaveColorBuffer(String fileName)
     {
-        ImageRef img(width, height, (float*)GetColorBuffer());
-        img.SaveAsBmpFile(fileName, true);
+        SaveColorBuffer(fileName, nullptr);
+    }
+
+    // same conversion as ImageRef::SaveAsBmpFile
+    static inline void ConvertToBgr(unsigned char * dst, const Vec4 * src, int count)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            int r = Math::Clamp((int)(src[i].x*255), 0, 255);
+            int g = Math::Clamp((int)(src[i].y*255), 0, 255);
+            int b = Math::Clamp((int)(src[i].z*255), 0, 255);
+            dst[i*3+2] = (unsigned char)r;
+            dst[i*3+1] = (unsigned char)g;
+            dst[i*3+0] = (unsigned char)b;
+        }
+    }
+
+    static inline void ConvertToRgb(unsigned char * dst, const Vec4 * src, int count)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            dst[i*3+0] = (unsigned char)Math::Clamp((int)(src[i].x*255), 0, 255);
+            dst[i*3+1] = (unsigned char)Math::Clamp((int)(src[i].y*255), 0, 255);
+            dst[i*3+2] = (unsigned char)Math::Clamp((int)(src[i].z*255), 0, 255);
+        }
+    }
+
+    static void WriteImageFile(const String & fileName, const unsigned char * data, int size)
+    {
+        FILE * f = fopen(fileName.ToMultiByteString(), "wb");
+        if (!f)
+            throw CoreLib::IO::IOException(L"Failed to open file for writing the image.");
+        size_t written = fwrite(data, 1, size, f);
+        fclose(f);
+        if (written != (size_t)size)
+            throw CoreLib::IO::IOException(L"Failed to write the image.");
+    }
+
+    void FrameBuffer::SaveColorBuffer(String fileName, const List<PixelRect> * changed)
+    {
+        ImageFileFormat format = GetImageFileFormat(fileName);
+        // the pixels kept from the last frame are in the buffer of its format: bmpFile, or rgbImage
+        // for both PNG and QOI
+        if ((format == ImageFileFormat::Bmp) != (lastSavedFormat == ImageFileFormat::Bmp))
+            changed = nullptr;
+        lastSavedFormat = format;
+        if (format != ImageFileFormat::Bmp)
+        {
+            // rows from the top of the image, the last rows of the frame buffer
+            int rowSize = width*3;
+            Vec4 * color = GetColorBuffer();
+            if (rgbImage.Count() != rowSize*height)
+            {
+                rgbImage.SetSize(rowSize*height);
+                changed = nullptr;
+            }
+            unsigned char * rows = rgbImage.Buffer();
+            if (changed)
+            {
+                Parallel::For(0, changed->Count(), 1, [&](int i)
+                {
+                    const PixelRect & rect = (*changed)[i];
+                    for (int y = rect.Y; y < rect.Y + rect.Height; y++)
+                        ConvertToRgb(rows + (height-1-y)*rowSize + rect.X*3, color + y*width + rect.X, rect.Width);
+                });
+            }
+            else
+            {
+                Parallel::For(0, height, [&](int y)
+                {
+                    ConvertToRgb(rows + (height-1-y)*rowSize, color + y*width, width);
+                });
+            }
+            if (format == ImageFileFormat::Png)
+                pngEncoder.Encode(rows, width, height, rowSize, imageFile, Parallel::Tasks());
+            else
+                qoiEncoder.Encode(rows, width, height, rowSize, imageFile, Parallel::Tasks());
+            WriteImageFile(fileName, imageFile.Buffer(), imageFile.Count());
+            return;
+        }
+
+        // bmpFile holds the whole file, headers and padded rows; the rows are in frame buffer
+        // order, which a bottom-up BMP shows upside down, like SaveAsBmpFile with reverseY
+        int rowSize = (width*3 + 3) & ~3;
+        int fileSize = 54 + rowSize*height;
+        Vec4 * color = GetColorBuffer();
+        if (bmpFile.Count() != fileSize)
+        {
+            bmpFile.SetSize(fileSize);
+            memset(bmpFile.Buffer(), 0, fileSize);
+            unsigned char * header = bmpFile.Buffer();
+            header[0] = 'B';
+            header[1] = 'M';
+            header[10] = 54;
+            header[14] = 40;
+            header[26] = 1;
+            header[28] = 24;
+            for (int i = 0; i < 4; i++)
+            {
+                header[2 + i] = (unsigned char)(fileSize >> (i*8));
+                header[18 + i] = (unsigned char)(width >> (i*8));
+                header[22 + i] = (unsigned char)(height >> (i*8));
+            }
+            changed = nullptr;
+        }
+        unsigned char * rows = bmpFile.Buffer() + 54;
+        if (changed)
+        {
+            Parallel::For(0, changed->Count(), 1, [&](int i)
+            {
+                const PixelRect & rect = (*changed)[i];
+                for (int y = rect.Y; y < rect.Y + rect.Height; y++)
+                    ConvertToBgr(rows + y*rowSize + rect.X*3, color + y*width + rect.X, rect.Width);
+            });
+        }
+        else
+        {
+            Parallel::For(0, height, [&](int y)
+            {
+                ConvertToBgr(rows + y*rowSize, color + y*width, width);
+            });
+        }
+
+        WriteImageFile(fileName, bmpFile.Buffer(), fileSize);
     }
 }
 
@@ -4,7 +4,9 @@
 #include "CoreLib/Basic.h"
 #include "CoreLib/VectorMath.h"
 #include "CoreLib/Threading.h"
+#include "CoreLib/Imaging/ImageEncoding.h"
 #include "Parallel.h"
+#include "YuvConverter.h"
 #include <memory.h>
 
 namespace RasterRenderer
@@ -28,6 +30,10 @@ namespace RasterRenderer
             Height = ((height & 0x3) != 0) ? (height>>2) + 1: height>>2;
             mask.SetSize(Width * Height);
         }
+        int GetMemorySize()
+        {
+            return mask.Capacity() * (int)sizeof(unsigned int);
+        }
         inline void Clear()
         {
             for (int i = 0; i<mask.Count(); i++)
@@ -54,6 +60,12 @@ namespace RasterRenderer
         }
     };
 
+    // Rectangle of pixels
+    struct PixelRect
+    {
+        int X, Y, Width, Height;
+    };
+
     class FrameBuffer
     {
     private:
@@ -61,16 +73,24 @@ namespace RasterRenderer
         List<Vec4> downSampledPixels;
         List<float> zBuffer;
         FrameBitMask mask;
+        List<unsigned char> bmpFile; // last BMP file written by SaveColorBuffer
+        List<unsigned char> rgbImage; // top-down RGB of the last PNG or QOI file written
+        List<unsigned char> imageFile;
+        CoreLib::Imaging::PngEncoder pngEncoder;
+        CoreLib::Imaging::QoiEncoder qoiEncoder;
+        CoreLib::Imaging::ImageFileFormat lastSavedFormat;
         int width, height;
         int sampleCountLog2;
         int sampleCount;
     public:
         static const int MultiSampleOffsets[][64];
         FrameBuffer()
+            : lastSavedFormat(CoreLib::Imaging::ImageFileFormat::Bmp)
         {
             width = height = 0;
         }
         FrameBuffer(int width, int height, int sampleCountLog2=0)
+            : lastSavedFormat(CoreLib::Imaging::ImageFileFormat::Bmp)
         {
             SetSize(width, height, sampleCountLog2);
         }
@@ -115,6 +135,18 @@ namespace RasterRenderer
         {
             mask.Clear();
         }
+        // Copies the color and depth samples of a rectangle from a frame buffer of the same size
+        // and sample count
+        inline void CopyRect(FrameBuffer & source, int x, int y, int w, int h)
+        {
+            int count = w << sampleCountLog2;
+            for (int row = y; row < y + h; row++)
+            {
+                int offset = (row*width + x) << sampleCountLog2;
+                memcpy((float*)(pixels.Buffer() + offset), (float*)(source.pixels.Buffer() + offset), count * sizeof(Vec4));
+                memcpy(zBuffer.Buffer() + offset, source.zBuffer.Buffer() + offset, count * sizeof(float));
+            }
+        }
         inline float GetMaxZ()
         {
             float maxZ = -1.0f;
@@ -200,7 +232,24 @@ namespace RasterRenderer
         {
             return sampleCountLog2;
         }
+        int GetMemorySize()
+        {
+            return (pixels.Capacity() + downSampledPixels.Capacity()) * (int)sizeof(Vec4) +
+                zBuffer.Capacity() * (int)sizeof(float) + mask.GetMemorySize() + bmpFile.Capacity() +
+                rgbImage.Capacity() + imageFile.Capacity() + pngEncoder.GetMemorySize() + qoiEncoder.GetMemorySize();
+        }
+        // Converts the color buffer, resolving its samples on the way, to a top-down 4:2:0 frame of
+        // GetYuv420Size(width, height) bytes
+        void ConvertToYuv420(const YuvFormat & format, unsigned char * result)
+        {
+            RasterRenderer::ConvertToYuv420(pixels.Buffer(), width, height, sampleCount, format, result);
+        }
+        // Writes the color buffer as a 24-bit file: PNG or QOI for a .png or .qoi file name, encoded
+        // in strips on the worker pool, and BMP otherwise
         void SaveColorBuffer(String fileName);
+        // The same, converting only the changed rectangles of the color buffer if given; the other
+        // pixels are written as they were converted for the last saved frame
+        void SaveColorBuffer(String fileName, const List<PixelRect> * changed);
     };
 
 
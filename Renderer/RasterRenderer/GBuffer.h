@@ -53,6 +53,25 @@ namespace RasterRenderer
             depthBuffer.SetSize(pixelCount);
         }
         
+        int GetMemorySize()
+        {
+            return (positionBuffer.Capacity() + normalBuffer.Capacity()) * (int)sizeof(Vec3) +
+                albedoBuffer.Capacity() * (int)sizeof(Vec4) + depthBuffer.Capacity() * (int)sizeof(float);
+        }
+        
+        // Copies a rectangle of all buffers from a G-Buffer of the same size
+        void CopyRect(GBuffer & source, int x, int y, int w, int h)
+        {
+            for (int row = y; row < y + h; row++)
+            {
+                int offset = row * width + x;
+                memcpy(positionBuffer.Buffer() + offset, source.positionBuffer.Buffer() + offset, w * sizeof(Vec3));
+                memcpy(normalBuffer.Buffer() + offset, source.normalBuffer.Buffer() + offset, w * sizeof(Vec3));
+                memcpy(albedoBuffer.Buffer() + offset, source.albedoBuffer.Buffer() + offset, w * sizeof(Vec4));
+                memcpy(depthBuffer.Buffer() + offset, source.depthBuffer.Buffer() + offset, w * sizeof(float));
+            }
+        }
+        
         void Clear()
         {
             // Clear all buffers
@@ -55,12 +55,6 @@ namespace RasterRenderer
             CORE_LIB_ALIGN_16(float depth[4]);
             _mm_store_ps(depth, input[9]);
             
-            // Extract albedo (default white, or from texture if available)
-            CORE_LIB_ALIGN_16(float u[4]);
-            CORE_LIB_ALIGN_16(float v[4]);
-            _mm_store_ps(u, input[10]);
-            _mm_store_ps(v, input[11]);
-            
             // Store data in output buffer for later G-Buffer write
             int offset = 0;
             for (int i = 0; i < 4; i++)
@@ -77,28 +71,25 @@ namespace RasterRenderer
             }
             
             // Albedo (default white, or sample texture)
+            QuadColor albedo;
+            albedo.R = albedo.G = albedo.B = albedo.A = _mm_set1_ps(1.0f);
+            TextureData * texture = *(TextureData **)((int*)state.ConstantBuffer + id*(4 + sizeof(TextureData*) / 4));
+            if (texture)
+                state.SampleTextureQuad(&albedo, texture, input[10], input[11]);
+            CORE_LIB_ALIGN_16(float albedoR[4]);
+            CORE_LIB_ALIGN_16(float albedoG[4]);
+            CORE_LIB_ALIGN_16(float albedoB[4]);
+            CORE_LIB_ALIGN_16(float albedoA[4]);
+            _mm_store_ps(albedoR, albedo.R);
+            _mm_store_ps(albedoG, albedo.G);
+            _mm_store_ps(albedoB, albedo.B);
+            _mm_store_ps(albedoA, albedo.A);
             for (int i = 0; i < 4; i++)
             {
-                Vec2 uv = Vec2(u[i], v[i]);
-                Vec4 albedo = Vec4(1.0f, 1.0f, 1.0f, 1.0f);
-                
-                // Sample texture if available
-                TextureData * texture = *(TextureData **)((int*)state.ConstantBuffer + id*(4 + sizeof(TextureData*) / 4));
-                if (texture)
-                {
-                    uv.x -= floor(uv.x);
-                    uv.y -= floor(uv.y);
-                    float dudx = fabs(u[1] - u[0]);
-                    float dvdx = fabs(v[1] - v[0]);
-                    float dudy = fabs(u[2] - u[0]);
-                    float dvdy = fabs(v[2] - v[0]);
-                    state.SampleTexture(&albedo, texture, 16, dudx, dvdx, dudy, dvdy, uv);
-                }
-                
-                output[offset++] = albedo.x;
-                output[offset++] = albedo.y;
-                output[offset++] = albedo.z;
-                output[offset++] = albedo.w;
+                output[offset++] = albedoR[i];
+                output[offset++] = albedoG[i];
+                output[offset++] = albedoB[i];
+                output[offset++] = albedoA[i];
             }
             
             // Depth
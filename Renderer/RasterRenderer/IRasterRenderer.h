@@ -21,6 +21,23 @@ namespace RasterRenderer
         virtual void Finish() = 0;
         virtual TraceCollection * GetTraces() = 0;
         virtual void Clear(const VectorMath::Vec4 & clearColor, bool color = true, bool depth = true, bool mask = false) = 0;
+        // Keeps the frame buffer as drawn so far this frame (the color and depth, and whatever else
+        // the renderer needs to continue drawing on top) as the static layer, until the next
+        // SaveStaticLayer or SetFrameBuffer
+        virtual void SaveStaticLayer() = 0;
+        // Starts a frame from the static layer in place of Clear; false, leaving the frame buffer
+        // as it is, if there is none
+        virtual bool RestoreStaticLayer() = 0;
+        // Tiled renderers: frames that start from RestoreStaticLayer only restore and draw the tiles
+        // that they or the previous frame in the frame buffer draw into; every other tile still
+        // holds the static layer from before
+        virtual void SetDirtyTileTracking(bool enable) = 0;
+        // Pixel rectangles the last frame changed, relative to the previous frame in the frame
+        // buffer; false if it may have changed anywhere
+        virtual bool GetChangedRegion(List<PixelRect> & rects) = 0;
+        // Bytes of the renderer's working buffers, which grow to the largest frame drawn so far, and
+        // of its static layer; the frame buffer is not included
+        virtual int GetMemorySize() = 0;
     };
     IRasterRenderer * CreateForwardNonTiledRenderer();
     IRasterRenderer * CreateTiledRenderer();
@@ -0,0 +1,359 @@
+#ifndef RASTER_RENDERER_LIGHT_CLUSTER_H
+#define RASTER_RENDERER_LIGHT_CLUSTER_H
+
+#include "CoreLib/Basic.h"
+#include "CoreLib/VectorMath.h"
+#include "Parallel.h"
+#include <immintrin.h>
+#include <math.h>
+
+namespace RasterRenderer
+{
+    using namespace CoreLib::Basic;
+    using namespace VectorMath;
+
+    enum class LightCullingMode
+    {
+        None,       // every fragment evaluates every light
+        Tiled,      // per screen tile light lists (single depth slice)
+        Clustered   // screen tiles x exponential depth slices
+    };
+
+    // A range of clusters touched by a point or a fragment quad
+    struct ClusterRange
+    {
+        int TileX0, TileX1, TileY0, TileY1;
+        int Slice0, Slice1;
+    };
+
+    // Clustered light grid.
+    // The view frustum is divided into TileSize x TileSize screen tiles and
+    // exponentially spaced depth slices. Every cluster stores a bitmask of the
+    // lights whose bounding sphere may reach it. Iterating the set bits visits
+    // the lights in ascending id order, so the lighting sums are accumulated in
+    // the same order as when every light is evaluated.
+    // Light bounds are given in the same space as the positions the shaders
+    // light (the view-space position output of DefaultShader). The projection
+    // is assumed to be a perspective matrix built by Matrix4::CreatePerspectiveMatrix,
+    // i.e. clip w equals the negated view-space z.
+    class LightClusterGrid
+    {
+    public:
+        static const int Log2TileSize = 5;
+        static const int TileSize = 1 << Log2TileSize;
+        static const int DepthSlices = 16;
+    private:
+        struct TileRect
+        {
+            int X0, X1, Y0, Y1; // inclusive, empty when X0 > X1
+        };
+        Matrix4 projection;
+        float halfWidth, halfHeight;
+        int gridWidth, gridHeight, sliceCount;
+        int lightCount, maskWords;
+        float zNear, zFar, sliceScale;
+        List<float> sliceBounds;        // sliceCount + 1 depth boundaries
+        List<TileRect> lightRects;      // lightCount * sliceCount tile rects
+        List<unsigned int> masks;       // maskWords per cluster, cluster = tile * sliceCount + slice
+        bool valid;
+
+        inline int TileFromPixel(float p, int gridSize) const
+        {
+            if (!(p > 0.0f))
+                return 0;
+            int tile = (int)Math::Min(p, (float)(gridSize << Log2TileSize)) >> Log2TileSize;
+            return Math::Min(tile, gridSize - 1);
+        }
+
+        // computes the tile rect covered by the part of a sphere between two depths
+        void ComputeSliceRect(TileRect & rect, const Vec3 & center, float radius, float depth0, float depth1)
+        {
+            rect.X0 = rect.Y0 = 0;
+            rect.X1 = rect.Y1 = -1;
+            float centerDepth = -center.z;
+            // radius of the sphere section within [depth0, depth1]
+            float dz = 0.0f;
+            if (centerDepth < depth0)
+                dz = depth0 - centerDepth;
+            else if (centerDepth > depth1)
+                dz = centerDepth - depth1;
+            float r2 = radius * radius - dz * dz;
+            if (r2 < 0.0f)
+                return;
+            float sectionRadius = sqrtf(r2);
+            float minX = 1e30f, maxX = -1e30f, minY = 1e30f, maxY = -1e30f;
+            for (int i = 0; i < 8; i++)
+            {
+                Vec4 corner((i & 1) ? center.x + sectionRadius : center.x - sectionRadius,
+                    (i & 2) ? center.y + sectionRadius : center.y - sectionRadius,
+                    (i & 4) ? -depth1 : -depth0, 1.0f);
+                Vec4 clip;
+                projection.Transform(clip, corner);
+                float invW = 1.0f / clip.w;
+                float px = (clip.x * invW + 1.0f) * halfWidth;
+                float py = (clip.y * invW + 1.0f) * halfHeight;
+                minX = Math::Min(minX, px);
+                maxX = Math::Max(maxX, px);
+                minY = Math::Min(minY, py);
+                maxY = Math::Max(maxY, py);
+            }
+            // one pixel of slack for the rounding in fragment lookups
+            minX -= 1.0f; minY -= 1.0f;
+            maxX += 1.0f; maxY += 1.0f;
+            if (maxX < 0.0f || maxY < 0.0f || minX >= halfWidth * 2.0f || minY >= halfHeight * 2.0f)
+                return;
+            rect.X0 = TileFromPixel(minX, gridWidth);
+            rect.X1 = TileFromPixel(maxX, gridWidth);
+            rect.Y0 = TileFromPixel(minY, gridHeight);
+            rect.Y1 = TileFromPixel(maxY, gridHeight);
+        }
+    public:
+        LightClusterGrid()
+        {
+            gridWidth = gridHeight = 0;
+            sliceCount = 1;
+            lightCount = maskWords = 0;
+            valid = false;
+        }
+
+        inline bool IsValid() const
+        {
+            return valid;
+        }
+        inline int GetLightCount() const
+        {
+            return lightCount;
+        }
+        inline int GetClusterCount() const
+        {
+            return gridWidth * gridHeight * sliceCount;
+        }
+
+        inline int SliceFromDepth(float depth) const
+        {
+            if (!(depth > zNear))
+                return 0;
+            int slice = (int)(logf(depth / zNear) * sliceScale);
+            return Math::Min(slice, sliceCount - 1);
+        }
+
+        // Rebuilds the grid. Each light is described by a bounding sphere (xyz = center,
+        // w = radius); a radius of 0 marks an unbounded light that goes into every
+        // cluster, a negative radius a slot that is never referenced.
+        void Build(const Vec4 * lightSpheres, int count, const Matrix4 & projectionTransform,
+            int viewportWidth, int viewportHeight, LightCullingMode mode)
+        {
+            projection = projectionTransform;
+            halfWidth = viewportWidth * 0.5f;
+            halfHeight = viewportHeight * 0.5f;
+            gridWidth = (viewportWidth + TileSize - 1) >> Log2TileSize;
+            gridHeight = (viewportHeight + TileSize - 1) >> Log2TileSize;
+            sliceCount = (mode == LightCullingMode::Clustered) ? DepthSlices : 1;
+            lightCount = count;
+            maskWords = (count + 31) >> 5;
+            zNear = projection.m[3][2] / (projection.m[2][2] - 1.0f);
+            zFar = projection.m[3][2] / (projection.m[2][2] + 1.0f);
+            sliceScale = sliceCount / logf(zFar / zNear);
+            sliceBounds.SetSize(sliceCount + 1);
+            for (int i = 0; i <= sliceCount; i++)
+                sliceBounds[i] = zNear * expf(i / sliceScale);
+            sliceBounds[0] = zNear;
+            sliceBounds[sliceCount] = zFar;
+
+            lightRects.SetSize(count * sliceCount);
+            masks.SetSize(gridWidth * gridHeight * sliceCount * maskWords);
+            valid = (mode != LightCullingMode::None && gridWidth > 0 && gridHeight > 0 && zFar > zNear);
+            if (!valid)
+                return;
+
+            // pass 1: per light, the tile rect covered in each depth slice
+            const float depthEpsilon = 1e-4f;
+            Parallel::For(0, count, 16, [&](int lightId)
+            {
+                const Vec4 & sphere = lightSpheres[lightId];
+                TileRect * rects = lightRects.Buffer() + lightId * sliceCount;
+                if (sphere.w < 0.0f)
+                {
+                    for (int s = 0; s < sliceCount; s++)
+                    {
+                        rects[s].X0 = rects[s].Y0 = 0;
+                        rects[s].X1 = rects[s].Y1 = -1;
+                    }
+                    return;
+                }
+                if (sphere.w == 0.0f)
+                {
+                    for (int s = 0; s < sliceCount; s++)
+                    {
+                        rects[s].X0 = rects[s].Y0 = 0;
+                        rects[s].X1 = gridWidth - 1;
+                        rects[s].Y1 = gridHeight - 1;
+                    }
+                    return;
+                }
+                Vec3 center(sphere.x, sphere.y, sphere.z);
+                float minDepth = (-center.z - sphere.w) * (1.0f - depthEpsilon);
+                float maxDepth = (-center.z + sphere.w) * (1.0f + depthEpsilon);
+                for (int s = 0; s < sliceCount; s++)
+                {
+                    float depth0 = Math::Max(sliceBounds[s] * (1.0f - depthEpsilon), minDepth);
+                    float depth1 = Math::Min(sliceBounds[s + 1] * (1.0f + depthEpsilon), maxDepth);
+                    if (depth0 > depth1)
+                    {
+                        rects[s].X0 = rects[s].Y0 = 0;
+                        rects[s].X1 = rects[s].Y1 = -1;
+                    }
+                    else
+                        ComputeSliceRect(rects[s], center, sphere.w, depth0, depth1);
+                }
+            });
+
+            // pass 2: scatter lights into cluster masks, one task per (slice, tile row)
+            Parallel::For(0, sliceCount * gridHeight, 1, [&](int task)
+            {
+                int slice = task / gridHeight;
+                int tileY = task % gridHeight;
+                for (int tileX = 0; tileX < gridWidth; tileX++)
+                {
+                    unsigned int * mask = masks.Buffer() + ((tileY * gridWidth + tileX) * sliceCount + slice) * maskWords;
+                    memset(mask, 0, maskWords * sizeof(unsigned int));
+                }
+                for (int lightId = 0; lightId < count; lightId++)
+                {
+                    const TileRect & rect = lightRects[lightId * sliceCount + slice];
+                    if (tileY < rect.Y0 || tileY > rect.Y1)
+                        continue;
+                    unsigned int bit = 1u << (lightId & 31);
+                    int word = lightId >> 5;
+                    for (int tileX = rect.X0; tileX <= rect.X1; tileX++)
+                        masks[((tileY * gridWidth + tileX) * sliceCount + slice) * maskWords + word] |= bit;
+                }
+            });
+        }
+
+        // cluster containing a single view-space position
+        inline void GetPointRange(ClusterRange & range, const Vec3 & pos) const
+        {
+            Vec4 clip;
+            projection.Transform(clip, Vec4(pos, 1.0f));
+            float invW = 1.0f / clip.w;
+            range.TileX0 = range.TileX1 = TileFromPixel((clip.x * invW + 1.0f) * halfWidth, gridWidth);
+            range.TileY0 = range.TileY1 = TileFromPixel((clip.y * invW + 1.0f) * halfHeight, gridHeight);
+            range.Slice0 = range.Slice1 = SliceFromDepth(clip.w);
+        }
+
+        // clusters touched by the four view-space positions of a fragment quad
+        inline void GetQuadRange(ClusterRange & range, __m128 x, __m128 y, __m128 z) const
+        {
+            auto transformRow = [&](int row)
+            {
+                return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(projection.m[0][row])), _mm_mul_ps(y, _mm_set1_ps(projection.m[1][row]))),
+                    _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(projection.m[2][row])), _mm_set1_ps(projection.m[3][row])));
+            };
+            __m128 one = _mm_set1_ps(1.0f);
+            __m128 w = transformRow(3);
+            __m128 invW = _mm_div_ps(one, w);
+            __m128 px = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(transformRow(0), invW), one), _mm_set1_ps(halfWidth));
+            __m128 py = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(transformRow(1), invW), one), _mm_set1_ps(halfHeight));
+            CORE_LIB_ALIGN_16(float pxs[4]);
+            CORE_LIB_ALIGN_16(float pys[4]);
+            CORE_LIB_ALIGN_16(float ws[4]);
+            _mm_store_ps(pxs, px);
+            _mm_store_ps(pys, py);
+            _mm_store_ps(ws, w);
+            range.TileX0 = range.TileY0 = range.Slice0 = 1 << 30;
+            range.TileX1 = range.TileY1 = range.Slice1 = -1;
+            for (int i = 0; i < 4; i++)
+            {
+                int tx = TileFromPixel(pxs[i], gridWidth);
+                int ty = TileFromPixel(pys[i], gridHeight);
+                int s = SliceFromDepth(ws[i]);
+                range.TileX0 = Math::Min(range.TileX0, tx);
+                range.TileX1 = Math::Max(range.TileX1, tx);
+                range.TileY0 = Math::Min(range.TileY0, ty);
+                range.TileY1 = Math::Max(range.TileY1, ty);
+                range.Slice0 = Math::Min(range.Slice0, s);
+                range.Slice1 = Math::Max(range.Slice1, s);
+            }
+        }
+
+        // visits, in ascending order, every light that may affect the clusters in range
+        template<typename Func>
+        inline void ForEachLight(const ClusterRange & range, const Func & f) const
+        {
+            ForEachLight(range, 0, lightCount, f);
+        }
+
+        // same as above, restricted to light ids in [first, last)
+        template<typename Func>
+        inline void ForEachLight(const ClusterRange & range, int first, int last, const Func & f) const
+        {
+            if (first >= last)
+                return;
+            const unsigned int * maskBuffer = masks.Buffer();
+            int firstWord = first >> 5;
+            int lastWord = (last - 1) >> 5;
+            unsigned int firstMask = ~0u << (first & 31);
+            unsigned int lastMask = ~0u >> (31 - ((last - 1) & 31));
+            bool singleCluster = range.TileX0 == range.TileX1 && range.TileY0 == range.TileY1 && range.Slice0 == range.Slice1;
+            if (singleCluster)
+            {
+                const unsigned int * mask = maskBuffer + ((range.TileY0 * gridWidth + range.TileX0) * sliceCount + range.Slice0) * maskWords;
+                for (int word = firstWord; word <= lastWord; word++)
+                {
+                    unsigned int bits = mask[word];
+                    if (word == firstWord)
+                        bits &= firstMask;
+                    if (word == lastWord)
+                        bits &= lastMask;
+                    while (bits)
+                    {
+                        f((word << 5) + Math::CountTrailingZeros(bits));
+                        bits &= bits - 1;
+                    }
+                }
+                return;
+            }
+            for (int word = firstWord; word <= lastWord; word++)
+            {
+                unsigned int bits = 0;
+                for (int ty = range.TileY0; ty <= range.TileY1; ty++)
+                    for (int tx = range.TileX0; tx <= range.TileX1; tx++)
+                    {
+                        const unsigned int * mask = maskBuffer + ((ty * gridWidth + tx) * sliceCount) * maskWords + word;
+                        for (int s = range.Slice0; s <= range.Slice1; s++)
+                            bits |= mask[s * maskWords];
+                    }
+                if (word == firstWord)
+                    bits &= firstMask;
+                if (word == lastWord)
+                    bits &= lastMask;
+                while (bits)
+                {
+                    f((word << 5) + Math::CountTrailingZeros(bits));
+                    bits &= bits - 1;
+                }
+            }
+        }
+
+        // average number of lights per cluster, for reporting
+        float GetAverageLightsPerCluster() const
+        {
+            if (!valid)
+                return (float)lightCount;
+            long long total = 0;
+            for (int i = 0; i < masks.Count(); i++)
+            {
+                unsigned int bits = masks[i];
+                while (bits)
+                {
+                    total++;
+                    bits &= bits - 1;
+                }
+            }
+            return (float)total / Math::Max(1, GetClusterCount());
+        }
+    };
+}
+
+#endif
@@ -1,9 +1,16 @@
 #include "ModelResource.h"
+#include "ResourceManager.h"
+#include "CoreLib/Graphics/GltfModel.h"
 #include "CoreLib/LibIO.h"
+#include "CoreLib/PerformanceCounter.h"
+#include "Parallel.h"
 #include <xmmintrin.h>
 #include <float.h>
+#include <limits.h>
 using namespace CoreLib::Graphics;
 using namespace CoreLib::IO;
+using namespace CoreLib::Diagnostics;
+using CoreLib::Int64;
 
 namespace RasterRenderer
 {
@@ -22,14 +29,380 @@ namespace RasterRenderer
         }
     }
 
+    struct ModelCacheEntry
+    {
+        String FileName;
+        unsigned long long SourceHash;
+        Int64 SourceSize;
+        ModelCacheEntry()
+            : SourceHash(0), SourceSize(0)
+        {}
+    };
+
+    // Model cache file: a header, the dependency, texture, material and batch tables, the constant
+    // buffer and a string table, followed by the vertices and each batch's indices and material ids
+    // at the offsets given by the header and the batch table, 64-byte aligned. The arrays are used
+    // in place through the mapping.
+    const unsigned int ModelCacheMagic = 0x3143444D; // "MDC1"
+    // bump whenever FromObjModel changes what it builds, so existing cache files are rebuilt
+    const int ModelCacheVersion = 2;
+    const int ModelCacheAlignment = 64;
+
+    struct ModelCacheHeader
+    {
+        unsigned int Magic;
+        int Version;
+        unsigned long long SourceHash;
+        Int64 SourceSize;
+        int PointerSize, VertexFormat, VertexCount, TriangleCount;
+        int DependencyCount, TextureCount, MaterialCount, BatchCount;
+        int ConstantCount, StringSize;
+        float Radius;
+        int Reserved;
+        Int64 VertexOffset;
+    };
+
+    // A material library read while building the model
+    struct ModelCacheDependency
+    {
+        unsigned long long Hash;
+        Int64 Size; // -1 if the file could not be read
+        int Name, Reserved; // offset in the string table
+    };
+
+    struct ModelCacheTexture
+    {
+        int Name, IsTransparent; // the batches were split assuming this transparency
+    };
+
+    struct ModelCacheMaterial
+    {
+        int Texture; // index in the texture table, -1 for none
+        float SpecularPower;
+        Vec4 DiffuseRate, SpecularRate, AmbientRate;
+    };
+
+    struct ModelCacheBatch
+    {
+        int TriangleCount, AlphaBlend;
+        Int64 IndexOffset, ConstantIndexOffset;
+    };
+
+    Int64 AlignModelCacheOffset(Int64 offset)
+    {
+        return (offset + ModelCacheAlignment - 1) & ~(Int64)(ModelCacheAlignment - 1);
+    }
+
+    // Hash and size of a whole file; false if it cannot be read
+    bool HashModelFile(const String & fileName, unsigned long long & hash, Int64 & size)
+    {
+        try
+        {
+            MemoryMappedFile file(fileName);
+            hash = ComputeHash64(file.Buffer(), file.Size());
+            size = file.Size();
+            return true;
+        }
+        catch (IOException &)
+        {
+            return false;
+        }
+    }
+
+    bool ModelResource::GetCacheEntry(const String & fileName, ModelCacheEntry & entry)
+    {
+        if (!HashModelFile(fileName, entry.SourceHash, entry.SourceSize))
+            return false;
+        char key[32];
+        sprintf(key, ".%016llx.mdlcache", entry.SourceHash);
+        String directory = CacheDirectory.Length() ? CacheDirectory : Path::GetDirectoryName(fileName);
+        String cacheName = Path::GetFileName(fileName) + String(key);
+        entry.FileName = directory.Length() ? Path::Combine(directory, cacheName) : cacheName;
+        return true;
+    }
+
+    bool ModelResource::ReadCache(const ModelCacheEntry & entry, ModelResource & rs)
+    {
+        RefPtr<MemoryMappedFile> cache;
+        try
+        {
+            cache = new MemoryMappedFile(entry.FileName);
+        }
+        catch (IOException &)
+        {
+            return false;
+        }
+        // the layout is checked in full before anything is used, so a stale, truncated or foreign
+        // file is rebuilt rather than trusted
+        const unsigned char * data = cache->Buffer();
+        Int64 fileSize = cache->Size();
+        if (fileSize < (Int64)sizeof(ModelCacheHeader))
+            return false;
+        ModelCacheHeader header;
+        memcpy(&header, data, sizeof(header));
+        const int pointerSize = sizeof(TextureData*)/4;
+        const int constSize = pointerSize + 4;
+        const int vertexSize = 8;
+        if (header.Magic != ModelCacheMagic || header.Version != ModelCacheVersion ||
+            header.SourceHash != entry.SourceHash || header.SourceSize != entry.SourceSize ||
+            header.PointerSize != pointerSize || header.VertexFormat != (int)VertexFormat::PositionNormalTex ||
+            header.VertexCount < 0 || header.TriangleCount < 0 || header.DependencyCount < 0 || header.TextureCount < 0 ||
+            header.MaterialCount < 1 || header.BatchCount < 0 || header.StringSize < 0 ||
+            header.ConstantCount != header.MaterialCount * constSize)
+            return false;
+        Int64 dependencyOffset = sizeof(ModelCacheHeader);
+        Int64 textureOffset = dependencyOffset + (Int64)header.DependencyCount * sizeof(ModelCacheDependency);
+        Int64 materialOffset = textureOffset + (Int64)header.TextureCount * sizeof(ModelCacheTexture);
+        Int64 batchOffset = materialOffset + (Int64)header.MaterialCount * sizeof(ModelCacheMaterial);
+        Int64 constantOffset = batchOffset + (Int64)header.BatchCount * sizeof(ModelCacheBatch);
+        Int64 stringOffset = constantOffset + (Int64)header.ConstantCount * sizeof(int);
+        Int64 tableEnd = stringOffset + header.StringSize;
+        if (tableEnd > fileSize || (header.StringSize && data[tableEnd - 1] != 0) || header.VertexOffset < tableEnd ||
+            header.VertexOffset % ModelCacheAlignment != 0 ||
+            header.VertexOffset + (Int64)header.VertexCount * vertexSize * sizeof(int) > fileSize)
+            return false;
+        List<ModelCacheDependency> dependencies;
+        List<ModelCacheTexture> textures;
+        List<ModelCacheMaterial> materials;
+        List<ModelCacheBatch> batches;
+        dependencies.SetSize(header.DependencyCount);
+        textures.SetSize(header.TextureCount);
+        materials.SetSize(header.MaterialCount);
+        batches.SetSize(header.BatchCount);
+        memcpy(dependencies.Buffer(), data + dependencyOffset, dependencies.Count() * sizeof(ModelCacheDependency));
+        memcpy(textures.Buffer(), data + textureOffset, textures.Count() * sizeof(ModelCacheTexture));
+        memcpy(materials.Buffer(), data + materialOffset, materials.Count() * sizeof(ModelCacheMaterial));
+        memcpy(batches.Buffer(), data + batchOffset, batches.Count() * sizeof(ModelCacheBatch));
+        const char * strings = (const char*)data + stringOffset;
+        int triangleCount = 0;
+        for (auto & batch : batches)
+        {
+            if (batch.TriangleCount < 0 || batch.IndexOffset % ModelCacheAlignment != 0 ||
+                batch.ConstantIndexOffset % ModelCacheAlignment != 0 ||
+                batch.IndexOffset < header.VertexOffset || batch.ConstantIndexOffset < header.VertexOffset ||
+                batch.IndexOffset + (Int64)batch.TriangleCount * 3 * sizeof(int) > fileSize ||
+                batch.ConstantIndexOffset + (Int64)batch.TriangleCount * sizeof(int) > fileSize)
+                return false;
+            triangleCount += batch.TriangleCount;
+        }
+        if (triangleCount != header.TriangleCount)
+            return false;
+        // the renderer indexes the vertices and materials with these unchecked
+        for (auto & batch : batches)
+        {
+            const int * indices = (const int*)(data + batch.IndexOffset);
+            const int * constantIndices = (const int*)(data + batch.ConstantIndexOffset);
+            for (Int64 i = 0; i < (Int64)batch.TriangleCount * 3; i++)
+                if ((unsigned int)indices[i] >= (unsigned int)header.VertexCount)
+                    return false;
+            for (int i = 0; i < batch.TriangleCount; i++)
+                if ((unsigned int)constantIndices[i] >= (unsigned int)header.MaterialCount)
+                    return false;
+        }
+        for (auto & dependency : dependencies)
+            if (dependency.Name < 0 || dependency.Name >= header.StringSize)
+                return false;
+        for (auto & texture : textures)
+            if (texture.Name < 0 || texture.Name >= header.StringSize)
+                return false;
+        for (auto & material : materials)
+            if (material.Texture < -1 || material.Texture >= header.TextureCount)
+                return false;
+
+        // the model file is matched by the cache name and header, its material libraries here
+        for (auto & dependency : dependencies)
+        {
+            unsigned long long hash = 0;
+            Int64 size = -1;
+            HashModelFile(String(strings + dependency.Name), hash, size);
+            if (size != dependency.Size || hash != dependency.Hash)
+                return false;
+        }
+        for (auto & texture : textures)
+            rs.textureFiles.Add(String(strings + texture.Name));
+        rs.LoadTextures();
+        for (int i = 0; i < textures.Count(); i++)
+            if (rs.textures[i]->IsTransparent != (textures[i].IsTransparent != 0))
+                return false;
+
+        rs.constBuffer.SetSize(header.ConstantCount);
+        memcpy(rs.constBuffer.Buffer(), data + constantOffset, header.ConstantCount * sizeof(int));
+        for (int i = 0; i < materials.Count(); i++)
+        {
+            ModelMaterial mat;
+            if (materials[i].Texture != -1)
+                mat.DiffuseMap = rs.textures[materials[i].Texture];
+            *(TextureData**)(rs.constBuffer.Buffer() + i * constSize) = mat.DiffuseMap.Ptr();
+            mat.DiffuseRate = materials[i].DiffuseRate;
+            mat.SpecularRate = materials[i].SpecularRate;
+            mat.AmbientRate = materials[i].AmbientRate;
+            mat.SpecularPower = materials[i].SpecularPower;
+            rs.materials.Add(mat);
+        }
+        rs.cacheFile = cache;
+        rs.vertices.SetReference(VertexFormat::PositionNormalTex, header.VertexCount, (void*)(data + header.VertexOffset));
+        for (auto & batch : batches)
+        {
+            // the mapping is read-only; the renderer never writes through these
+            int * indices = (int*)(data + batch.IndexOffset);
+            int * constantIndices = (int*)(data + batch.ConstantIndexOffset);
+            rs.batches.Add(new RenderBatch(IndexBufferRef(ElementType::Triangles, batch.TriangleCount, indices), constantIndices, batch.AlphaBlend != 0));
+        }
+        rs.Count = header.TriangleCount;
+        rs.Radius = header.Radius;
+        rs.shader = new TextureShader();
+        rs.LoadedFromCache = true;
+        return true;
+    }
+
+    bool ModelResource::WriteCache(const ModelCacheEntry & entry, const List<String> & materialLibs)
+    {
+        if (entry.FileName.Length() == 0)
+            return false;
+        if (CacheDirectory.Length() && !Directory::Create(CacheDirectory))
+            return false;
+        const int pointerSize = sizeof(TextureData*)/4;
+        const int constSize = pointerSize + 4;
+        List<char> strings;
+        auto addString = [&](const String & str)
+        {
+            int offset = strings.Count();
+            const char * mbStr = str.ToMultiByteString();
+            strings.AddRange(mbStr, (int)strlen(mbStr) + 1);
+            return offset;
+        };
+        List<ModelCacheDependency> dependencies;
+        for (auto & materialLib : materialLibs)
+        {
+            ModelCacheDependency dependency;
+            dependency.Hash = 0;
+            dependency.Size = -1;
+            HashModelFile(materialLib, dependency.Hash, dependency.Size);
+            dependency.Name = addString(materialLib);
+            dependency.Reserved = 0;
+            dependencies.Add(dependency);
+        }
+        List<ModelCacheTexture> textureTable;
+        for (int i = 0; i < textureFiles.Count(); i++)
+        {
+            ModelCacheTexture texture;
+            texture.Name = addString(textureFiles[i]);
+            texture.IsTransparent = textures[i]->IsTransparent;
+            textureTable.Add(texture);
+        }
+        List<ModelCacheMaterial> materialTable;
+        List<int> constants(constBuffer);
+        for (int i = 0; i < materials.Count(); i++)
+        {
+            ModelCacheMaterial material;
+            material.Texture = -1;
+            for (int j = 0; j < textures.Count(); j++)
+                if (materials[i].DiffuseMap == textures[j])
+                    material.Texture = j;
+            material.SpecularPower = materials[i].SpecularPower;
+            material.DiffuseRate = materials[i].DiffuseRate;
+            material.SpecularRate = materials[i].SpecularRate;
+            material.AmbientRate = materials[i].AmbientRate;
+            materialTable.Add(material);
+            // texture pointers are only meaningful in this process
+            memset(constants.Buffer() + i * constSize, 0, pointerSize * sizeof(int));
+        }
+
+        ModelCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        header.Magic = ModelCacheMagic;
+        header.Version = ModelCacheVersion;
+        header.SourceHash = entry.SourceHash;
+        header.SourceSize = entry.SourceSize;
+        header.PointerSize = pointerSize;
+        header.VertexFormat = (int)vertices.GetFormat();
+        header.VertexCount = vertices.Count();
+        header.TriangleCount = Count;
+        header.DependencyCount = dependencies.Count();
+        header.TextureCount = textureTable.Count();
+        header.MaterialCount = materialTable.Count();
+        header.BatchCount = batches.Count();
+        header.ConstantCount = constants.Count();
+        header.StringSize = strings.Count();
+        header.Radius = Radius;
+        Int64 tableEnd = sizeof(ModelCacheHeader) + dependencies.Count() * sizeof(ModelCacheDependency) +
+            textureTable.Count() * sizeof(ModelCacheTexture) + materialTable.Count() * sizeof(ModelCacheMaterial) +
+            batches.Count() * sizeof(ModelCacheBatch) + constants.Count() * sizeof(int) + strings.Count();
+        header.VertexOffset = AlignModelCacheOffset(tableEnd);
+        Int64 vertexDataSize = (Int64)vertices.Count() * vertices.GetVertexSize() * sizeof(int);
+        Int64 offset = AlignModelCacheOffset(header.VertexOffset + vertexDataSize);
+        List<ModelCacheBatch> batchTable;
+        for (auto & batch : batches)
+        {
+            ModelCacheBatch entry;
+            entry.TriangleCount = batch->IndexBuffer.Count();
+            entry.AlphaBlend = batch->AlphaBlend;
+            entry.IndexOffset = offset;
+            entry.ConstantIndexOffset = AlignModelCacheOffset(offset + (Int64)entry.TriangleCount * 3 * sizeof(int));
+            offset = AlignModelCacheOffset(entry.ConstantIndexOffset + (Int64)entry.TriangleCount * sizeof(int));
+            batchTable.Add(entry);
+        }
+
+        // written under a name of its own and renamed into place, like the texture cache
+        String tempName = File::GetTemporaryName(entry.FileName);
+        bool written = false;
+        try
+        {
+            FileStream stream(tempName, FileMode::Create);
+            const char padding[ModelCacheAlignment] = {};
+            Int64 position = 0;
+            // pads from the end of the previous array up to arrayOffset
+            auto writeArray = [&](Int64 arrayOffset, const void * buffer, Int64 size)
+            {
+                int paddingSize = (int)(arrayOffset - position);
+                position = arrayOffset + size;
+                return stream.Write(padding, paddingSize) == paddingSize && stream.Write(buffer, (int)size) == (int)size;
+            };
+            written = writeArray(0, &header, sizeof(header)) &&
+                writeArray(position, dependencies.Buffer(), dependencies.Count() * sizeof(ModelCacheDependency)) &&
+                writeArray(position, textureTable.Buffer(), textureTable.Count() * sizeof(ModelCacheTexture)) &&
+                writeArray(position, materialTable.Buffer(), materialTable.Count() * sizeof(ModelCacheMaterial)) &&
+                writeArray(position, batchTable.Buffer(), batchTable.Count() * sizeof(ModelCacheBatch)) &&
+                writeArray(position, constants.Buffer(), constants.Count() * sizeof(int)) &&
+                writeArray(position, strings.Buffer(), strings.Count()) &&
+                writeArray(header.VertexOffset, vertices.GetDataPointer(), vertexDataSize);
+            for (int i = 0; written && i < batches.Count(); i++)
+            {
+                written = writeArray(batchTable[i].IndexOffset, batches[i]->IndexBuffer.GetDataPointer(), (Int64)batchTable[i].TriangleCount * 3 * sizeof(int)) &&
+                    writeArray(batchTable[i].ConstantIndexOffset, batches[i]->ConstantIndex, (Int64)batchTable[i].TriangleCount * sizeof(int));
+            }
+            stream.Close();
+        }
+        catch (IOException &)
+        {
+            written = false;
+        }
+        if (written && File::Replace(tempName, entry.FileName))
+            return true;
+        File::Delete(tempName);
+        return false;
+    }
+
+    bool ModelResource::UseCache = false;
+    String ModelResource::CacheDirectory;
+
     ModelResource ModelResource::FromObjModel(String fileName)
     {
+        auto loadCounter = PerformanceCounter::Start();
+        ModelCacheEntry cacheEntry;
+        bool useCache = UseCache && GetCacheEntry(fileName, cacheEntry);
+        ModelResource cached;
+        if (useCache && ReadCache(cacheEntry, cached))
+        {
+            cached.LoadTime = PerformanceCounter::ToSeconds(PerformanceCounter::End(loadCounter));
+            return cached;
+        }
         ObjModel obj;
         if (Path::GetFileExt(fileName).ToLower() == L"obj")
         {
-            if (LoadObj(obj, fileName.ToMultiByteString()))
+            if (LoadObj(obj, fileName.ToMultiByteString(), PolygonType::Triangle, Parallel::Tasks()))
             {
-                RecomputeNormals(obj);
+                RecomputeNormals(obj, Parallel::Tasks());
                 
             }
             else
@@ -51,7 +424,11 @@ namespace RasterRenderer
             }
         }
         String basePath = Path::GetDirectoryName(fileName);
-        return FromObjModel(basePath, obj);
+        ModelResource rs = FromObjModel(basePath, obj);
+        if (useCache)
+            rs.WriteCache(cacheEntry, obj.MaterialLibs);
+        rs.LoadTime = PerformanceCounter::ToSeconds(PerformanceCounter::End(loadCounter));
+        return rs;
     }
 
     struct MdlVertex
@@ -75,16 +452,88 @@ namespace RasterRenderer
             Norm = norm;
             Tex = tex;
         }
-        inline bool operator == (const IndexVertex & v)
+        inline bool operator == (const IndexVertex & v) const
         {
             return Pos == v.Pos && Tex == v.Tex && Norm == v.Norm;
         }
-        inline int GetHashCode()
+        inline int GetHashCode() const
+        {
+            unsigned int hash = (unsigned int)Pos * 0x9E3779B1u;
+            hash = (hash ^ (unsigned int)Norm) * 0x85EBCA77u;
+            hash = (hash ^ (unsigned int)Tex) * 0xC2B2AE3Du;
+            return (int)(hash ^ (hash >> 15));
+        }
+    };
+
+    // Open-addressing table (linear probing) from id triples to vertex ids, sized for at most
+    // maxCount entries at half load
+    class VertexIdTable
+    {
+    private:
+        List<IndexVertex> keys;
+        List<int> ids;
+        int mask;
+    public:
+        VertexIdTable(int maxCount)
         {
-            return (Pos<<20)+(Norm<<10) + Tex;
+            int size = 16;
+            while (size < maxCount * 2)
+                size <<= 1;
+            keys.SetSize(size);
+            ids.SetSize(size);
+            for (int i = 0; i < size; i++)
+                ids[i] = -1;
+            mask = size - 1;
+        }
+        // Returns the id stored for key, or stores newId and returns -1 if key is not in the table
+        inline int Insert(const IndexVertex & key, int newId)
+        {
+            for (int slot = key.GetHashCode() & mask; ; slot = (slot + 1) & mask)
+            {
+                if (ids[slot] == -1)
+                {
+                    keys[slot] = key;
+                    ids[slot] = newId;
+                    return -1;
+                }
+                if (keys[slot] == key)
+                    return ids[slot];
+            }
         }
     };
 
+    const int VertexDedupBatchSize = 1 << 13; // faces
+
+    void ModelResource::LoadTextures()
+    {
+        auto loadCounter = PerformanceCounter::Start();
+        ResourceManager::Global().LoadTextures(textureFiles, textureImages, textures);
+        TextureLoadTime = PerformanceCounter::ToSeconds(PerformanceCounter::End(loadCounter));
+    }
+
+    int ModelResource::GetTextureMemory()
+    {
+        List<TextureData*> counted;
+        int size = 0;
+        for (auto & mat : materials)
+        {
+            if (mat.DiffuseMap && counted.IndexOf(mat.DiffuseMap.Ptr()) == -1)
+            {
+                counted.Add(mat.DiffuseMap.Ptr());
+                size += mat.DiffuseMap->GetMemorySize();
+            }
+        }
+        return size;
+    }
+
+    int ModelResource::GetGeometryMemory()
+    {
+        int size = vertices.Count() * vertices.GetVertexSize() + constBuffer.Count() * sizeof(int);
+        for (auto & batch : batches)
+            size += batch->IndexBuffer.Count() * (batch->IndexBuffer.VertexCountPerPatch() + 1) * sizeof(int);
+        return size;
+    }
+
     ModelResource ModelResource::FromObjModel(String basePath, ObjModel & model)
     {
         ModelResource rs;
@@ -92,53 +541,92 @@ namespace RasterRenderer
         ComputeBBox(model, minX, minY, minZ, maxX, maxY, maxZ);
         rs.Radius = sqrt((maxX-minX)*(maxX-minX) + (maxY-minY)*(maxY-minY) + (maxZ-minZ)*(maxZ-minZ));
         
-        List<MdlVertex> verts;
-        verts.Reserve(model.Vertices.Count());
-        List<List<int>> groups;
-        groups.SetSize(model.Materials.Count()+1);
-        List<IndexVertex> vertexDict;
-        vertexDict.SetSize(model.Vertices.Count());
-        for (int i = 0; i<vertexDict.Count(); i++)
-        {
-            vertexDict[i].Norm = -1;
-            vertexDict[i].Tex = -1;
-            vertexDict[i].Pos = -1;
-        };
-        int indexCount = 0;
-        for (auto & face : model.Faces)
+        // One vertex per distinct (position, normal, tex coord) id triple. Batches of faces are
+        // deduplicated on their own in parallel, then the batches' distinct triples are merged in
+        // order, which numbers the vertices by first use exactly as a serial pass would
+        int faceCount = model.Faces.Count();
+        int batchCount = (faceCount + VertexDedupBatchSize - 1) / VertexDedupBatchSize;
+        List<int> cornerIds;
+        cornerIds.SetSize(faceCount * 3);
+        List<List<IndexVertex>> batchVertices;
+        batchVertices.SetSize(batchCount);
+        Parallel::For(0, batchCount, 1, [&](int batch)
         {
-            int indices[3];
-            for (int i = 0; i<3; i++)
+            int first = batch * VertexDedupBatchSize;
+            int last = Math::Min(first + VertexDedupBatchSize, faceCount);
+            VertexIdTable table((last - first) * 3);
+            List<IndexVertex> & vertices = batchVertices[batch];
+            for (int f = first; f < last; f++)
             {
-                auto index = IndexVertex(face.VertexIds[i], face.NormalIds[i], face.TexCoordIds[i]);
-                if (vertexDict[index.Pos].Tex == index.Tex && vertexDict[index.Pos].Norm == index.Norm /*!vertexDict.TryGetValue(index, indices[i])*/)
+                auto & face = model.Faces[f];
+                for (int i = 0; i<3; i++)
                 {
-                    indices[i] = vertexDict[index.Pos].Pos;
+                    auto index = IndexVertex(face.VertexIds[i], face.NormalIds[i], face.TexCoordIds[i]);
+                    int id = table.Insert(index, vertices.Count());
+                    if (id == -1)
+                    {
+                        id = vertices.Count();
+                        vertices.Add(index);
+                    }
+                    cornerIds[f * 3 + i] = id;
                 }
-                else
+            }
+        });
+        int batchVertexCount = 0;
+        for (auto & vertices : batchVertices)
+            batchVertexCount += vertices.Count();
+        VertexIdTable vertexTable(batchVertexCount);
+        List<IndexVertex> vertexIndices;
+        List<List<int>> batchToModel;
+        batchToModel.SetSize(batchCount);
+        for (int batch = 0; batch < batchCount; batch++)
+        {
+            for (auto & index : batchVertices[batch])
+            {
+                int id = vertexTable.Insert(index, vertexIndices.Count());
+                if (id == -1)
                 {
-                    MdlVertex vert;
-                    vert.Position = model.Vertices[index.Pos];
-                    if (index.Norm != -1)
-                        vert.Normal = model.Normals[index.Norm];
-                    else
-                        vert.Normal.SetZero();
-                    if (index.Tex != -1)
-                        vert.TexCoord = model.TexCoords[index.Tex];
-                    else
-                        vert.TexCoord.SetZero();
-                    verts.Add(vert);
-                    indices[i] = verts.Count()-1;
-                    vertexDict[index.Pos] = index;
-                    vertexDict[index.Pos].Pos = verts.Count()-1;
+                    id = vertexIndices.Count();
+                    vertexIndices.Add(index);
                 }
+                batchToModel[batch].Add(id);
             }
-            groups[face.MaterialId+1].AddRange(indices, 3);
-            indexCount+=3;
         }
-        rs.Count = indexCount/3;
+        Parallel::For(0, batchCount, 1, [&](int batch)
+        {
+            int last = Math::Min((batch + 1) * VertexDedupBatchSize, faceCount) * 3;
+            for (int i = batch * VertexDedupBatchSize * 3; i < last; i++)
+                cornerIds[i] = batchToModel[batch][cornerIds[i]];
+        });
+        List<MdlVertex> verts;
+        verts.SetSize(vertexIndices.Count());
+        Parallel::For(0, (verts.Count() + VertexDedupBatchSize - 1) / VertexDedupBatchSize, 1, [&](int block)
+        {
+            int last = Math::Min((block + 1) * VertexDedupBatchSize, verts.Count());
+            for (int i = block * VertexDedupBatchSize; i < last; i++)
+            {
+                auto & index = vertexIndices[i];
+                MdlVertex & vert = verts[i];
+                vert.Position = model.Vertices[index.Pos];
+                if (index.Norm != -1)
+                    vert.Normal = model.Normals[index.Norm];
+                else
+                    vert.Normal.SetZero();
+                if (index.Tex != -1)
+                    vert.TexCoord = model.TexCoords[index.Tex];
+                else
+                    vert.TexCoord.SetZero();
+            }
+        });
+        List<List<int>> groups;
+        groups.SetSize(model.Materials.Count()+1);
+        for (int f = 0; f < faceCount; f++)
+            groups[model.Faces[f].MaterialId+1].AddRange(cornerIds.Buffer() + f * 3, 3);
+        int indexCount = faceCount * 3;
+        rs.Count = faceCount;
 
         rs.vertexBuffer = new VertexBuffer(VertexFormat::PositionNormalTex, verts.Count(), verts.Buffer());
+        rs.vertices = *rs.vertexBuffer;
 
         // load materials
         const int pointerSize = sizeof(TextureData*)/4;
@@ -151,31 +639,21 @@ namespace RasterRenderer
         rs.constBuffer.Add(FloatAsInt(0.7f));
         rs.constBuffer.Add(FloatAsInt(0.7f));
         rs.constBuffer.Add(FloatAsInt(1.0f));
-        Dictionary<String, RefPtr<TextureData>> textures;
         for (int i = 0; i<model.Materials.Count(); i++)
         {
-            ModelMaterial mat;
             if (model.Materials[i]->DiffuseMap.Length())
             {
-                String diffuseMap = Path::Combine(basePath,  model.Materials[i]->DiffuseMap);
-                try
-                {
-                    RefPtr<TextureData> texture;
-                    if (textures.TryGetValue(diffuseMap, texture))
-                        mat.DiffuseMap = texture;
-                    else
-                    {
-                        mat.DiffuseMap = new TextureData(diffuseMap);
-                        textures[diffuseMap] = mat.DiffuseMap;
-                    }
-                }
-                catch (IOException&)
-                {
-					printf("Cannot load texture \"%s\"\n", diffuseMap.ToMultiByteString());
-                    mat.DiffuseMap = new TextureData();
-                }
-                
+                String diffuseMap = Path::Combine(basePath, model.Materials[i]->DiffuseMap);
+                if (rs.textureFiles.IndexOf(diffuseMap) == -1)
+                    rs.textureFiles.Add(diffuseMap);
             }
+        }
+        rs.LoadTextures();
+        for (int i = 0; i<model.Materials.Count(); i++)
+        {
+            ModelMaterial mat;
+            if (model.Materials[i]->DiffuseMap.Length())
+                mat.DiffuseMap = rs.textures[rs.textureFiles.IndexOf(Path::Combine(basePath, model.Materials[i]->DiffuseMap))];
             else
                 mat.DiffuseMap = 0;
             for (int z = 0; z<pointerSize; z++)
@@ -225,4 +703,298 @@ namespace RasterRenderer
         rs.shader = new TextureShader();
         return rs;
     }
+
+    // One drawn copy of a glTF primitive: the primitive under the world transform of a node
+    struct GltfInstance
+    {
+        const GltfPrimitive * Primitive;
+        Matrix4 Transform;
+        Matrix4 NormalTransform; // inverse of Transform, applied transposed
+        bool FlipWinding; // Transform mirrors, so the triangles are reversed to stay counter-clockwise
+        bool Flat; // no NORMAL attribute; every triangle gets its own three vertices and face normal
+        int ConstantIndex;
+        int FirstVertex, VertexCount;
+        int FirstTriangle, TriangleCount;
+    };
+
+    // Position of corner of triangle in the vertex sequence of a primitive
+    inline int GetGltfCorner(GltfPrimitiveMode mode, int triangle, int corner)
+    {
+        if (mode == GltfPrimitiveMode::TriangleStrip)
+            return triangle + ((triangle & 1) && corner ? 3 - corner : corner);
+        if (mode == GltfPrimitiveMode::TriangleFan)
+            return corner ? triangle + corner : 0;
+        return triangle * 3 + corner;
+    }
+
+    ModelResource ModelResource::FromFile(String fileName)
+    {
+        String ext = Path::GetFileExt(fileName).ToLower();
+        if (ext == L"gltf" || ext == L"glb")
+            return FromGltfModel(fileName);
+        return FromObjModel(fileName);
+    }
+
+    ModelResource ModelResource::FromGltfModel(String fileName)
+    {
+        auto loadCounter = PerformanceCounter::Start();
+        GltfModel model(fileName);
+        auto unsupported = [&](const wchar_t * reason)
+        {
+            return IOException(L"Cannot load model file '" + fileName + L"': " + reason);
+        };
+        ModelResource rs;
+
+        // constant slot 0 is the glTF default material, slot i + 1 holds material i
+        const int pointerSize = sizeof(TextureData*)/4;
+        List<int> imageTextures;
+        imageTextures.SetSize(model.Images.Count());
+        for (int i = 0; i < imageTextures.Count(); i++)
+            imageTextures[i] = -1;
+        auto useImage = [&](int image)
+        {
+            if (image == -1 || imageTextures[image] != -1)
+                return;
+            imageTextures[image] = rs.textureFiles.Count();
+            auto & source = model.Images[image];
+            ModelImageData data = {nullptr, 0};
+            if (source.FileName.Length())
+                rs.textureFiles.Add(source.FileName);
+            else
+            {
+                // decoded straight from the mapped buffer, named after the model for the texture cache
+                if (model.BufferViews[source.BufferView].Length > INT_MAX)
+                    throw unsupported(L"embedded image too large");
+                data.Data = model.GetBufferViewData(source.BufferView);
+                data.Size = (int)model.BufferViews[source.BufferView].Length;
+                rs.textureFiles.Add(fileName + L".image" + String(image));
+            }
+            rs.textureImages.Add(data);
+        };
+        // normal textures are not loaded: no shader perturbs normals yet
+        for (auto & material : model.Materials)
+            useImage(material.BaseColorImage);
+        rs.LoadTextures();
+        auto addMaterial = [&](const ModelMaterial & mat)
+        {
+            for (int i = 0; i < pointerSize; i++)
+                rs.constBuffer.Add(0);
+            *(TextureData**)(rs.constBuffer.Buffer() + rs.constBuffer.Count() - pointerSize) = mat.DiffuseMap.Ptr();
+            rs.constBuffer.Add(FloatAsInt(mat.DiffuseRate.x));
+            rs.constBuffer.Add(FloatAsInt(mat.DiffuseRate.y));
+            rs.constBuffer.Add(FloatAsInt(mat.DiffuseRate.z));
+            rs.constBuffer.Add(FloatAsInt(mat.DiffuseRate.w));
+            rs.materials.Add(mat);
+        };
+        addMaterial(ModelMaterial());
+        for (auto & material : model.Materials)
+        {
+            ModelMaterial mat;
+            if (material.BaseColorImage != -1)
+                mat.DiffuseMap = rs.textures[imageTextures[material.BaseColorImage]];
+            mat.DiffuseRate = material.BaseColorFactor;
+            // opaque materials ignore alpha; there is no alpha test, so masked ones are blended
+            if (material.AlphaMode == GltfAlphaMode::Opaque)
+                mat.DiffuseRate.w = 1.0f;
+            addMaterial(mat);
+        }
+
+        // instances of the primitives in the scene by batch: opaque, then blended, each first single
+        // and then double sided, so every batch is one range of the index array
+        List<GltfInstance> instances[4];
+        List<int> nodeStack;
+        List<Matrix4> transformStack;
+        for (int i = model.SceneNodes.Count() - 1; i >= 0; i--)
+        {
+            nodeStack.Add(model.SceneNodes[i]);
+            transformStack.Add(model.Nodes[model.SceneNodes[i]].Transform);
+        }
+        while (nodeStack.Count())
+        {
+            auto & node = model.Nodes[nodeStack.Last()];
+            Matrix4 transform = transformStack.Last();
+            nodeStack.SetSize(nodeStack.Count() - 1);
+            transformStack.SetSize(transformStack.Count() - 1);
+            for (int i = node.Children.Count() - 1; i >= 0; i--)
+            {
+                Matrix4 childTransform;
+                Matrix4::Multiply(childTransform, transform, model.Nodes[node.Children[i]].Transform);
+                nodeStack.Add(node.Children[i]);
+                transformStack.Add(childTransform);
+            }
+            if (node.Mesh == -1)
+                continue;
+            for (auto & prim : model.Meshes[node.Mesh].Primitives)
+            {
+                // points and lines have no triangles to draw
+                if (prim.Mode != GltfPrimitiveMode::Triangles && prim.Mode != GltfPrimitiveMode::TriangleStrip &&
+                    prim.Mode != GltfPrimitiveMode::TriangleFan)
+                    continue;
+                if (prim.Position == -1)
+                    continue;
+                auto & position = model.Accessors[prim.Position];
+                if (position.ComponentCount != 3)
+                    throw unsupported(L"POSITION is not a VEC3 accessor");
+                if (prim.Normal != -1 && (model.Accessors[prim.Normal].ComponentCount != 3 || model.Accessors[prim.Normal].Count != position.Count))
+                    throw unsupported(L"NORMAL does not match POSITION");
+                if (prim.TexCoord != -1 && (model.Accessors[prim.TexCoord].ComponentCount != 2 || model.Accessors[prim.TexCoord].Count != position.Count))
+                    throw unsupported(L"TEXCOORD_0 does not match POSITION");
+                int cornerCount = position.Count;
+                if (prim.Indices != -1)
+                {
+                    auto & indices = model.Accessors[prim.Indices];
+                    if (indices.ComponentCount != 1 || (indices.ComponentType != GltfComponentType::UnsignedByte &&
+                        indices.ComponentType != GltfComponentType::UnsignedShort && indices.ComponentType != GltfComponentType::UnsignedInt))
+                        throw unsupported(L"indices are not an unsigned integer SCALAR accessor");
+                    cornerCount = indices.Count;
+                }
+                GltfInstance instance;
+                instance.Primitive = &prim;
+                instance.Transform = transform;
+                float determinant = transform.Inverse3D(instance.NormalTransform);
+                if (determinant == 0.0f)
+                    instance.NormalTransform = transform; // degenerate, any normals will do
+                instance.FlipWinding = determinant < 0.0f;
+                instance.Flat = prim.Normal == -1;
+                instance.ConstantIndex = prim.Material + 1;
+                if (prim.Mode == GltfPrimitiveMode::Triangles)
+                    instance.TriangleCount = cornerCount / 3;
+                else
+                    instance.TriangleCount = Math::Max(cornerCount - 2, 0);
+                instance.VertexCount = instance.Flat ? instance.TriangleCount * 3 : position.Count;
+                bool blend = prim.Material != -1 && model.Materials[prim.Material].AlphaMode != GltfAlphaMode::Opaque;
+                bool doubleSided = prim.Material != -1 && model.Materials[prim.Material].DoubleSided;
+                instances[blend * 2 + doubleSided].Add(instance);
+            }
+        }
+        int batchTriangles[4] = {0, 0, 0, 0};
+        Int64 vertexCount = 0, triangleCount = 0;
+        List<GltfInstance> allInstances;
+        for (int x = 0; x < 4; x++)
+        {
+            for (auto & instance : instances[x])
+            {
+                instance.FirstVertex = (int)vertexCount;
+                instance.FirstTriangle = (int)triangleCount;
+                vertexCount += instance.VertexCount;
+                triangleCount += instance.TriangleCount;
+                batchTriangles[x] += instance.TriangleCount;
+                allInstances.Add(instance);
+            }
+        }
+        if (vertexCount > INT_MAX || triangleCount * 3 > INT_MAX)
+            throw unsupported(L"too many vertices");
+
+        // every instance is converted from the mapped buffers into its own range of the vertex and
+        // index arrays in a single pass
+        List<MdlVertex> verts;
+        verts.SetSize((int)vertexCount);
+        List<int> index, constIndex;
+        index.SetSize((int)triangleCount * 3);
+        constIndex.SetSize((int)triangleCount);
+        List<int> badIndices;
+        badIndices.SetSize(allInstances.Count());
+        Parallel::For(0, allInstances.Count(), 1, [&](int i)
+        {
+            auto & instance = allInstances[i];
+            auto & prim = *instance.Primitive;
+            int positionCount = model.Accessors[prim.Position].Count;
+            MdlVertex * vertices = verts.Buffer() + instance.FirstVertex;
+            int * triangles = index.Buffer() + instance.FirstTriangle * 3;
+            badIndices[i] = 0;
+            auto readVertex = [&](int id, MdlVertex & vert)
+            {
+                float value[3];
+                model.ReadFloats(prim.Position, id, value);
+                instance.Transform.Transform(vert.Position, Vec3(value[0], value[1], value[2]));
+                if (prim.TexCoord != -1)
+                {
+                    // glTF puts v = 0 at the top of an image, textures are stored bottom row first
+                    model.ReadFloats(prim.TexCoord, id, value);
+                    vert.TexCoord = Vec2(value[0], 1.0f - value[1]);
+                }
+                else
+                    vert.TexCoord.SetZero();
+                vert.Normal.SetZero();
+                if (prim.Normal != -1)
+                {
+                    model.ReadFloats(prim.Normal, id, value);
+                    Vec3 normal;
+                    instance.NormalTransform.TransposeTransformNormal(normal, Vec3(value[0], value[1], value[2]));
+                    if (normal.Length() > 0.0f)
+                        vert.Normal = normal.Normalize();
+                }
+            };
+            if (!instance.Flat)
+                for (int v = 0; v < positionCount; v++)
+                    readVertex(v, vertices[v]);
+            for (int t = 0; t < instance.TriangleCount; t++)
+            {
+                int * triangle = triangles + t * 3;
+                for (int c = 0; c < 3; c++)
+                {
+                    int corner = GetGltfCorner(prim.Mode, t, c);
+                    int id = prim.Indices != -1 ? model.ReadIndex(prim.Indices, corner) : corner;
+                    if (id < 0 || id >= positionCount)
+                    {
+                        badIndices[i] = 1;
+                        id = 0;
+                    }
+                    int slot = instance.FlipWinding && c ? 3 - c : c;
+                    if (instance.Flat)
+                    {
+                        readVertex(id, vertices[t * 3 + slot]);
+                        triangle[slot] = instance.FirstVertex + t * 3 + slot;
+                    }
+                    else
+                        triangle[slot] = instance.FirstVertex + id;
+                }
+                if (instance.Flat)
+                {
+                    MdlVertex * corners = vertices + t * 3;
+                    Vec3 normal;
+                    Vec3::Cross(normal, corners[1].Position - corners[0].Position, corners[2].Position - corners[0].Position);
+                    if (normal.Length() > 0.0f)
+                        normal = normal.Normalize();
+                    corners[0].Normal = corners[1].Normal = corners[2].Normal = normal;
+                }
+                constIndex[instance.FirstTriangle + t] = instance.ConstantIndex;
+            }
+        });
+        for (int bad : badIndices)
+            if (bad)
+                throw unsupported(L"vertex index out of range");
+
+        float minX, minY, minZ, maxX, maxY, maxZ;
+        minX = minY = minZ = FLT_MAX;
+        maxX = maxY = maxZ = -FLT_MAX;
+        for (auto & v : verts)
+        {
+            if (v.Position.x < minX) minX = v.Position.x;
+            if (v.Position.x > maxX) maxX = v.Position.x;
+            if (v.Position.y < minY) minY = v.Position.y;
+            if (v.Position.y > maxY) maxY = v.Position.y;
+            if (v.Position.z < minZ) minZ = v.Position.z;
+            if (v.Position.z > maxZ) maxZ = v.Position.z;
+        }
+        if (verts.Count())
+            rs.Radius = sqrt((maxX-minX)*(maxX-minX) + (maxY-minY)*(maxY-minY) + (maxZ-minZ)*(maxZ-minZ));
+        rs.vertexBuffer = new VertexBuffer(VertexFormat::PositionNormalTex, verts.Count(), verts.Buffer());
+        rs.vertices = *rs.vertexBuffer;
+        int firstTriangle = 0;
+        for (int x = 0; x < 4; x++)
+        {
+            if (batchTriangles[x])
+            {
+                RefPtr<RenderBatch> batch = new RenderBatch(batchTriangles[x], index.Buffer() + firstTriangle * 3, constIndex.Buffer() + firstTriangle, x >= 2);
+                batch->DoubleSided = (x & 1) != 0;
+                rs.batches.Add(batch);
+            }
+            firstTriangle += batchTriangles[x];
+        }
+        rs.Count = (int)triangleCount;
+        rs.shader = new TextureShader();
+        rs.LoadTime = PerformanceCounter::ToSeconds(PerformanceCounter::End(loadCounter));
+        return rs;
+    }
 }
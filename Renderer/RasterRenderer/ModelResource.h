@@ -9,16 +9,26 @@ namespace RasterRenderer
 {
     class RenderBatch
     {
+    private:
+        List<int> indices, constantIndices; // empty when the batch references a mapped model cache
     public:
-        RasterRenderer::IndexBuffer IndexBuffer;
-        List<int> ConstantIndex;
+        IndexBufferRef IndexBuffer;
+        int * ConstantIndex;
         bool AlphaBlend;
+        bool DoubleSided; // drawn without backface culling
         RenderBatch(int n, int * data, int * constIdx, bool alpha)
-            :IndexBuffer(ElementType::Triangles, n, data)
         {
             AlphaBlend = alpha;
-            ConstantIndex.AddRange(constIdx, n);
+            DoubleSided = false;
+            indices.AddRange(data, n * 3);
+            constantIndices.AddRange(constIdx, n);
+            IndexBuffer = IndexBufferRef(ElementType::Triangles, n, indices.Buffer());
+            ConstantIndex = constantIndices.Buffer();
         }
+        // References the triangles in place instead of copying them; the data must outlive the batch
+        RenderBatch(IndexBufferRef indexBuffer, int * constIdx, bool alpha)
+            : IndexBuffer(indexBuffer), ConstantIndex(constIdx), AlphaBlend(alpha), DoubleSided(false)
+        {}
     };
 
     class ModelMaterial
@@ -35,52 +45,103 @@ namespace RasterRenderer
         }
     };
 
+    struct ModelCacheEntry;
+
+    // An encoded image held in memory, such as one embedded in a glTF model
+    struct ModelImageData
+    {
+        const unsigned char * Data;
+        int Size;
+    };
+
     class ModelResource
     {
     private:
+        VertexBufferRef vertices; // vertexBuffer's data, or the vertices in cacheFile
         RefPtr<VertexBuffer> vertexBuffer;
+        RefPtr<CoreLib::IO::MemoryMappedFile> cacheFile; // backs vertices and batches when loaded from a cache
         //RefPtr<IndexBuffer> indexBuffer;
         List<RefPtr<RenderBatch>> batches;
         List<ModelMaterial> materials;
+        List<String> textureFiles; // of the distinct diffuse maps
+        List<ModelImageData> textureImages; // data of the textureFiles held in memory, Data is null for image files
+        List<RefPtr<TextureData>> textures; // loaded from textureFiles and textureImages through the ResourceManager
         Shader* shader;
         List<int> constBuffer;
         int Count;
+        static bool GetCacheEntry(const String & fileName, ModelCacheEntry & entry);
+        static bool ReadCache(const ModelCacheEntry & entry, ModelResource & rs);
+        bool WriteCache(const ModelCacheEntry & entry, const List<String> & materialLibs);
+        void LoadTextures();
     public:
         float Radius;
+        double TextureLoadTime; // seconds spent decoding textures and building their mip chains
+        double LoadTime; // seconds FromObjModel(fileName) or FromGltfModel(fileName) took in total
+        bool LoadedFromCache;
         ModelResource()
-            : shader(nullptr)
+            : shader(nullptr), Count(0), Radius(0.0f), TextureLoadTime(0.0), LoadTime(0.0), LoadedFromCache(false)
         {}
+        // Keep processed models (vertices, batches, materials and bounds) in .mdlcache files, named by
+        // a hash of the model file and checked against its material libraries, and map them on later
+        // loads instead of parsing and processing the model again
+        static bool UseCache;
+        // Directory of the cache files; empty puts them next to the models
+        static String CacheDirectory;
         static ModelResource FromObjModel(String fileName);
         static ModelResource FromObjModel(String basePath, CoreLib::Graphics::ObjModel & model);
+        // Loads the default scene of a .gltf or .glb file. Throws IOException if the file cannot be
+        // loaded or uses features the renderer cannot draw.
+        static ModelResource FromGltfModel(String fileName);
+        // FromGltfModel for .gltf and .glb files, FromObjModel otherwise
+        static ModelResource FromFile(String fileName);
         inline int TriangleCount()
         {
             return Count;
         }
+        inline int VertexCount()
+        {
+            return vertices.Count();
+        }
+        // Bytes held by the textures of all materials, each shared texture counted once
+        int GetTextureMemory();
+        // Bytes held by the vertices, triangles and material constants
+        int GetGeometryMemory();
         void SetShader(Shader * shader)
         {
             this->shader = shader;
         }
         inline void Draw(RenderState & state, IRasterRenderer * renderer)
         {
-            if (!renderer || !vertexBuffer.Ptr())
+            Draw(state, renderer, nullptr);
+        }
+        // Draws with the given shader in place of the model's own, so that models shared through the
+        // ResourceManager need no SetShader; nullptr uses the model's shader
+        inline void Draw(RenderState & state, IRasterRenderer * renderer, Shader * shaderOverride)
+        {
+            if (!renderer || !vertices.GetDataPointer())
                 return;
             
             state.ConstantBuffer = constBuffer.Buffer();
             // Use model's shader if set, otherwise use state's shader
-            if (this->shader)
+            if (shaderOverride)
+                state.Shader = shaderOverride;
+            else if (this->shader)
                 state.Shader = this->shader;
             
             if (!state.Shader)
                 return;
             
+            bool backfaceCulling = state.BackfaceCulling;
             for (int i = 0; i<batches.Count(); i++)
             {
                 if (!batches[i].Ptr())
                     continue;
                 
                 state.AlphaBlend = batches[i]->AlphaBlend;
-                renderer->Draw(state, vertexBuffer.Ptr(), &batches[i]->IndexBuffer, batches[i]->ConstantIndex.Buffer());
+                state.BackfaceCulling = backfaceCulling && !batches[i]->DoubleSided;
+                renderer->Draw(state, &vertices, &batches[i]->IndexBuffer, batches[i]->ConstantIndex);
             }
+            state.BackfaceCulling = backfaceCulling;
         }
     };
 }
@@ -29,6 +29,38 @@ namespace RasterRenderer
         {
         }
 
+        inline void SaveStaticLayer(FrameBuffer & layer)
+        {
+            Parallel::For(0, frameBuffer->GetHeight(), [&](int y)
+            {
+                layer.CopyRect(*frameBuffer, 0, y, frameBuffer->GetWidth(), 1);
+            });
+        }
+
+        inline void RestoreStaticLayer(FrameBuffer & layer)
+        {
+            Parallel::For(0, frameBuffer->GetHeight(), [&](int y)
+            {
+                frameBuffer->CopyRect(layer, 0, y, frameBuffer->GetWidth(), 1);
+            });
+        }
+
+        // there are no tiles to track, every frame restores the whole static layer
+        inline void SetDirtyTileTracking(bool enable)
+        {
+        }
+
+        inline bool GetChangedRegion(List<PixelRect> & rects)
+        {
+            rects.Clear();
+            return false;
+        }
+
+        inline int GetMemorySize()
+        {
+            return fragmentBuffer.Capacity() * (int)sizeof(Fragment);
+        }
+
         // RenderProjectedBatch --
         //
         // input: a list of post-clipping projected triangles to rasterize.
@@ -47,6 +47,16 @@ public:
         concurrency::parallel_for(first, last, f, concurrency::simple_partitioner(chunkSize));
     }
 #endif
+    // Runs body(0) ... body(count - 1) on the worker pool. Passed to the CoreLib loaders that split
+    // their work into independent items (LoadObj, TextureData)
+    struct Tasks
+    {
+        template<typename Func>
+        void operator()(int count, const Func & body) const
+        {
+            Parallel::For(0, count, 1, body);
+        }
+    };
     inline static void * Alloc(size_t size)
     {
 #ifdef USE_TBB
@@ -41,6 +41,9 @@ namespace RasterRenderer
         Matrix4 ModelViewProjectionTransform;
         Matrix4 NormalTransform;
         RasterRenderer::TextureFilter TextureFilter;
+        TextureAddressMode TextureAddress;
+        bool ScalarTextureSampling;     // sample quads one fragment at a time (reference path)
+        bool PerPixelTextureFootprint;  // per-fragment derivatives and filter footprint instead of one per quad (reference path)
         int ViewportWidth, ViewportHeight;
         float HalfWidth, HalfHeight;
         float zMin, zMax;
@@ -72,6 +75,9 @@ namespace RasterRenderer
             EnableDebugDump = false;
             memset(TextureBinding, 0, sizeof(TextureData*) * 16);
             this->TextureFilter = RasterRenderer::TextureFilter::TriLinear;
+            this->TextureAddress = TextureAddressMode::Wrap;
+            this->ScalarTextureSampling = false;
+            this->PerPixelTextureFootprint = false;
             this->TransparencyOrder = RasterRenderer::TransparencyOrder::Unchanged;
         }
         void SetViewport(int width, int height)
@@ -103,27 +109,99 @@ namespace RasterRenderer
         {
 			if (this->TextureFilter == RasterRenderer::TextureFilter::Linear)
 			{
-				LinearSampling(result, texture, uv);
+				LinearSampling(result, texture, uv, TextureAddress);
 			}
 			else if (this->TextureFilter == RasterRenderer::TextureFilter::TriLinear)
 			{
-				TrilinearSampling(result, texture, sqrt(dudx*dudx + dudy*dudy), sqrt(dvdx*dvdx + dvdy*dvdy), uv);
+				TrilinearSampling(result, texture, sqrt(dudx*dudx + dudy*dudy), sqrt(dvdx*dvdx + dvdy*dvdy), uv, 0, TextureAddress);
 			}
 			else if (this->TextureFilter == RasterRenderer::TextureFilter::Nearest)
 			{
-				NearestSampling(result, texture, uv);
+				NearestSampling(result, texture, uv, TextureAddress);
 			}
 			else if(this->TextureFilter == RasterRenderer::TextureFilter::Anisotropic16x)
 			{
-				AnisotropicSampling(result, texture, 16, dudx, dvdx, dudy, dvdy, uv);
+				AnisotropicSampling(result, texture, 16, dudx, dvdx, dudy, dvdy, uv, TextureAddress);
 			}
 			else if (this->TextureFilter == RasterRenderer::TextureFilter::Anisotropic8x)
 			{
-				AnisotropicSampling(result, texture, 8, dudx, dvdx, dudy, dvdy, uv);
+				AnisotropicSampling(result, texture, 8, dudx, dvdx, dudy, dvdy, uv, TextureAddress);
 			}
 			else if (this->TextureFilter == RasterRenderer::TextureFilter::Anisotropic4x)
 			{
-				AnisotropicSampling(result, texture, 4, dudx, dvdx, dudy, dvdy, uv);
+				AnisotropicSampling(result, texture, 4, dudx, dvdx, dudy, dvdy, uv, TextureAddress);
+			}
+        }
+        // Samples the 4 fragments of a quad at once. The derivatives are taken from the quad's
+        // lane differences (see ComputeQuadDerivatives); the scalar path uses lane 1 - lane 0
+        // along x and lane 2 - lane 0 along y. Lanes left untouched by the filter
+        // (Linear with a NaN coordinate) keep the value passed in result.
+        inline void SampleTextureQuad(QuadColor * result, TextureData * texture, __m128 u, __m128 v)
+        {
+			CORE_LIB_ALIGN_16(float us[4]);
+			CORE_LIB_ALIGN_16(float vs[4]);
+			_mm_store_ps(us, u);
+			_mm_store_ps(vs, v);
+			float dudx = fabs(us[1] - us[0]);
+			float dudy = fabs(us[2] - us[0]);
+			float dvdx = fabs(vs[1] - vs[0]);
+			float dvdy = fabs(vs[2] - vs[0]);
+			if (ScalarTextureSampling || PerPixelTextureFootprint)
+			{
+				// lanes are (x, y) = (0, 0), (1, 0), (0, 1), (1, 1); a per-pixel footprint takes the
+				// x derivative from the fragment's row and the y derivative from its column
+				int rowOther[4] = {1, 0, 3, 2};
+				int columnOther[4] = {2, 3, 0, 1};
+				CORE_LIB_ALIGN_16(float channels[4][4]);
+				_mm_store_ps(channels[0], result->R);
+				_mm_store_ps(channels[1], result->G);
+				_mm_store_ps(channels[2], result->B);
+				_mm_store_ps(channels[3], result->A);
+				for (int i = 0; i < 4; i++)
+				{
+					Vec2 uv = Vec2(us[i], vs[i]);
+					if (TextureAddress == TextureAddressMode::Wrap)
+					{
+						uv.x -= floor(uv.x);
+						uv.y -= floor(uv.y);
+					}
+					Vec4 color = Vec4(channels[0][i], channels[1][i], channels[2][i], channels[3][i]);
+					if (PerPixelTextureFootprint)
+					{
+						SampleTexture(&color, texture, 16, fabs(us[rowOther[i]] - us[i]), fabs(vs[rowOther[i]] - vs[i]),
+							fabs(us[columnOther[i]] - us[i]), fabs(vs[columnOther[i]] - vs[i]), uv);
+					}
+					else
+						SampleTexture(&color, texture, 16, dudx, dvdx, dudy, dvdy, uv);
+					channels[0][i] = color.x;
+					channels[1][i] = color.y;
+					channels[2][i] = color.z;
+					channels[3][i] = color.w;
+				}
+				result->R = _mm_load_ps(channels[0]);
+				result->G = _mm_load_ps(channels[1]);
+				result->B = _mm_load_ps(channels[2]);
+				result->A = _mm_load_ps(channels[3]);
+				return;
+			}
+			QuadDerivatives derivatives;
+			ComputeQuadDerivatives(derivatives, u, v);
+			switch (this->TextureFilter)
+			{
+			case RasterRenderer::TextureFilter::Linear:
+				LinearSamplingQuad(*result, texture, u, v, TextureAddress);
+				break;
+			case RasterRenderer::TextureFilter::TriLinear:
+				TrilinearSamplingQuad(*result, texture, derivatives, u, v, 0, TextureAddress);
+				break;
+			case RasterRenderer::TextureFilter::Nearest:
+				NearestSamplingQuad(*result, texture, u, v, TextureAddress);
+				break;
+			case RasterRenderer::TextureFilter::Anisotropic16x:
+			case RasterRenderer::TextureFilter::Anisotropic8x:
+			case RasterRenderer::TextureFilter::Anisotropic4x:
+				AnisotropicSamplingQuad(*result, texture, (int)this->TextureFilter, derivatives, u, v, TextureAddress);
+				break;
 			}
         }
     };
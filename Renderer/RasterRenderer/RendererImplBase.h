@@ -8,6 +8,7 @@
 #include "Parallel.h"
 #include "Rasterizer.h"
 #include "Statistics.h"
+#include "ForwardLightingShader.h"
 #include "CoreLib/LibIO.h"
 #include "CoreLib/PerformanceCounter.h"
 #include <atomic>
@@ -100,7 +101,20 @@ namespace RasterRenderer
         List<ProjectedTriangle> triangleBuffer[Cores];
         List<float> vertexOutputBuffer[Cores];
         List<int> indexOutputBuffer[Cores];
+        int vertexCacheVersions[Cores] = {}; // per renderer, so that renderers can run side by side
         int SegmentMask;
+        // Bytes of the per-core buffers, which keep the capacity of the largest batch so far
+        int GetMemorySize() const
+        {
+            int size = 0;
+            for (int i = 0; i < Cores; i++)
+            {
+                size += (tessVertBuffer[i].Capacity() + vertexOutputBuffer[i].Capacity()) * (int)sizeof(float);
+                size += (vertexMap[i].Capacity() + indexOutputBuffer[i].Capacity()) * (int)sizeof(int);
+                size += triangleBuffer[i].Capacity() * (int)sizeof(ProjectedTriangle);
+            }
+            return size;
+        }
     public:
         // an iterator that records the consume progress of setup triangles, for all cores.
         // because the triangle setup is processed by many threads, each thread will write setup
@@ -335,7 +349,6 @@ namespace RasterRenderer
 
             Parallel::For(0, Cores, [&, this](int threadId)
             {
-                static int vertexCacheVersions[Cores];
                 Array<Vec3, MaxClipPlanes> clipDistances;
                 //TessellationResult tessResult;
                 float vertexOutputData[512];
@@ -363,6 +376,7 @@ namespace RasterRenderer
 
 
                 int vertCount = 0;
+                int verticesShaded = 0;
                 int tessVertCount = 0;
                 float * vertexSource = (float*)vertBuffer->GetDataPointer();
                 int vertexSize = vertBuffer->GetVertexSize();
@@ -411,6 +425,7 @@ namespace RasterRenderer
                                     vertexOutputData);
                                 vertexOutputBuffer[threadId].AddRange(vertexOutputData, vertexOutputSize);
                                 vertCount++;
+                                verticesShaded++;
                             }
                             index[i] = vertAttribLoc;
                         }
@@ -503,6 +518,7 @@ namespace RasterRenderer
                 {
                     vertexOutputBuffer[threadId][i*tessellatedVertexOutputSize + 3] = 1.0f / vertexOutputBuffer[threadId][i*tessellatedVertexOutputSize + 3];
                 }
+                Statistics::VertexShaderInvocations.fetch_add(verticesShaded, std::memory_order_relaxed);
             });
             return Math::Min(end, consumePtr.load(std::memory_order_relaxed));
         }
@@ -521,8 +537,23 @@ namespace RasterRenderer
         static const int batchSize = 1 << 12;
         // buffered triangle input
         ProjectedTriangleInput triangleInput;
+        // lighting shaders whose lights have been packed for the current frame
+        List<ForwardLightingShader*> preparedLightShaders;
+        // copy of the frame buffer kept by SaveStaticLayer
+        FrameBuffer staticLayer;
+        bool hasStaticLayer;
+
+        inline void PrepareLights(RenderState & state)
+        {
+            ForwardLightingShader * lightingShader = dynamic_cast<ForwardLightingShader*>(state.Shader);
+            if (!lightingShader || preparedLightShaders.IndexOf(lightingShader) != -1)
+                return;
+            lightingShader->UpdateLights(state);
+            preparedLightShaders.Add(lightingShader);
+        }
     public:
         RendererImplBase()
+            : frameBuffer(nullptr), hasStaticLayer(false)
         {
             renderAlgorithm.Init();
         }
@@ -542,6 +573,7 @@ namespace RasterRenderer
             halfWidth = screenWidth*0.5f;
             halfHeight = screenHeight*0.5f;
             renderAlgorithm.SetFrameBuffer(frameBuffer);
+            hasStaticLayer = false;
         }
 
         virtual void Draw(RenderState & state, VertexBufferRef * vertBuffer, IndexBufferRef * indexBuffer, int * constantIndex)
@@ -552,6 +584,7 @@ namespace RasterRenderer
             IndexBufferRef & index = *indexBuffer;
             int i = 0;
             int vertexOutputSize = state.Shader->GetTessellatedVertexOutputSize();
+            PrepareLights(state);
             
             while (i < indexBuffer->Count())
             {
@@ -570,9 +603,45 @@ namespace RasterRenderer
         {
             // tell the renderer to clear framebuffer.
             renderAlgorithm.Clear(clearColor, color, depth);
+            preparedLightShaders.Clear();
             if (mask)
                 frameBuffer->ClearMask();
         }
+
+        virtual void SaveStaticLayer()
+        {
+            if (staticLayer.GetWidth() != screenWidth || staticLayer.GetHeight() != screenHeight ||
+                staticLayer.GetSampleCountLog2() != frameBuffer->GetSampleCountLog2())
+                staticLayer.SetSize(screenWidth, screenHeight, frameBuffer->GetSampleCountLog2());
+            renderAlgorithm.SaveStaticLayer(staticLayer);
+            hasStaticLayer = true;
+        }
+
+        virtual bool RestoreStaticLayer()
+        {
+            if (!hasStaticLayer)
+                return false;
+            renderAlgorithm.RestoreStaticLayer(staticLayer);
+            // the lights are packed again for the frame's dynamic draws, as after Clear
+            preparedLightShaders.Clear();
+            return true;
+        }
+
+        virtual void SetDirtyTileTracking(bool enable)
+        {
+            renderAlgorithm.SetDirtyTileTracking(enable);
+        }
+
+        virtual bool GetChangedRegion(List<PixelRect> & rects)
+        {
+            return renderAlgorithm.GetChangedRegion(rects);
+        }
+
+        virtual int GetMemorySize()
+        {
+            return triangleInput.GetMemorySize() + renderAlgorithm.GetMemorySize() +
+                (hasStaticLayer ? staticLayer.GetMemorySize() : 0);
+        }
     };
 
     inline void ShadeFragment_DebugShowId(RenderState & state, float shadeResult[16], int id)
@@ -0,0 +1,233 @@
+#include "ResourceManager.h"
+#include "CoreLib/LibIO.h"
+#include "Parallel.h"
+using namespace CoreLib::IO;
+using CoreLib::Int64;
+
+namespace RasterRenderer
+{
+    bool ResourceManager::Enabled = false;
+
+    ResourceManager & ResourceManager::Global()
+    {
+        static ResourceManager manager;
+        return manager;
+    }
+
+    void ResourceManager::LoadTextures(const List<String> & files, const List<ModelImageData> & images, List<RefPtr<TextureData>> & result)
+    {
+        int count = files.Count();
+        auto getImage = [&](int i)
+        {
+            return i < images.Count() ? images[i] : ModelImageData{nullptr, 0};
+        };
+        result.SetSize(count);
+        for (auto & texture : result)
+            texture = nullptr;
+        // content hash and size of each texture not found by name; size -1 if the file cannot be read
+        List<unsigned long long> hashes;
+        List<Int64> sizes;
+        hashes.SetSize(count);
+        sizes.SetSize(count);
+        List<int> missing, pending, hits;
+        for (int i = 0; i < count; i++)
+        {
+            unsigned long long hash;
+            SharedTexture shared;
+            if (Enabled && !getImage(i).Data && textureHashes.TryGetValue(files[i], hash) && textures.TryGetValue(hash, shared))
+            {
+                result[i] = shared.Texture;
+                hits.Add(i);
+            }
+            else
+                missing.Add(i);
+        }
+        if (Enabled)
+        {
+            Parallel::For(0, missing.Count(), 1, [&](int m)
+            {
+                int i = missing[m];
+                ModelImageData image = getImage(i);
+                sizes[i] = -1;
+                if (image.Data)
+                {
+                    hashes[i] = ComputeHash64(image.Data, image.Size);
+                    sizes[i] = image.Size;
+                    return;
+                }
+                try
+                {
+                    MemoryMappedFile file(files[i]);
+                    hashes[i] = ComputeHash64(file.Buffer(), file.Size());
+                    sizes[i] = file.Size();
+                }
+                catch (IOException &)
+                {
+                }
+            });
+        }
+        // the first request for a content decodes it, later ones in this call share it
+        List<int> sameAs;
+        sameAs.SetSize(count);
+        for (int i : missing)
+        {
+            sameAs[i] = -1;
+            SharedTexture shared;
+            if (Enabled && sizes[i] != -1 && textures.TryGetValue(hashes[i], shared) && shared.SourceSize == sizes[i])
+            {
+                result[i] = shared.Texture;
+                hits.Add(i);
+                if (!getImage(i).Data)
+                    textureHashes[files[i]] = hashes[i];
+                continue;
+            }
+            if (Enabled && sizes[i] != -1)
+            {
+                for (int j : pending)
+                    if (hashes[j] == hashes[i] && sizes[j] == sizes[i])
+                    {
+                        sameAs[i] = j;
+                        break;
+                    }
+            }
+            if (sameAs[i] == -1)
+                pending.Add(i);
+            else
+                hits.Add(i);
+        }
+        // decode the distinct textures concurrently; each one also filters its mip levels in parallel
+        List<TextureData *> decoded;
+        decoded.SetSize(count);
+        Parallel::For(0, pending.Count(), 1, [&](int p)
+        {
+            int i = pending[p];
+            ModelImageData image = getImage(i);
+            decoded[i] = nullptr;
+            try
+            {
+                if (image.Data)
+                    decoded[i] = new TextureData(files[i], image.Data, image.Size, Parallel::Tasks());
+                else
+                    decoded[i] = new TextureData(files[i], Parallel::Tasks());
+            }
+            catch (IOException &)
+            {
+            }
+        });
+        for (int i : pending)
+        {
+            if (!decoded[i])
+            {
+                printf("Cannot load texture \"%s\"\n", files[i].ToMultiByteString());
+                result[i] = new TextureData();
+                continue;
+            }
+            result[i] = decoded[i];
+            statistics.TextureLoads++;
+            statistics.LoadedMemory += result[i]->GetMemorySize();
+            if (Enabled && sizes[i] != -1)
+            {
+                SharedTexture shared;
+                shared.Texture = result[i];
+                shared.SourceSize = sizes[i];
+                textures[hashes[i]] = shared;
+                if (!getImage(i).Data)
+                    textureHashes[files[i]] = hashes[i];
+            }
+        }
+        for (int i : hits)
+        {
+            if (!result[i])
+            {
+                result[i] = result[sameAs[i]];
+                if (!getImage(i).Data && decoded[sameAs[i]])
+                    textureHashes[files[i]] = hashes[i];
+            }
+            statistics.TextureHits++;
+            statistics.SharedMemory += result[i]->GetMemorySize();
+        }
+    }
+
+    bool ResourceManager::FindModel(const String & key, RefPtr<ModelResource> & model)
+    {
+        if (!Enabled || !models.TryGetValue(key, model))
+            return false;
+        statistics.ModelHits++;
+        statistics.SharedMemory += model->GetGeometryMemory() + model->GetTextureMemory();
+        return true;
+    }
+
+    void ResourceManager::AddModel(const String & key, RefPtr<ModelResource> & model)
+    {
+        // its textures were counted as they loaded
+        statistics.ModelLoads++;
+        statistics.LoadedMemory += model->GetGeometryMemory();
+        if (Enabled)
+            models[key] = model;
+    }
+
+    RefPtr<ModelResource> ResourceManager::LoadModel(const String & fileName)
+    {
+        return GetModel(fileName, [&]() { return ModelResource::FromFile(fileName); });
+    }
+
+    void ResourceManager::UnloadTexture(const String & fileName)
+    {
+        unsigned long long hash;
+        if (!textureHashes.TryGetValue(fileName, hash))
+            return;
+        textures.Remove(hash);
+        List<String> names;
+        for (auto & name : textureHashes)
+            if (name.Value == hash)
+                names.Add(name.Key);
+        for (auto & name : names)
+            textureHashes.Remove(name);
+    }
+
+    void ResourceManager::UnloadModel(const String & key)
+    {
+        models.Remove(key);
+    }
+
+    int ResourceManager::UnloadUnused()
+    {
+        // models first, they hold references to their textures
+        List<String> unusedModels;
+        for (auto & model : models)
+            if (model.Value.GetReferenceCount() == 1)
+                unusedModels.Add(model.Key);
+        for (auto & key : unusedModels)
+            models.Remove(key);
+        List<unsigned long long> unusedTextures;
+        for (auto & texture : textures)
+            if (texture.Value.Texture.GetReferenceCount() == 1)
+                unusedTextures.Add(texture.Key);
+        for (auto hash : unusedTextures)
+            textures.Remove(hash);
+        List<String> names;
+        for (auto & name : textureHashes)
+            if (!textures.ContainsKey(name.Value))
+                names.Add(name.Key);
+        for (auto & name : names)
+            textureHashes.Remove(name);
+        return unusedModels.Count() + unusedTextures.Count();
+    }
+
+    void ResourceManager::Clear()
+    {
+        models.Clear();
+        textures.Clear();
+        textureHashes.Clear();
+    }
+
+    Int64 ResourceManager::GetMemorySize()
+    {
+        Int64 size = 0;
+        for (auto & texture : textures)
+            size += texture.Value.Texture->GetMemorySize();
+        for (auto & model : models)
+            size += model.Value->GetGeometryMemory();
+        return size;
+    }
+}
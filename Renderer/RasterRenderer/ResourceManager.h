@@ -0,0 +1,86 @@
+#ifndef RASTER_RENDERER_RESOURCE_MANAGER_H
+#define RASTER_RENDERER_RESOURCE_MANAGER_H
+
+#include "ModelResource.h"
+#include "CoreLib/Dictionary.h"
+
+namespace RasterRenderer
+{
+    struct ResourceStatistics
+    {
+        int TextureLoads, TextureHits; // requests that decoded a texture, and that got an existing one
+        int ModelLoads, ModelHits;
+        CoreLib::Int64 LoadedMemory; // bytes of the textures and models loaded
+        CoreLib::Int64 SharedMemory; // bytes the hits would have loaded again without sharing
+        ResourceStatistics()
+            : TextureLoads(0), TextureHits(0), ModelLoads(0), ModelHits(0), LoadedMemory(0), SharedMemory(0)
+        {}
+    };
+
+    // Process-wide store of the textures and models that several ModelResources or scenes use.
+    // Textures are interned by file name and by a hash of their encoded contents, so an image under
+    // two names or embedded in two glTF files is decoded once; models are interned by file name, or
+    // by a key of the caller's choosing for models built in code. The manager holds a reference to
+    // everything it loaded until Unload, UnloadUnused or Clear drops it; other holders keep theirs.
+    // Textures are loaded with the TextureData options in effect at the first request.
+    // Not thread-safe: call it from one thread at a time, loads use the worker pool internally.
+    class ResourceManager
+    {
+    private:
+        struct SharedTexture
+        {
+            RefPtr<TextureData> Texture;
+            CoreLib::Int64 SourceSize;
+        };
+        Dictionary<String, unsigned long long> textureHashes; // file name to content hash
+        Dictionary<unsigned long long, SharedTexture> textures; // by content hash
+        Dictionary<String, RefPtr<ModelResource>> models;
+        ResourceStatistics statistics;
+        void AddModel(const String & key, RefPtr<ModelResource> & model);
+        bool FindModel(const String & key, RefPtr<ModelResource> & model);
+    public:
+        // Share through Global(); when false (the default) every request loads a private copy, as
+        // if there were no manager, so benchmarks that reload models measure the full load
+        static bool Enabled;
+        static ResourceManager & Global();
+        // Sets result[i] to the texture of files[i], decoded from images[i] where its Data is not null
+        // (images may be shorter than files). Textures not loaded yet are decoded concurrently.
+        // Unreadable textures are reported and replaced by an empty texture that is not interned.
+        void LoadTextures(const List<String> & files, const List<ModelImageData> & images, List<RefPtr<TextureData>> & result);
+        // ModelResource::FromFile, shared by file name. Throws IOException like FromFile.
+        RefPtr<ModelResource> LoadModel(const String & fileName);
+        // The model stored under key, or the one create() returns, stored under key
+        template<typename CreateFunc>
+        RefPtr<ModelResource> GetModel(const String & key, const CreateFunc & create)
+        {
+            RefPtr<ModelResource> model;
+            if (FindModel(key, model))
+                return model;
+            model = new ModelResource(create());
+            AddModel(key, model);
+            return model;
+        }
+        // Drop the manager's reference to one texture or model
+        void UnloadTexture(const String & fileName);
+        void UnloadModel(const String & key);
+        // Drops the models and textures that only the manager still references, and returns their count
+        int UnloadUnused();
+        void Clear();
+        int GetTextureCount()
+        {
+            return textures.Count();
+        }
+        int GetModelCount()
+        {
+            return models.Count();
+        }
+        // Bytes held by the interned textures and models, each counted once
+        CoreLib::Int64 GetMemorySize();
+        const ResourceStatistics & GetStatistics()
+        {
+            return statistics;
+        }
+    };
+}
+
+#endif
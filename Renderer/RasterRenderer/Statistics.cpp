@@ -9,6 +9,7 @@ namespace RasterRenderer
     std::atomic<int> Statistics::TrianglesProcessed;
     std::atomic<int> Statistics::TrianglesShaded;
     std::atomic<int> Statistics::ShadingCount;
+    std::atomic<int> Statistics::VertexShaderInvocations;
     std::atomic<long long> Statistics::Time_TriangleInput;
     std::atomic<long long> Statistics::Time_Render;
     std::atomic<int> Statistics::TriangleAreaHistogram[10];
@@ -12,6 +12,7 @@ namespace RasterRenderer
     {
     public:
         static std::atomic<int> ShadingCount;
+        static std::atomic<int> VertexShaderInvocations; // counted whether or not instrumentation is enabled
         static std::atomic<long long> Time_TriangleInput, Time_Render;
         static std::atomic<int> PackagesProcessed, PackagesCulled, PackagesOccluded;
         static std::atomic<int> CullingOverhead, TrianglesProcessed, TrianglesShaded;
@@ -25,6 +26,7 @@ namespace RasterRenderer
             TrianglesShaded.store(0);
             PackagesOccluded.store(0);
             ShadingCount.store(0);
+            VertexShaderInvocations.store(0);
             Time_TriangleInput.store(0);
             Time_Render.store(0);
             for (int i = 0; i<10; i++)
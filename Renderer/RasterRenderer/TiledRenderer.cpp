@@ -1,5 +1,6 @@
 #include "RendererImplBase.h"
 #include "CommonTraceCollection.h"
+#include "DirtyTiles.h"
 #include <algorithm>
 #include <immintrin.h>
 
@@ -33,15 +34,26 @@ namespace RasterRenderer
         
         vector<vector<TiledTriangle>> tileBins;
         vector<vector<TiledTriangle>> localTileBins[Cores];
+        DirtyTileSet dirtyTiles;
+        bool trackDirtyTiles;
+
+        inline void GetTileRect(int tileId, int & x, int & y, int & w, int & h)
+        {
+            x = (tileId % gridWidth) * TileSize;
+            y = (tileId / gridWidth) * TileSize;
+            w = min(TileSize, frameBuffer->GetWidth() - x);
+            h = min(TileSize, frameBuffer->GetHeight() - y);
+        }
     public:
         inline void Init()
         {
-
+            trackDirtyTiles = false;
         }
 
         inline void Clear(const Vec4 & clearColor, bool color, bool depth)
         {
             frameBuffer->Clear(clearColor, color, depth);
+            dirtyTiles.Invalidate();
         }
 
         inline void SetFrameBuffer(FrameBuffer * frameBuffer)
@@ -64,14 +76,83 @@ namespace RasterRenderer
             for (int threadId = 0; threadId < Cores; threadId++) {
                 localTileBins[threadId].assign(numTiles, vector<TiledTriangle>());
             }
+            dirtyTiles.SetTileCount(numTiles);
         }
 
         inline void Finish()
         {
-            // TODO: 
-            // Finish() is called at the end of the frame. If it hasn't done so, your
-            // implementation should flush local per-tile framebuffer contents to the 
-            // global frame buffer (this->frameBuffer) here.
+            // tiles that only the previous frame drew into get the static layer back
+            dirtyTiles.EndFrame([&](int tileId, FrameBuffer & layer)
+            {
+                int x, y, w, h;
+                GetTileRect(tileId, x, y, w, h);
+                frameBuffer->CopyRect(layer, x, y, w, h);
+            });
+        }
+
+        // copies the static layer out of and back into the frame buffer, one task per tile
+        inline void CopyTiles(FrameBuffer & dest, FrameBuffer & source)
+        {
+            Parallel::For(0, gridWidth*gridHeight, 1, [&](int tileId)
+            {
+                int x, y, w, h;
+                GetTileRect(tileId, x, y, w, h);
+                dest.CopyRect(source, x, y, w, h);
+            });
+        }
+
+        inline void SaveStaticLayer(FrameBuffer & layer)
+        {
+            CopyTiles(layer, *frameBuffer);
+            if (trackDirtyTiles)
+                dirtyTiles.BeginFrame(&layer, false);
+        }
+
+        inline void RestoreStaticLayer(FrameBuffer & layer)
+        {
+            bool continued = trackDirtyTiles && dirtyTiles.CanContinue();
+            if (!continued)
+                CopyTiles(*frameBuffer, layer);
+            if (trackDirtyTiles)
+                dirtyTiles.BeginFrame(&layer, continued);
+            else
+                dirtyTiles.Invalidate();
+        }
+
+        inline void SetDirtyTileTracking(bool enable)
+        {
+            trackDirtyTiles = enable;
+            dirtyTiles.Invalidate();
+        }
+
+        inline bool GetChangedRegion(List<PixelRect> & rects)
+        {
+            List<int> tiles;
+            rects.Clear();
+            if (!dirtyTiles.GetChangedTiles(tiles))
+                return false;
+            for (int tileId : tiles)
+            {
+                PixelRect rect;
+                GetTileRect(tileId, rect.X, rect.Y, rect.Width, rect.Height);
+                rects.Add(rect);
+            }
+            return true;
+        }
+
+        inline int GetMemorySize()
+        {
+            size_t size = 0;
+            auto addBins = [&](const vector<vector<TiledTriangle>> & bins)
+            {
+                size += bins.capacity() * sizeof(vector<TiledTriangle>);
+                for (auto & bin : bins)
+                    size += bin.capacity() * sizeof(TiledTriangle);
+            };
+            addBins(tileBins);
+            for (int threadId = 0; threadId < Cores; threadId++)
+                addBins(localTileBins[threadId]);
+            return (int)size;
         }
 
         inline void BinTriangles(RenderState & state, ProjectedTriangleInput & input, int vertexOutputSize, int threadId)
@@ -131,6 +212,11 @@ namespace RasterRenderer
             static __m128i xOffset = _mm_set_epi32(24, 8, 24, 8);
             static __m128i yOffset = _mm_set_epi32(24, 24, 8, 8);
             
+            if (tileBins[tileId].empty())
+                return;
+            if (FrameBuffer * layer = dirtyTiles.Draw(tileId))
+                frameBuffer->CopyRect(*layer, tilePixelX, tilePixelY, tilePixelW, tilePixelH);
+            
             for (const auto& tiledTri : tileBins[tileId]) {
                 ProjectedTriangle tri = tiledTri.triangle;
                 
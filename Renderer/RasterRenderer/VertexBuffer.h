@@ -75,7 +75,9 @@ namespace RasterRenderer
         }
     public:
         VertexBufferRef()
-        {}
+        {
+            SetReference(VertexFormat::Position, 0, 0);
+        }
         VertexBufferRef(VertexFormat format, int n, void * data)
         {
             SetReference(format, n, data);
@@ -204,6 +206,10 @@ namespace RasterRenderer
         {
             return bufferRef[id];
         }
+        int * GetDataPointer()
+        {
+            return bufferRef;
+        }
         inline ElementType GetElementType()
         {
             return elementType;
@@ -0,0 +1,321 @@
+#include "YuvConverter.h"
+#include "Parallel.h"
+#include "CoreLib/Basic.h"
+#include <math.h>
+#include <string.h>
+#include <smmintrin.h>
+
+using namespace CoreLib::Basic;
+
+namespace RasterRenderer
+{
+    namespace
+    {
+        // BT.709 luma weights
+        const float KR = 0.2126f, KB = 0.0722f, KG = 1.0f - KR - KB;
+
+        // From Y' in [0, 1] and B' - Y', R' - Y' to code values
+        struct YuvScale
+        {
+            float Luma, LumaOffset, Cb, Cr;
+            YuvScale(YuvRange range)
+            {
+                bool full = range == YuvRange::Full;
+                float chroma = full ? 255.0f : 224.0f;
+                Luma = full ? 255.0f : 219.0f;
+                LumaOffset = full ? 0.0f : 16.0f;
+                Cb = chroma / (2.0f * (1.0f - KB));
+                Cr = chroma / (2.0f * (1.0f - KR));
+            }
+        };
+
+        struct YuvPlanes
+        {
+            unsigned char * Luma, * U, * V; // Nv12: U points to the interleaved plane and V is U + 1
+            int ChromaWidth, ChromaHeight, ChromaStride, ChromaStep;
+            YuvPlanes(unsigned char * result, int width, int height, YuvLayout layout)
+            {
+                ChromaWidth = (width + 1) / 2;
+                ChromaHeight = (height + 1) / 2;
+                Luma = result;
+                U = result + width * height;
+                if (layout == YuvLayout::Nv12)
+                {
+                    V = U + 1;
+                    ChromaStride = ChromaWidth * 2;
+                    ChromaStep = 2;
+                }
+                else
+                {
+                    V = U + ChromaWidth * ChromaHeight;
+                    ChromaStride = ChromaWidth;
+                    ChromaStep = 1;
+                }
+            }
+        };
+
+        inline unsigned char ToCode(float x)
+        {
+            int v = (int)floorf(x + 0.5f);
+            return (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+        }
+
+        inline float Saturate(float x)
+        {
+            return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+        }
+
+        // BT.709 opto-electronic transfer function
+        inline float EncodeGamma(float x)
+        {
+            return x < 0.018f ? 4.5f * x : 1.099f * powf(x, 0.45f) - 0.099f;
+        }
+
+        // EncodeGamma of saturated x; the power's result is discarded below 0.018, where log2 of 0 is
+        // not defined
+        inline __m128 EncodeGamma(__m128 x)
+        {
+            __m128 power = _mm_pow_ps(_mm_max_ps(x, _mm_set1_ps(0.018f)), _mm_set1_ps(0.45f));
+            __m128 curve = _mm_sub_ps(_mm_mul_ps(power, _mm_set1_ps(1.099f)), _mm_set1_ps(0.099f));
+            __m128 line = _mm_mul_ps(x, _mm_set1_ps(4.5f));
+            return _mm_blendv_ps(curve, line, _mm_cmplt_ps(x, _mm_set1_ps(0.018f)));
+        }
+
+        inline __m128 Saturate(__m128 x)
+        {
+            return _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+        }
+
+        // The average of a pixel's samples
+        inline __m128 LoadPixel(const Vec4 * samples, int sampleCount, __m128 sampleWeight)
+        {
+            __m128 sum = _mm_loadu_ps(&samples->x);
+            if (sampleCount == 1)
+                return sum;
+            for (int i = 1; i < sampleCount; i++)
+                sum = _mm_add_ps(sum, _mm_loadu_ps(&samples[i].x));
+            return _mm_mul_ps(sum, sampleWeight);
+        }
+
+        // The saturated, encoded red, green and blue of four pixels, one lane each
+        inline void LoadQuad(const Vec4 * samples, int sampleCount, __m128 sampleWeight, bool encodeGamma,
+            __m128 & r, __m128 & g, __m128 & b)
+        {
+            __m128 p0 = LoadPixel(samples, sampleCount, sampleWeight);
+            __m128 p1 = LoadPixel(samples + sampleCount, sampleCount, sampleWeight);
+            __m128 p2 = LoadPixel(samples + sampleCount * 2, sampleCount, sampleWeight);
+            __m128 p3 = LoadPixel(samples + sampleCount * 3, sampleCount, sampleWeight);
+            _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+            r = Saturate(p0);
+            g = Saturate(p1);
+            b = Saturate(p2);
+            if (encodeGamma)
+            {
+                r = EncodeGamma(r);
+                g = EncodeGamma(g);
+                b = EncodeGamma(b);
+            }
+        }
+
+        inline __m128 GetLuma(__m128 r, __m128 g, __m128 b)
+        {
+            return _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(KR)), _mm_mul_ps(g, _mm_set1_ps(KG))),
+                _mm_mul_ps(b, _mm_set1_ps(KB)));
+        }
+
+        // The scalar path for the columns after the last whole group of eight
+        inline void LoadPixel(const Vec4 * samples, int sampleCount, bool encodeGamma, float rgb[3])
+        {
+            Vec4 sum = samples[0];
+            for (int i = 1; i < sampleCount; i++)
+                sum += samples[i];
+            sum *= 1.0f / sampleCount;
+            rgb[0] = Saturate(sum.x);
+            rgb[1] = Saturate(sum.y);
+            rgb[2] = Saturate(sum.z);
+            if (encodeGamma)
+            {
+                for (int i = 0; i < 3; i++)
+                    rgb[i] = EncodeGamma(rgb[i]);
+            }
+        }
+
+        // Luma rows 2 * cy and 2 * cy + 1, if there is one, and chroma row cy
+        void ConvertRowPair(const Vec4 * samples, int width, int height, int sampleCount, const YuvFormat & format,
+            const YuvScale & scale, const YuvPlanes & planes, int cy)
+        {
+            int rows = Math::Min(2, height - cy * 2);
+            const Vec4 * source[2];
+            unsigned char * luma[2];
+            for (int i = 0; i < 2; i++)
+            {
+                int y = cy * 2 + Math::Min(i, rows - 1);
+                source[i] = samples + (height - 1 - y) * width * sampleCount;
+                luma[i] = planes.Luma + y * width;
+            }
+            unsigned char * u = planes.U + cy * planes.ChromaStride;
+            unsigned char * v = planes.V + cy * planes.ChromaStride;
+
+            __m128 sampleWeight = _mm_set1_ps(1.0f / sampleCount);
+            __m128 lumaScale = _mm_set1_ps(scale.Luma), lumaOffset = _mm_set1_ps(scale.LumaOffset);
+            __m128 cbScale = _mm_set1_ps(scale.Cb), crScale = _mm_set1_ps(scale.Cr), chromaOffset = _mm_set1_ps(128.0f);
+            int x = 0;
+            for (; x + 8 <= width; x += 8)
+            {
+                __m128 rSum[2], gSum[2], bSum[2];
+                for (int i = 0; i < 2; i++)
+                {
+                    __m128i codes[2];
+                    for (int half = 0; half < 2; half++)
+                    {
+                        __m128 r, g, b;
+                        LoadQuad(source[i] + (x + half * 4) * sampleCount, sampleCount, sampleWeight, format.EncodeGamma, r, g, b);
+                        codes[half] = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(GetLuma(r, g, b), lumaScale), lumaOffset));
+                        if (i == 0)
+                        {
+                            rSum[half] = r;
+                            gSum[half] = g;
+                            bSum[half] = b;
+                        }
+                        else
+                        {
+                            rSum[half] = _mm_add_ps(rSum[half], r);
+                            gSum[half] = _mm_add_ps(gSum[half], g);
+                            bSum[half] = _mm_add_ps(bSum[half], b);
+                        }
+                    }
+                    if (i < rows)
+                    {
+                        __m128i words = _mm_packs_epi32(codes[0], codes[1]);
+                        _mm_storel_epi64((__m128i*)(luma[i] + x), _mm_packus_epi16(words, words));
+                    }
+                }
+                // neighbouring lanes are the two columns of a chroma sample
+                __m128 quarter = _mm_set1_ps(0.25f);
+                __m128 r = _mm_mul_ps(_mm_hadd_ps(rSum[0], rSum[1]), quarter);
+                __m128 g = _mm_mul_ps(_mm_hadd_ps(gSum[0], gSum[1]), quarter);
+                __m128 b = _mm_mul_ps(_mm_hadd_ps(bSum[0], bSum[1]), quarter);
+                __m128 y = GetLuma(r, g, b);
+                __m128i cb = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(b, y), cbScale), chromaOffset));
+                __m128i cr = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(r, y), crScale), chromaOffset));
+                __m128i words = _mm_packs_epi32(cb, cr);
+                __m128i bytes = _mm_packus_epi16(words, words); // four U, then four V
+                int cx = x / 2;
+                if (format.Layout == YuvLayout::Nv12)
+                    _mm_storel_epi64((__m128i*)(u + cx * 2), _mm_unpacklo_epi8(bytes, _mm_srli_si128(bytes, 4)));
+                else
+                {
+                    int cbBytes = _mm_cvtsi128_si32(bytes), crBytes = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 4));
+                    memcpy(u + cx, &cbBytes, 4);
+                    memcpy(v + cx, &crBytes, 4);
+                }
+            }
+            for (int cx = x / 2; cx < planes.ChromaWidth; cx++)
+            {
+                int columns = Math::Min(2, width - cx * 2);
+                float sum[3] = {0.0f, 0.0f, 0.0f};
+                for (int i = 0; i < rows; i++)
+                {
+                    for (int j = 0; j < columns; j++)
+                    {
+                        float rgb[3];
+                        LoadPixel(source[i] + (cx * 2 + j) * sampleCount, sampleCount, format.EncodeGamma, rgb);
+                        luma[i][cx * 2 + j] = ToCode((KR * rgb[0] + KG * rgb[1] + KB * rgb[2]) * scale.Luma + scale.LumaOffset);
+                        for (int k = 0; k < 3; k++)
+                            sum[k] += rgb[k];
+                    }
+                }
+                float weight = 1.0f / (rows * columns);
+                float r = sum[0] * weight, g = sum[1] * weight, b = sum[2] * weight;
+                float y = KR * r + KG * g + KB * b;
+                u[cx * planes.ChromaStep] = ToCode((b - y) * scale.Cb + 128.0f);
+                v[cx * planes.ChromaStep] = ToCode((r - y) * scale.Cr + 128.0f);
+            }
+        }
+    }
+
+    int GetYuv420Size(int width, int height)
+    {
+        return width * height + ((width + 1) / 2) * ((height + 1) / 2) * 2;
+    }
+
+    void ConvertToYuv420(const Vec4 * samples, int width, int height, int sampleCount, const YuvFormat & format,
+        unsigned char * result, bool parallel)
+    {
+        YuvScale scale(format.Range);
+        YuvPlanes planes(result, width, height, format.Layout);
+        auto convert = [&](int cy)
+        {
+            ConvertRowPair(samples, width, height, sampleCount, format, scale, planes, cy);
+        };
+        // bands of 16 rows
+        if (parallel)
+            Parallel::For(0, planes.ChromaHeight, 8, convert);
+        else
+            Parallel::SerialFor(0, planes.ChromaHeight, convert);
+    }
+
+    void ConvertToYuv420Reference(const Vec4 * samples, int width, int height, int sampleCount, const YuvFormat & format,
+        unsigned char * result)
+    {
+        const double kr = 0.2126, kb = 0.0722, kg = 1.0 - kr - kb;
+        bool full = format.Range == YuvRange::Full;
+        double lumaScale = full ? 255.0 : 219.0, lumaOffset = full ? 0.0 : 16.0, chromaScale = full ? 255.0 : 224.0;
+        auto toCode = [](double x)
+        {
+            int v = (int)floor(x + 0.5);
+            return (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+        };
+        // the resolved, saturated and encoded color of the pixel at (x, y) from the top
+        auto getColor = [&](int x, int y, double rgb[3])
+        {
+            const Vec4 * pixel = samples + ((height - 1 - y) * width + x) * sampleCount;
+            for (int c = 0; c < 3; c++)
+            {
+                double sum = 0.0;
+                for (int i = 0; i < sampleCount; i++)
+                    sum += (&pixel[i].x)[c];
+                double value = sum / sampleCount;
+                value = value < 0.0 ? 0.0 : (value > 1.0 ? 1.0 : value);
+                if (format.EncodeGamma)
+                    value = value < 0.018 ? 4.5 * value : 1.099 * pow(value, 0.45) - 0.099;
+                rgb[c] = value;
+            }
+        };
+
+        YuvPlanes planes(result, width, height, format.Layout);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                double rgb[3];
+                getColor(x, y, rgb);
+                planes.Luma[y * width + x] = toCode((kr * rgb[0] + kg * rgb[1] + kb * rgb[2]) * lumaScale + lumaOffset);
+            }
+        }
+        for (int cy = 0; cy < planes.ChromaHeight; cy++)
+        {
+            for (int cx = 0; cx < planes.ChromaWidth; cx++)
+            {
+                double sum[3] = {0.0, 0.0, 0.0};
+                int count = 0;
+                for (int y = cy * 2; y < Math::Min(cy * 2 + 2, height); y++)
+                {
+                    for (int x = cx * 2; x < Math::Min(cx * 2 + 2, width); x++)
+                    {
+                        double rgb[3];
+                        getColor(x, y, rgb);
+                        for (int c = 0; c < 3; c++)
+                            sum[c] += rgb[c];
+                        count++;
+                    }
+                }
+                double r = sum[0] / count, g = sum[1] / count, b = sum[2] / count;
+                double luma = kr * r + kg * g + kb * b;
+                int offset = cy * planes.ChromaStride + cx * planes.ChromaStep;
+                planes.U[offset] = toCode((b - luma) * chromaScale / (2.0 * (1.0 - kb)) + 128.0);
+                planes.V[offset] = toCode((r - luma) * chromaScale / (2.0 * (1.0 - kr)) + 128.0);
+            }
+        }
+    }
+}
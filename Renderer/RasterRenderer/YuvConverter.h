@@ -0,0 +1,52 @@
+#ifndef RASTER_RENDERER_YUV_CONVERTER_H
+#define RASTER_RENDERER_YUV_CONVERTER_H
+
+#include "CoreLib/VectorMath.h"
+
+namespace RasterRenderer
+{
+    using namespace VectorMath;
+
+    enum class YuvLayout
+    {
+        I420, // planes Y, U, V
+        Nv12  // plane Y, then U and V interleaved
+    };
+
+    enum class YuvRange
+    {
+        Limited, // Y 16-235, U and V 16-240
+        Full     // 0-255
+    };
+
+    // 4:2:0 BT.709 output of a frame buffer's color
+    struct YuvFormat
+    {
+        YuvLayout Layout;
+        YuvRange Range;
+        // The color is linear light and gets the BT.709 transfer function; otherwise it is taken as
+        // already encoded, as the BMP writer takes it
+        bool EncodeGamma;
+        YuvFormat()
+            : Layout(YuvLayout::I420), Range(YuvRange::Limited), EncodeGamma(false)
+        {}
+    };
+
+    // Bytes of a width x height frame, whose chroma planes are (width + 1) / 2 x (height + 1) / 2
+    int GetYuv420Size(int width, int height);
+
+    // Converts color samples, sampleCount per pixel one after the other and rows from the bottom of
+    // the image up as in FrameBuffer, to a top-down 4:2:0 frame in one pass: each task resolves the
+    // samples of two rows, encodes them and writes their luma and their row of chroma, which
+    // averages the saturated colors of the up to four pixels a chroma sample covers. Runs on SSE,
+    // over bands of rows on the worker pool if parallel.
+    void ConvertToYuv420(const Vec4 * samples, int width, int height, int sampleCount, const YuvFormat & format,
+        unsigned char * result, bool parallel = true);
+
+    // The same, one pixel at a time in double precision, for checking ConvertToYuv420; a value may
+    // differ from it by one where the rounding falls differently
+    void ConvertToYuv420Reference(const Vec4 * samples, int width, int height, int sampleCount, const YuvFormat & format,
+        unsigned char * result);
+}
+
+#endif
@@ -7,6 +7,8 @@
 #include "CoreLib/PerformanceCounter.h"
 #include "CoreLib/LibIO.h"
 #include "CoreLib/VectorMath.h"
+#include "CoreLib/Imaging/Bitmap.h"
+#include "CoreLib/Imaging/TextureData.h"
 #include <iostream>
 #include <iomanip>
 #include <vector>
@@ -15,6 +17,11 @@
 #include <map>
 #include <algorithm>
 #include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
 
 using namespace CoreLib::Basic;
 using namespace CoreLib::Diagnostics;
@@ -48,6 +55,86 @@ struct LightScalingResult
     double speedup; // deferred/forward time ratio (< 1 means deferred is faster)
 };
 
+struct LightCullingResult
+{
+    String rendererName;
+    int lightCount;
+    LightCullingMode mode;
+    double avgFrameTimeMs;
+    double gridBuildMs;        // time to rebuild the light grid once
+    float lightsPerCluster;    // average light list length
+    float maxColorDiff;        // max channel difference against the unculled frame
+};
+
+struct StaticLayerResult
+{
+    String rendererName;
+    bool dirtyTiles;           // only the tiles drawn into by the frame or the one before it were restored
+    int frameCount;
+    double fullFrameTimeMs;    // Clear and Draw of the whole scene
+    double layerFrameTimeMs;   // static layer restore and player draws, the first frame excluded
+    double layerBuildTimeMs;   // first frame, which draws and saves the static layer
+    int mismatchedFrames;      // frames whose color buffer differs from the full render in any bit
+    int mismatchedFiles;       // dirty tiles: frames whose incrementally converted BMP differs from a full one
+    float maxColorDiff;
+};
+
+struct ImageFormatResult
+{
+    String writerName;
+    int frameCount;
+    double saveTimeMs;         // per frame: conversion, encoding and writing the file
+    double megabytesPerSecond; // of 24-bit pixels saved
+    double fileBytes;          // average file size
+    int mismatchedFrames;      // PNG and QOI: frames that decode to other pixels than the BMP
+};
+
+struct LightingKernelResult
+{
+    int lightCount;
+    LightKernel kernel;
+    double cyclesPerFragment;  // __rdtsc ticks per shaded fragment
+    double nsPerFragment;
+    float maxColorDiff;        // max channel difference against the reference kernel
+};
+
+struct YuvConversionResult
+{
+    int width, height, sampleCount;
+    YuvFormat format;
+    double referenceMs;        // scalar double precision reference, one thread
+    double vectorMs;           // SSE, one thread
+    double parallelMs;         // SSE over bands of rows on the worker pool
+    int maxDiff;               // largest code value difference against the reference
+    double differingValues;    // fraction of code values that differ at all
+};
+
+static const char * GetLightKernelName(LightKernel kernel)
+{
+    switch (kernel)
+    {
+    case LightKernel::FragmentLanes:
+        return "FragmentLanes";
+    case LightKernel::LightLanes:
+        return "LightLanes";
+    default:
+        return "Reference";
+    }
+}
+
+static const char * GetLightCullingModeName(LightCullingMode mode)
+{
+    switch (mode)
+    {
+    case LightCullingMode::Tiled:
+        return "Tiled";
+    case LightCullingMode::Clustered:
+        return "Clustered";
+    default:
+        return "None";
+    }
+}
+
 class NFLRendererComparison
 {
 private:
@@ -67,6 +154,7 @@ private:
     void SetupLightsWithCount(ForwardLightingShader* shader, int numLights)
     {
         shader->Lights.Clear();
+        shader->InvalidateLights();
         
         // Always add at least one directional light (sun)
         ForwardLightingShader::Light sunLight;
@@ -954,20 +1042,823 @@ public:
         file.close();
         printf("Light scaling CSV saved to: %s\n", outputPath.ToMultiByteString());
     }
+    
+    // Benchmark one renderer with a given light count and culling mode.
+    // The first frame is compared against referenceFrame (filled when mode is None).
+    LightCullingResult BenchmarkLightCulling(bool deferred, int numLights, LightCullingMode mode, int maxFrames, List<Vec4> & referenceFrame)
+    {
+        printf("  %s, %d lights, %s culling (%d frames)...\n", deferred ? "Deferred" : "Forward", numLights, GetLightCullingModeName(mode), maxFrames);
+        fflush(stdout);
+        
+        FrameBuffer frameBuffer(width, height);
+        IRasterRenderer* renderer = deferred ? CreateDeferredTiledRenderer() : CreateTiledRenderer();
+        renderer->SetFrameBuffer(&frameBuffer);
+        
+        RefPtr<NFLPlayScene> scene = new NFLPlayScene(viewSettings, stadiumModelPath, playData);
+        
+        ForwardLightingShader* shader = new ForwardLightingShader();
+        shader->CameraPosition = Vec3(60.0f, 60.0f, 50.0f);
+        shader->Shininess = 32.0f;
+        shader->SpecularColor = Vec3(0.5f, 0.5f, 0.5f);
+        shader->LightCulling = mode;
+        SetupLightsWithCount(shader, numLights);
+        scene->SetShader(shader);
+        
+        // Warmup frame doubles as the correctness check
+        scene->SetStep(playData.steps[0]);
+        renderer->Clear(scene->ClearColor);
+        scene->Draw(renderer);
+        renderer->Finish();
+        
+        LightCullingResult result;
+        result.rendererName = deferred ? L"Deferred" : L"Forward";
+        result.lightCount = numLights;
+        result.mode = mode;
+        result.maxColorDiff = 0.0f;
+        
+        Vec4 * pixels = frameBuffer.GetColorBuffer();
+        int pixelCount = width * height;
+        if (mode == LightCullingMode::None)
+        {
+            referenceFrame.SetSize(pixelCount);
+            memcpy(referenceFrame.Buffer(), pixels, pixelCount * sizeof(Vec4));
+        }
+        else if (referenceFrame.Count() == pixelCount)
+        {
+            for (int i = 0; i < pixelCount; i++)
+            {
+                result.maxColorDiff = std::max(result.maxColorDiff, fabsf(pixels[i].x - referenceFrame[i].x));
+                result.maxColorDiff = std::max(result.maxColorDiff, fabsf(pixels[i].y - referenceFrame[i].y));
+                result.maxColorDiff = std::max(result.maxColorDiff, fabsf(pixels[i].z - referenceFrame[i].z));
+            }
+        }
+        
+        double totalTime = 0.0;
+        int frameCount = std::min(maxFrames, (int)playData.steps.size());
+        for (int i = 0; i < frameCount; i++)
+        {
+            scene->SetStep(playData.steps[i]);
+            
+            auto counter = PerformanceCounter::Start();
+            renderer->Clear(scene->ClearColor);
+            scene->Draw(renderer);
+            renderer->Finish();
+            totalTime += PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)) * 1000.0;
+        }
+        result.avgFrameTimeMs = totalTime / frameCount;
+        
+        // Light packing and grid construction cost in isolation (included in the frame time above)
+        result.gridBuildMs = 0.0;
+        result.lightsPerCluster = (float)numLights;
+        if (mode != LightCullingMode::None)
+        {
+            const int buildRuns = 10;
+            auto counter = PerformanceCounter::Start();
+            for (int i = 0; i < buildRuns; i++)
+                shader->UpdateLights(scene->State);
+            result.gridBuildMs = PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)) * 1000.0 / buildRuns;
+            result.lightsPerCluster = shader->LightGrid.GetAverageLightsPerCluster();
+        }
+        
+        printf("    %.2f ms/frame (grid build %.3f ms, %.1f lights/cluster, max diff %g)\n",
+            result.avgFrameTimeMs, result.gridBuildMs, result.lightsPerCluster, result.maxColorDiff);
+        
+        DestroyRenderer(renderer);
+        return result;
+    }
+    
+    static bool ReadFileBytes(const String & fileName, std::vector<char> & bytes)
+    {
+        std::ifstream file(fileName.ToMultiByteString(), std::ios::binary);
+        if (!file.is_open())
+            return false;
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+    
+    // Decodes a 3-channel QOI file to RGBA, to check QoiEncoder with a decoder of its own; false if
+    // the file is malformed
+    static bool DecodeQoi(const std::vector<char> & file, int & imageWidth, int & imageHeight, std::vector<unsigned char> & rgba)
+    {
+        const unsigned char * data = (const unsigned char *)file.data();
+        int size = (int)file.size();
+        if (size < 22 || memcmp(data, "qoif", 4) != 0 || data[12] != 3)
+            return false;
+        imageWidth = data[4] << 24 | data[5] << 16 | data[6] << 8 | data[7];
+        imageHeight = data[8] << 24 | data[9] << 16 | data[10] << 8 | data[11];
+        rgba.resize((size_t)imageWidth * imageHeight * 4);
+        unsigned char table[64][4] = {}, pixel[4] = {0, 0, 0, 255};
+        int pos = 14, end = size - 8, run = 0;
+        for (int p = 0; p < imageWidth * imageHeight; p++)
+        {
+            if (run > 0)
+                run--;
+            else
+            {
+                if (pos >= end)
+                    return false;
+                int op = data[pos++];
+                if (op == 0xFE)
+                {
+                    memcpy(pixel, data + pos, 3);
+                    pos += 3;
+                }
+                else if ((op & 0xC0) == 0x00)
+                    memcpy(pixel, table[op], 4);
+                else if ((op & 0xC0) == 0x40)
+                {
+                    pixel[0] += ((op >> 4) & 3) - 2;
+                    pixel[1] += ((op >> 2) & 3) - 2;
+                    pixel[2] += (op & 3) - 2;
+                }
+                else if ((op & 0xC0) == 0x80)
+                {
+                    int next = data[pos++], dg = (op & 63) - 32;
+                    pixel[0] += dg - 8 + (next >> 4);
+                    pixel[1] += dg;
+                    pixel[2] += dg - 8 + (next & 15);
+                }
+                else if (op != 0xFF)
+                    run = op & 63;
+                else
+                    return false;
+                memcpy(table[(pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) & 63], pixel, 4);
+            }
+            memcpy(&rgba[(size_t)p * 4], pixel, 4);
+        }
+        static const unsigned char endMarker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+        return pos == end && memcmp(data + end, endMarker, 8) == 0;
+    }
+    
+    // Renders frames of the play with the forward renderer and saves each one through every frame
+    // writer: ImageRef::SaveAsBmpFile, the serial writer the renderers used before, and
+    // FrameBuffer::SaveColorBuffer as BMP, PNG and QOI, converting every pixel. Every PNG is
+    // decoded with stb_image and every QOI with DecodeQoi, and compared with the BMP.
+    std::vector<ImageFormatResult> BenchmarkImageFormats(const String & outputDir, int maxFrames)
+    {
+        FrameBuffer frame(width, height);
+        IRasterRenderer* renderer = CreateTiledRenderer();
+        renderer->SetFrameBuffer(&frame);
+        
+        RefPtr<NFLPlayScene> scene = new NFLPlayScene(viewSettings, stadiumModelPath, playData);
+        ForwardLightingShader* shader = new ForwardLightingShader();
+        shader->CameraPosition = Vec3(60.0f, 60.0f, 50.0f);
+        shader->Shininess = 32.0f;
+        shader->SpecularColor = Vec3(0.5f, 0.5f, 0.5f);
+        SetupLights(shader);
+        scene->SetShader(shader);
+        
+        const wchar_t * writerNames[] = {L"ImageRef BMP", L"FrameBuffer BMP", L"PNG", L"QOI"};
+        const wchar_t * fileNames[] = {L"image_formats_serial.bmp", L"image_formats.bmp", L"image_formats.png", L"image_formats.qoi"};
+        std::vector<ImageFormatResult> results(4);
+        int frameCount = Math::Min(maxFrames, (int)playData.steps.size());
+        for (int w = 0; w < 4; w++)
+        {
+            results[w].writerName = writerNames[w];
+            results[w].frameCount = frameCount;
+            results[w].saveTimeMs = results[w].fileBytes = 0.0;
+            results[w].mismatchedFrames = 0;
+        }
+        std::vector<char> fileBytes[4];
+        std::vector<unsigned char> qoiPixels;
+        for (int i = 0; i < frameCount; i++)
+        {
+            scene->SetStep(playData.steps[i]);
+            renderer->Clear(scene->ClearColor);
+            scene->Draw(renderer);
+            renderer->Finish();
+            
+            for (int w = 0; w < 4; w++)
+            {
+                String path = Path::Combine(outputDir, fileNames[w]);
+                auto counter = PerformanceCounter::Start();
+                if (w == 0)
+                    CoreLib::Imaging::ImageRef(width, height, (float*)frame.GetColorBuffer()).SaveAsBmpFile(path, true);
+                else
+                    frame.SaveColorBuffer(path);
+                results[w].saveTimeMs += PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)) * 1000.0;
+                if (!ReadFileBytes(path, fileBytes[w]))
+                    throw IOException(L"Cannot read " + path);
+                results[w].fileBytes += (double)fileBytes[w].size();
+            }
+            
+            CoreLib::Imaging::Bitmap bmp((const unsigned char*)fileBytes[1].data(), (int)fileBytes[1].size());
+            int pixelCount = width * height;
+            try {
+                CoreLib::Imaging::Bitmap png((const unsigned char*)fileBytes[2].data(), (int)fileBytes[2].size());
+                if (png.GetWidth() != width || png.GetHeight() != height || memcmp(png.GetPixels(), bmp.GetPixels(), pixelCount * 4) != 0)
+                    results[2].mismatchedFrames++;
+            } catch (IOException&) {
+                results[2].mismatchedFrames++;
+            }
+            int qoiWidth, qoiHeight;
+            if (!DecodeQoi(fileBytes[3], qoiWidth, qoiHeight, qoiPixels) || qoiWidth != width || qoiHeight != height ||
+                memcmp(qoiPixels.data(), bmp.GetPixels(), pixelCount * 4) != 0)
+                results[3].mismatchedFrames++;
+        }
+        
+        double megabytes = width * height * 3 / 1048576.0;
+        for (auto & r : results)
+        {
+            r.saveTimeMs /= Math::Max(frameCount, 1);
+            r.fileBytes /= Math::Max(frameCount, 1);
+            r.megabytesPerSecond = r.saveTimeMs > 0.0 ? megabytes * 1000.0 / r.saveTimeMs : 0.0;
+            printf("  %-15s: %8.2f ms/frame, %8.1f MB/s, %9.0f bytes", r.writerName.ToMultiByteString(), r.saveTimeMs,
+                r.megabytesPerSecond, r.fileBytes);
+            if (&r >= &results[2])
+                printf(", %d/%d frames differ from the BMP", r.mismatchedFrames, r.frameCount);
+            printf("\n");
+        }
+        
+        DestroyRenderer(renderer);
+        return results;
+    }
+    
+    void GenerateImageFormatReport(const std::vector<ImageFormatResult>& results, const String& outputPath)
+    {
+        std::ofstream file(outputPath.ToMultiByteString());
+        if (!file.is_open())
+        {
+            printf("ERROR: Could not open output file: %s\n", outputPath.ToMultiByteString());
+            return;
+        }
+        
+        file << "# Frame Image Format Report\n\n";
+        file << "- Resolution: " << width << "x" << height << ", forward renderer, " << (results.empty() ? 0 : results[0].frameCount) << " frames\n";
+        file << "- ImageRef BMP: ImageRef::SaveAsBmpFile, serial; the others are FrameBuffer::SaveColorBuffer by file\n";
+        file << "  extension, converting every pixel, with PNG and QOI encoded in strips of rows on the worker pool\n";
+        file << "- Save ms covers conversion, encoding and writing the file; MB/s is of 24-bit pixels\n";
+        file << "- Differing Frames counts PNG and QOI files that do not decode to the pixels of the BMP\n\n";
+        
+        file << "| Writer | Save ms | MB/s | File KB | Size vs BMP | Speedup vs ImageRef | Differing Frames |\n";
+        file << "|--------|---------|------|---------|-------------|---------------------|------------------|\n";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const auto& r = results[i];
+            file << "| " << r.writerName.ToMultiByteString() << " | ";
+            file << std::fixed << std::setprecision(2) << r.saveTimeMs << " | " << std::setprecision(1) << r.megabytesPerSecond << " | ";
+            file << r.fileBytes / 1024.0 << " | " << std::setprecision(3) << r.fileBytes / Math::Max(results[1].fileBytes, 1.0) << " | ";
+            file << std::setprecision(2) << (r.saveTimeMs > 0 ? results[0].saveTimeMs / r.saveTimeMs : 0.0) << "x | ";
+            if (i >= 2)
+                file << r.mismatchedFrames << " |\n";
+            else
+                file << "- |\n";
+        }
+        
+        file.close();
+        printf("\nImage format report saved to: %s\n", outputPath.ToMultiByteString());
+    }
+    
+    // Renders the whole play both in full and over a cached static layer, each into its own frame
+    // buffer, and compares the two color buffers of every frame bit for bit. With dirtyTiles, the
+    // layered renderer restores only the tiles the players covered, and every frame is also saved
+    // to outputDir both converting just the changed tiles and in full, and the files compared.
+    // Under a texture budget, each run starts from the pinned levels alone, as a newly loaded
+    // stadium does, and the levels both renders sampled are paged in between frames.
+    StaticLayerResult BenchmarkStaticLayer(bool deferred, bool dirtyTiles, const String & outputDir)
+    {
+        printf("  %s renderer%s...\n", deferred ? "Deferred" : "Forward", dirtyTiles ? ", dirty tiles" : "");
+        fflush(stdout);
+        
+        FrameBuffer fullFrame(width, height), layerFrame(width, height);
+        IRasterRenderer* fullRenderer = deferred ? CreateDeferredTiledRenderer() : CreateTiledRenderer();
+        IRasterRenderer* layerRenderer = deferred ? CreateDeferredTiledRenderer() : CreateTiledRenderer();
+        fullRenderer->SetFrameBuffer(&fullFrame);
+        layerRenderer->SetFrameBuffer(&layerFrame);
+        layerRenderer->SetDirtyTileTracking(dirtyTiles);
+        
+        RefPtr<NFLPlayScene> scene = new NFLPlayScene(viewSettings, stadiumModelPath, playData);
+        ForwardLightingShader* shader = new ForwardLightingShader();
+        shader->CameraPosition = Vec3(60.0f, 60.0f, 50.0f);
+        shader->Shininess = 32.0f;
+        shader->SpecularColor = Vec3(0.5f, 0.5f, 0.5f);
+        SetupLights(shader);
+        scene->SetShader(shader);
+        
+        // the textures are shared with the earlier runs, which paged their levels in
+        CoreLib::Int64 textureBudget = CoreLib::Imaging::TextureResidency::Budget;
+        if (textureBudget > 0)
+        {
+            CoreLib::Imaging::TextureResidency::Budget = 1;
+            CoreLib::Imaging::TextureResidency::Update();
+            CoreLib::Imaging::TextureResidency::Budget = textureBudget;
+        }
+        
+        // Warmup
+        scene->SetStep(playData.steps[0]);
+        fullRenderer->Clear(scene->ClearColor);
+        scene->Draw(fullRenderer);
+        fullRenderer->Finish();
+        
+        StaticLayerResult result;
+        result.rendererName = deferred ? L"Deferred" : L"Forward";
+        result.dirtyTiles = dirtyTiles;
+        result.frameCount = (int)playData.steps.size();
+        result.mismatchedFrames = 0;
+        result.mismatchedFiles = 0;
+        result.maxColorDiff = 0.0f;
+        result.layerBuildTimeMs = 0.0;
+        double fullTime = 0.0, layerTime = 0.0;
+        unsigned long long layerKey = 0;
+        int pixelCount = width * height;
+        String incrementalPath = Path::Combine(outputDir, L"dirty_tiles_incremental.bmp");
+        String fullPath = Path::Combine(outputDir, L"dirty_tiles_full.bmp");
+        List<PixelRect> changedRegion;
+        std::vector<char> incrementalFile, fullFile;
+        for (int i = 0; i < result.frameCount; i++)
+        {
+            scene->SetStep(playData.steps[i]);
+            
+            auto counter = PerformanceCounter::Start();
+            fullRenderer->Clear(scene->ClearColor);
+            scene->Draw(fullRenderer);
+            fullRenderer->Finish();
+            fullTime += PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)) * 1000.0;
+            
+            counter = PerformanceCounter::Start();
+            scene->DrawOverStaticLayer(layerRenderer, layerKey);
+            layerRenderer->Finish();
+            double frameTime = PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)) * 1000.0;
+            if (i == 0)
+                result.layerBuildTimeMs = frameTime;
+            else
+                layerTime += frameTime;
+            
+            Vec4 * fullPixels = fullFrame.GetColorBuffer();
+            Vec4 * layerPixels = layerFrame.GetColorBuffer();
+            if (memcmp(fullPixels, layerPixels, pixelCount * sizeof(Vec4)) != 0)
+            {
+                result.mismatchedFrames++;
+                for (int p = 0; p < pixelCount; p++)
+                {
+                    result.maxColorDiff = std::max(result.maxColorDiff, fabsf(fullPixels[p].x - layerPixels[p].x));
+                    result.maxColorDiff = std::max(result.maxColorDiff, fabsf(fullPixels[p].y - layerPixels[p].y));
+                    result.maxColorDiff = std::max(result.maxColorDiff, fabsf(fullPixels[p].z - layerPixels[p].z));
+                }
+            }
+            
+            if (dirtyTiles)
+            {
+                // layerFrame keeps the file it converted for the last frame; fullFrame converts every pixel
+                layerFrame.SaveColorBuffer(incrementalPath, layerRenderer->GetChangedRegion(changedRegion) ? &changedRegion : nullptr);
+                fullFrame.SaveColorBuffer(fullPath, nullptr);
+                if (!ReadFileBytes(incrementalPath, incrementalFile) || !ReadFileBytes(fullPath, fullFile) ||
+                    incrementalFile != fullFile)
+                    result.mismatchedFiles++;
+            }
+            if (CoreLib::Imaging::TextureResidency::Budget > 0)
+                CoreLib::Imaging::TextureResidency::Update();
+        }
+        result.fullFrameTimeMs = fullTime / result.frameCount;
+        result.layerFrameTimeMs = result.frameCount > 1 ? layerTime / (result.frameCount - 1) : result.layerBuildTimeMs;
+        
+        printf("    full %.2f ms/frame, static layer %.2f ms/frame (first frame %.2f ms), %d/%d frames differ (max diff %g)\n",
+            result.fullFrameTimeMs, result.layerFrameTimeMs, result.layerBuildTimeMs, result.mismatchedFrames,
+            result.frameCount, result.maxColorDiff);
+        if (dirtyTiles)
+            printf("    %d/%d incrementally saved frames differ from full saves\n", result.mismatchedFiles, result.frameCount);
+        
+        DestroyRenderer(fullRenderer);
+        DestroyRenderer(layerRenderer);
+        return result;
+    }
+    
+    void GenerateStaticLayerReport(const std::vector<StaticLayerResult>& results, const String& outputPath)
+    {
+        std::ofstream file(outputPath.ToMultiByteString());
+        if (!file.is_open())
+        {
+            printf("ERROR: Could not open output file: %s\n", outputPath.ToMultiByteString());
+            return;
+        }
+        
+        file << "# Static Layer Comparison Report\n\n";
+        file << "- Resolution: " << width << "x" << height << "\n";
+        if (CoreLib::Imaging::TextureResidency::Budget > 0)
+            file << "- Texture budget: " << CoreLib::Imaging::TextureResidency::Budget / 1048576.0
+                 << " MB, the sampled mip levels are paged in between frames\n";
+        file << "- Full: every frame clears and draws the stadium and the players\n";
+        file << "- Static Layer: the stadium is drawn and saved once (First Frame), later frames restore it and draw the players\n";
+        file << "- Dirty Tiles: frames restore only the tiles the players covered in them or in the frame before, and the\n";
+        file << "  saved BMP converts only those tiles; Differing Files counts saves that are not byte-identical to a full save\n";
+        file << "- Differing Frames counts frames whose color buffer is not bit-identical to the full render\n\n";
+        
+        file << "| Renderer | Dirty Tiles | Frames | Full ms | Static Layer ms | First Frame ms | Speedup | Differing Frames | Differing Files | Max Diff |\n";
+        file << "|----------|-------------|--------|---------|-----------------|----------------|---------|------------------|-----------------|----------|\n";
+        for (const auto& r : results)
+        {
+            file << "| " << r.rendererName.ToMultiByteString() << " | " << (r.dirtyTiles ? "yes" : "no") << " | " << r.frameCount << " | ";
+            file << std::fixed << std::setprecision(2) << r.fullFrameTimeMs << " | " << r.layerFrameTimeMs << " | ";
+            file << r.layerBuildTimeMs << " | ";
+            file << (r.layerFrameTimeMs > 0 ? r.fullFrameTimeMs / r.layerFrameTimeMs : 0.0) << "x | ";
+            file << r.mismatchedFrames << " | ";
+            if (r.dirtyTiles)
+                file << r.mismatchedFiles << " | ";
+            else
+                file << "- | ";
+            file << std::scientific << std::setprecision(1) << r.maxColorDiff << std::fixed << " |\n";
+        }
+        
+        file.close();
+        printf("\nStatic layer report saved to: %s\n", outputPath.ToMultiByteString());
+    }
+    
+    // Sweep light counts for forward and deferred shading with each culling mode
+    std::vector<LightCullingResult> RunLightCullingComparison(int framesPerTest = 10)
+    {
+        printf("\n========================================\n");
+        printf("=== LIGHT CULLING COMPARISON ===\n");
+        printf("========================================\n");
+        printf("Frames per test: %d\n\n", framesPerTest);
+        
+        std::vector<int> lightCounts = {1, 10, 50, 100, 250, 500, 1000};
+        LightCullingMode modes[] = {LightCullingMode::None, LightCullingMode::Tiled, LightCullingMode::Clustered};
+        std::vector<LightCullingResult> results;
+        
+        for (int numLights : lightCounts)
+        {
+            printf("\n--- Testing with %d lights ---\n", numLights);
+            for (int renderer = 0; renderer < 2; renderer++)
+            {
+                List<Vec4> referenceFrame;
+                for (auto mode : modes)
+                {
+                    try {
+                        results.push_back(BenchmarkLightCulling(renderer == 1, numLights, mode, framesPerTest, referenceFrame));
+                    } catch (...) {
+                        printf("    FAILED\n");
+                    }
+                    fflush(stdout);
+                }
+            }
+        }
+        return results;
+    }
+    
+    void GenerateLightCullingReport(const std::vector<LightCullingResult>& results, const String& outputPath)
+    {
+        std::ofstream file(outputPath.ToMultiByteString());
+        if (!file.is_open())
+        {
+            printf("ERROR: Could not open output file: %s\n", outputPath.ToMultiByteString());
+            return;
+        }
+        
+        file << "# Light Culling Comparison Report\n\n";
+        file << "- Resolution: " << width << "x" << height << "\n";
+        file << "- Tiles: " << LightClusterGrid::TileSize << "x" << LightClusterGrid::TileSize
+             << " pixels, clustered mode adds " << LightClusterGrid::DepthSlices << " exponential depth slices\n";
+        file << "- Frame time includes the per-frame light grid build\n";
+        file << "- Max Diff is the largest color channel difference against the unculled frame\n\n";
+        
+        file << "| Renderer | Lights | Culling | Frame ms | Grid Build ms | Lights/Cluster | Speedup | Max Diff |\n";
+        file << "|----------|--------|---------|----------|---------------|----------------|---------|----------|\n";
+        
+        double baseline = 0.0;
+        for (const auto& r : results)
+        {
+            if (r.mode == LightCullingMode::None)
+                baseline = r.avgFrameTimeMs;
+            file << "| " << r.rendererName.ToMultiByteString() << " | " << r.lightCount << " | " << GetLightCullingModeName(r.mode) << " | ";
+            file << std::fixed << std::setprecision(2) << r.avgFrameTimeMs << " | ";
+            file << std::setprecision(3) << r.gridBuildMs << " | ";
+            file << std::setprecision(1) << r.lightsPerCluster << " | ";
+            file << std::setprecision(2) << (r.avgFrameTimeMs > 0 ? baseline / r.avgFrameTimeMs : 0.0) << "x | ";
+            file << std::scientific << std::setprecision(1) << r.maxColorDiff << std::fixed << " |\n";
+        }
+        
+        file.close();
+        printf("\nLight culling report saved to: %s\n", outputPath.ToMultiByteString());
+    }
+    
+    void GenerateLightCullingCSV(const std::vector<LightCullingResult>& results, const String& outputPath)
+    {
+        std::ofstream file(outputPath.ToMultiByteString());
+        if (!file.is_open())
+        {
+            printf("ERROR: Could not open CSV file: %s\n", outputPath.ToMultiByteString());
+            return;
+        }
+        
+        file << "Renderer,LightCount,Culling,FrameTimeMs,GridBuildMs,LightsPerCluster,MaxColorDiff\n";
+        for (const auto& r : results)
+        {
+            file << r.rendererName.ToMultiByteString() << "," << r.lightCount << "," << GetLightCullingModeName(r.mode) << ",";
+            file << std::fixed << std::setprecision(3);
+            file << r.avgFrameTimeMs << "," << r.gridBuildMs << "," << r.lightsPerCluster << ",";
+            file << std::scientific << r.maxColorDiff << std::fixed << "\n";
+        }
+        
+        file.close();
+        printf("Light culling CSV saved to: %s\n", outputPath.ToMultiByteString());
+    }
 };
 
+// deterministic LCG so benchmark inputs are identical across runs and platforms
+static float RandomFloat(unsigned int & seed, float min, float max)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return min + (max - min) * ((seed >> 8) * (1.0f / 16777216.0f));
+}
+
+// Per-fragment cost of the forward lighting kernels, measured on synthetic quads
+// with every light evaluated (no culling) so that only the kernel itself is timed.
+// The light mix is one directional light followed by interleaved point and spot
+// lights, which makes the reference kernel branch on the light type per light.
+static std::vector<LightingKernelResult> RunLightingKernelBenchmark()
+{
+    const int quadCount = 4096;
+    const int lightCounts[] = {1, 4, 16, 64, 256, 1024};
+    const LightKernel kernels[] = {LightKernel::Reference, LightKernel::FragmentLanes, LightKernel::LightLanes};
+
+    unsigned int seed = 1234;
+    // 12 attribute vectors of 4 floats per quad
+    List<float, AlignedAllocator<16>> inputs;
+    inputs.SetSize(quadCount * 48);
+    for (int q = 0; q < quadCount; q++)
+    {
+        __m128 * input = (__m128*)(inputs.Buffer() + q * 48);
+        CORE_LIB_ALIGN_16(float attribs[12][4]);
+        for (int i = 0; i < 4; i++)
+        {
+            attribs[0][i] = attribs[1][i] = attribs[2][i] = 0.0f;
+            attribs[3][i] = 1.0f;
+            Vec3 normal = Vec3(RandomFloat(seed, -1.0f, 1.0f), RandomFloat(seed, -1.0f, 1.0f), RandomFloat(seed, 0.1f, 1.0f));
+            attribs[4][i] = normal.x; attribs[5][i] = normal.y; attribs[6][i] = normal.z;
+            attribs[7][i] = RandomFloat(seed, -40.0f, 40.0f);
+            attribs[8][i] = RandomFloat(seed, -40.0f, 40.0f);
+            attribs[9][i] = RandomFloat(seed, -80.0f, -5.0f);
+            attribs[10][i] = attribs[11][i] = 0.0f;
+        }
+        for (int i = 0; i < 12; i++)
+            input[i] = _mm_load_ps(attribs[i]);
+    }
+
+    RenderState state;
+    state.ConstantBuffer = nullptr;
+    ForwardLightingShader shader;
+    shader.LightCulling = LightCullingMode::None;
+    shader.CameraPosition = Vec3(0.0f, 0.0f, 0.0f);
+
+    std::vector<LightingKernelResult> results;
+    List<float> reference, output;
+    reference.SetSize(quadCount * 16);
+    output.SetSize(quadCount * 16);
+    for (int lightCount : lightCounts)
+    {
+        shader.Lights.Clear();
+        for (int i = 0; i < lightCount; i++)
+        {
+            ForwardLightingShader::Light light;
+            light.LightType = i == 0 ? ForwardLightingShader::Light::DIRECTIONAL :
+                (i % 3 == 0 ? ForwardLightingShader::Light::SPOT : ForwardLightingShader::Light::POINT);
+            light.Position = Vec3(RandomFloat(seed, -40.0f, 40.0f), RandomFloat(seed, -40.0f, 40.0f), RandomFloat(seed, -80.0f, 0.0f));
+            light.Direction = i == 0 ? Vec3(0.3f, -0.5f, -0.81f) : Vec3(0.0f, 0.0f, -1.0f);
+            light.Color = Vec3(RandomFloat(seed, 0.5f, 1.0f), RandomFloat(seed, 0.5f, 1.0f), RandomFloat(seed, 0.5f, 1.0f));
+            light.Intensity = 1.0f / lightCount;
+            light.Ambient = 0.1f / lightCount;
+            light.Decay = 60.0f;
+            light.InnerConeAngle = 0.9f;
+            light.OuterConeAngle = 0.7f;
+            shader.Lights.Add(light);
+        }
+        shader.UpdateLights(state);
+
+        // keep the total work roughly constant across light counts
+        int passes = Math::Max(1, 256 / lightCount);
+        for (LightKernel kernel : kernels)
+        {
+            shader.Kernel = kernel;
+            List<float> & target = kernel == LightKernel::Reference ? reference : output;
+            for (int q = 0; q < quadCount; q++)
+                shader.ShadeFragment(state, target.Buffer() + q * 16, (__m128*)(inputs.Buffer() + q * 48), 0);
+
+            unsigned long long bestCycles = ~0ull;
+            double bestSeconds = 1e30;
+            for (int run = 0; run < 5; run++)
+            {
+                auto counter = PerformanceCounter::Start();
+                unsigned long long start = __rdtsc();
+                for (int pass = 0; pass < passes; pass++)
+                    for (int q = 0; q < quadCount; q++)
+                        shader.ShadeFragment(state, target.Buffer() + q * 16, (__m128*)(inputs.Buffer() + q * 48), 0);
+                unsigned long long cycles = __rdtsc() - start;
+                double seconds = PerformanceCounter::ToSeconds(PerformanceCounter::End(counter));
+                bestCycles = Math::Min(bestCycles, cycles);
+                bestSeconds = Math::Min(bestSeconds, seconds);
+            }
+
+            LightingKernelResult result;
+            result.lightCount = lightCount;
+            result.kernel = kernel;
+            double fragments = (double)quadCount * 4.0 * passes;
+            result.cyclesPerFragment = bestCycles / fragments;
+            result.nsPerFragment = bestSeconds * 1e9 / fragments;
+            result.maxColorDiff = 0.0f;
+            if (kernel != LightKernel::Reference)
+            {
+                for (int i = 0; i < output.Count(); i++)
+                    result.maxColorDiff = Math::Max(result.maxColorDiff, fabs(output[i] - reference[i]));
+            }
+            printf("  %4d lights, %-13s: %8.1f cycles/fragment, %7.2f ns/fragment, max diff %g\n", lightCount,
+                GetLightKernelName(kernel), result.cyclesPerFragment, result.nsPerFragment, result.maxColorDiff);
+            results.push_back(result);
+        }
+    }
+    return results;
+}
+
+static String GetYuvFormatName(const YuvFormat & format)
+{
+    String name = format.Layout == YuvLayout::Nv12 ? L"NV12" : L"I420";
+    name = name + (format.Range == YuvRange::Full ? L" full" : L" limited");
+    if (format.EncodeGamma)
+        name = name + L" gamma";
+    return name;
+}
+
+// ConvertToYuv420 against the scalar reference on frame buffers of random colors, some outside
+// [0, 1], in every layout, range and gamma setting, with and without 4x MSAA, at an odd size that
+// leaves scalar columns and a single last row, 1080p and 4K
+static std::vector<YuvConversionResult> RunYuvConversionBenchmark()
+{
+    const int sizes[][2] = {{333, 201}, {1920, 1080}, {3840, 2160}};
+    std::vector<YuvConversionResult> results;
+    unsigned int seed = 4321;
+    for (auto & size : sizes)
+    {
+        for (int sampleCountLog2 = 0; sampleCountLog2 <= 2; sampleCountLog2 += 2)
+        {
+            FrameBuffer frame(size[0], size[1], sampleCountLog2);
+            for (int y = 0; y < size[1]; y++)
+                for (int x = 0; x < size[0]; x++)
+                    for (int i = 0; i < frame.GetSampleCount(); i++)
+                        frame.SetPixel(x, y, i, Vec4(RandomFloat(seed, -0.1f, 1.1f), RandomFloat(seed, -0.1f, 1.1f),
+                            RandomFloat(seed, -0.1f, 1.1f), 1.0f));
+            const Vec4 * samples = &frame.GetPixel(0, 0, 0);
+            List<unsigned char> reference, output;
+            reference.SetSize(GetYuv420Size(size[0], size[1]));
+            output.SetSize(reference.Count());
+            for (int variant = 0; variant < 8; variant++)
+            {
+                YuvConversionResult result;
+                result.width = size[0];
+                result.height = size[1];
+                result.sampleCount = frame.GetSampleCount();
+                result.format.Layout = (variant & 1) ? YuvLayout::Nv12 : YuvLayout::I420;
+                result.format.Range = (variant & 2) ? YuvRange::Full : YuvRange::Limited;
+                result.format.EncodeGamma = (variant & 4) != 0;
+
+                auto counter = PerformanceCounter::Start();
+                ConvertToYuv420Reference(samples, size[0], size[1], result.sampleCount, result.format, reference.Buffer());
+                result.referenceMs = PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)) * 1000.0;
+
+                result.vectorMs = result.parallelMs = 1e30;
+                for (int run = 0; run < 3; run++)
+                {
+                    counter = PerformanceCounter::Start();
+                    ConvertToYuv420(samples, size[0], size[1], result.sampleCount, result.format, output.Buffer(), false);
+                    result.vectorMs = Math::Min(result.vectorMs, PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)) * 1000.0);
+                    counter = PerformanceCounter::Start();
+                    frame.ConvertToYuv420(result.format, output.Buffer());
+                    result.parallelMs = Math::Min(result.parallelMs, PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)) * 1000.0);
+                }
+
+                result.maxDiff = 0;
+                int differing = 0;
+                for (int i = 0; i < output.Count(); i++)
+                {
+                    int diff = abs((int)output[i] - (int)reference[i]);
+                    result.maxDiff = Math::Max(result.maxDiff, diff);
+                    if (diff)
+                        differing++;
+                }
+                result.differingValues = differing / (double)output.Count();
+                printf("  %4dx%-4d %dx %-20s: reference %8.2f ms, SSE %7.2f ms, parallel %6.2f ms, max diff %d (%.4f%% differ)\n",
+                    result.width, result.height, result.sampleCount, GetYuvFormatName(result.format).ToMultiByteString(),
+                    result.referenceMs, result.vectorMs, result.parallelMs, result.maxDiff, result.differingValues * 100.0);
+                fflush(stdout);
+                results.push_back(result);
+            }
+        }
+    }
+    return results;
+}
+
+static void GenerateYuvConversionReport(const std::vector<YuvConversionResult>& results, const String& outputPath)
+{
+    std::ofstream file(outputPath.ToMultiByteString());
+    if (!file.is_open())
+    {
+        printf("ERROR: Could not open output file: %s\n", outputPath.ToMultiByteString());
+        return;
+    }
+
+    file << "# YUV 4:2:0 Conversion Report\n\n";
+    file << "- Input: frame buffers of random colors in [-0.1, 1.1], resolved from their samples by the conversion\n";
+    file << "- Reference: scalar, double precision, one thread; SSE: ConvertToYuv420 on one thread;\n";
+    file << "  Parallel: ConvertToYuv420 over bands of rows; best of 3 runs\n";
+    file << "- Max Diff is the largest code value difference against the reference\n\n";
+
+    file << "| Size | Samples | Format | Reference ms | SSE ms | Parallel ms | SSE Speedup | Max Diff | Differing |\n";
+    file << "|------|---------|--------|--------------|--------|-------------|-------------|----------|-----------|\n";
+    for (const auto& r : results)
+    {
+        file << "| " << r.width << "x" << r.height << " | " << r.sampleCount << " | " << GetYuvFormatName(r.format).ToMultiByteString() << " | ";
+        file << std::fixed << std::setprecision(2) << r.referenceMs << " | " << r.vectorMs << " | " << r.parallelMs << " | ";
+        file << (r.vectorMs > 0 ? r.referenceMs / r.vectorMs : 0.0) << "x | " << r.maxDiff << " | ";
+        file << std::setprecision(4) << r.differingValues * 100.0 << "% |\n";
+    }
+
+    file.close();
+    printf("\nYUV conversion report saved to: %s\n", outputPath.ToMultiByteString());
+}
+
+static void GenerateLightingKernelReport(const std::vector<LightingKernelResult>& results, const String& outputPath)
+{
+    std::ofstream file(outputPath.ToMultiByteString());
+    if (!file.is_open())
+    {
+        printf("ERROR: Could not open output file: %s\n", outputPath.ToMultiByteString());
+        return;
+    }
+
+    file << "# Lighting Kernel Report\n\n";
+    file << "- Reference: original loop over the Light array with a per-light type branch and\n";
+    file << "  repeated-squaring specular power\n";
+    file << "- FragmentLanes: lights packed by type (SoA), one light against the 4 fragments of a quad\n";
+    file << "- LightLanes: lights packed by type (SoA), 4 lights against one fragment\n";
+    file << "- Cycles are __rdtsc ticks, best of 5 runs, light culling disabled\n";
+    file << "- Max Diff is the largest color channel difference against the reference kernel\n\n";
+
+    file << "| Lights | Kernel | Cycles/Fragment | ns/Fragment | Speedup | Max Diff |\n";
+    file << "|--------|--------|-----------------|-------------|---------|----------|\n";
+    double baseline = 0.0;
+    for (const auto& r : results)
+    {
+        if (r.kernel == LightKernel::Reference)
+            baseline = r.cyclesPerFragment;
+        file << "| " << r.lightCount << " | " << GetLightKernelName(r.kernel) << " | ";
+        file << std::fixed << std::setprecision(1) << r.cyclesPerFragment << " | ";
+        file << std::setprecision(2) << r.nsPerFragment << " | ";
+        file << (r.cyclesPerFragment > 0 ? baseline / r.cyclesPerFragment : 0.0) << "x | ";
+        file << std::scientific << std::setprecision(1) << r.maxColorDiff << std::fixed << " |\n";
+    }
+
+    file.close();
+    printf("\nLighting kernel report saved to: %s\n", outputPath.ToMultiByteString());
+}
+
 int main(int argc, char* argv[])
 {
     printf("=== NFL Renderer Comparison Tool ===\n");
     
+    // The lighting kernel benchmark runs on synthetic data and needs no input files
+    if (argc > 1 && strcmp(argv[1], "--lighting-cycles") == 0)
+    {
+        String outputDir = (argc > 2) ? String(argv[2]) : String(L"output");
+        printf("\n=== Running Lighting Kernel Benchmark ===\n");
+        auto kernelResults = RunLightingKernelBenchmark();
+        GenerateLightingKernelReport(kernelResults, Path::Combine(outputDir, L"lighting_kernels.md"));
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--yuv") == 0)
+    {
+        String outputDir = (argc > 2) ? String(argv[2]) : String(L"output");
+        printf("\n=== Running YUV Conversion Benchmark ===\n");
+        auto yuvResults = RunYuvConversionBenchmark();
+        GenerateYuvConversionReport(yuvResults, Path::Combine(outputDir, L"yuv_conversion.md"));
+        bool matches = true;
+        for (const auto& r : yuvResults)
+            matches = matches && r.maxDiff <= 1;
+        printf("YUV conversion %s the reference\n", matches ? "matches" : "DIFFERS from");
+        return matches ? 0 : 1;
+    }
+
     if (argc < 4)
     {
-        printf("Usage: %s <tracking_csv> <game_play> <stadium_model.obj> [output_dir] [width] [height] [--light-scaling]\n", argv[0]);
+        printf("Usage: %s <tracking_csv> <game_play> <stadium_model.obj> [output_dir] [width] [height] [--light-scaling] [--light-culling]\n"
+               "          [--static-layer] [--dirty-tiles] [--texture-budget MB] [--image-formats]\n", argv[0]);
         printf("\nExamples:\n");
         printf("  Basic comparison (5 lights, full animation):\n");
         printf("    %s tracking.csv 58580_001136 stadium.obj output/ 1920 1080\n", argv[0]);
         printf("\n  Light scaling test (1-100 lights, 20 frames each):\n");
         printf("    %s tracking.csv 58580_001136 stadium.obj output/ 1920 1080 --light-scaling\n", argv[0]);
+        printf("\n  Light culling test (1-1000 lights, no/tiled/clustered culling):\n");
+        printf("    %s tracking.csv 58580_001136 stadium.obj output/ 1920 1080 --light-culling\n", argv[0]);
+        printf("\n  Static layer test (stadium drawn once, players over it, checked against full renders):\n");
+        printf("    %s tracking.csv 58580_001136 stadium.obj output/ 1920 1080 --static-layer\n", argv[0]);
+        printf("\n  The same, also restoring and saving only the tiles the players covered (--dirty-tiles):\n");
+        printf("    %s tracking.csv 58580_001136 stadium.obj output/ 1920 1080 --static-layer --dirty-tiles\n", argv[0]);
+        printf("\n  The static layer test with stadium mip levels paged in on first use under a texture budget:\n");
+        printf("    %s tracking.csv 58580_001136 stadium.obj output/ 1920 1080 --static-layer --texture-budget 64\n", argv[0]);
+        printf("    %s tracking.csv 58580_001136 stadium.obj output/ 1920 1080 --static-layer --dirty-tiles --texture-budget 64\n", argv[0]);
+        printf("\n  Frame writers: BMP, PNG and QOI save times and sizes, PNG and QOI checked against the BMP:\n");
+        printf("    %s tracking.csv 58580_001136 stadium.obj output/ 1920 1080 --image-formats\n", argv[0]);
+        printf("\n  Lighting kernel cycles per fragment (synthetic, no input files):\n");
+        printf("    %s --lighting-cycles [output_dir]\n", argv[0]);
+        printf("\n  YUV 4:2:0 conversion against its scalar reference (synthetic, no input files):\n");
+        printf("    %s --yuv [output_dir]\n", argv[0]);
         return 1;
     }
     
@@ -980,13 +1871,24 @@ int main(int argc, char* argv[])
     
     // Check for --light-scaling flag
     bool runLightScaling = false;
+    bool runLightCulling = false;
+    bool runStaticLayer = false;
+    bool runDirtyTiles = false;
+    bool runImageFormats = false;
     for (int i = 1; i < argc; i++)
     {
         if (strcmp(argv[i], "--light-scaling") == 0)
-        {
             runLightScaling = true;
-            break;
-        }
+        else if (strcmp(argv[i], "--light-culling") == 0)
+            runLightCulling = true;
+        else if (strcmp(argv[i], "--static-layer") == 0)
+            runStaticLayer = true;
+        else if (strcmp(argv[i], "--dirty-tiles") == 0)
+            runStaticLayer = runDirtyTiles = true;
+        else if (strcmp(argv[i], "--image-formats") == 0)
+            runImageFormats = true;
+        else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+            CoreLib::Imaging::TextureResidency::Budget = (CoreLib::Int64)(atof(argv[++i]) * 1024.0 * 1024.0);
     }
     
     printf("Configuration:\n");
@@ -995,6 +1897,8 @@ int main(int argc, char* argv[])
     printf("  Stadium Model: %s\n", stadiumModel.ToMultiByteString());
     printf("  Output Dir: %s\n", outputDir.ToMultiByteString());
     printf("  Resolution: %dx%d\n", width, height);
+    if (CoreLib::Imaging::TextureResidency::Budget > 0)
+        printf("  Texture budget: %.1f MB\n", CoreLib::Imaging::TextureResidency::Budget / 1048576.0);
     
     // Load play data
     printf("\nLoading play data...\n");
@@ -1008,10 +1912,76 @@ int main(int argc, char* argv[])
         return 1;
     }
     
+    // Every renderer's scene shares the stadium and player models
+    ResourceManager::Enabled = true;
+
     // Create comparison tool
     NFLRendererComparison comparison(width, height, stadiumModel, playData);
     
-    if (runLightScaling)
+    if (runImageFormats)
+    {
+        printf("\n=== Running Image Format Comparison ===\n");
+        std::vector<ImageFormatResult> formatResults;
+        try {
+            formatResults = comparison.BenchmarkImageFormats(outputDir, 20);
+        } catch (Exception& ex) {
+            printf("    FAILED: %s\n", ex.Message.ToMultiByteString());
+            return 1;
+        }
+        comparison.GenerateImageFormatReport(formatResults, Path::Combine(outputDir, L"image_formats.md"));
+        
+        bool lossless = formatResults[2].mismatchedFrames == 0 && formatResults[3].mismatchedFrames == 0;
+        printf("PNG and QOI frames %s the BMP\n", lossless ? "decode to the pixels of" : "DIFFER from");
+        if (!lossless)
+            return 1;
+    }
+    else if (runStaticLayer)
+    {
+        printf("\n=== Running Static Layer Comparison ===\n");
+        std::vector<StaticLayerResult> layerResults;
+        for (int dirtyTiles = 0; dirtyTiles < (runDirtyTiles ? 2 : 1); dirtyTiles++)
+        {
+            for (int renderer = 0; renderer < 2; renderer++)
+            {
+                try {
+                    layerResults.push_back(comparison.BenchmarkStaticLayer(renderer == 1, dirtyTiles == 1, outputDir));
+                } catch (...) {
+                    printf("    FAILED\n");
+                }
+                fflush(stdout);
+            }
+        }
+        comparison.GenerateStaticLayerReport(layerResults, Path::Combine(outputDir, L"static_layer_comparison.md"));
+        
+        bool identical = !layerResults.empty();
+        for (const auto& r : layerResults)
+            identical = identical && r.mismatchedFrames == 0 && r.mismatchedFiles == 0;
+        printf("Static layer output %s the full render\n", identical ? "is pixel-identical to" : "DIFFERS from");
+        if (!identical)
+            return 1;
+    }
+    else if (runLightCulling)
+    {
+        printf("\n=== Running Light Culling Comparison ===\n");
+        printf("This test compares no culling, tiled culling and clustered culling\n");
+        printf("for forward and deferred shading with 1-1000 lights.\n");
+        
+        auto cullingResults = comparison.RunLightCullingComparison(10);
+        
+        String cullingReportPath = Path::Combine(outputDir, L"light_culling_comparison.md");
+        String cullingCsvPath = Path::Combine(outputDir, L"light_culling_comparison.csv");
+        comparison.GenerateLightCullingReport(cullingResults, cullingReportPath);
+        comparison.GenerateLightCullingCSV(cullingResults, cullingCsvPath);
+        
+        printf("\n| Renderer | Lights | Culling   | Frame ms |\n");
+        printf("|----------|--------|-----------|----------|\n");
+        for (const auto& r : cullingResults)
+        {
+            printf("| %-8s | %6d | %-9s | %8.2f |\n", r.rendererName.ToMultiByteString(), r.lightCount,
+                GetLightCullingModeName(r.mode), r.avgFrameTimeMs);
+        }
+    }
+    else if (runLightScaling)
     {
         // Run light scaling comparison
         printf("\n=== Running Light Scaling Comparison ===\n");
@@ -0,0 +1,267 @@
+#include "FrameWriter.h"
+#include "CoreLib/LibIO.h"
+#include "CoreLib/PerformanceCounter.h"
+#include <algorithm>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#define popen _popen
+#define pclose _pclose
+#define dup _dup
+#define dup2 _dup2
+#define fileno _fileno
+#define fdopen _fdopen
+#define PIPE_WRITE_MODE "wb"
+#else
+#define PIPE_WRITE_MODE "w"
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+using namespace CoreLib::IO;
+using namespace CoreLib::Diagnostics;
+
+namespace RasterRenderer
+{
+    namespace NFL
+    {
+        namespace
+        {
+            // the same rounding as FrameBuffer::SaveColorBuffer
+            inline unsigned char ToByte(float x)
+            {
+                int v = (int)(x * 255);
+                return (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+            }
+        }
+
+        int FrameWriter::GetFrameSize(FrameStreamFormat format, int width, int height)
+        {
+            if (format == FrameStreamFormat::Rgb)
+                return width * height * 3;
+            return GetYuv420Size(width, height);
+        }
+
+        void FrameWriter::ConvertToRgb(const Vec4 * pixels, int width, int height, unsigned char * result)
+        {
+            for (int y = 0; y < height; y++)
+            {
+                const Vec4 * row = pixels + (height - 1 - y) * width;
+                unsigned char * dst = result + y * width * 3;
+                for (int x = 0; x < width; x++)
+                {
+                    dst[x * 3] = ToByte(row[x].x);
+                    dst[x * 3 + 1] = ToByte(row[x].y);
+                    dst[x * 3 + 2] = ToByte(row[x].z);
+                }
+            }
+        }
+
+        int FrameWriter::divertedStdout = -1;
+
+        void FrameWriter::DivertStdout()
+        {
+            // the stream keeps the original stdout, and printf output goes to stderr
+            fflush(stdout);
+            divertedStdout = dup(fileno(stdout));
+            if (divertedStdout != -1)
+                dup2(fileno(stderr), fileno(stdout));
+        }
+
+        FrameWriter::FrameWriter(FrameStreamFormat format, const YuvFormat & yuvFormat, const String & target, int width,
+            int height, double fps, int queueDepth, int converterCount)
+            : format(format), yuvFormat(yuvFormat), width(width), height(height), stream(nullptr), isProcess(false), nextFrame(0), closing(false),
+              bytesWritten(0), writeSeconds(0.0)
+        {
+#ifndef _WIN32
+            // an encoder that exits early fails the write instead of ending the process
+            signal(SIGPIPE, SIG_IGN);
+#endif
+            if (target == L"-")
+            {
+                if (divertedStdout == -1)
+                    DivertStdout();
+                if (divertedStdout != -1)
+                    stream = fdopen(divertedStdout, "wb");
+                divertedStdout = -1;
+            }
+            else if (target.Length() > 1 && target[0] == L'|')
+            {
+                fflush(stdout);
+                stream = popen(target.SubString(1, target.Length() - 1).ToMultiByteString(), PIPE_WRITE_MODE);
+                isProcess = true;
+            }
+            else
+                stream = fopen(target.ToMultiByteString(), "wb");
+            if (!stream)
+                throw IOException(L"Cannot open the frame stream " + target);
+#ifdef _WIN32
+            _setmode(_fileno(stream), _O_BINARY);
+#endif
+            if (format == FrameStreamFormat::Y4m)
+            {
+                // frame rate as a ratio of integers, in thousandths where it is not whole
+                int rate = (int)(fps * 1000.0 + 0.5), scale = 1000;
+                if (rate % 1000 == 0)
+                {
+                    rate /= 1000;
+                    scale = 1;
+                }
+                // the chroma samples sit between their four pixels, as in JPEG
+                if (fprintf(stream, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg XCOLORRANGE=%s\n", width, height, rate, scale,
+                    yuvFormat.Range == YuvRange::Full ? "FULL" : "LIMITED") < 0)
+                    error = L"Cannot write the frame stream header";
+                this->yuvFormat.Layout = YuvLayout::I420;
+            }
+
+            slots.resize(Math::Max(queueDepth, 1));
+            for (auto & slot : slots)
+            {
+                slot.State = SlotState::Free;
+                slot.FrameIndex = -1;
+                if (format == FrameStreamFormat::Rgb)
+                    slot.Pixels.resize(width * height);
+                slot.Data.resize(GetFrameSize(format, width, height));
+            }
+            for (int i = 0; i < Math::Max(converterCount, 1); i++)
+                threads.push_back(std::thread([this] { RunConverter(); }));
+            threads.push_back(std::thread([this] { RunWriter(); }));
+        }
+
+        FrameWriter::~FrameWriter()
+        {
+            Close();
+        }
+
+        bool FrameWriter::Submit(int frameIndex, FrameBuffer & frame)
+        {
+            FrameSlot & slot = slots[frameIndex % slots.size()];
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&] { return frameIndex < nextFrame + (int)slots.size() || error.Length(); });
+                if (error.Length())
+                    return false;
+            }
+            // the slot is this frame's until the writer frees it
+            if (format == FrameStreamFormat::Rgb)
+            {
+                const Vec4 * pixels = frame.GetColorBuffer();
+                std::copy(pixels, pixels + width * height, slot.Pixels.begin());
+            }
+            else
+                frame.ConvertToYuv420(yuvFormat, slot.Data.data());
+            std::lock_guard<std::mutex> guard(lock);
+            slot.FrameIndex = frameIndex;
+            slot.State = format == FrameStreamFormat::Rgb ? SlotState::Copied : SlotState::Converted;
+            changed.notify_all();
+            return true;
+        }
+
+        void FrameWriter::RunConverter()
+        {
+            for (;;)
+            {
+                FrameSlot * slot = nullptr;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    changed.wait(guard, [&]
+                    {
+                        for (auto & s : slots)
+                        {
+                            if (s.State == SlotState::Copied)
+                            {
+                                slot = &s;
+                                return true;
+                            }
+                        }
+                        return closing;
+                    });
+                    if (!slot)
+                        return;
+                    slot->State = SlotState::Converting;
+                }
+                ConvertToRgb(slot->Pixels.data(), width, height, slot->Data.data());
+                std::lock_guard<std::mutex> guard(lock);
+                slot->State = SlotState::Converted;
+                changed.notify_all();
+            }
+        }
+
+        void FrameWriter::RunWriter()
+        {
+            for (;;)
+            {
+                FrameSlot * slot = nullptr;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    changed.wait(guard, [&]
+                    {
+                        FrameSlot & next = slots[nextFrame % slots.size()];
+                        if (next.State == SlotState::Converted && next.FrameIndex == nextFrame)
+                            slot = &next;
+                        return slot || closing;
+                    });
+                    if (!slot)
+                        return;
+                    if (error.Length())
+                        slot = nullptr;
+                }
+                if (slot)
+                {
+                    auto counter = PerformanceCounter::Start();
+                    bool written = (format != FrameStreamFormat::Y4m || fputs("FRAME\n", stream) >= 0) &&
+                        fwrite(slot->Data.data(), 1, slot->Data.size(), stream) == slot->Data.size();
+                    double seconds = PerformanceCounter::ToSeconds(PerformanceCounter::End(counter));
+                    std::lock_guard<std::mutex> guard(lock);
+                    writeSeconds += seconds;
+                    if (written)
+                        bytesWritten += slot->Data.size() + (format == FrameStreamFormat::Y4m ? 6 : 0);
+                    else if (!error.Length())
+                        error = L"Cannot write frame " + String(nextFrame) + L" to the frame stream";
+                }
+                std::lock_guard<std::mutex> guard(lock);
+                slots[nextFrame % slots.size()].State = SlotState::Free;
+                nextFrame++;
+                changed.notify_all();
+            }
+        }
+
+        bool FrameWriter::Close()
+        {
+            if (!stream)
+                return false;
+            {
+                // after a failure, frames queued behind one that Submit refused are never written
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&]
+                {
+                    if (error.Length())
+                        return true;
+                    for (auto & slot : slots)
+                        if (slot.State != SlotState::Free)
+                            return false;
+                    return true;
+                });
+                closing = true;
+                changed.notify_all();
+            }
+            for (auto & thread : threads)
+                thread.join();
+            threads.clear();
+            bool flushed = fflush(stream) == 0;
+            int status = isProcess ? pclose(stream) : fclose(stream);
+            stream = nullptr;
+            if (!error.Length() && !flushed)
+                error = L"Cannot write the frame stream";
+            if (!error.Length() && status != 0)
+                error = isProcess ? String(L"The encoder process failed") : String(L"Cannot close the frame stream");
+            return error.Length() == 0;
+        }
+
+        String FrameWriter::GetError()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return error;
+        }
+    }
+}
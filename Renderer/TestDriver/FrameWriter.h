@@ -0,0 +1,101 @@
+#ifndef NFL_FRAME_WRITER_H
+#define NFL_FRAME_WRITER_H
+
+#include "CoreLib/Basic.h"
+#include "CoreLib/VectorMath.h"
+#include "FrameBuffer.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdio.h>
+
+namespace RasterRenderer
+{
+    namespace NFL
+    {
+        using namespace CoreLib::Basic;
+        using namespace VectorMath;
+
+        enum class FrameStreamFormat
+        {
+            Rgb, // rgb24 rows top to bottom, no headers (ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH -i -)
+            Y4m, // YUV4MPEG2 4:2:0 (ffmpeg -i -)
+            Yuv  // raw I420 or NV12 frames, no headers (ffmpeg -f rawvideo -pix_fmt yuv420p|nv12 -s WxH -i -)
+        };
+
+        // Streams video frames, in frame order, to stdout, a file or FIFO, or the standard input of an
+        // encoder process, so that no frame files are written.
+        //
+        // Submit copies a frame's color buffer into a ring of queueDepth frames and returns, and the
+        // renderer goes on with its frame buffer. Converter threads turn the copies into the stream
+        // format and a writer thread writes them in order, so rendering overlaps the conversion, the
+        // writes and the encoder. YUV frames skip the copy: Submit converts the frame buffer, in one
+        // parallel pass, straight into the ring. Frame i waits in Submit until frame i - queueDepth has been
+        // written, which bounds the memory and lets frames be submitted from several threads in any
+        // order without a later frame taking the place an earlier one needs.
+        class FrameWriter
+        {
+        private:
+            enum class SlotState { Free, Copied, Converting, Converted };
+            struct FrameSlot
+            {
+                SlotState State;
+                int FrameIndex;
+                std::vector<Vec4> Pixels; // the color buffer of an Rgb frame
+                std::vector<unsigned char> Data; // the frame in the stream format
+            };
+            FrameStreamFormat format;
+            YuvFormat yuvFormat;
+            int width, height;
+            FILE * stream;
+            bool isProcess;
+            std::vector<FrameSlot> slots; // frame i in slots[i % slots.size()]
+            std::vector<std::thread> threads;
+            std::mutex lock;
+            std::condition_variable changed;
+            int nextFrame; // the next frame to write
+            bool closing;
+            String error; // the first failure, after which frames are dropped
+            CoreLib::Int64 bytesWritten;
+            double writeSeconds; // spent in fwrite, waiting for the reader when the pipe is full
+            static int divertedStdout; // the original stdout, once DivertStdout has moved it aside
+
+            void RunConverter();
+            void RunWriter();
+        public:
+            // target: "-" for stdout, whose printf output then goes to stderr instead; "|command" for a
+            // shell command that reads the stream from its standard input; otherwise the path of a
+            // file or FIFO. yuvFormat gives the planes of a Yuv stream and the range and gamma of both
+            // YUV formats; Y4M is always I420. fps goes to the Y4M header. Throws IOException if the
+            // target cannot be opened.
+            FrameWriter(FrameStreamFormat format, const YuvFormat & yuvFormat, const String & target, int width, int height,
+                double fps, int queueDepth, int converterCount);
+            ~FrameWriter();
+            // Queues frame frameIndex, counting from 0; every frame up to the last must be submitted once.
+            // Returns false, without queueing the frame, once the stream has failed.
+            bool Submit(int frameIndex, FrameBuffer & frame);
+            // Writes the queued frames and ends the stream, waiting for an encoder process to exit;
+            // false if the stream failed
+            bool Close();
+            String GetError();
+            CoreLib::Int64 GetBytesWritten()
+            {
+                return bytesWritten;
+            }
+            double GetWriteSeconds()
+            {
+                return writeSeconds;
+            }
+            // Sends printf output to stderr from here on and keeps the original stdout for a "-" stream,
+            // so that nothing printed before the stream opens ends up in it
+            static void DivertStdout();
+            // Bytes of one frame in the stream format, without the Y4M frame header
+            static int GetFrameSize(FrameStreamFormat format, int width, int height);
+            // Converts a color buffer, whose first row is the bottom of the image, to rgb24 rows from the top
+            static void ConvertToRgb(const Vec4 * pixels, int width, int height, unsigned char * result);
+        };
+    }
+}
+
+#endif
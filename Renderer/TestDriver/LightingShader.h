@@ -55,40 +55,17 @@ namespace RasterRenderer
                     sumLightingG = _mm_add_ps(sumLightingG, _mm_mul_ps(_mm_set1_ps(light.Color.y), lighting));
                     sumLightingB = _mm_add_ps(sumLightingB, _mm_mul_ps(_mm_set1_ps(light.Color.z), lighting));
                 }
-                CORE_LIB_ALIGN_16(float u[4]);
-                CORE_LIB_ALIGN_16(float v[4]);
-                CORE_LIB_ALIGN_16(float lighting[3][4]);
-
-                _mm_store_ps(u, input[10]);
-                _mm_store_ps(v, input[11]);
-                _mm_store_ps(lighting[0], sumLightingR);
-                _mm_store_ps(lighting[1], sumLightingG);
-                _mm_store_ps(lighting[2], sumLightingB);
-                float dudx = fabs(u[1] - u[0]);
-                float dudy = fabs(u[2] - u[0]);
-                float dvdx = fabs(v[1] - v[0]);
-                float dvdy = fabs(v[2] - v[0]);
-
-                for (int i = 0; i<4; i++)
-                {
-                    Vec2 uv = Vec2(u[i], v[i]);
-                    // sample texture
-                    Vec4 diffuseMap = Vec4(1.0f, 1.0f, 1.0f, 1.0f);
-                    TextureData * texture = *(TextureData **)((int*)state.ConstantBuffer + id*(4 + sizeof(TextureData*) / 4));
-                    if (texture)
-                    {
-                        uv.x -= floor(uv.x);
-                        uv.y -= floor(uv.y);
-                        state.SampleTexture(&diffuseMap, texture, 16, dudx, dvdx, dudy, dvdy, uv);
-                    }
-                    Vec4 diffRate = *(Vec4*)((int*)state.ConstantBuffer + id*(4 + sizeof(TextureData*) / 4) + sizeof(TextureData*) / 4);
-                    diffuseMap *= Vec4(lighting[0][i], lighting[1][i], lighting[2][i], 1.0f);
-                    diffuseMap *= diffRate;
-                    output[i] = diffuseMap.x;
-                    output[i + 4] = diffuseMap.y;
-                    output[i + 8] = diffuseMap.z;
-                    output[i + 12] = diffuseMap.w;
-                }
+                // sample texture
+                QuadColor diffuseMap;
+                diffuseMap.R = diffuseMap.G = diffuseMap.B = diffuseMap.A = _mm_set_ps1(1.0f);
+                TextureData * texture = *(TextureData **)((int*)state.ConstantBuffer + id*(4 + sizeof(TextureData*) / 4));
+                if (texture)
+                    state.SampleTextureQuad(&diffuseMap, texture, input[10], input[11]);
+                Vec4 diffRate = *(Vec4*)((int*)state.ConstantBuffer + id*(4 + sizeof(TextureData*) / 4) + sizeof(TextureData*) / 4);
+                _mm_storeu_ps(output, _mm_mul_ps(_mm_mul_ps(diffuseMap.R, sumLightingR), _mm_set_ps1(diffRate.x)));
+                _mm_storeu_ps(output + 4, _mm_mul_ps(_mm_mul_ps(diffuseMap.G, sumLightingG), _mm_set_ps1(diffRate.y)));
+                _mm_storeu_ps(output + 8, _mm_mul_ps(_mm_mul_ps(diffuseMap.B, sumLightingB), _mm_set_ps1(diffRate.z)));
+                _mm_storeu_ps(output + 12, _mm_mul_ps(diffuseMap.A, _mm_set_ps1(diffRate.w)));
             }
         };
     }
@@ -4,7 +4,7 @@
 #include "CoreLib/Basic.h"
 #include "TestScene.h"
 #include "NFLTrackingData.h"
-#include "ModelResource.h"
+#include "ResourceManager.h"
 #include "CoreLib/VectorMath.h"
 #include "CoreLib/Graphics/ObjModel.h"
 #include <vector>
@@ -17,34 +17,52 @@ using namespace Testing;
 using namespace VectorMath;
 using namespace NFL;
 
-// Simple player model (a colored box)
+// Simple player model (a colored box, shared by the players of a team)
 class SimplePlayerModel
 {
 private:
-    ModelResource model;
+    RefPtr<ModelResource> model;
     
 public:
     SimplePlayerModel(const Vec3& color);
     void Draw(RenderState& state, IRasterRenderer* renderer);
-    void SetShader(Shader* shader);
 };
 
 // NFL play scene with stadium and animated players
 class NFLPlayScene : public TestScene
 {
 private:
-    ModelResource stadiumModel;
-    std::vector<SimplePlayerModel> playerModels;
-    std::map<int, std::vector<PlayerPosition>> playerPositions;
-    std::vector<int> steps;
-    int currentStep;
+    RefPtr<ModelResource> stadiumModel; // null if it could not be loaded
+    std::vector<SimplePlayerModel> playerModels; // one per player of the tracks
+    PlayerTracks tracks;
+    PlayerFrame playerFrame; // player states at currentTime
+    float currentTime;
+    TrackInterpolation interpolation;
+    Vec3 cameraPosition, cameraTarget;
     
     Vec3 GetTeamColor(const String& team);
+    void GetViewMatrix(Matrix4 & viewMatrix);
     
 public:
     NFLPlayScene(ViewSettings& viewSettings, const String& stadiumModelPath, const PlayData& playData);
     void SetStep(int step);
+    // Time in tracking steps (10 per second), between steps for output frame rates above 10 Hz
+    void SetTime(float step);
+    // How player states are found between steps; Linear by default
+    void SetInterpolation(TrackInterpolation mode);
+    // Looks from position at target, Z up; above the sideline by default
+    void SetCamera(const Vec3& position, const Vec3& target);
     virtual void Draw(IRasterRenderer* renderer);
+    // Draw is DrawStatic followed by DrawDynamic. The stadium does not move, so its color and depth
+    // can be kept as the renderer's static layer for as long as GetStaticLayerKey stays the same.
+    void DrawStatic(IRasterRenderer* renderer);
+    void DrawDynamic(IRasterRenderer* renderer);
+    // Hash of everything DrawStatic depends on: camera, projection, viewport, clear color, the
+    // lighting shader's lights and the resident texture levels. Players cast no shadows in this renderer, so they are not part of it.
+    unsigned long long GetStaticLayerKey();
+    // Starts the frame from the renderer's static layer and draws the players. The layer is cleared,
+    // drawn and saved first if layerKey, the key of the renderer's layer, is not GetStaticLayerKey.
+    void DrawOverStaticLayer(IRasterRenderer* renderer, unsigned long long& layerKey);
     virtual void SetShader(Shader* shader);
 };
 
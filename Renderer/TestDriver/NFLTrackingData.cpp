@@ -1,428 +1,1033 @@
 #include "NFLTrackingData.h"
 #include "CoreLib/LibIO.h"
-#include "CoreLib/LibString.h"
-#include "CoreLib/TextIO.h"
+#include "CoreLib/NumberParsing.h"
+#include "Parallel.h"
 #include <algorithm>
+#include <set>
+#include <string>
+#include <emmintrin.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
 
 using namespace CoreLib::IO;
+using CoreLib::Int64;
 
 namespace RasterRenderer
 {
     namespace NFL
     {
-        std::map<String, PlayData> TrackingDataLoader::LoadFromCSV(const String& csvPath)
+        namespace
         {
-            std::map<String, PlayData> plays;
-            
-            try
-            {
-                RefPtr<TextReader> reader = new StreamReader(new FileStream(csvPath, FileMode::Open));
-                String line;
-                bool firstLine = true;
-                List<String> headers;
-                
-                int lineCount = 0;
-                while (true)
-                {
-                    line = reader->ReadLine();
-                    if (line.Length() == 0) break; // End of file
-                    lineCount++;
-                    if (lineCount % 100000 == 0)
+            enum TrackingColumn
+            {
+                GamePlayColumn, GameKeyColumn, PlayIdColumn, PlayerIdColumn, StepColumn, TeamColumn, PositionColumn,
+                JerseyColumn, XColumn, YColumn, SpeedColumn, DirectionColumn, OrientationColumn, TrackingColumnCount
+            };
+
+            const char * const TrackingColumnNames[TrackingColumnCount] =
+            {
+                "game_play", "game_key", "play_id", "nfl_player_id", "step", "team", "position",
+                "jersey_number", "x_position", "y_position", "speed", "direction", "orientation"
+            };
+
+            // Fields past this one are not split off, none of the columns is expected there
+            const int MaxTrackingFields = 64;
+            const int TrackingChunkSize = 1 << 22;
+
+            struct TrackingField
+            {
+                const char * Begin, * End;
+            };
+
+            // One row of the file, its text fields pointing into the mapped file
+            struct TrackingRow
+            {
+                TrackingField GamePlay, GameKey, PlayId, Team, Position;
+                int PlayerId, Step, JerseyNumber;
+                float X, Y, Speed, Direction, Orientation;
+            };
+
+            struct TrackingChunk
+            {
+                const char * Begin, * End;
+                std::vector<TrackingRow> Rows;
+            };
+
+            // Field index of each column, resolved from the header line once
+            struct TrackingLayout
+            {
+                int Columns[TrackingColumnCount]; // -1 if the file does not have the column
+                int FieldCount;
+            };
+
+            inline bool SameField(TrackingField field, const char * text, int length)
+            {
+                return field.End - field.Begin == length && memcmp(field.Begin, text, length) == 0;
+            }
+
+            inline bool SameField(TrackingField a, TrackingField b)
+            {
+                return SameField(a, b.Begin, (int)(b.End - b.Begin));
+            }
+
+            // Calls row(fields, fieldCount) for each non-empty line of [begin, end). Lines are split at the
+            // commas outside double quotes, and the quotes around a field are removed. Line breaks, commas
+            // and quotes are found 16 bytes at a time. Lines not starting with the field prefix, quoted or
+            // not, are skipped without splitting them if prefix is not null.
+            template<typename RowFunc>
+            void SplitTrackingRows(const char * begin, const char * end, const char * prefix, int prefixLength, const RowFunc & row)
+            {
+                TrackingField fields[MaxTrackingFields];
+                int fieldCount = 0;
+                const char * lineBegin = begin, * fieldBegin = begin;
+                bool inQuotes = false;
+                auto startLine = [&](const char * pos)
+                {
+                    lineBegin = fieldBegin = pos;
+                    fieldCount = 0;
+                    inQuotes = false;
+                    // a line that does not match is skipped up to its line break
+                    if (!prefix)
+                        return false;
+                    int quoted = pos < end && *pos == '"';
+                    const char * field = pos + quoted;
+                    if (end - field <= prefixLength + quoted || memcmp(field, prefix, prefixLength) != 0)
+                        return true;
+                    return (quoted && field[prefixLength] != '"') || field[prefixLength + quoted] != ',';
+                };
+                auto endField = [&](const char * fieldEnd)
+                {
+                    if (fieldCount == MaxTrackingFields)
+                        return;
+                    TrackingField field = {fieldBegin, fieldEnd};
+                    if (field.Begin < field.End && *field.Begin == '"')
+                        field.Begin++;
+                    if (field.Begin < field.End && field.End[-1] == '"')
+                        field.End--;
+                    fields[fieldCount++] = field;
+                };
+                auto endLine = [&](const char * lineEnd)
+                {
+                    if (lineEnd > lineBegin && lineEnd[-1] == '\r')
+                        lineEnd--;
+                    if (lineEnd == lineBegin)
+                        return;
+                    endField(lineEnd);
+                    row((const TrackingField *)fields, fieldCount);
+                };
+                bool skipping = startLine(begin);
+                const __m128i lineBreak = _mm_set1_epi8('\n'), comma = _mm_set1_epi8(','), quote = _mm_set1_epi8('"');
+                for (const char * pos = begin; pos < end; pos += 16)
+                {
+                    unsigned int lines = 0, delimiters = 0;
+                    if (end - pos >= 16)
                     {
-                        printf("Processing line %d...\n", lineCount);
+                        __m128i block = _mm_loadu_si128((const __m128i *)pos);
+                        lines = _mm_movemask_epi8(_mm_cmpeq_epi8(block, lineBreak));
+                        delimiters = lines | _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, comma), _mm_cmpeq_epi8(block, quote)));
                     }
-                    
-                    // Parse CSV line
-                    List<String> fields;
-                    String current;
-                    bool inQuotes = false;
-                    
-                    for (int i = 0; i < line.Length(); i++)
+                    else
                     {
-                        wchar_t c = line[i];
-                        if (c == L'"')
+                        for (int i = 0; i < end - pos; i++)
                         {
-                            inQuotes = !inQuotes;
+                            if (pos[i] == '\n')
+                                lines |= 1u << i;
+                            if (pos[i] == '\n' || pos[i] == ',' || pos[i] == '"')
+                                delimiters |= 1u << i;
                         }
-                        else if (c == L',' && !inQuotes)
+                    }
+                    while (unsigned int mask = skipping ? lines : delimiters)
+                    {
+                        int bit = Math::CountTrailingZeros(mask);
+                        const char * delimiter = pos + bit;
+                        lines &= ~((2u << bit) - 1);
+                        delimiters &= ~((2u << bit) - 1);
+                        if (*delimiter == '\n')
                         {
-                            fields.Add(current);
-                            current = L"";
+                            if (!skipping)
+                                endLine(delimiter);
+                            skipping = startLine(delimiter + 1);
                         }
-                        else
+                        else if (*delimiter == '"')
+                            inQuotes = !inQuotes;
+                        else if (!inQuotes)
                         {
-                            current = current + String(c);
+                            endField(delimiter);
+                            fieldBegin = delimiter + 1;
                         }
                     }
-                    fields.Add(current);
-                    
-                    if (firstLine)
-                    {
-                        headers = fields;
-                        firstLine = false;
-                        continue;
-                    }
-                    
-                    if (fields.Count() < headers.Count()) continue;
-                    
-                    // Find column indices
-                    int gamePlayIdx = -1, gameKeyIdx = -1, playIdIdx = -1, playerIdIdx = -1;
-                    int stepIdx = -1, teamIdx = -1, positionIdx = -1, jerseyIdx = -1;
-                    int xIdx = -1, yIdx = -1, speedIdx = -1, directionIdx = -1, orientationIdx = -1;
-                    
-                    for (int i = 0; i < headers.Count(); i++)
+                }
+                if (!skipping && lineBegin < end)
+                    endLine(end);
+            }
+
+            // Like the wcstol it replaces: leading blanks and a sign, then digits up to the first other character
+            inline int ParseTrackingInt(TrackingField field)
+            {
+                const char * pos = field.Begin;
+                while (pos < field.End && (*pos == ' ' || *pos == '\t'))
+                    pos++;
+                bool negative = false;
+                if (pos < field.End && (*pos == '-' || *pos == '+'))
+                    negative = *pos++ == '-';
+                long long value = 0;
+                for (; pos < field.End && (unsigned)(*pos - '0') < 10; pos++)
+                    value = Math::Min(value * 10 + (*pos - '0'), 1ll << 40);
+                return (int)(negative ? -value : value);
+            }
+
+            // The float of the correctly rounded double strtod reads, as the (float)wcstod it replaces. Plain
+            // decimals are read exactly by ParseExactDecimal, which rounds the same as strtod; anything else
+            // is copied out and given to strtod.
+            inline float ParseTrackingFloat(TrackingField field)
+            {
+                const char * pos = field.Begin, * end = field.End;
+                while (pos < end && (*pos == ' ' || *pos == '\t'))
+                    pos++;
+                double value;
+                if (CoreLib::Text::ParseExactDecimal(pos, end, value) && pos == end)
+                    return (float)value;
+                char buffer[64];
+                int length = (int)Math::Min(field.End - field.Begin, (ptrdiff_t)sizeof(buffer) - 1);
+                memcpy(buffer, field.Begin, length);
+                buffer[length] = 0;
+                return (float)strtod(buffer, nullptr);
+            }
+
+            inline bool SameColumnName(TrackingField field, const char * name)
+            {
+                int length = (int)strlen(name);
+                if (field.End - field.Begin != length)
+                    return false;
+                for (int i = 0; i < length; i++)
+                    if (tolower((unsigned char)field.Begin[i]) != name[i])
+                        return false;
+                return true;
+            }
+
+            // Resolves the columns from the header line and splits the rows after it into chunks ending at
+            // line breaks. Returns false if a column every row needs is missing.
+            bool SplitTrackingFile(const MemoryMappedFile & file, TrackingLayout & layout, std::vector<TrackingChunk> & chunks)
+            {
+                const char * pos = (const char *)file.Buffer();
+                const char * end = pos + file.Size();
+                if (end - pos >= 3 && memcmp(pos, "\xEF\xBB\xBF", 3) == 0)
+                    pos += 3;
+                const char * headerEnd = (const char *)memchr(pos, '\n', end - pos);
+                headerEnd = headerEnd ? headerEnd + 1 : end;
+                for (int c = 0; c < TrackingColumnCount; c++)
+                    layout.Columns[c] = -1;
+                layout.FieldCount = 0;
+                SplitTrackingRows(pos, headerEnd, nullptr, 0, [&](const TrackingField * fields, int fieldCount)
+                {
+                    layout.FieldCount = fieldCount;
+                    for (int i = 0; i < fieldCount; i++)
+                        for (int c = 0; c < TrackingColumnCount; c++)
+                            if (SameColumnName(fields[i], TrackingColumnNames[c]))
+                                layout.Columns[c] = i;
+                });
+                if (layout.Columns[GamePlayColumn] < 0 || layout.Columns[PlayerIdColumn] < 0 || layout.Columns[StepColumn] < 0)
+                    return false;
+                for (pos = headerEnd; pos < end; )
+                {
+                    const char * chunkEnd = end - pos > TrackingChunkSize ? pos + TrackingChunkSize : end;
+                    if (chunkEnd < end)
                     {
-                        String h = headers[i].ToLower();
-                        if (h == L"game_play") gamePlayIdx = i;
-                        else if (h == L"game_key") gameKeyIdx = i;
-                        else if (h == L"play_id") playIdIdx = i;
-                        else if (h == L"nfl_player_id") playerIdIdx = i;
-                        else if (h == L"step") stepIdx = i;
-                        else if (h == L"team") teamIdx = i;
-                        else if (h == L"position") positionIdx = i;
-                        else if (h == L"jersey_number") jerseyIdx = i;
-                        else if (h == L"x_position") xIdx = i;
-                        else if (h == L"y_position") yIdx = i;
-                        else if (h == L"speed") speedIdx = i;
-                        else if (h == L"direction") directionIdx = i;
-                        else if (h == L"orientation") orientationIdx = i;
+                        const char * lineBreak = (const char *)memchr(chunkEnd, '\n', end - chunkEnd);
+                        chunkEnd = lineBreak ? lineBreak + 1 : end;
                     }
-                    
-                    if (gamePlayIdx < 0 || playerIdIdx < 0 || stepIdx < 0) continue;
-                    
-                    String gamePlay = fields[gamePlayIdx];
-                    int playerId = StringToInt(fields[playerIdIdx]);
-                    int step = StringToInt(fields[stepIdx]);
-                    
-                    // Get or create play
-                    PlayData& play = plays[gamePlay];
-                    if (play.gamePlay.Length() == 0)
+                    TrackingChunk chunk;
+                    chunk.Begin = pos;
+                    chunk.End = chunkEnd;
+                    chunks.push_back(std::move(chunk));
+                    pos = chunkEnd;
+                }
+                return true;
+            }
+
+            // Parses the rows of a chunk that have every header column, and belong to gamePlay if it is not null
+            void ParseTrackingChunk(TrackingChunk & chunk, const TrackingLayout & layout, const char * gamePlay, int gamePlayLength)
+            {
+                const int * columns = layout.Columns;
+                // most files start with game_play, so rows of other plays are skipped by their first bytes
+                bool prefixFilter = gamePlay && columns[GamePlayColumn] == 0;
+                SplitTrackingRows(chunk.Begin, chunk.End, prefixFilter ? gamePlay : nullptr, gamePlayLength,
+                    [&](const TrackingField * fields, int fieldCount)
+                {
+                    if (fieldCount < layout.FieldCount)
+                        return;
+                    if (gamePlay && !SameField(fields[columns[GamePlayColumn]], gamePlay, gamePlayLength))
+                        return;
+                    TrackingField none = {nullptr, nullptr};
+                    auto text = [&](int column)
                     {
-                        play.gamePlay = gamePlay;
-                        if (gameKeyIdx >= 0) play.gameKey = fields[gameKeyIdx];
-                        if (playIdIdx >= 0) play.playId = fields[playIdIdx];
-                    }
-                    
-                    // Create player position
-                    PlayerPosition pos;
-                    pos.step = step;
-                    if (teamIdx >= 0) pos.team = fields[teamIdx];
-                    if (positionIdx >= 0) pos.position = fields[positionIdx];
-                    if (jerseyIdx >= 0) pos.jerseyNumber = StringToInt(fields[jerseyIdx]);
-                    if (xIdx >= 0) pos.x = (float)StringToDouble(fields[xIdx]);
-                    if (yIdx >= 0) pos.y = (float)StringToDouble(fields[yIdx]);
-                    if (speedIdx >= 0) pos.speed = (float)StringToDouble(fields[speedIdx]);
-                    if (directionIdx >= 0) pos.direction = (float)StringToDouble(fields[directionIdx]);
-                    if (orientationIdx >= 0) pos.orientation = (float)StringToDouble(fields[orientationIdx]);
-                    
-                    // Add to player's position list
-                    play.players[playerId].push_back(pos);
-                    
-                    // Track step
-                    bool found = false;
-                    for (int s : play.steps)
+                        return columns[column] >= 0 ? fields[columns[column]] : none;
+                    };
+                    auto number = [&](int column)
                     {
-                        if (s == step)
-                        {
-                            found = true;
-                            break;
-                        }
-                    }
-                    if (!found)
+                        return columns[column] >= 0 ? ParseTrackingFloat(fields[columns[column]]) : 0.0f;
+                    };
+                    TrackingRow row;
+                    row.GamePlay = fields[columns[GamePlayColumn]];
+                    row.GameKey = text(GameKeyColumn);
+                    row.PlayId = text(PlayIdColumn);
+                    row.Team = text(TeamColumn);
+                    row.Position = text(PositionColumn);
+                    row.PlayerId = ParseTrackingInt(fields[columns[PlayerIdColumn]]);
+                    row.Step = ParseTrackingInt(fields[columns[StepColumn]]);
+                    row.JerseyNumber = columns[JerseyColumn] >= 0 ? ParseTrackingInt(fields[columns[JerseyColumn]]) : 0;
+                    row.X = number(XColumn);
+                    row.Y = number(YColumn);
+                    row.Speed = number(SpeedColumn);
+                    row.Direction = number(DirectionColumn);
+                    row.Orientation = number(OrientationColumn);
+                    chunk.Rows.push_back(row);
+                });
+            }
+
+            // Text fields as Strings; teams and positions repeat, so the few distinct ones are converted once
+            class TrackingStrings
+            {
+            private:
+                std::vector<std::pair<TrackingField, String>> strings;
+            public:
+                String Get(TrackingField field)
+                {
+                    if (field.Begin == field.End)
+                        return String();
+                    for (auto & s : strings)
+                        if (SameField(s.first, field))
+                            return s.second;
+                    std::vector<char> text(field.Begin, field.End);
+                    text.push_back(0);
+                    String result = text.data();
+                    if (strings.size() < 256)
+                        strings.push_back(std::make_pair(field, result));
+                    return result;
+                }
+            };
+
+            // Appends the rows of a play in file order
+            class TrackingPlayBuilder
+            {
+            private:
+                PlayData & play;
+                std::vector<PlayerPosition> * lastPlayer = nullptr;
+                int lastPlayerId = 0;
+            public:
+                TrackingPlayBuilder(PlayData & play)
+                    : play(play)
+                {}
+                void Add(const TrackingRow & row, TrackingStrings & strings)
+                {
+                    if (!lastPlayer || row.PlayerId != lastPlayerId)
                     {
-                        play.steps.push_back(step);
+                        lastPlayer = &play.players[row.PlayerId];
+                        lastPlayerId = row.PlayerId;
                     }
+                    PlayerPosition pos;
+                    pos.step = row.Step;
+                    pos.team = strings.Get(row.Team);
+                    pos.position = strings.Get(row.Position);
+                    pos.jerseyNumber = row.JerseyNumber;
+                    pos.x = row.X;
+                    pos.y = row.Y;
+                    pos.speed = row.Speed;
+                    pos.direction = row.Direction;
+                    pos.orientation = row.Orientation;
+                    lastPlayer->push_back(pos);
+                    play.steps.push_back(row.Step);
                 }
-                
-                // Sort steps for each play
-                for (auto& pair : plays)
+                void Finish()
                 {
-                    std::sort(pair.second.steps.begin(), pair.second.steps.end());
+                    std::sort(play.steps.begin(), play.steps.end());
+                    play.steps.erase(std::unique(play.steps.begin(), play.steps.end()), play.steps.end());
                 }
-                
-                printf("Loaded %d plays from tracking data\n", (int)plays.size());
-            }
-            catch (Exception& ex)
+            };
+
+            // Maps a tracking CSV or play index file; false, after reporting it, if it cannot be read
+            bool MapTrackingFile(const String & fileName, RefPtr<MemoryMappedFile> & file)
             {
-                printf("Error loading tracking CSV: %s\n", ex.Message.ToMultiByteString());
-            }
-            
-            return plays;
-        }
-        
-        PlayData TrackingDataLoader::GetPlay(const String& csvPath, const String& gamePlay)
-        {
-            printf("  GetPlay: Starting...\n");
-            fflush(stdout);
-            PlayData playData;
-            playData.gamePlay = gamePlay;
-            
-            try
-            {
-                printf("  GetPlay: Checking if file exists...\n");
-                fflush(stdout);
-                // Check if file exists first
-                bool fileExists = false;
-                try {
-                    fileExists = File::Exists(csvPath);
-                } catch (...) {
-                    printf("  GetPlay: Exception in File::Exists\n");
-                    fflush(stdout);
-                    return playData;
+                try
+                {
+                    file = new MemoryMappedFile(fileName);
+                    return true;
                 }
-                
-                if (!fileExists)
+                catch (IOException & ex)
                 {
-                    printf("  GetPlay: Error: CSV file does not exist\n");
-                    fflush(stdout);
-                    return playData;
+                    printf("Error loading tracking data: %s\n", ex.Message.ToMultiByteString());
+                    return false;
                 }
-                printf("  GetPlay: File exists, opening...\n");
-                fflush(stdout);
-                
-                RefPtr<FileStream> fileStream;
-                try {
-                    fileStream = new FileStream(csvPath, FileMode::Open);
-                } catch (Exception& ex) {
-                    printf("  GetPlay: Exception creating FileStream: %s\n", ex.Message.ToMultiByteString());
-                    fflush(stdout);
-                    return playData;
+            }
+
+            // Splits the file into chunks and parses them concurrently. Returns false, after reporting it,
+            // if the file lacks a needed column.
+            bool ParseTrackingFile(const MemoryMappedFile & file, const String & csvPath, const char * gamePlay, int gamePlayLength,
+                std::vector<TrackingChunk> & chunks)
+            {
+                TrackingLayout layout;
+                if (!SplitTrackingFile(file, layout, chunks))
+                {
+                    printf("Error loading tracking CSV: %s has no game_play, nfl_player_id or step column\n", csvPath.ToMultiByteString());
+                    return false;
                 }
-                printf("  GetPlay: FileStream created\n");
-                fflush(stdout);
-                
-                RefPtr<TextReader> reader;
-                try {
-                    reader = new StreamReader(fileStream);
-                } catch (Exception& ex) {
-                    printf("  GetPlay: Exception creating StreamReader: %s\n", ex.Message.ToMultiByteString());
-                    fflush(stdout);
-                    return playData;
+                Parallel::For(0, (int)chunks.size(), 1, [&](int c)
+                {
+                    ParseTrackingChunk(chunks[c], layout, gamePlay, gamePlayLength);
+                });
+                return true;
+            }
+
+            // Play index file: a header, the play blocks, and the play table sorted by game_play followed by
+            // its string table at TableOffset. A play block is a PlayBlockHeader, the play's sorted steps, its
+            // player table, the columns of its samples grouped by player in file order, and the team and
+            // position strings the samples refer to. Blocks and the table are 64-byte aligned and the arrays
+            // in them 4-byte aligned, so one play is read in place from a single range of the mapping.
+            const unsigned int PlayIndexMagic = 0x3149504E; // "NPI1"
+            const int PlayIndexVersion = 1;
+            const int PlayIndexAlignment = 64;
+
+            struct PlayIndexHeader
+            {
+                unsigned int Magic;
+                int Version;
+                int PlayCount, StringSize;
+                Int64 TableOffset;
+            };
+
+            struct PlayIndexEntry
+            {
+                Int64 Offset, Size; // of the play block
+                int GamePlay, GameKey, PlayId, Reserved; // offsets in the string table
+            };
+
+            struct PlayBlockHeader
+            {
+                int StepCount, PlayerCount, SampleCount, StringSize;
+            };
+
+            struct PlayBlockPlayer
+            {
+                int PlayerId, FirstSample, SampleCount, Reserved;
+            };
+
+            // Offsets of the arrays of a play block from its start
+            struct PlayBlockLayout
+            {
+                Int64 Steps, Players, SampleSteps, X, Y, Speed, Direction, Orientation, JerseyNumbers, Teams, Positions, Strings, Size;
+                PlayBlockLayout(const PlayBlockHeader & header)
+                {
+                    Int64 samples = header.SampleCount;
+                    Steps = sizeof(PlayBlockHeader);
+                    Players = Steps + (Int64)header.StepCount * sizeof(int);
+                    SampleSteps = Players + (Int64)header.PlayerCount * sizeof(PlayBlockPlayer);
+                    X = SampleSteps + samples * sizeof(int);
+                    Y = X + samples * sizeof(float);
+                    Speed = Y + samples * sizeof(float);
+                    Direction = Speed + samples * sizeof(float);
+                    Orientation = Direction + samples * sizeof(float);
+                    JerseyNumbers = Orientation + samples * sizeof(float);
+                    Teams = JerseyNumbers + samples * sizeof(int);
+                    Positions = Teams + samples * sizeof(unsigned short);
+                    Strings = Positions + samples * sizeof(unsigned short);
+                    Size = Strings + header.StringSize;
                 }
-                printf("  GetPlay: StreamReader created\n");
-                fflush(stdout);
-                String line;
-                bool firstLine = true;
-                List<String> headers;
-                
-                int lineCount = 0;
-                int playLineCount = 0;
-                printf("  GetPlay: Starting to read lines...\n");
-                fflush(stdout);
-                
-                while (true)
-                {
-                    try {
-                        line = reader->ReadLine();
-                    } catch (Exception& ex) {
-                        printf("  GetPlay: Exception reading line %d: %s\n", lineCount, ex.Message.ToMultiByteString());
-                        fflush(stdout);
-                        break;
-                    } catch (...) {
-                        printf("  GetPlay: Unknown exception reading line %d\n", lineCount);
-                        fflush(stdout);
-                        break;
-                    }
-                    
-                    if (line.Length() == 0) {
-                        printf("  GetPlay: End of file reached at line %d\n", lineCount);
-                        fflush(stdout);
-                        break; // End of file
-                    }
-                    
-                    lineCount++;
-                    if (lineCount == 1) {
-                        printf("  GetPlay: Read first line successfully (length=%d)\n", line.Length());
-                        fflush(stdout);
-                    }
-                    if (lineCount % 100000 == 0)
+            };
+
+            Int64 AlignPlayIndexOffset(Int64 offset)
+            {
+                return (offset + PlayIndexAlignment - 1) & ~(Int64)(PlayIndexAlignment - 1);
+            }
+
+            bool IsPlayIndex(const MemoryMappedFile & file)
+            {
+                unsigned int magic = 0;
+                if (file.Size() >= (Int64)sizeof(magic))
+                    memcpy(&magic, file.Buffer(), sizeof(magic));
+                return magic == PlayIndexMagic;
+            }
+
+            // The play table of a play index, checked against the file size; false if the file is not a
+            // valid play index of this version
+            bool GetPlayTable(const MemoryMappedFile & file, const PlayIndexEntry *& entries, int & count, const char *& strings)
+            {
+                const unsigned char * data = file.Buffer();
+                Int64 fileSize = file.Size();
+                PlayIndexHeader header;
+                if (fileSize < (Int64)sizeof(header))
+                    return false;
+                memcpy(&header, data, sizeof(header));
+                Int64 stringOffset = header.TableOffset + (Int64)header.PlayCount * sizeof(PlayIndexEntry);
+                if (header.Magic != PlayIndexMagic || header.Version != PlayIndexVersion || header.PlayCount < 0 ||
+                    header.StringSize < 1 || header.TableOffset < (Int64)sizeof(header) || header.TableOffset % PlayIndexAlignment != 0 ||
+                    stringOffset + header.StringSize > fileSize || data[stringOffset + header.StringSize - 1] != 0)
+                    return false;
+                entries = (const PlayIndexEntry *)(data + header.TableOffset);
+                count = header.PlayCount;
+                strings = (const char *)data + stringOffset;
+                for (int i = 0; i < count; i++)
+                {
+                    const PlayIndexEntry & entry = entries[i];
+                    if (entry.Offset < (Int64)sizeof(header) || entry.Offset % PlayIndexAlignment != 0 || entry.Size < (Int64)sizeof(PlayBlockHeader) ||
+                        entry.Offset + entry.Size > header.TableOffset || (unsigned)entry.GamePlay >= (unsigned)header.StringSize ||
+                        (unsigned)entry.GameKey >= (unsigned)header.StringSize || (unsigned)entry.PlayId >= (unsigned)header.StringSize)
+                        return false;
+                }
+                return true;
+            }
+
+            // Rebuilds the PlayData of a play block; false if the block is malformed
+            bool ReadPlayBlock(const MemoryMappedFile & file, const PlayIndexEntry & entry, const char * strings, PlayData & play)
+            {
+                const unsigned char * block = file.Buffer() + entry.Offset;
+                PlayBlockHeader header;
+                memcpy(&header, block, sizeof(header));
+                if (header.StepCount < 0 || header.PlayerCount < 0 || header.SampleCount < 0 || header.StringSize < 0)
+                    return false;
+                PlayBlockLayout layout(header);
+                if (layout.Size > entry.Size || (header.StringSize && block[layout.Size - 1] != 0))
+                    return false;
+                auto column = [&](Int64 offset)
+                {
+                    return block + offset;
+                };
+                const int * steps = (const int *)column(layout.Steps);
+                const PlayBlockPlayer * players = (const PlayBlockPlayer *)column(layout.Players);
+                const int * sampleSteps = (const int *)column(layout.SampleSteps);
+                const float * x = (const float *)column(layout.X), * y = (const float *)column(layout.Y);
+                const float * speed = (const float *)column(layout.Speed), * direction = (const float *)column(layout.Direction);
+                const float * orientation = (const float *)column(layout.Orientation);
+                const int * jerseyNumbers = (const int *)column(layout.JerseyNumbers);
+                const unsigned short * teams = (const unsigned short *)column(layout.Teams);
+                const unsigned short * positions = (const unsigned short *)column(layout.Positions);
+                const char * blockStrings = (const char *)column(layout.Strings);
+                // the few distinct names are converted once
+                std::map<int, String> names;
+                auto getName = [&](unsigned short offset, String & name)
+                {
+                    if (offset >= header.StringSize)
+                        return false;
+                    auto found = names.find(offset);
+                    if (found == names.end())
+                        found = names.insert(std::make_pair((int)offset, String(blockStrings + offset))).first;
+                    name = found->second;
+                    return true;
+                };
+                play.gameKey = strings + entry.GameKey;
+                play.playId = strings + entry.PlayId;
+                play.steps.assign(steps, steps + header.StepCount);
+                for (int p = 0; p < header.PlayerCount; p++)
+                {
+                    const PlayBlockPlayer & player = players[p];
+                    if (player.FirstSample < 0 || player.SampleCount < 0 || player.SampleCount > header.SampleCount - player.FirstSample)
+                        return false;
+                    std::vector<PlayerPosition> & track = play.players[player.PlayerId];
+                    track.resize(player.SampleCount);
+                    for (int i = 0; i < player.SampleCount; i++)
                     {
-                        printf("  GetPlay: Processed %d lines, found %d play lines...\n", lineCount, playLineCount);
-                        fflush(stdout);
+                        int s = player.FirstSample + i;
+                        PlayerPosition & pos = track[i];
+                        if (!getName(teams[s], pos.team) || !getName(positions[s], pos.position))
+                            return false;
+                        pos.step = sampleSteps[s];
+                        pos.jerseyNumber = jerseyNumbers[s];
+                        pos.x = x[s];
+                        pos.y = y[s];
+                        pos.speed = speed[s];
+                        pos.direction = direction[s];
+                        pos.orientation = orientation[s];
                     }
-                    
-                    if (firstLine)
-                    {
-                        // Parse header
-                        List<String> headerFields;
-                        String current;
-                        for (int i = 0; i < line.Length(); i++)
+                }
+                return true;
+            }
+
+            // Samples of one play in file order, gathered while building a play index
+            class PlayColumns
+            {
+            private:
+                std::vector<std::pair<std::string, unsigned short>> names;
+                bool AddName(TrackingField field, std::vector<unsigned short> & column)
+                {
+                    int length = (int)(field.End - field.Begin);
+                    for (auto & name : names)
+                        if (SameField(field, name.first.data(), (int)name.first.size()))
                         {
-                            wchar_t c = line[i];
-                            if (c == L',')
-                            {
-                                headerFields.Add(current);
-                                current = L"";
-                            }
-                            else
-                            {
-                                current = current + String(c);
-                            }
+                            column.push_back(name.second);
+                            return true;
                         }
-                        headerFields.Add(current);
-                        headers = headerFields;
-                        firstLine = false;
-                        continue;
+                    if (Strings.size() + length + 1 > 0xFFFF)
+                        return false;
+                    names.push_back(std::make_pair(std::string(field.Begin, field.End), (unsigned short)Strings.size()));
+                    column.push_back((unsigned short)Strings.size());
+                    Strings.insert(Strings.end(), field.Begin, field.End);
+                    Strings.push_back(0);
+                    return true;
+                }
+            public:
+                std::string GameKey, PlayId;
+                std::vector<int> PlayerIds, Steps, JerseyNumbers;
+                std::vector<float> X, Y, Speed, Direction, Orientation;
+                std::vector<unsigned short> Teams, Positions; // offsets in Strings
+                std::vector<char> Strings;
+                // False if the play has more than 64 KB of distinct team and position names
+                bool Add(const TrackingRow & row)
+                {
+                    if (Steps.empty())
+                    {
+                        GameKey.assign(row.GameKey.Begin, row.GameKey.End);
+                        PlayId.assign(row.PlayId.Begin, row.PlayId.End);
                     }
-                    
-                    // Quick check: does this line start with game_play?
-                    bool isOurPlay = false;
-                    if (line.Length() >= gamePlay.Length())
+                    PlayerIds.push_back(row.PlayerId);
+                    Steps.push_back(row.Step);
+                    JerseyNumbers.push_back(row.JerseyNumber);
+                    X.push_back(row.X);
+                    Y.push_back(row.Y);
+                    Speed.push_back(row.Speed);
+                    Direction.push_back(row.Direction);
+                    Orientation.push_back(row.Orientation);
+                    return AddName(row.Team, Teams) && AddName(row.Position, Positions);
+                }
+            };
+
+            template<typename T>
+            std::vector<T> GatherPlayColumn(const std::vector<T> & values, const std::vector<int> & order)
+            {
+                std::vector<T> result(order.size());
+                for (int i = 0; i < (int)order.size(); i++)
+                    result[i] = values[order[i]];
+                return result;
+            }
+
+            // Writes the plays, sorted by game_play, under a name of its own and renames the file into
+            // place, like the model cache
+            bool WritePlayIndex(const std::map<std::string, PlayColumns> & plays, const String & indexPath)
+            {
+                PlayIndexHeader header;
+                header.Magic = PlayIndexMagic;
+                header.Version = PlayIndexVersion;
+                header.PlayCount = (int)plays.size();
+                std::vector<PlayIndexEntry> entries;
+                std::vector<char> strings;
+                auto addString = [&](const std::string & s)
+                {
+                    int offset = (int)strings.size();
+                    strings.insert(strings.end(), s.begin(), s.end());
+                    strings.push_back(0);
+                    return offset;
+                };
+                Int64 offset = AlignPlayIndexOffset(sizeof(header));
+                for (auto & play : plays)
+                {
+                    PlayBlockHeader block;
+                    block.SampleCount = (int)play.second.Steps.size();
+                    block.StepCount = (int)std::set<int>(play.second.Steps.begin(), play.second.Steps.end()).size();
+                    block.PlayerCount = (int)std::set<int>(play.second.PlayerIds.begin(), play.second.PlayerIds.end()).size();
+                    block.StringSize = (int)play.second.Strings.size();
+                    PlayIndexEntry entry;
+                    entry.Offset = offset;
+                    entry.Size = PlayBlockLayout(block).Size;
+                    entry.GamePlay = addString(play.first);
+                    entry.GameKey = addString(play.second.GameKey);
+                    entry.PlayId = addString(play.second.PlayId);
+                    entry.Reserved = 0;
+                    entries.push_back(entry);
+                    offset = AlignPlayIndexOffset(offset + entry.Size);
+                }
+                header.TableOffset = offset;
+                header.StringSize = (int)strings.size();
+                String tempName = File::GetTemporaryName(indexPath);
+                bool written = false;
+                try
+                {
+                    FileStream stream(tempName, FileMode::Create);
+                    const char padding[PlayIndexAlignment] = {};
+                    Int64 position = 0;
+                    // pads from the end of the previous array up to arrayOffset
+                    auto writeArray = [&](Int64 arrayOffset, const void * buffer, Int64 size)
                     {
-                        String lineStart = line.SubString(0, gamePlay.Length());
-                        if (lineStart == gamePlay)
+                        int paddingSize = (int)(arrayOffset - position);
+                        position = arrayOffset + size;
+                        return stream.Write(padding, paddingSize) == paddingSize && stream.Write(buffer, (int)size) == (int)size;
+                    };
+                    written = writeArray(0, &header, sizeof(header));
+                    int p = 0;
+                    for (auto & play : plays)
+                    {
+                        if (!written)
+                            break;
+                        const PlayColumns & columns = play.second;
+                        Int64 blockOffset = entries[p++].Offset;
+                        // samples grouped by player, in file order within each player
+                        std::vector<int> order(columns.Steps.size());
+                        for (int i = 0; i < (int)order.size(); i++)
+                            order[i] = i;
+                        std::stable_sort(order.begin(), order.end(), [&](int a, int b)
                         {
-                            // Check if next char is comma (to avoid partial matches)
-                            if (line.Length() > gamePlay.Length() && line[gamePlay.Length()] == L',')
+                            return columns.PlayerIds[a] < columns.PlayerIds[b];
+                        });
+                        std::vector<int> steps(columns.Steps);
+                        std::sort(steps.begin(), steps.end());
+                        steps.erase(std::unique(steps.begin(), steps.end()), steps.end());
+                        std::vector<PlayBlockPlayer> players;
+                        for (int i = 0; i < (int)order.size(); i++)
+                        {
+                            if (players.empty() || players.back().PlayerId != columns.PlayerIds[order[i]])
                             {
-                                isOurPlay = true;
+                                PlayBlockPlayer player = {columns.PlayerIds[order[i]], i, 0, 0};
+                                players.push_back(player);
                             }
+                            players.back().SampleCount++;
                         }
+                        PlayBlockHeader block;
+                        block.StepCount = (int)steps.size();
+                        block.PlayerCount = (int)players.size();
+                        block.SampleCount = (int)order.size();
+                        block.StringSize = (int)columns.Strings.size();
+                        PlayBlockLayout layout(block);
+                        auto sampleSteps = GatherPlayColumn(columns.Steps, order), jerseyNumbers = GatherPlayColumn(columns.JerseyNumbers, order);
+                        auto x = GatherPlayColumn(columns.X, order), y = GatherPlayColumn(columns.Y, order);
+                        auto speed = GatherPlayColumn(columns.Speed, order), direction = GatherPlayColumn(columns.Direction, order);
+                        auto orientation = GatherPlayColumn(columns.Orientation, order);
+                        auto teams = GatherPlayColumn(columns.Teams, order), positions = GatherPlayColumn(columns.Positions, order);
+                        Int64 samples = (Int64)order.size();
+                        written = writeArray(blockOffset, &block, sizeof(block)) &&
+                            writeArray(blockOffset + layout.Steps, steps.data(), steps.size() * sizeof(int)) &&
+                            writeArray(blockOffset + layout.Players, players.data(), players.size() * sizeof(PlayBlockPlayer)) &&
+                            writeArray(blockOffset + layout.SampleSteps, sampleSteps.data(), samples * sizeof(int)) &&
+                            writeArray(blockOffset + layout.X, x.data(), samples * sizeof(float)) &&
+                            writeArray(blockOffset + layout.Y, y.data(), samples * sizeof(float)) &&
+                            writeArray(blockOffset + layout.Speed, speed.data(), samples * sizeof(float)) &&
+                            writeArray(blockOffset + layout.Direction, direction.data(), samples * sizeof(float)) &&
+                            writeArray(blockOffset + layout.Orientation, orientation.data(), samples * sizeof(float)) &&
+                            writeArray(blockOffset + layout.JerseyNumbers, jerseyNumbers.data(), samples * sizeof(int)) &&
+                            writeArray(blockOffset + layout.Teams, teams.data(), samples * sizeof(unsigned short)) &&
+                            writeArray(blockOffset + layout.Positions, positions.data(), samples * sizeof(unsigned short)) &&
+                            writeArray(blockOffset + layout.Strings, columns.Strings.data(), columns.Strings.size());
                     }
-                    
-                    if (!isOurPlay) continue;
-                    playLineCount++;
-                    
-                    // Parse CSV line for play
-                    List<String> fields;
-                    String current;
-                    bool inQuotes = false;
-                    
-                    for (int i = 0; i < line.Length(); i++)
+                    written = written && writeArray(header.TableOffset, entries.data(), entries.size() * sizeof(PlayIndexEntry)) &&
+                        writeArray(position, strings.data(), strings.size());
+                    stream.Close();
+                }
+                catch (IOException &)
+                {
+                    written = false;
+                }
+                if (written && File::Replace(tempName, indexPath))
+                    return true;
+                File::Delete(tempName);
+                printf("Error writing play index %s\n", indexPath.ToMultiByteString());
+                return false;
+            }
+        }
+
+        std::map<String, PlayData> TrackingDataLoader::LoadFromCSV(const String& csvPath)
+        {
+            std::map<String, PlayData> plays;
+            RefPtr<MemoryMappedFile> file;
+            if (!MapTrackingFile(csvPath, file))
+                return plays;
+            if (IsPlayIndex(*file))
+            {
+                const PlayIndexEntry * entries;
+                const char * strings;
+                int count;
+                bool valid = GetPlayTable(*file, entries, count, strings);
+                std::vector<PlayData> blocks(valid ? count : 0);
+                std::vector<char> blockValid(blocks.size());
+                Parallel::For(0, (int)blocks.size(), 1, [&](int i)
+                {
+                    blockValid[i] = ReadPlayBlock(*file, entries[i], strings, blocks[i]);
+                });
+                for (int i = 0; i < (int)blocks.size(); i++)
+                    valid = valid && blockValid[i];
+                if (!valid)
+                {
+                    printf("Error loading tracking data: %s is not a valid play index\n", csvPath.ToMultiByteString());
+                    return plays;
+                }
+                for (int i = 0; i < count; i++)
+                {
+                    String gamePlay = strings + entries[i].GamePlay;
+                    PlayData & play = plays[gamePlay];
+                    play = std::move(blocks[i]);
+                    play.gamePlay = gamePlay;
+                }
+                return plays;
+            }
+            std::vector<TrackingChunk> chunks;
+            if (!ParseTrackingFile(*file, csvPath, nullptr, 0, chunks))
+                return plays;
+            // rows of a play are usually contiguous, so the play is only looked up when it changes
+            std::map<String, TrackingPlayBuilder> builders;
+            TrackingStrings strings;
+            TrackingField lastGamePlay = {nullptr, nullptr};
+            TrackingPlayBuilder * builder = nullptr;
+            for (auto & chunk : chunks)
+            {
+                for (auto & row : chunk.Rows)
+                {
+                    if (!builder || !SameField(row.GamePlay, lastGamePlay))
                     {
-                        wchar_t c = line[i];
-                        if (c == L'"')
-                        {
-                            inQuotes = !inQuotes;
-                        }
-                        else if (c == L',' && !inQuotes)
-                        {
-                            fields.Add(current);
-                            current = L"";
-                        }
-                        else
+                        String gamePlay = strings.Get(row.GamePlay);
+                        PlayData & play = plays[gamePlay];
+                        auto found = builders.find(gamePlay);
+                        if (found == builders.end())
                         {
-                            current = current + String(c);
+                            play.gamePlay = gamePlay;
+                            play.gameKey = strings.Get(row.GameKey);
+                            play.playId = strings.Get(row.PlayId);
+                            found = builders.insert(std::make_pair(gamePlay, TrackingPlayBuilder(play))).first;
                         }
+                        builder = &found->second;
+                        lastGamePlay = row.GamePlay;
                     }
-                    fields.Add(current);
-                    
-                    if (fields.Count() < headers.Count()) continue;
-                    
-                    // Find column indices
-                    int gamePlayIdx = -1, gameKeyIdx = -1, playIdIdx = -1, playerIdIdx = -1;
-                    int stepIdx = -1, teamIdx = -1, positionIdx = -1, jerseyIdx = -1;
-                    int xIdx = -1, yIdx = -1, speedIdx = -1, directionIdx = -1, orientationIdx = -1;
-                    
-                    for (int i = 0; i < headers.Count(); i++)
-                    {
-                        String h = headers[i].ToLower();
-                        if (h == L"game_play") gamePlayIdx = i;
-                        else if (h == L"game_key") gameKeyIdx = i;
-                        else if (h == L"play_id") playIdIdx = i;
-                        else if (h == L"nfl_player_id") playerIdIdx = i;
-                        else if (h == L"step") stepIdx = i;
-                        else if (h == L"team") teamIdx = i;
-                        else if (h == L"position") positionIdx = i;
-                        else if (h == L"jersey_number") jerseyIdx = i;
-                        else if (h == L"x_position") xIdx = i;
-                        else if (h == L"y_position") yIdx = i;
-                        else if (h == L"speed") speedIdx = i;
-                        else if (h == L"direction") directionIdx = i;
-                        else if (h == L"orientation") orientationIdx = i;
-                    }
-                    
-                    if (gamePlayIdx < 0 || playerIdIdx < 0 || stepIdx < 0) continue;
-                    
-                    if (playData.gamePlay.Length() == 0)
+                    builder->Add(row, strings);
+                }
+                chunk.Rows = std::vector<TrackingRow>();
+            }
+            for (auto & b : builders)
+                b.second.Finish();
+            return plays;
+        }
+
+        PlayData TrackingDataLoader::GetPlay(const String& csvPath, const String& gamePlay)
+        {
+            PlayData playData;
+            playData.gamePlay = gamePlay;
+            RefPtr<MemoryMappedFile> file;
+            if (!MapTrackingFile(csvPath, file))
+                return playData;
+            String name = gamePlay;
+            const char * key = name.ToMultiByteString();
+            if (IsPlayIndex(*file))
+            {
+                const PlayIndexEntry * entries;
+                const char * strings;
+                int count;
+                if (!GetPlayTable(*file, entries, count, strings))
+                {
+                    printf("Error loading tracking data: %s is not a valid play index\n", csvPath.ToMultiByteString());
+                    return playData;
+                }
+                auto found = std::lower_bound(entries, entries + count, key, [&](const PlayIndexEntry & entry, const char * k)
+                {
+                    return strcmp(strings + entry.GamePlay, k) < 0;
+                });
+                if (found != entries + count && strcmp(strings + found->GamePlay, key) == 0 &&
+                    !ReadPlayBlock(*file, *found, strings, playData))
+                {
+                    printf("Error loading tracking data: %s is not a valid play index\n", csvPath.ToMultiByteString());
+                    playData = PlayData();
+                    playData.gamePlay = gamePlay;
+                }
+                return playData;
+            }
+            std::vector<TrackingChunk> chunks;
+            if (!ParseTrackingFile(*file, csvPath, key, (int)strlen(key), chunks))
+                return playData;
+            TrackingPlayBuilder builder(playData);
+            TrackingStrings strings;
+            bool first = true;
+            for (auto & chunk : chunks)
+            {
+                for (auto & row : chunk.Rows)
+                {
+                    if (first)
                     {
-                        playData.gamePlay = gamePlay;
-                        if (gameKeyIdx >= 0) playData.gameKey = fields[gameKeyIdx];
-                        if (playIdIdx >= 0) playData.playId = fields[playIdIdx];
+                        playData.gameKey = strings.Get(row.GameKey);
+                        playData.playId = strings.Get(row.PlayId);
+                        first = false;
                     }
-                    
-                    int playerId = StringToInt(fields[playerIdIdx]);
-                    int step = StringToInt(fields[stepIdx]);
-                    
-                    // Create player position
-                    PlayerPosition pos;
-                    pos.step = step;
-                    if (teamIdx >= 0) pos.team = fields[teamIdx];
-                    if (positionIdx >= 0) pos.position = fields[positionIdx];
-                    if (jerseyIdx >= 0) pos.jerseyNumber = StringToInt(fields[jerseyIdx]);
-                    if (xIdx >= 0) pos.x = (float)StringToDouble(fields[xIdx]);
-                    if (yIdx >= 0) pos.y = (float)StringToDouble(fields[yIdx]);
-                    if (speedIdx >= 0) pos.speed = (float)StringToDouble(fields[speedIdx]);
-                    if (directionIdx >= 0) pos.direction = (float)StringToDouble(fields[directionIdx]);
-                    if (orientationIdx >= 0) pos.orientation = (float)StringToDouble(fields[orientationIdx]);
-                    
-                    // Add to player's position list
-                    playData.players[playerId].push_back(pos);
-                    
-                    // Track step
-                    bool found = false;
-                    for (int s : playData.steps)
+                    builder.Add(row, strings);
+                }
+            }
+            builder.Finish();
+            return playData;
+        }
+
+        bool TrackingDataLoader::BuildPlayIndex(const String& csvPath, const String& indexPath)
+        {
+            RefPtr<MemoryMappedFile> file;
+            TrackingLayout layout;
+            std::vector<TrackingChunk> chunks;
+            if (!MapTrackingFile(csvPath, file))
+                return false;
+            if (!SplitTrackingFile(*file, layout, chunks))
+            {
+                printf("Error loading tracking CSV: %s has no game_play, nfl_player_id or step column\n", csvPath.ToMultiByteString());
+                return false;
+            }
+            // parsed a batch of chunks at a time, so only the compact columns of the whole file are held
+            const int batchSize = 64;
+            std::map<std::string, PlayColumns> plays;
+            PlayColumns * columns = nullptr;
+            TrackingField lastGamePlay = {nullptr, nullptr};
+            for (int batch = 0; batch < (int)chunks.size(); batch += batchSize)
+            {
+                int batchEnd = Math::Min(batch + batchSize, (int)chunks.size());
+                Parallel::For(batch, batchEnd, 1, [&](int c)
+                {
+                    ParseTrackingChunk(chunks[c], layout, nullptr, 0);
+                });
+                for (int c = batch; c < batchEnd; c++)
+                {
+                    for (auto & row : chunks[c].Rows)
                     {
-                        if (s == step)
+                        if (!columns || !SameField(row.GamePlay, lastGamePlay))
                         {
-                            found = true;
-                            break;
+                            columns = &plays[std::string(row.GamePlay.Begin, row.GamePlay.End)];
+                            lastGamePlay = row.GamePlay;
+                        }
+                        if (!columns->Add(row))
+                        {
+                            printf("Error building play index: a play of %s has too many team and position names\n", csvPath.ToMultiByteString());
+                            return false;
                         }
                     }
-                    if (!found)
-                    {
-                        playData.steps.push_back(step);
-                    }
+                    chunks[c].Rows = std::vector<TrackingRow>();
                 }
-                
-                printf("  GetPlay: Finished reading, sorting steps...\n");
-                fflush(stdout);
-                
-                // Sort steps
-                std::sort(playData.steps.begin(), playData.steps.end());
-                
-                printf("  GetPlay: Steps sorted\n");
-                fflush(stdout);
-                
-                printf("Loaded play %s: %d steps, %d players\n", 
-                       gamePlay.ToMultiByteString(), 
-                       (int)playData.steps.size(), 
-                       (int)playData.players.size());
-                fflush(stdout);
-                
-                // Explicitly close the reader and file stream before returning
-                printf("  GetPlay: Closing file stream...\n");
-                fflush(stdout);
-                try {
-                    reader->Close();
-                } catch (...) {
-                    // Ignore close errors
-                }
-                reader = nullptr;
-                fileStream = nullptr;
-                printf("  GetPlay: File stream closed\n");
-                fflush(stdout);
             }
-            catch (Exception& ex)
+            return WritePlayIndex(plays, indexPath);
+        }
+
+        namespace
+        {
+            // The difference of two angles in degrees, taken the shorter way around the circle
+            inline __m128 WrapDegrees(__m128 difference)
             {
-                printf("  GetPlay: Exception in try block: %s\n", ex.Message.ToMultiByteString());
-                fflush(stdout);
+                __m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(difference, _mm_set1_ps(1.0f / 360.0f))));
+                return _mm_sub_ps(difference, _mm_mul_ps(turns, _mm_set1_ps(360.0f)));
             }
-            catch (std::exception& ex)
+
+            // Catmull-Rom spline through p1 at t = 0 and p2 at t = 1
+            inline __m128 CatmullRom(__m128 p0, __m128 p1, __m128 p2, __m128 p3, __m128 t)
             {
-                printf("  GetPlay: std::exception: %s\n", ex.what());
-                fflush(stdout);
+                __m128 a = _mm_sub_ps(p2, p0);
+                __m128 b = _mm_sub_ps(_mm_add_ps(_mm_add_ps(p0, p0), _mm_mul_ps(p2, _mm_set1_ps(4.0f))),
+                    _mm_add_ps(_mm_mul_ps(p1, _mm_set1_ps(5.0f)), p3));
+                __m128 c = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(p1, p2), _mm_set1_ps(3.0f)), p3), p0);
+                __m128 curve = _mm_add_ps(a, _mm_mul_ps(t, _mm_add_ps(b, _mm_mul_ps(t, c))));
+                return _mm_add_ps(p1, _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), t), curve));
             }
-            catch (...)
+        }
+
+        PlayerTracks::PlayerTracks()
+            : PlayerCount(0), PaddedPlayerCount(0), FirstStep(0), FrameCount(0)
+        {
+        }
+
+        PlayerTracks::PlayerTracks(const PlayData& play)
+            : PlayerCount(0), PaddedPlayerCount(0), FirstStep(0), FrameCount(0)
+        {
+            for (auto & player : play.players)
+                if (!player.second.empty())
+                    PlayerIds.push_back(player.first);
+            if (PlayerIds.empty() || play.steps.empty())
+                return;
+            PlayerCount = (int)PlayerIds.size();
+            PaddedPlayerCount = (PlayerCount + 3) & ~3;
+            FirstStep = play.steps.front();
+            FrameCount = play.steps.back() - FirstStep + 1;
+            size_t size = (size_t)FrameCount * PaddedPlayerCount;
+            x.assign(size, 0.0f);
+            y.assign(size, 0.0f);
+            orientation.assign(size, 0.0f);
+            present.assign(size, 0);
+            int p = 0;
+            for (auto & player : play.players)
             {
-                printf("  GetPlay: Unknown exception\n");
-                fflush(stdout);
+                if (player.second.empty())
+                    continue;
+                // the first sample of a step is used, as the search it replaces found
+                for (auto & pos : player.second)
+                {
+                    size_t i = (size_t)(pos.step - FirstStep) * PaddedPlayerCount + p;
+                    if (present[i])
+                        continue;
+                    present[i] = 1;
+                    x[i] = pos.x;
+                    y[i] = pos.y;
+                    orientation[i] = pos.orientation;
+                }
+                auto copy = [&](int from, int to)
+                {
+                    size_t source = (size_t)from * PaddedPlayerCount + p, target = (size_t)to * PaddedPlayerCount + p;
+                    x[target] = x[source];
+                    y[target] = y[source];
+                    orientation[target] = orientation[source];
+                };
+                int previous = -1;
+                for (int f = 0; f < FrameCount; f++)
+                {
+                    if (present[(size_t)f * PaddedPlayerCount + p])
+                    {
+                        if (previous == -1)
+                            for (int g = 0; g < f; g++)
+                                copy(f, g);
+                        previous = f;
+                    }
+                    else if (previous != -1)
+                        copy(previous, f);
+                }
+                p++;
+            }
+        }
+
+        void PlayerTracks::Sample(float step, TrackInterpolation mode, PlayerFrame& frame) const
+        {
+            frame.x.resize(PaddedPlayerCount);
+            frame.y.resize(PaddedPlayerCount);
+            frame.orientation.resize(PaddedPlayerCount);
+            frame.visible.resize(PaddedPlayerCount);
+            if (!FrameCount)
+                return;
+            float time = Math::Clamp(step - (float)FirstStep, 0.0f, (float)(FrameCount - 1));
+            int f1 = Math::Min((int)time, FrameCount - 1);
+            float t = time - (float)f1;
+            int f0 = Math::Max(f1 - 1, 0), f2 = Math::Min(f1 + 1, FrameCount - 1), f3 = Math::Min(f1 + 2, FrameCount - 1);
+            int nearest = t < 0.5f ? f1 : f2;
+            memcpy(frame.visible.data(), present.data() + (size_t)nearest * PaddedPlayerCount, PaddedPlayerCount);
+            if (mode == TrackInterpolation::Nearest)
+            {
+                size_t row = (size_t)nearest * PaddedPlayerCount;
+                memcpy(frame.x.data(), x.data() + row, PaddedPlayerCount * sizeof(float));
+                memcpy(frame.y.data(), y.data() + row, PaddedPlayerCount * sizeof(float));
+                memcpy(frame.orientation.data(), orientation.data() + row, PaddedPlayerCount * sizeof(float));
+                return;
+            }
+            size_t rows[4] = {(size_t)f0 * PaddedPlayerCount, (size_t)f1 * PaddedPlayerCount, (size_t)f2 * PaddedPlayerCount,
+                (size_t)f3 * PaddedPlayerCount};
+            __m128 vt = _mm_set1_ps(t);
+            for (int p = 0; p < PaddedPlayerCount; p += 4)
+            {
+                __m128 x1 = _mm_loadu_ps(&x[rows[1] + p]), x2 = _mm_loadu_ps(&x[rows[2] + p]);
+                __m128 y1 = _mm_loadu_ps(&y[rows[1] + p]), y2 = _mm_loadu_ps(&y[rows[2] + p]);
+                __m128 o1 = _mm_loadu_ps(&orientation[rows[1] + p]);
+                __m128 o2 = _mm_add_ps(o1, WrapDegrees(_mm_sub_ps(_mm_loadu_ps(&orientation[rows[2] + p]), o1)));
+                __m128 rx, ry, ro;
+                if (mode == TrackInterpolation::Linear)
+                {
+                    rx = _mm_add_ps(x1, _mm_mul_ps(_mm_sub_ps(x2, x1), vt));
+                    ry = _mm_add_ps(y1, _mm_mul_ps(_mm_sub_ps(y2, y1), vt));
+                    ro = _mm_add_ps(o1, _mm_mul_ps(_mm_sub_ps(o2, o1), vt));
+                }
+                else
+                {
+                    __m128 x0 = _mm_loadu_ps(&x[rows[0] + p]), x3 = _mm_loadu_ps(&x[rows[3] + p]);
+                    __m128 y0 = _mm_loadu_ps(&y[rows[0] + p]), y3 = _mm_loadu_ps(&y[rows[3] + p]);
+                    // unwrapped around the sample at f1, so the spline does not swing through a full turn
+                    __m128 o0 = _mm_sub_ps(o1, WrapDegrees(_mm_sub_ps(o1, _mm_loadu_ps(&orientation[rows[0] + p]))));
+                    __m128 o3 = _mm_add_ps(o2, WrapDegrees(_mm_sub_ps(_mm_loadu_ps(&orientation[rows[3] + p]),
+                        _mm_loadu_ps(&orientation[rows[2] + p]))));
+                    rx = CatmullRom(x0, x1, x2, x3, vt);
+                    ry = CatmullRom(y0, y1, y2, y3, vt);
+                    ro = CatmullRom(o0, o1, o2, o3, vt);
+                }
+                _mm_storeu_ps(&frame.x[p], rx);
+                _mm_storeu_ps(&frame.y[p], ry);
+                _mm_storeu_ps(&frame.orientation[p], ro);
             }
-            
-            printf("  GetPlay: Returning playData\n");
-            fflush(stdout);
-            return playData;
         }
     }
 }
-
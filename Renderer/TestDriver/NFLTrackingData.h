@@ -45,6 +45,49 @@ namespace RasterRenderer
             PlayData() {}
         };
 
+        enum class TrackInterpolation
+        {
+            Nearest,    // the sample of the nearest step
+            Linear,
+            CatmullRom  // through the samples of the two steps on either side
+        };
+
+        // State of every player of a PlayerTracks at one time, in PlayerIds order. The arrays have
+        // PaddedPlayerCount entries.
+        struct PlayerFrame
+        {
+            std::vector<float> x, y;
+            std::vector<float> orientation; // degrees, not wrapped to [0, 360)
+            std::vector<unsigned char> visible; // the player has a sample at the nearest step
+        };
+
+        // Player tracks of a play as dense arrays with one row per step from the first step of the play
+        // to the last, the players of a row side by side, so the state at any time is found without a
+        // search and interpolated for four players at a time. Steps a player has no sample at repeat the
+        // player's previous sample, or its first one before that, and are not visible.
+        // Orientation is interpolated along the shorter way around the circle.
+        class PlayerTracks
+        {
+        private:
+            std::vector<float> x, y, orientation; // [frame * PaddedPlayerCount + player]
+            std::vector<unsigned char> present;
+        public:
+            std::vector<int> PlayerIds; // ascending, as in PlayData::players
+            int PlayerCount, PaddedPlayerCount; // padded to a multiple of 4
+            int FirstStep, FrameCount;
+            PlayerTracks();
+            PlayerTracks(const PlayData& play);
+            // State at a time in steps, which may fall between two steps; clamped to the play
+            void Sample(float step, TrackInterpolation mode, PlayerFrame& frame) const;
+        };
+
+        // Reads the tracking CSV in place from a memory mapping. Columns are found by their header name
+        // once, and the file is split into chunks at line breaks that are parsed on the worker pool and
+        // merged in file order. A file that cannot be read or lacks the game_play, nfl_player_id or step
+        // column is reported and gives no plays.
+        // Either function also reads a play index that BuildPlayIndex wrote in place of the CSV: a binary
+        // file of per-play column blocks and a table of their offsets, from which one play is read without
+        // touching the others.
         class TrackingDataLoader
         {
         public:
@@ -52,8 +95,12 @@ namespace RasterRenderer
             // Returns map from gamePlay (e.g., "58580_001136") to PlayData
             static std::map<String, PlayData> LoadFromCSV(const String& csvPath);
             
-            // Get a specific play by gamePlay string
+            // Get a specific play by gamePlay string; only the rows of that play are parsed
             static PlayData GetPlay(const String& csvPath, const String& gamePlay);
+
+            // Converts a tracking CSV to a play index. Returns false, after reporting it, if the CSV cannot
+            // be read or the index cannot be written.
+            static bool BuildPlayIndex(const String& csvPath, const String& indexPath);
         };
     }
 }
@@ -5,7 +5,8 @@
 #include "ForwardLightingShader.h"
 #include "NFLTrackingData.h"
 #include "NFLScene.h"
-#include "ModelResource.h"
+#include "ResourceManager.h"
+#include "FrameWriter.h"
 #include "CoreLib/PerformanceCounter.h"
 #include "CoreLib/LibIO.h"
 #include "CoreLib/VectorMath.h"
@@ -13,6 +14,7 @@
 #include <iostream>
 #include <iomanip>
 #include <vector>
+#include <string>
 #include <cmath>
 
 using namespace CoreLib::Basic;
@@ -26,7 +28,7 @@ using namespace NFL;
 
 // Simple player model implementation
 // (Declaration is in NFLScene.h)
-SimplePlayerModel::SimplePlayerModel(const Vec3& color)
+static ModelResource CreatePlayerBox(const Vec3& color)
 {
         // Create a simple box model for players
         ObjModel obj;
@@ -48,8 +50,9 @@ SimplePlayerModel::SimplePlayerModel(const Vec3& color)
         
         // Create 12 faces (2 per side)
         ObjFace face;
-        face.NormalIds[0] = face.NormalIds[1] = face.NormalIds[2] = -1;
-        face.TexCoordIds[0] = face.TexCoordIds[1] = face.TexCoordIds[2] = -1;
+        face.VertexIds[3] = -1;
+        face.NormalIds[0] = face.NormalIds[1] = face.NormalIds[2] = face.NormalIds[3] = -1;
+        face.TexCoordIds[0] = face.TexCoordIds[1] = face.TexCoordIds[2] = face.TexCoordIds[3] = -1;
         face.MaterialId = 0;
         face.SmoothGroup = 0;
         
@@ -100,17 +103,20 @@ SimplePlayerModel::SimplePlayerModel(const Vec3& color)
         RecomputeNormals(obj);
         
         // Convert to ModelResource
-        model = ModelResource::FromObjModel(L"", obj);
+        return ModelResource::FromObjModel(L"", obj);
     }
-    
-void SimplePlayerModel::Draw(RenderState& state, IRasterRenderer* renderer)
+
+SimplePlayerModel::SimplePlayerModel(const Vec3& color)
 {
-    model.Draw(state, renderer);
+    // Players of a team share one box
+    char key[64];
+    sprintf(key, "nfl-player-box:%g,%g,%g", color.x, color.y, color.z);
+    model = ResourceManager::Global().GetModel(key, [&]() { return CreatePlayerBox(color); });
 }
-
-void SimplePlayerModel::SetShader(Shader* shader)
+    
+void SimplePlayerModel::Draw(RenderState& state, IRasterRenderer* renderer)
 {
-    model.SetShader(shader);
+    model->Draw(state, renderer, state.Shader);
 }
 
 // Simple field/ground plane model (not used anymore, but kept for reference)
@@ -140,8 +146,9 @@ public:
         
         // Create 2 triangles to form the quad
         ObjFace face;
-        face.NormalIds[0] = face.NormalIds[1] = face.NormalIds[2] = -1;
-        face.TexCoordIds[0] = face.TexCoordIds[1] = face.TexCoordIds[2] = -1;
+        face.VertexIds[3] = -1;
+        face.NormalIds[0] = face.NormalIds[1] = face.NormalIds[2] = face.NormalIds[3] = -1;
+        face.TexCoordIds[0] = face.TexCoordIds[1] = face.TexCoordIds[2] = face.TexCoordIds[3] = -1;
         face.MaterialId = 0;
         face.SmoothGroup = 0;
         
@@ -188,7 +195,9 @@ Vec3 NFLPlayScene::GetTeamColor(const String& team)
 }
 
 NFLPlayScene::NFLPlayScene(ViewSettings& viewSettings, const String& stadiumModelPath, const PlayData& playData)
-    : TestScene(viewSettings), currentStep(0)
+    : TestScene(viewSettings), currentTime(0.0f), interpolation(TrackInterpolation::Linear),
+      cameraPosition(60.0f, 60.0f, 50.0f), // Position above field (Z=50), offset in Y
+      cameraTarget(60.0f, 26.65f, 0.0f)    // Center of field (Z=0) - looking down
 {
     // Set clear color to light blue (sky color) instead of black
     ClearColor = Vec4(0.5f, 0.7f, 1.0f, 1.0f); // Light blue sky
@@ -196,8 +205,9 @@ NFLPlayScene::NFLPlayScene(ViewSettings& viewSettings, const String& stadiumMode
     // Load stadium model
     try
     {
-        stadiumModel = ModelResource::FromObjModel(stadiumModelPath);
-        printf("Loaded stadium model: %d triangles\n", stadiumModel.TriangleCount());
+        stadiumModel = ResourceManager::Global().LoadModel(stadiumModelPath);
+        printf("Loaded stadium model: %d triangles in %.1f ms%s\n", stadiumModel->TriangleCount(), stadiumModel->LoadTime * 1000.0,
+            stadiumModel->LoadedFromCache ? " from the model cache" : "");
     }
     catch (Exception& ex)
     {
@@ -205,17 +215,14 @@ NFLPlayScene::NFLPlayScene(ViewSettings& viewSettings, const String& stadiumMode
     }
     
     // Store player positions
-    playerPositions = playData.players;
-    steps = playData.steps;
+    tracks = PlayerTracks(playData);
+    tracks.Sample(currentTime, interpolation, playerFrame);
     
     // Create player models (one per unique player)
-    for (const auto& pair : playerPositions)
+    for (int id : tracks.PlayerIds)
     {
-        if (pair.second.size() > 0)
-        {
-            Vec3 color = GetTeamColor(pair.second[0].team);
-            playerModels.push_back(SimplePlayerModel(color));
-        }
+        Vec3 color = GetTeamColor(playData.players.at(id)[0].team);
+        playerModels.push_back(SimplePlayerModel(color));
     }
     
     printf("Created %d player models\n", (int)playerModels.size());
@@ -223,391 +230,2021 @@ NFLPlayScene::NFLPlayScene(ViewSettings& viewSettings, const String& stadiumMode
     
 void NFLPlayScene::SetStep(int step)
 {
-    currentStep = step;
+    SetTime((float)step);
+}
+
+void NFLPlayScene::SetTime(float step)
+{
+    currentTime = step;
+    tracks.Sample(currentTime, interpolation, playerFrame);
+}
+
+void NFLPlayScene::SetInterpolation(TrackInterpolation mode)
+{
+    interpolation = mode;
+    tracks.Sample(currentTime, interpolation, playerFrame);
+}
+
+void NFLPlayScene::SetCamera(const Vec3& position, const Vec3& target)
+{
+    cameraPosition = position;
+    cameraTarget = target;
+}
+
+void NFLPlayScene::GetViewMatrix(Matrix4& viewMatrix)
+{
+    Vec3 worldUp(0.0f, 0.0f, 1.0f);         // Z is up (world up vector)
+    Matrix4::LookAt(viewMatrix, cameraPosition, cameraTarget, worldUp);
+    
+    // Flip the Y axis (up vector) to correct upside-down orientation
+    viewMatrix.m[0][1] = -viewMatrix.m[0][1];  // Flip Y component of X axis (right)
+    viewMatrix.m[1][1] = -viewMatrix.m[1][1];  // Flip Y component of Y axis (up)
+    viewMatrix.m[2][1] = -viewMatrix.m[2][1];  // Flip Y component of Z axis (forward)
+    viewMatrix.m[3][1] = -viewMatrix.m[3][1];  // Flip Y component of translation
 }
 
 void NFLPlayScene::Draw(IRasterRenderer* renderer)
 {
-        
-        Vec3 cameraPos(60.0f, 60.0f, 50.0f);   // Position above field (Z=50), offset in Y
-        Vec3 target(60.0f, 26.65f, 0.0f);        // Center of field (Z=0) - looking down
-        Vec3 worldUp(0.0f, 0.0f, 1.0f);         // Z is up (world up vector)
-        
-        Matrix4 viewMatrix;
-        Matrix4::LookAt(viewMatrix, cameraPos, target, worldUp);
-        
-        // Flip the Y axis (up vector) to correct upside-down orientation
-        viewMatrix.m[0][1] = -viewMatrix.m[0][1];  // Flip Y component of X axis (right)
-        viewMatrix.m[1][1] = -viewMatrix.m[1][1];  // Flip Y component of Y axis (up)
-        viewMatrix.m[2][1] = -viewMatrix.m[2][1];  // Flip Y component of Z axis (forward)
-        viewMatrix.m[3][1] = -viewMatrix.m[3][1];  // Flip Y component of translation
-        
-        const float STADIUM_SCALE = 10.0f;
-        
-        Matrix4 stadiumScale, stadiumTranslation, stadiumTransform;
-        Matrix4::CreateIdentityMatrix(stadiumScale);
-        Matrix4::Scale(stadiumScale, STADIUM_SCALE, STADIUM_SCALE, STADIUM_SCALE);
-        // Position stadium at field center (matching Python offset)
-        Matrix4::Translation(stadiumTranslation, 60.0f, 26.65f, 0.0f);
-        Matrix4::Multiply(stadiumTransform, stadiumTranslation, stadiumScale);
-        
-        // Combine view and model transforms
-        Matrix4 stadiumModelView;
-        Matrix4::Multiply(stadiumModelView, viewMatrix, stadiumTransform);
-        State.ModelViewTransform = stadiumModelView;
-        Matrix4::Multiply(State.ModelViewProjectionTransform, State.ProjectionTransform, stadiumModelView);
-        // Normal transform should be inverse transpose of model-view for correct lighting
-        stadiumModelView.Inverse(State.NormalTransform);
-        State.NormalTransform.Transpose();
-        
-        // Disable backface culling temporarily to see if field geometry is being culled
-        // Field geometry in OBJ might have normals pointing down instead of up
-        bool oldBackfaceCulling = State.BackfaceCulling;
-        State.BackfaceCulling = false;
-        try {
-            stadiumModel.Draw(State, renderer);
-        } catch (...) {
-            throw;
-        }
-        State.BackfaceCulling = oldBackfaceCulling;
-        
-        // Draw players at current step
-        int playerIdx = 0;
-        for (const auto& pair : playerPositions)
+    DrawStatic(renderer);
+    DrawDynamic(renderer);
+}
+
+void NFLPlayScene::DrawStatic(IRasterRenderer* renderer)
+{
+    Matrix4 viewMatrix;
+    GetViewMatrix(viewMatrix);
+    
+    const float STADIUM_SCALE = 10.0f;
+    
+    Matrix4 stadiumScale, stadiumTranslation, stadiumTransform;
+    Matrix4::CreateIdentityMatrix(stadiumScale);
+    Matrix4::Scale(stadiumScale, STADIUM_SCALE, STADIUM_SCALE, STADIUM_SCALE);
+    // Position stadium at field center (matching Python offset)
+    Matrix4::Translation(stadiumTranslation, 60.0f, 26.65f, 0.0f);
+    Matrix4::Multiply(stadiumTransform, stadiumTranslation, stadiumScale);
+    
+    // Combine view and model transforms
+    Matrix4 stadiumModelView;
+    Matrix4::Multiply(stadiumModelView, viewMatrix, stadiumTransform);
+    State.ModelViewTransform = stadiumModelView;
+    Matrix4::Multiply(State.ModelViewProjectionTransform, State.ProjectionTransform, stadiumModelView);
+    // Normal transform should be inverse transpose of model-view for correct lighting
+    stadiumModelView.Inverse(State.NormalTransform);
+    State.NormalTransform.Transpose();
+    
+    // Disable backface culling temporarily to see if field geometry is being culled
+    // Field geometry in OBJ might have normals pointing down instead of up
+    bool oldBackfaceCulling = State.BackfaceCulling;
+    State.BackfaceCulling = false;
+    if (stadiumModel)
+        stadiumModel->Draw(State, renderer, State.Shader);
+    State.BackfaceCulling = oldBackfaceCulling;
+}
+
+void NFLPlayScene::DrawDynamic(IRasterRenderer* renderer)
+{
+    Matrix4 viewMatrix;
+    GetViewMatrix(viewMatrix);
+    
+    // Draw players at current step
+    for (int playerIdx = 0; playerIdx < tracks.PlayerCount; playerIdx++)
+    {
+        if (playerFrame.visible[playerIdx])
         {
-            // Find position at current step
-            const PlayerPosition* pos = nullptr;
-            for (const auto& p : pair.second)
-            {
-                if (p.step == currentStep)
-                {
-                    pos = &p;
-                    break;
-                }
-            }
+            float worldX = playerFrame.x[playerIdx];  // Absolute X coordinate (0-120 yards)
+            float worldY = playerFrame.y[playerIdx];  // Absolute Y coordinate (0-53.3 yards)
+            float worldZ = 1.0f;    // Player center height (half of 2 yards tall) - bottom at Z=0
             
-            if (pos && playerIdx < (int)playerModels.size())
-            {
-                float worldX = pos->x;  // Absolute X coordinate (0-120 yards)
-                float worldY = pos->y;  // Absolute Y coordinate (0-53.3 yards)
-                float worldZ = 1.0f;    // Player center height (half of 2 yards tall) - bottom at Z=0
-                
-                // Create transform matrix for player
-                // Scale player model to appropriate size (already scaled in model creation)
-                Matrix4 playerScale, translation, rotation, playerModelTransform;
-                Matrix4::CreateIdentityMatrix(playerScale);
-                // Player model is already sized correctly (0.4 yards wide x 2 yards tall)
-                // No additional scaling needed
-                
-                Matrix4::Translation(translation, worldX, worldY, worldZ);
-                
-                // Rotate based on orientation (around Z axis, which is up)
-                float angleRad = pos->orientation * 3.14159f / 180.0f;
-                Matrix4::RotationZ(rotation, angleRad);
-                
-                // Combine transforms: scale -> rotate -> translate
-                Matrix4 temp;
-                Matrix4::Multiply(temp, rotation, playerScale);
-                Matrix4::Multiply(playerModelTransform, translation, temp);
-                
-                // Combine view and model transforms
-                Matrix4 playerModelView;
-                Matrix4::Multiply(playerModelView, viewMatrix, playerModelTransform);
-                
-                // Set transform
-                State.ModelViewTransform = playerModelView;
-                Matrix4::Multiply(State.ModelViewProjectionTransform, State.ProjectionTransform, playerModelView);
-                // Normal transform should be inverse transpose of model-view for correct lighting
-                playerModelView.Inverse(State.NormalTransform);
-                State.NormalTransform.Transpose();
-                
-                // Draw player
-                playerModels[playerIdx].Draw(State, renderer);
-            }
+            // Create transform matrix for player
+            // Scale player model to appropriate size (already scaled in model creation)
+            Matrix4 playerScale, translation, rotation, playerModelTransform;
+            Matrix4::CreateIdentityMatrix(playerScale);
+            // Player model is already sized correctly (0.4 yards wide x 2 yards tall)
+            // No additional scaling needed
+            
+            Matrix4::Translation(translation, worldX, worldY, worldZ);
+            
+            // Rotate based on orientation (around Z axis, which is up)
+            float angleRad = playerFrame.orientation[playerIdx] * 3.14159f / 180.0f;
+            Matrix4::RotationZ(rotation, angleRad);
+            
+            // Combine transforms: scale -> rotate -> translate
+            Matrix4 temp;
+            Matrix4::Multiply(temp, rotation, playerScale);
+            Matrix4::Multiply(playerModelTransform, translation, temp);
             
-            playerIdx++;
+            // Combine view and model transforms
+            Matrix4 playerModelView;
+            Matrix4::Multiply(playerModelView, viewMatrix, playerModelTransform);
+            
+            // Set transform
+            State.ModelViewTransform = playerModelView;
+            Matrix4::Multiply(State.ModelViewProjectionTransform, State.ProjectionTransform, playerModelView);
+            // Normal transform should be inverse transpose of model-view for correct lighting
+            playerModelView.Inverse(State.NormalTransform);
+            State.NormalTransform.Transpose();
+            
+            // Draw player
+            playerModels[playerIdx].Draw(State, renderer);
         }
     }
+}
+
+void NFLPlayScene::DrawOverStaticLayer(IRasterRenderer* renderer, unsigned long long& layerKey)
+{
+    unsigned long long key = GetStaticLayerKey();
+    if (key != layerKey || !renderer->RestoreStaticLayer())
+    {
+        renderer->Clear(ClearColor);
+        DrawStatic(renderer);
+        renderer->SaveStaticLayer();
+        layerKey = key;
+    }
+    DrawDynamic(renderer);
+}
+
+unsigned long long NFLPlayScene::GetStaticLayerKey()
+{
+    Matrix4 viewMatrix;
+    GetViewMatrix(viewMatrix);
+    int viewport[2] = {State.ViewportWidth, State.ViewportHeight};
+    unsigned long long key = ComputeHash64(viewMatrix.values, sizeof(viewMatrix.values));
+    key = ComputeHash64(State.ProjectionTransform.values, sizeof(State.ProjectionTransform.values), key);
+    key = ComputeHash64(viewport, sizeof(viewport), key);
+    key = ComputeHash64(&ClearColor, sizeof(ClearColor), key);
+    key = ComputeHash64(&State.TextureFilter, sizeof(State.TextureFilter), key);
+    key = ComputeHash64(&State.Shader, sizeof(State.Shader), key);
+    if (auto shader = dynamic_cast<ForwardLightingShader*>(State.Shader))
+    {
+        key = ComputeHash64(shader->Lights.Buffer(), shader->Lights.Count() * sizeof(ForwardLightingShader::Light), key);
+        int modes[2] = {(int)shader->Kernel, (int)shader->LightCulling};
+        key = ComputeHash64(modes, sizeof(modes), key);
+        key = ComputeHash64(&shader->CameraPosition, sizeof(shader->CameraPosition), key);
+        key = ComputeHash64(&shader->Shininess, sizeof(shader->Shininess), key);
+        key = ComputeHash64(&shader->SpecularColor, sizeof(shader->SpecularColor), key);
+    }
+    // under a texture budget the stadium's levels page in after the frames that first sample them
+    int textureGeneration = CoreLib::Imaging::TextureResidency::Generation;
+    key = ComputeHash64(&textureGeneration, sizeof(textureGeneration), key);
+    return key;
+}
     
 void NFLPlayScene::SetShader(Shader* shader)
 {
+    // Models are shared through the ResourceManager, so they draw with State.Shader instead of their own
     TestScene::SetShader(shader);
-    stadiumModel.SetShader(shader);
-    for (auto& player : playerModels)
-    {
-        player.SetShader(shader);
-    }
 }
 
 // Main function - only compiled when NFL_VIDEO_RENDERER_MAIN is defined
 #ifdef NFL_VIDEO_RENDERER_MAIN
-int main(int argc, char* argv[])
+#include "Parallel.h"
+#ifdef USE_TBB
+#include "../lib/tbb/task_scheduler_init.h"
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#endif
+
+static bool SamePlay(const PlayData & a, const PlayData & b)
 {
-    printf("=== NFL Video Renderer Starting ===\n");
-    fflush(stdout);
-    
-    if (argc < 4)
+    if (a.steps != b.steps || a.players.size() != b.players.size() || a.gameKey != b.gameKey || a.playId != b.playId)
+        return false;
+    for (auto pa = a.players.begin(), pb = b.players.begin(); pa != a.players.end(); ++pa, ++pb)
     {
-        printf("Usage: %s <tracking_csv> <game_play> <stadium_model.obj> [output_dir] [width] [height]\n", argv[0]);
-        printf("Example: %s tracking.csv 58580_001136 stadium.obj output/ 1920 1080\n", argv[0]);
-        return 1;
+        if (pa->first != pb->first || pa->second.size() != pb->second.size())
+            return false;
+        for (size_t i = 0; i < pa->second.size(); i++)
+        {
+            auto & p = pa->second[i];
+            auto & q = pb->second[i];
+            if (p.step != q.step || p.team != q.team || p.position != q.position || p.jerseyNumber != q.jerseyNumber ||
+                memcmp(&p.x, &q.x, sizeof(float)) || memcmp(&p.y, &q.y, sizeof(float)) || memcmp(&p.speed, &q.speed, sizeof(float)) ||
+                memcmp(&p.direction, &q.direction, sizeof(float)) || memcmp(&p.orientation, &q.orientation, sizeof(float)))
+                return false;
+        }
     }
-    
-    printf("Step 1: Parsing arguments...\n");
-    String trackingCsv = argv[1];
-    String gamePlay = argv[2];
-    String stadiumModel = argv[3];
-    String outputDir = (argc > 4) ? String(argv[4]) : String(L"output");
-    int width = (argc > 5) ? StringToInt(argv[5]) : 1920;
-    int height = (argc > 6) ? StringToInt(argv[6]) : 1080;
-    
-    printf("  Tracking CSV: %s\n", trackingCsv.ToMultiByteString());
-    printf("  Game Play: %s\n", gamePlay.ToMultiByteString());
-    printf("  Stadium Model: %s\n", stadiumModel.ToMultiByteString());
-    printf("  Output Dir: %s\n", outputDir.ToMultiByteString());
-    printf("  Resolution: %dx%d\n", width, height);
-    
-    // Load play data
-    printf("\nStep 2: Loading play data...\n");
-    PlayData playData;
-    try {
-        printf("  Calling TrackingDataLoader::GetPlay...\n");
-        fflush(stdout);
-        playData = TrackingDataLoader::GetPlay(trackingCsv, gamePlay);
-        printf("  GetPlay returned, checking playData...\n");
-        fflush(stdout);
-        printf("  playData.steps.size() = %d\n", (int)playData.steps.size());
-        fflush(stdout);
-        printf("  playData.players.size() = %d\n", (int)playData.players.size());
-        fflush(stdout);
+    return true;
+}
+
+static CoreLib::Int64 TrackingFileSize(const String & fileName)
+{
+    try
+    {
+        return MemoryMappedFile(fileName).Size();
     }
-    catch (Exception& ex) {
-        printf("Exception loading play data: %s\n", ex.Message.ToMultiByteString());
-        return 1;
+    catch (IOException &)
+    {
+        return -1;
     }
-    catch (std::exception& ex) {
-        printf("std::exception loading play data: %s\n", ex.what());
-        return 1;
+}
+
+// Writes a CSV of at least the given size: the rows of the source file repeated under new game_play
+// values, with the source rows themselves in the middle so a play lookup has to scan the whole file.
+// An existing file of that size is reused.
+static bool GenerateTrackingCsv(const String & sourceCsv, const String & fileName, CoreLib::Int64 size)
+{
+    if (TrackingFileSize(fileName) >= size)
+        return true;
+    RefPtr<MemoryMappedFile> source;
+    try
+    {
+        source = new MemoryMappedFile(sourceCsv);
     }
-    catch (...) {
-        printf("Unknown exception loading play data\n");
-        return 1;
+    catch (IOException & ex)
+    {
+        printf("%s\n", ex.Message.ToMultiByteString());
+        return false;
     }
-    
-    printf("  Play data loaded: %d steps, %d players\n", (int)playData.steps.size(), (int)playData.players.size());
-    fflush(stdout);
-    
-    if (playData.steps.size() == 0)
+    std::vector<std::string> lines;
+    const char * pos = (const char *)source->Buffer(), * end = pos + source->Size();
+    while (pos < end)
     {
-        printf("Error: Play not found or has no data\n");
-        fflush(stdout);
-        return 1;
+        const char * lineEnd = (const char *)memchr(pos, '\n', end - pos);
+        if (!lineEnd)
+            lineEnd = end;
+        if (lineEnd > pos)
+            lines.push_back(std::string(pos, lineEnd[-1] == '\r' ? lineEnd - 1 : lineEnd));
+        pos = lineEnd + 1;
     }
-    
-    printf("\nStep 3: Creating view settings...\n");
-    fflush(stdout);
-    // Create view settings
-    ViewSettings viewSettings;
-    printf("  ViewSettings object created\n");
-    fflush(stdout);
-    viewSettings.WindowWidth = width;
-    viewSettings.WindowHeight = height;
-    viewSettings.FovY = 60.0f;
-    viewSettings.zNear = 0.1f;
-    viewSettings.zFar = 500.0f;
-    printf("  ViewSettings configured\n");
-    fflush(stdout);
-    
-    printf("\nStep 4: Creating scene...\n");
-    fflush(stdout);
-    // Create scene
-    NFLPlayScene* scene = nullptr;
-    try {
-        printf("  Creating NFLPlayScene with stadium: %s\n", stadiumModel.ToMultiByteString());
-        fflush(stdout);
-        scene = new NFLPlayScene(viewSettings, stadiumModel, playData);
-        printf("  Scene created successfully\n");
-        fflush(stdout);
-        printf("  Scene pointer: %p\n", (void*)scene);
-        fflush(stdout);
+    if (lines.size() < 2 || lines[0].compare(0, 10, "game_play,") != 0)
+    {
+        printf("%s does not start with a game_play column\n", sourceCsv.ToMultiByteString());
+        return false;
     }
-    catch (Exception& ex) {
-        printf("Exception creating scene: %s\n", ex.Message.ToMultiByteString());
-        fflush(stdout);
-        return 1;
+    FILE * f = fopen(fileName.ToMultiByteString(), "wb");
+    if (!f)
+    {
+        printf("Cannot write \"%s\"\n", fileName.ToMultiByteString());
+        return false;
     }
-    catch (std::exception& ex) {
-        printf("std::exception creating scene: %s\n", ex.what());
-        fflush(stdout);
-        return 1;
+    CoreLib::Int64 rowBytes = 0;
+    for (size_t i = 1; i < lines.size(); i++)
+        rowBytes += lines[i].size() + 1;
+    int copies = (int)(size / rowBytes) + 1;
+    fprintf(f, "%s\n", lines[0].c_str());
+    for (int c = 0; c < copies; c++)
+    {
+        for (size_t i = 1; i < lines.size(); i++)
+        {
+            size_t comma = lines[i].find(',');
+            if (c == copies / 2)
+                fprintf(f, "%s\n", lines[i].c_str());
+            else
+                fprintf(f, "9%04d_%06d%s\n", c / 1000000, c % 1000000, lines[i].c_str() + (comma == std::string::npos ? lines[i].size() : comma));
+        }
     }
-    catch (...) {
-        printf("Unknown exception creating scene\n");
-        fflush(stdout);
+    bool written = ferror(f) == 0;
+    fclose(f);
+    if (!written)
+        printf("Cannot write \"%s\"\n", fileName.ToMultiByteString());
+    return written;
+}
+
+// Times TrackingDataLoader on generated files: GetPlay of one play from a file of the given size, and
+// LoadFromCSV of every play from a smaller one, for each worker count
+static int TrackingCsvBenchmark(const String & sourceCsv, const String & gamePlay, double gigabytes, const String & outputCsv)
+{
+    List<int> threadCounts;
+#ifdef USE_TBB
+    int maxThreads = tbb::task_scheduler_init::default_num_threads();
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+        threadCounts.Add(threads);
+    threadCounts.Add(maxThreads);
+#else
+    threadCounts.Add(0);
+#endif
+    CoreLib::Int64 size = (CoreLib::Int64)(gigabytes * 1024.0 * 1024.0 * 1024.0);
+    String allCsv = outputCsv + L".all.csv";
+    printf("Generating %s and %s...\n", outputCsv.ToMultiByteString(), allCsv.ToMultiByteString());
+    fflush(stdout);
+    if (!GenerateTrackingCsv(sourceCsv, outputCsv, size) || !GenerateTrackingCsv(sourceCsv, allCsv, Math::Min(size / 8, (CoreLib::Int64)256 << 20)))
         return 1;
+    for (int test = 0; test < 2; test++)
+    {
+        String fileName = test == 0 ? outputCsv : allCsv;
+        double megabytes = TrackingFileSize(fileName) / (1024.0 * 1024.0);
+        PlayData reference;
+        std::map<String, PlayData> referencePlays;
+        double baseTime = 0.0;
+        for (int t = 0; t < threadCounts.Count(); t++)
+        {
+#ifdef USE_TBB
+            tbb::task_scheduler_init init(threadCounts[t]);
+#endif
+            // best of three, the first run of the first worker count also warms the file cache
+            double minTime = 1e10;
+            bool same = true;
+            int plays = 0, steps = 0;
+            for (int run = 0; run < 3; run++)
+            {
+                auto counter = PerformanceCounter::Start();
+                if (test == 0)
+                {
+                    PlayData play = TrackingDataLoader::GetPlay(fileName, gamePlay);
+                    minTime = Math::Min(minTime, PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)));
+                    if (t == 0 && run == 0)
+                        reference = play;
+                    same = same && SamePlay(play, reference);
+                    plays = 1;
+                    steps = (int)play.steps.size();
+                }
+                else
+                {
+                    std::map<String, PlayData> all = TrackingDataLoader::LoadFromCSV(fileName);
+                    minTime = Math::Min(minTime, PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)));
+                    if (t == 0 && run == 0)
+                        referencePlays = all;
+                    same = same && all.size() == referencePlays.size();
+                    for (auto a = all.begin(), r = referencePlays.begin(); same && a != all.end(); ++a, ++r)
+                        same = a->first == r->first && SamePlay(a->second, r->second);
+                    plays = (int)all.size();
+                }
+            }
+            if (t == 0)
+            {
+                baseTime = minTime;
+                if (test == 0)
+                    printf("\nGetPlay %s: %.1f MB, %d steps of the play\n", gamePlay.ToMultiByteString(), megabytes, steps);
+                else
+                    printf("\nLoadFromCSV: %.1f MB, %d plays\n", megabytes, plays);
+                printf("Threads |  Load (ms) |   MB/s | Speedup | Same as 1 thread\n");
+                printf("--------|------------|--------|---------|-----------------\n");
+            }
+            printf("%7d | %10.1f | %6.1f | %6.2fx | %s\n", threadCounts[t], minTime * 1000.0, megabytes / minTime,
+                baseTime / minTime, same ? "yes" : "NO");
+        }
     }
-    
-    printf("  After scene creation, before lighting setup\n");
-    fflush(stdout);
-    
-    printf("\nStep 5: Setting up lighting...\n");
-    fflush(stdout);
-    // Set up lighting
-    printf("  About to create ForwardLightingShader...\n");
-    fflush(stdout);
-    ForwardLightingShader* shader = new ForwardLightingShader();
-    printf("  ForwardLightingShader created\n");
-    fflush(stdout);
-    
-    printf("  Setting shader properties...\n");
+    return 0;
+}
+
+// Drops a file from the page cache, so the next read of it comes from the disk; false where that is
+// not supported
+static bool EvictFromFileCache(const String & fileName)
+{
+#ifdef _WIN32
+    return false;
+#else
+    int fd = open(fileName.ToMultiByteString(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    bool evicted = fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return evicted;
+#endif
+}
+
+// Converts a tracking CSV to a play index, checks that every play reads back from the index the same
+// as from the CSV, and times cold and warm loads of one play from each
+static int PlayIndexBenchmark(const String & csvPath, const String & indexPath, const String & gamePlay)
+{
+    auto counter = PerformanceCounter::Start();
+    if (!TrackingDataLoader::BuildPlayIndex(csvPath, indexPath))
+        return 1;
+    double buildTime = PerformanceCounter::ToSeconds(PerformanceCounter::End(counter));
+    printf("Built %s (%.1f MB) from %s (%.1f MB) in %.1f ms\n", indexPath.ToMultiByteString(), TrackingFileSize(indexPath) / (1024.0 * 1024.0),
+        csvPath.ToMultiByteString(), TrackingFileSize(csvPath) / (1024.0 * 1024.0), buildTime * 1000.0);
     fflush(stdout);
+    {
+        std::map<String, PlayData> csvPlays = TrackingDataLoader::LoadFromCSV(csvPath);
+        std::map<String, PlayData> indexPlays = TrackingDataLoader::LoadFromCSV(indexPath);
+        int mismatches = (int)(csvPlays.size() > indexPlays.size() ? csvPlays.size() - indexPlays.size() : indexPlays.size() - csvPlays.size());
+        for (auto & play : csvPlays)
+        {
+            auto found = indexPlays.find(play.first);
+            if (found == indexPlays.end() || found->second.gamePlay != play.second.gamePlay || !SamePlay(found->second, play.second) ||
+                !SamePlay(TrackingDataLoader::GetPlay(indexPath, play.first), play.second))
+                mismatches++;
+        }
+        if (mismatches)
+            printf("Round trip: %d plays, %d DIFFER from the CSV\n", (int)csvPlays.size(), mismatches);
+        else
+            printf("Round trip: %d plays, all identical to the CSV through LoadFromCSV and GetPlay\n", (int)csvPlays.size());
+        if (mismatches)
+            return 1;
+    }
+    // best of three; cold loads drop the file from the page cache first
+    String title = L"GetPlay " + gamePlay;
+    printf("\n%-25s | Cold (ms) | Warm (ms)\n", title.ToMultiByteString());
+    printf("--------------------------|-----------|----------\n");
+    for (int source = 0; source < 2; source++)
+    {
+        String fileName = source == 0 ? csvPath : indexPath;
+        double times[2] = {1e10, 1e10};
+        bool cold = true;
+        int steps = 0;
+        for (int warm = 0; warm < 2; warm++)
+        {
+            for (int run = 0; run < 3; run++)
+            {
+                if (!warm)
+                    cold = cold && EvictFromFileCache(fileName);
+                auto loadCounter = PerformanceCounter::Start();
+                PlayData play = TrackingDataLoader::GetPlay(fileName, gamePlay);
+                times[warm] = Math::Min(times[warm], PerformanceCounter::ToSeconds(PerformanceCounter::End(loadCounter)));
+                steps = (int)play.steps.size();
+            }
+        }
+        char coldTime[32];
+        sprintf(coldTime, cold ? "%9.2f" : "      n/a", times[0] * 1000.0);
+        printf("%-25s | %s | %9.2f\n", source == 0 ? "CSV" : "Play index", coldTime, times[1] * 1000.0);
+        if (!steps)
+            printf("  (play not found)\n");
+    }
+    return 0;
+}
+
+// Sun and corner floodlights, matching the Python renderer
+static ForwardLightingShader * CreateFieldShader()
+{
+    ForwardLightingShader * shader = new ForwardLightingShader();
     // Match camera position used in Draw() method
-    shader->CameraPosition = Vec3(60.0f, 60.0f, 50.0f); // Camera looking at field
-    printf("  CameraPosition set\n");
-    fflush(stdout);
+    shader->CameraPosition = Vec3(60.0f, 60.0f, 50.0f);
     shader->Shininess = 32.0f;
-    printf("  Shininess set\n");
-    fflush(stdout);
     shader->SpecularColor = Vec3(0.5f, 0.5f, 0.5f);
-    printf("  SpecularColor set\n");
-    fflush(stdout);
-    
-    // Add lights - match Python renderer setup
-    printf("  Creating lights...\n");
-    fflush(stdout);
-    
+
     // Main directional light (sun) - pointing down at field
     ForwardLightingShader::Light sunLight;
     sunLight.LightType = ForwardLightingShader::Light::DIRECTIONAL;
     sunLight.Direction = Vec3(0.0f, 0.0f, -1.0f); // Pointing down in world space (Z is up)
     sunLight.Color = Vec3(1.0f, 1.0f, 0.95f);
-    sunLight.Intensity = 4.0f; // Match Python intensity
+    sunLight.Intensity = 4.0f;
     sunLight.Ambient = 0.4f;
     shader->Lights.Add(sunLight);
-    printf("  Sun light added\n");
-    fflush(stdout);
-    
-    // Add point lights at corners for better field illumination (matching Python)
+
+    // Point lights at corners for better field illumination
     Vec3 corners[] = {
         Vec3(-10.0f, -10.0f, 50.0f),
         Vec3(130.0f, -10.0f, 50.0f),
         Vec3(130.0f, 63.0f, 50.0f),
         Vec3(-10.0f, 63.0f, 50.0f)
     };
-    
     for (int i = 0; i < 4; i++)
     {
         ForwardLightingShader::Light pointLight;
         pointLight.LightType = ForwardLightingShader::Light::POINT;
         pointLight.Position = corners[i];
         pointLight.Color = Vec3(1.0f, 1.0f, 1.0f);
-        pointLight.Intensity = 200.0f; // Match Python intensity
+        pointLight.Intensity = 200.0f;
         pointLight.Ambient = 0.1f;
         pointLight.Decay = 100.0f; // Distance attenuation
         shader->Lights.Add(pointLight);
     }
-    printf("  Point lights added\n");
-    fflush(stdout);
-    
-    printf("  Setting shader on scene...\n");
-    fflush(stdout);
-    try {
-        scene->SetShader(shader);
-        printf("  Shader set on scene successfully\n");
-        fflush(stdout);
-    } catch (Exception& ex) {
-        printf("  Exception setting shader: %s\n", ex.Message.ToMultiByteString());
-        fflush(stdout);
-        return 1;
-    } catch (...) {
-        printf("  Unknown exception setting shader\n");
-        fflush(stdout);
-        return 1;
+    return shader;
+}
+
+// A frame in flight: its own scene state, shader, frame buffer and renderer. The renderer repacks
+// the shader's lights every frame and the scene keeps the current player states, so neither can be
+// shared between frames that render at the same time; the models and textures are shared through
+// the ResourceManager.
+struct FrameSlot
+{
+    RefPtr<NFLPlayScene> Scene;
+    FrameBuffer Frame;
+    IRasterRenderer * Renderer;
+    int FrameIndex;
+    unsigned long long StaticLayerKey; // scene's static layer key when the renderer's layer was saved
+    String SaveError; // empty if the slot's last frame was saved
+    List<PixelRect> ChangedRegion;
+    FrameSlot(NFLPlayScene * scene, int width, int height, bool trackDirtyTiles)
+        : Scene(scene), Frame(width, height), FrameIndex(-1), StaticLayerKey(0)
+    {
+        Renderer = CreateTiledRenderer();
+        Renderer->SetFrameBuffer(&Frame);
+        Renderer->SetDirtyTileTracking(trackDirtyTiles);
     }
-    
-    printf("\nStep 6: Creating renderer...\n");
-    fflush(stdout);
-    // Create renderer
-    printf("  Creating FrameBuffer (%dx%d)...\n", width, height);
+    ~FrameSlot()
+    {
+        DestroyRenderer(Renderer);
+    }
+    CoreLib::Int64 GetMemorySize()
+    {
+        return (CoreLib::Int64)Frame.GetMemorySize() + Renderer->GetMemorySize();
+    }
+    // Moves the scene's camera and the lighting shader's eye with it
+    void SetCamera(const Vec3 & position, const Vec3 & target)
+    {
+        Scene->SetCamera(position, target);
+        if (auto shader = dynamic_cast<ForwardLightingShader*>(Scene->State.Shader))
+            shader->CameraPosition = position;
+    }
+    // Renders the scene at its current time
+    void Render(bool useStaticLayer)
+    {
+        if (useStaticLayer)
+            Scene->DrawOverStaticLayer(Renderer, StaticLayerKey);
+        else
+        {
+            Renderer->Clear(Scene->ClearColor);
+            Scene->Draw(Renderer);
+        }
+        Renderer->Finish();
+    }
+    // Saves the frame, converting only the pixels that changed since the slot's last frame if the
+    // renderer tracks them
+    void Save(const String & fileName)
+    {
+        Frame.SaveColorBuffer(fileName, Renderer->GetChangedRegion(ChangedRegion) ? &ChangedRegion : nullptr);
+    }
+};
+
+// Chooses how many frames render at once. Frames are rendered in waves of that many, each wave
+// on its own slots. A fixed count only gives way to the memory cap; otherwise the count starts at
+// one and grows by one after every wave whose throughput beat the best so far by 5%, until it
+// reaches the limit, the next slot would not fit the memory cap, or a wave is not faster, which
+// returns it to the best count for the rest of the video.
+class FrameScheduler
+{
+private:
+    int limit, inFlight, bestInFlight;
+    bool adaptive, settled;
+    CoreLib::Int64 memoryCap;
+    double bestFramesPerSecond;
+public:
+    // limit: frames in flight, or the most the schedule may grow to if adaptive; memoryCap in
+    // bytes of all slots together, 0 for no cap
+    FrameScheduler(int limit, bool adaptive, CoreLib::Int64 memoryCap)
+        : limit(Math::Max(limit, 1)), inFlight(adaptive ? 1 : Math::Max(limit, 1)), bestInFlight(1),
+          adaptive(adaptive), settled(!adaptive), memoryCap(memoryCap), bestFramesPerSecond(0.0)
+    {}
+    int GetFramesInFlight()
+    {
+        return inFlight;
+    }
+    // slotBytes: the largest memory size of a slot so far, which grows with the renderer buffers
+    void EndWave(int frames, double seconds, CoreLib::Int64 slotBytes)
+    {
+        int fitting = inFlight;
+        if (memoryCap > 0 && slotBytes > 0)
+            fitting = (int)Math::Max(memoryCap / slotBytes, (CoreLib::Int64)1);
+        if (!settled && frames == inFlight)
+        {
+            double framesPerSecond = frames / Math::Max(seconds, 1e-9);
+            if (framesPerSecond > bestFramesPerSecond * 1.05)
+            {
+                bestFramesPerSecond = framesPerSecond;
+                bestInFlight = inFlight;
+                if (inFlight < limit && inFlight < fitting)
+                    inFlight++;
+                else
+                    settled = true;
+            }
+            else
+            {
+                inFlight = bestInFlight;
+                settled = true;
+            }
+        }
+        inFlight = Math::Min(inFlight, fitting);
+    }
+};
+
+// Settings of a video render besides the play, the stadium and the camera
+struct VideoOptions
+{
+    String OutputDir;
+    int Width, Height;
+    double Fps; // output frame rate, 0 for one frame per tracking step
+    TrackInterpolation Interpolation;
+    int FramesInFlight; // or the most the schedule may grow to if AdaptiveFramesInFlight
+    bool AdaptiveFramesInFlight;
+    CoreLib::Int64 FrameMemoryCap; // bytes, 0 for no cap
+    bool UseStaticLayer, TrackDirtyTiles;
+    bool Stream; // frames go to StreamTarget through a FrameWriter instead of image files in OutputDir
+    String FrameExtension; // of the frame files, which names their format: bmp, png or qoi
+    FrameStreamFormat StreamFormat;
+    YuvFormat StreamYuv; // planes of a Yuv stream, and range and gamma of both YUV formats
+    String StreamTarget;
+    int StreamQueue, StreamThreads;
+    VideoOptions()
+        : OutputDir(L"output"), Width(1920), Height(1080), Fps(0.0), Interpolation(TrackInterpolation::Linear),
+          FramesInFlight(1), AdaptiveFramesInFlight(false), FrameMemoryCap(0), UseStaticLayer(false), TrackDirtyTiles(false),
+          Stream(false), FrameExtension(L"bmp"), StreamFormat(FrameStreamFormat::Y4m), StreamTarget(L"-"), StreamQueue(4), StreamThreads(2)
+    {}
+};
+
+// Sets the stream format named rgb, y4m, i420 or nv12; false for any other name
+static bool ParseStreamFormat(const char * name, VideoOptions & options)
+{
+    if (strcmp(name, "rgb") == 0)
+        options.StreamFormat = FrameStreamFormat::Rgb;
+    else if (strcmp(name, "y4m") == 0)
+        options.StreamFormat = FrameStreamFormat::Y4m;
+    else if (strcmp(name, "i420") == 0 || strcmp(name, "nv12") == 0)
+    {
+        options.StreamFormat = FrameStreamFormat::Yuv;
+        options.StreamYuv.Layout = strcmp(name, "nv12") == 0 ? YuvLayout::Nv12 : YuvLayout::I420;
+    }
+    else
+        return false;
+    return true;
+}
+
+// Sets the frame file format named bmp, png or qoi; false for any other name
+static bool ParseFrameFormat(const char * name, VideoOptions & options)
+{
+    if (strcmp(name, "bmp") != 0 && strcmp(name, "png") != 0 && strcmp(name, "qoi") != 0)
+        return false;
+    options.FrameExtension = name;
+    return true;
+}
+
+// Parses the render option at argv[i], with its value if it takes one, and the process-wide cache
+// options; false if argv[i] is none of them
+static bool ParseVideoOption(int argc, char* argv[], int & i, VideoOptions & options)
+{
+    if (strcmp(argv[i], "--texture-cache") == 0)
+        CoreLib::Imaging::TextureData::UseCache = true;
+    else if (strcmp(argv[i], "--texture-cache-dir") == 0 && i + 1 < argc)
+    {
+        CoreLib::Imaging::TextureData::UseCache = true;
+        CoreLib::Imaging::TextureData::CacheDirectory = argv[++i];
+    }
+    else if (strcmp(argv[i], "--model-cache") == 0)
+        ModelResource::UseCache = true;
+    else if (strcmp(argv[i], "--model-cache-dir") == 0 && i + 1 < argc)
+    {
+        ModelResource::UseCache = true;
+        ModelResource::CacheDirectory = argv[++i];
+    }
+    else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+        CoreLib::Imaging::TextureResidency::Budget = (CoreLib::Int64)(atof(argv[++i]) * 1024.0 * 1024.0);
+    else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+        options.Fps = atof(argv[++i]);
+    else if (strcmp(argv[i], "--interpolation") == 0 && i + 1 < argc)
+    {
+        i++;
+        if (strcmp(argv[i], "nearest") == 0)
+            options.Interpolation = TrackInterpolation::Nearest;
+        else if (strcmp(argv[i], "catmull-rom") == 0)
+            options.Interpolation = TrackInterpolation::CatmullRom;
+        else
+            options.Interpolation = TrackInterpolation::Linear;
+    }
+    else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+    {
+        i++;
+        options.AdaptiveFramesInFlight = strcmp(argv[i], "auto") == 0;
+        options.FramesInFlight = options.AdaptiveFramesInFlight ? Math::Max((int)std::thread::hardware_concurrency(), 1) : Math::Max(atoi(argv[i]), 1);
+    }
+    else if (strcmp(argv[i], "--static-layer") == 0)
+        options.UseStaticLayer = true;
+    else if (strcmp(argv[i], "--dirty-tiles") == 0)
+        options.UseStaticLayer = options.TrackDirtyTiles = true;
+    else if (strcmp(argv[i], "--frame-memory") == 0 && i + 1 < argc)
+        options.FrameMemoryCap = (CoreLib::Int64)(atof(argv[++i]) * 1024.0 * 1024.0);
+    else if (strcmp(argv[i], "--frame-format") == 0 && i + 1 < argc)
+    {
+        if (!ParseFrameFormat(argv[++i], options))
+            options.FrameExtension = L"bmp";
+    }
+    else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc)
+    {
+        options.Stream = true;
+        if (!ParseStreamFormat(argv[++i], options))
+            options.StreamFormat = FrameStreamFormat::Y4m;
+    }
+    else if (strcmp(argv[i], "--yuv-range") == 0 && i + 1 < argc)
+        options.StreamYuv.Range = strcmp(argv[++i], "full") == 0 ? YuvRange::Full : YuvRange::Limited;
+    else if (strcmp(argv[i], "--yuv-gamma") == 0)
+        options.StreamYuv.EncodeGamma = true;
+    else if (strcmp(argv[i], "--stream-to") == 0 && i + 1 < argc)
+        options.StreamTarget = argv[++i];
+    else if (strcmp(argv[i], "--stream-queue") == 0 && i + 1 < argc)
+        options.StreamQueue = Math::Max(atoi(argv[++i]), 1);
+    else if (strcmp(argv[i], "--stream-threads") == 0 && i + 1 < argc)
+        options.StreamThreads = Math::Max(atoi(argv[++i]), 1);
+    else
+        return false;
+    return true;
+}
+
+// Frame times in tracking steps: the steps themselves, or evenly spaced at the output frame rate
+static std::vector<float> GetFrameTimes(const PlayData & playData, double fps)
+{
+    std::vector<float> frameTimes;
+    if (fps > 0.0)
+    {
+        int firstStep = playData.steps.front(), lastStep = playData.steps.back();
+        int frameCount = (int)((lastStep - firstStep) * fps / 10.0) + 1;
+        for (int i = 0; i < frameCount; i++)
+            frameTimes.push_back((float)(firstStep + i * 10.0 / fps));
+    }
+    else
+    {
+        for (int step : playData.steps)
+            frameTimes.push_back((float)step);
+    }
+    return frameTimes;
+}
+
+// Zero-padded frame numbers for proper sorting
+static String GetFramePath(const VideoOptions & options, int frameIndex)
+{
+    char frameNumStr[32];
+    snprintf(frameNumStr, sizeof(frameNumStr), "%05d", frameIndex);
+    return Path::Combine(options.OutputDir, String(L"frame_") + String(frameNumStr) + L"." + options.FrameExtension);
+}
+
+// Keeps TextureResidency::Update apart from the waves of every render in the process: waves of
+// several videos may run at once, but Update must not run while a frame samples textures. A
+// pending update holds new waves back until it is done.
+class WaveGate
+{
+private:
+    std::mutex lock;
+    std::condition_variable changed;
+    int waves;
+    bool updating;
+public:
+    WaveGate()
+        : waves(0), updating(false)
+    {}
+    void BeginWave()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&] { return !updating; });
+        waves++;
+    }
+    void EndWave()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        waves--;
+        changed.notify_all();
+    }
+    CoreLib::Imaging::TextureResidencyStats UpdateTextures()
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [&] { return !updating; });
+            updating = true;
+            changed.wait(guard, [&] { return waves == 0; });
+        }
+        auto stats = CoreLib::Imaging::TextureResidency::Update();
+        std::lock_guard<std::mutex> guard(lock);
+        updating = false;
+        changed.notify_all();
+        return stats;
+    }
+};
+
+static WaveGate waveGate;
+
+// A wave on a WaveGate from construction to destruction, so a frame that throws still ends it
+struct WaveScope
+{
+    WaveGate & Gate;
+    WaveScope(WaveGate & gate)
+        : Gate(gate)
+    {
+        Gate.BeginWave();
+    }
+    ~WaveScope()
+    {
+        Gate.EndWave();
+    }
+    WaveScope(const WaveScope &) = delete;
+    WaveScope & operator=(const WaveScope &) = delete;
+};
+
+struct VideoStats
+{
+    int Frames, FailedFrames; // frames rendered, and those of them that could not be saved
+    int MaxFramesInFlight, FinalFramesInFlight;
+    double Seconds;
+    CoreLib::Int64 SlotBytes; // largest memory size of a slot
+    CoreLib::Int64 PeakTextureBytes;
+    CoreLib::Int64 StreamBytes;
+    double StreamWriteSeconds; // the frame writer's time in writes, mostly waiting for the reader
+    String StreamError;
+    VideoStats()
+        : Frames(0), FailedFrames(0), MaxFramesInFlight(0), FinalFramesInFlight(0), Seconds(0.0), SlotBytes(0), PeakTextureBytes(0),
+          StreamBytes(0), StreamWriteSeconds(0.0)
+    {}
+};
+
+// Set in process by --server-check alone, before its server starts: called with the index of each
+// frame before it renders, so the check can make a frame throw inside a wave
+static void (*frameCheckHook)(int frameIndex) = nullptr;
+
+// Renders the frames at frameTimes into options.OutputDir, or the frame stream, on slots, which
+// holds at least one slot; createSlot makes the further slots the schedule asks for. With
+// printProgress, save errors and progress every ten frames are printed. Throws IOException if
+// the frame stream cannot be opened.
+static VideoStats RenderFrames(const VideoOptions & options, const std::vector<float> & frameTimes,
+    std::vector<std::unique_ptr<FrameSlot>> & slots, const std::function<FrameSlot*()> & createSlot, bool printProgress)
+{
+    FrameScheduler scheduler(options.FramesInFlight, options.AdaptiveFramesInFlight, options.FrameMemoryCap);
+    VideoStats stats;
+    int numFrames = (int)frameTimes.size();
+    CoreLib::Imaging::TextureResidencyStats textureStats = {};
+    auto renderCounter = PerformanceCounter::Start();
+    std::unique_ptr<FrameWriter> writer;
+    if (options.Stream)
+    {
+        // one frame per tracking step is 10 frames per second
+        writer.reset(new FrameWriter(options.StreamFormat, options.StreamYuv, options.StreamTarget, options.Width, options.Height,
+            options.Fps > 0.0 ? options.Fps : 10.0, options.StreamQueue, options.StreamThreads));
+    }
+    for (int firstFrame = 0; firstFrame < numFrames; )
+    {
+        int inFlight = Math::Min(scheduler.GetFramesInFlight(), numFrames - firstFrame);
+        try {
+            while ((int)slots.size() < inFlight)
+                slots.push_back(std::unique_ptr<FrameSlot>(createSlot()));
+        }
+        catch (Exception& ex) {
+            if (printProgress)
+                printf("Exception creating frame slot: %s\n", ex.Message.ToMultiByteString());
+            inFlight = Math::Min(inFlight, (int)slots.size());
+        }
+        stats.MaxFramesInFlight = Math::Max(stats.MaxFramesInFlight, inFlight);
+
+        // The frames of a wave render side by side, each on its own slot, and frame files are saved by
+        // the task that rendered them, so one frame's serial parts overlap the others' parallel ones.
+        // Stream frames are submitted in order once the wave is done: Submit blocks until the frames
+        // more than a queue length before it are written, and a task blocked there could hold the
+        // worker thread an earlier frame of the wave is waiting for.
+        auto waveCounter = PerformanceCounter::Start();
+        {
+            WaveScope wave(waveGate);
+            Parallel::For(0, inFlight, 1, [&](int s)
+            {
+                FrameSlot & slot = *slots[s];
+                slot.FrameIndex = firstFrame + s;
+                if (frameCheckHook)
+                    frameCheckHook(slot.FrameIndex);
+                slot.Scene->SetTime(frameTimes[slot.FrameIndex]);
+                slot.Render(options.UseStaticLayer);
+
+                slot.SaveError = String();
+                if (!writer)
+                {
+                    try {
+                        slot.Save(GetFramePath(options, slot.FrameIndex));
+                    } catch (Exception& ex) {
+                        slot.SaveError = ex.Message;
+                    }
+                }
+            });
+        }
+        if (writer)
+        {
+            for (int s = 0; s < inFlight; s++)
+            {
+                if (!writer->Submit(slots[s]->FrameIndex, slots[s]->Frame))
+                    slots[s]->SaveError = writer->GetError();
+            }
+        }
+        double waveTime = PerformanceCounter::ToSeconds(PerformanceCounter::End(waveCounter));
+        for (int s = 0; s < inFlight; s++)
+            stats.SlotBytes = Math::Max(stats.SlotBytes, slots[s]->GetMemorySize());
+        scheduler.EndWave(inFlight, waveTime, stats.SlotBytes);
+
+        // No frame samples textures between waves
+        if (CoreLib::Imaging::TextureResidency::Budget > 0)
+        {
+            textureStats = waveGate.UpdateTextures();
+            if (textureStats.ResidentBytes > stats.PeakTextureBytes)
+                stats.PeakTextureBytes = textureStats.ResidentBytes;
+        }
+
+        // Report in frame order, whichever frame of the wave finished first
+        for (int s = 0; s < inFlight; s++)
+        {
+            int i = firstFrame + s;
+            if (slots[s]->SaveError.Length())
+            {
+                stats.FailedFrames++;
+                if (printProgress)
+                {
+                    printf("Error saving frame %d: %s\n", i, slots[s]->SaveError.ToMultiByteString());
+                    fflush(stdout);
+                }
+                // Continue with next frame
+            }
+            if (printProgress && ((i + 1) % 10 == 0 || i == 0))
+            {
+                printf("Rendered %d/%d frames (step %g, %d in flight)\n", i + 1, numFrames, frameTimes[i], inFlight);
+                if (CoreLib::Imaging::TextureResidency::Budget > 0)
+                    printf("  Textures: %.2f / %.2f MB resident, %d levels sampled, paged in %.2f MB, evicted %.2f MB, deferred %d\n",
+                           textureStats.ResidentBytes / 1048576.0, CoreLib::Imaging::TextureResidency::Budget / 1048576.0,
+                           textureStats.SampledLevels, textureStats.PagedInBytes / 1048576.0,
+                           textureStats.EvictedBytes / 1048576.0, textureStats.DeferredLevels);
+                fflush(stdout);
+            }
+        }
+        firstFrame += inFlight;
+    }
+    if (writer)
+    {
+        if (!writer->Close())
+            stats.StreamError = writer->GetError();
+        stats.StreamBytes = writer->GetBytesWritten();
+        stats.StreamWriteSeconds = writer->GetWriteSeconds();
+    }
+    stats.Frames = numFrames;
+    stats.FinalFramesInFlight = scheduler.GetFramesInFlight();
+    stats.Seconds = PerformanceCounter::ToSeconds(PerformanceCounter::End(renderCounter));
+    return stats;
+}
+
+#ifndef _WIN32
+// A video render queued on the render server
+struct RenderJob
+{
+    enum class JobState { Queued, Running, Done, Failed };
+    int Id, Priority; // higher priorities run first, equal ones in the order they were queued
+    String TrackingFile, GamePlay, StadiumModel;
+    VideoOptions Options;
+    Vec3 CameraPosition, CameraTarget;
+    JobState State;
+    String Error;
+    double QueuedAt, StartedAt, FinishedAt; // seconds since the server started
+    double LoadSeconds; // play data and scenes, from the server's caches or loaded
+    bool PlayCached, ScenesCached;
+    VideoStats Stats;
+    RenderJob()
+        : Id(0), Priority(0),
+          CameraPosition(60.0f, 60.0f, 50.0f), CameraTarget(60.0f, 26.65f, 0.0f), // NFLPlayScene's camera
+          State(JobState::Queued), QueuedAt(0.0), StartedAt(0.0), FinishedAt(0.0), LoadSeconds(0.0),
+          PlayCached(false), ScenesCached(false)
+    {}
+    bool IsFinished() const
+    {
+        return State == JobState::Done || State == JobState::Failed;
+    }
+};
+
+// Long-running renderer behind a Unix domain socket. Clients connect, send one command line and
+// read the reply:
+//   render tracking=<file> play=<game_play> stadium=<obj> output=<dir> [width=W] [height=H] [fps=F]
+//          [priority=P] [camera=x,y,z,targetX,targetY,targetZ] [interpolation=nearest|linear|catmull-rom]
+//          [format=bmp|png|qoi] [stream=rgb|y4m|i420|nv12]
+//       queues a video render and replies "queued <id> <queue depth>"; values cannot hold spaces.
+//       With stream, output is the stream's file, FIFO or |command instead of a directory.
+//   status <id>    replies the job's line, as in the stats
+//   wait <id>      the same once the job has finished
+//   stats          replies the stats, as written to the stats file
+//   shutdown       stops taking connections; the server exits once the queued jobs are done
+// Errors reply "error <message>".
+//
+// Jobs run on a pool of workers, each rendering one video at a time with the frames-in-flight
+// schedule of a command line render. Between jobs the server keeps the tracking data of recent
+// plays, the models and textures (through the ResourceManager), and the scenes, frame buffers and
+// renderers of finished jobs, so a job for a play and resolution rendered before starts at once.
+class RenderServer
+{
+private:
+    struct CachedPlay
+    {
+        std::shared_ptr<PlayData> Play;
+        CoreLib::Int64 FileSize, FileTime; // of the tracking file when it was loaded
+        unsigned long long LastUse;
+    };
+    // Slots of a finished job, for the next job of the same play, stadium and resolution
+    struct CachedSlots
+    {
+        std::vector<std::unique_ptr<FrameSlot>> Slots;
+        CoreLib::Int64 Bytes;
+        unsigned long long LastUse;
+    };
+    static const int MaxCachedPlays = 64;
+    static const int MaxFinishedJobs = 1000; // older finished jobs are dropped from the stats
+
+    VideoOptions defaults;
+    String socketPath, statsPath;
+    CoreLib::Int64 sceneCacheCap;
+    int workerCount;
+    TimePoint startTime;
+
+    std::mutex lock; // everything below, except where noted
+    std::condition_variable jobsChanged;
+    std::map<int, std::shared_ptr<RenderJob>> jobs;
+    std::vector<std::shared_ptr<RenderJob>> queue;
+    int nextJobId, runningJobs, completedJobs, failedJobs, activeClients;
+    bool stopping;
+    int listenSocket;
+    std::map<std::string, CachedPlay> plays;
+    std::multimap<std::string, CachedSlots> idleSlots;
+    unsigned long long useCounter;
+    int playHits, playMisses, sceneHits, sceneMisses;
+
+    // The ResourceManager and the reference counts of the models it shares are not thread-safe, so
+    // scenes are made and destroyed under this lock
+    std::mutex resourceLock;
+
+    double Now()
+    {
+        return PerformanceCounter::ToSeconds(PerformanceCounter::End(startTime));
+    }
+    static bool GetFileStamp(const String & fileName, CoreLib::Int64 & size, CoreLib::Int64 & time)
+    {
+        struct stat info;
+        if (stat(fileName.ToMultiByteString(), &info) != 0)
+            return false;
+        size = (CoreLib::Int64)info.st_size;
+        time = (CoreLib::Int64)info.st_mtime;
+        return true;
+    }
+    static std::string GetSlotKey(const RenderJob & job, CoreLib::Int64 fileSize, CoreLib::Int64 fileTime)
+    {
+        char resolution[128];
+        snprintf(resolution, sizeof(resolution), "|%dx%d|%lld|%lld", job.Options.Width, job.Options.Height, (long long)fileSize, (long long)fileTime);
+        return std::string(job.TrackingFile.ToMultiByteString()) + "|" + job.GamePlay.ToMultiByteString() + "|" +
+            job.StadiumModel.ToMultiByteString() + resolution;
+    }
+    void DestroySlots(std::vector<std::unique_ptr<FrameSlot>> & slots)
+    {
+        std::lock_guard<std::mutex> guard(resourceLock);
+        slots.clear();
+    }
+
+    // The play from the cache, or loaded from its tracking file if the file changed since
+    std::shared_ptr<PlayData> GetPlay(RenderJob & job, CoreLib::Int64 & fileSize, CoreLib::Int64 & fileTime)
+    {
+        if (!GetFileStamp(job.TrackingFile, fileSize, fileTime))
+            throw IOException(L"Cannot open tracking file " + job.TrackingFile);
+        std::string key = std::string(job.TrackingFile.ToMultiByteString()) + "|" + job.GamePlay.ToMultiByteString();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto cached = plays.find(key);
+            if (cached != plays.end() && cached->second.FileSize == fileSize && cached->second.FileTime == fileTime)
+            {
+                cached->second.LastUse = ++useCounter;
+                playHits++;
+                job.PlayCached = true;
+                return cached->second.Play;
+            }
+            playMisses++;
+        }
+        std::shared_ptr<PlayData> play = std::make_shared<PlayData>(TrackingDataLoader::GetPlay(job.TrackingFile, job.GamePlay));
+        std::lock_guard<std::mutex> guard(lock);
+        CachedPlay & entry = plays[key];
+        entry.Play = play;
+        entry.FileSize = fileSize;
+        entry.FileTime = fileTime;
+        entry.LastUse = ++useCounter;
+        while ((int)plays.size() > MaxCachedPlays)
+        {
+            auto oldest = plays.begin();
+            for (auto p = plays.begin(); p != plays.end(); ++p)
+                if (p->second.LastUse < oldest->second.LastUse)
+                    oldest = p;
+            plays.erase(oldest);
+        }
+        return play;
+    }
+    // Takes a cached set of slots for key; empty if there is none
+    std::vector<std::unique_ptr<FrameSlot>> TakeSlots(const std::string & key)
+    {
+        std::vector<std::unique_ptr<FrameSlot>> slots;
+        std::lock_guard<std::mutex> guard(lock);
+        auto cached = idleSlots.find(key);
+        if (cached != idleSlots.end())
+        {
+            slots = std::move(cached->second.Slots);
+            idleSlots.erase(cached);
+            sceneHits++;
+        }
+        else
+            sceneMisses++;
+        return slots;
+    }
+    // Caches a job's slots, evicting the least recently used sets over the cache size
+    void ReturnSlots(const std::string & key, std::vector<std::unique_ptr<FrameSlot>> & slots)
+    {
+        std::vector<std::unique_ptr<FrameSlot>> evicted;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            CachedSlots entry;
+            entry.Bytes = 0;
+            for (auto & slot : slots)
+                entry.Bytes += slot->GetMemorySize();
+            entry.Slots = std::move(slots);
+            slots.clear();
+            entry.LastUse = ++useCounter;
+            idleSlots.insert(std::make_pair(key, std::move(entry)));
+            for (;;)
+            {
+                CoreLib::Int64 bytes = 0;
+                auto oldest = idleSlots.begin();
+                for (auto c = idleSlots.begin(); c != idleSlots.end(); ++c)
+                {
+                    bytes += c->second.Bytes;
+                    if (c->second.LastUse < oldest->second.LastUse)
+                        oldest = c;
+                }
+                if (bytes <= sceneCacheCap || idleSlots.empty())
+                    break;
+                for (auto & slot : oldest->second.Slots)
+                    evicted.push_back(std::move(slot));
+                idleSlots.erase(oldest);
+            }
+        }
+        DestroySlots(evicted);
+    }
+
+    // Runs a copy of a job, which only this worker uses, and leaves the outcome in it
+    void RunJob(RenderJob & job)
+    {
+        auto loadCounter = PerformanceCounter::Start();
+        std::vector<std::unique_ptr<FrameSlot>> slots;
+        try
+        {
+            CoreLib::Int64 fileSize, fileTime;
+            std::shared_ptr<PlayData> play = GetPlay(job, fileSize, fileTime);
+            if (play->steps.empty())
+                throw Exception(L"Play not found or has no data");
+            std::string slotKey = GetSlotKey(job, fileSize, fileTime);
+            ViewSettings viewSettings;
+            viewSettings.WindowWidth = job.Options.Width;
+            viewSettings.WindowHeight = job.Options.Height;
+            viewSettings.FovY = 60.0f;
+            viewSettings.zNear = 0.1f;
+            viewSettings.zFar = 500.0f;
+            auto prepare = [&](FrameSlot & slot)
+            {
+                slot.Scene->SetInterpolation(job.Options.Interpolation);
+                slot.SetCamera(job.CameraPosition, job.CameraTarget);
+                slot.Renderer->SetDirtyTileTracking(job.Options.TrackDirtyTiles);
+            };
+            auto createSlot = [&]() -> FrameSlot *
+            {
+                std::lock_guard<std::mutex> guard(resourceLock);
+                NFLPlayScene * scene = new NFLPlayScene(viewSettings, job.StadiumModel, *play);
+                scene->SetShader(CreateFieldShader());
+                FrameSlot * slot = new FrameSlot(scene, job.Options.Width, job.Options.Height, job.Options.TrackDirtyTiles);
+                prepare(*slot);
+                return slot;
+            };
+            slots = TakeSlots(slotKey);
+            job.ScenesCached = !slots.empty();
+            for (auto & slot : slots)
+                prepare(*slot);
+            if (slots.empty())
+                slots.push_back(std::unique_ptr<FrameSlot>(createSlot()));
+            job.LoadSeconds = PerformanceCounter::ToSeconds(PerformanceCounter::End(loadCounter));
+
+            job.Stats = RenderFrames(job.Options, GetFrameTimes(*play, job.Options.Fps), slots, createSlot, false);
+            if (job.Stats.StreamError.Length())
+                job.Error = job.Stats.StreamError;
+            else if (job.Stats.FailedFrames)
+                job.Error = String(job.Stats.FailedFrames) + L" frames could not be saved to " + job.Options.OutputDir;
+            ReturnSlots(slotKey, slots);
+        }
+        catch (Exception & ex)
+        {
+            job.Error = ex.Message.Length() ? ex.Message : String(L"Render failed");
+        }
+        catch (std::exception & ex)
+        {
+            job.Error = ex.what();
+        }
+        DestroySlots(slots);
+    }
+
+    void RunWorker()
+    {
+        for (;;)
+        {
+            std::shared_ptr<RenderJob> job;
+            // Strings share their buffers without atomic counts, so the copy is made and dropped under lock
+            std::unique_ptr<RenderJob> run;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                jobsChanged.wait(guard, [&] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                auto next = queue.begin();
+                for (auto j = queue.begin(); j != queue.end(); ++j)
+                    if ((*j)->Priority > (*next)->Priority || ((*j)->Priority == (*next)->Priority && (*j)->Id < (*next)->Id))
+                        next = j;
+                job = *next;
+                queue.erase(next);
+                job->State = RenderJob::JobState::Running;
+                job->StartedAt = Now();
+                runningJobs++;
+                run.reset(new RenderJob(*job));
+            }
+            WriteStats();
+            printf("Job %d: rendering %s at %dx%d\n", run->Id, run->GamePlay.ToMultiByteString(), run->Options.Width, run->Options.Height);
+            fflush(stdout);
+
+            RunJob(*run);
+
+            if (run->Error.Length())
+                printf("Job %d: failed: %s\n", run->Id, run->Error.ToMultiByteString());
+            else
+                printf("Job %d: %d frames in %.2f s (%.1f frames per second)\n", run->Id, run->Stats.Frames, run->Stats.Seconds,
+                    run->Stats.Frames / Math::Max(run->Stats.Seconds, 1e-9));
+            fflush(stdout);
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                job->Error = run->Error;
+                job->LoadSeconds = run->LoadSeconds;
+                job->PlayCached = run->PlayCached;
+                job->ScenesCached = run->ScenesCached;
+                job->Stats = run->Stats;
+                job->FinishedAt = Now();
+                job->State = job->Error.Length() ? RenderJob::JobState::Failed : RenderJob::JobState::Done;
+                run.reset();
+                runningJobs--;
+                if (job->State == RenderJob::JobState::Done)
+                    completedJobs++;
+                else
+                    failedJobs++;
+                std::vector<int> finished;
+                for (auto & j : jobs)
+                    if (j.second->IsFinished())
+                        finished.push_back(j.first);
+                for (int i = 0; i + MaxFinishedJobs < (int)finished.size(); i++)
+                    jobs.erase(finished[i]);
+                jobsChanged.notify_all();
+            }
+            WriteStats();
+        }
+    }
+
+    // Called with lock held
+    std::string FormatJob(const RenderJob & job)
+    {
+        static const char * stateNames[] = {"queued", "running", "done", "failed"};
+        double now = Now();
+        double started = job.State == RenderJob::JobState::Queued ? now : job.StartedAt;
+        char line[1024];
+        snprintf(line, sizeof(line),
+            "job id=%d state=%s priority=%d play=%s size=%dx%d frames=%d queue_ms=%.1f load_ms=%.1f render_ms=%.1f fps=%.2f "
+            "cached_play=%d cached_scenes=%d output=%s",
+            job.Id, stateNames[(int)job.State], job.Priority, job.GamePlay.ToMultiByteString(), job.Options.Width, job.Options.Height,
+            job.Stats.Frames, (started - job.QueuedAt) * 1000.0, job.LoadSeconds * 1000.0, job.Stats.Seconds * 1000.0,
+            job.Stats.Frames / Math::Max(job.Stats.Seconds, 1e-9), job.PlayCached ? 1 : 0, job.ScenesCached ? 1 : 0,
+            job.Options.OutputDir.ToMultiByteString());
+        std::string result = line;
+        if (job.Error.Length())
+            result += std::string(" error=\"") + job.Error.ToMultiByteString() + "\"";
+        return result;
+    }
+    std::string GetStatsText()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        CoreLib::Int64 sceneBytes = 0;
+        for (auto & cached : idleSlots)
+            sceneBytes += cached.second.Bytes;
+        char header[1024];
+        snprintf(header, sizeof(header),
+            "uptime_s %.1f\nworkers %d\nqueue_depth %d\nrunning %d\ncompleted %d\nfailed %d\n"
+            "play_cache %d plays, %d hits, %d misses\nscene_cache %d sets, %.1f MB of %.1f MB, %d hits, %d misses\n",
+            Now(), workerCount, (int)queue.size(), runningJobs, completedJobs, failedJobs,
+            (int)plays.size(), playHits, playMisses, (int)idleSlots.size(), sceneBytes / 1048576.0, sceneCacheCap / 1048576.0,
+            sceneHits, sceneMisses);
+        std::string text = header;
+        for (auto & job : jobs)
+            text += FormatJob(*job.second) + "\n";
+        return text;
+    }
+    // Replaces the stats file, so readers never see a partly written one
+    void WriteStats()
+    {
+        if (!statsPath.Length())
+            return;
+        std::string text = GetStatsText();
+        String tempPath = statsPath + L".tmp";
+        FILE * f = fopen(tempPath.ToMultiByteString(), "wb");
+        if (!f)
+            return;
+        bool written = fwrite(text.data(), 1, text.size(), f) == text.size();
+        written = fclose(f) == 0 && written;
+        if (written)
+            rename(tempPath.ToMultiByteString(), statsPath.ToMultiByteString());
+    }
+
+    // Parses a render command into a queued job
+    std::string QueueJob(const std::vector<std::string> & words)
+    {
+        std::shared_ptr<RenderJob> job = std::make_shared<RenderJob>();
+        job->Options = defaults;
+        for (size_t w = 1; w < words.size(); w++)
+        {
+            size_t equals = words[w].find('=');
+            if (equals == std::string::npos)
+                return "error expected name=value, got " + words[w];
+            std::string name = words[w].substr(0, equals), value = words[w].substr(equals + 1);
+            if (name == "tracking")
+                job->TrackingFile = value.c_str();
+            else if (name == "play")
+                job->GamePlay = value.c_str();
+            else if (name == "stadium")
+                job->StadiumModel = value.c_str();
+            else if (name == "output")
+                job->Options.OutputDir = value.c_str();
+            else if (name == "width")
+                job->Options.Width = atoi(value.c_str());
+            else if (name == "height")
+                job->Options.Height = atoi(value.c_str());
+            else if (name == "fps")
+                job->Options.Fps = atof(value.c_str());
+            else if (name == "priority")
+                job->Priority = atoi(value.c_str());
+            else if (name == "format")
+            {
+                if (!ParseFrameFormat(value.c_str(), job->Options))
+                    return "error unknown frame format " + value;
+            }
+            else if (name == "stream")
+            {
+                if (!ParseStreamFormat(value.c_str(), job->Options))
+                    return "error unknown stream format " + value;
+                job->Options.Stream = true;
+            }
+            else if (name == "camera")
+            {
+                float v[6];
+                if (sscanf(value.c_str(), "%f,%f,%f,%f,%f,%f", v, v + 1, v + 2, v + 3, v + 4, v + 5) != 6)
+                    return "error camera takes x,y,z,targetX,targetY,targetZ";
+                job->CameraPosition = Vec3(v[0], v[1], v[2]);
+                job->CameraTarget = Vec3(v[3], v[4], v[5]);
+            }
+            else if (name == "interpolation")
+            {
+                if (value == "nearest")
+                    job->Options.Interpolation = TrackInterpolation::Nearest;
+                else if (value == "catmull-rom")
+                    job->Options.Interpolation = TrackInterpolation::CatmullRom;
+                else if (value == "linear")
+                    job->Options.Interpolation = TrackInterpolation::Linear;
+                else
+                    return "error unknown interpolation " + value;
+            }
+            else
+                return "error unknown render parameter " + name;
+        }
+        if (!job->TrackingFile.Length() || !job->GamePlay.Length() || !job->StadiumModel.Length())
+            return "error render needs tracking=, play= and stadium=";
+        if (job->Options.Width <= 0 || job->Options.Height <= 0)
+            return "error width and height must be positive";
+        if (job->Options.Stream)
+        {
+            if (job->Options.OutputDir == L"-")
+                return "error the server cannot stream to its stdout";
+            job->Options.StreamTarget = job->Options.OutputDir;
+        }
+        int id, depth;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (stopping)
+                return "error the server is shutting down";
+            id = job->Id = nextJobId++;
+            job->QueuedAt = Now();
+            jobs[id] = job;
+            queue.push_back(job);
+            depth = (int)queue.size();
+            jobsChanged.notify_all();
+        }
+        WriteStats();
+        return "queued " + std::to_string(id) + " " + std::to_string(depth);
+    }
+    std::string GetJobStatus(const std::string & idText, bool wait)
+    {
+        int id = atoi(idText.c_str());
+        std::unique_lock<std::mutex> guard(lock);
+        auto found = jobs.find(id);
+        if (found == jobs.end())
+            return "error no job " + idText;
+        std::shared_ptr<RenderJob> job = found->second;
+        if (wait)
+            jobsChanged.wait(guard, [&] { return job->IsFinished(); });
+        return FormatJob(*job);
+    }
+    void Stop()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        jobsChanged.notify_all();
+        // wakes the accept loop
+        shutdown(listenSocket, SHUT_RDWR);
+    }
+
+    std::string HandleCommand(const std::string & line)
+    {
+        std::vector<std::string> words;
+        size_t pos = 0;
+        while (pos < line.size())
+        {
+            size_t start = line.find_first_not_of(" \t\r", pos);
+            if (start == std::string::npos)
+                break;
+            size_t end = line.find_first_of(" \t\r", start);
+            if (end == std::string::npos)
+                end = line.size();
+            words.push_back(line.substr(start, end - start));
+            pos = end;
+        }
+        if (words.empty())
+            return "error empty command";
+        if (words[0] == "render")
+            return QueueJob(words);
+        if ((words[0] == "status" || words[0] == "wait") && words.size() == 2)
+            return GetJobStatus(words[1], words[0] == "wait");
+        if (words[0] == "stats")
+            return GetStatsText();
+        if (words[0] == "shutdown")
+        {
+            Stop();
+            return "stopping";
+        }
+        return "error unknown command " + words[0];
+    }
+    void HandleClient(int client)
+    {
+        // a client that sends no full line in time is dropped
+        timeval timeout = {10, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::string line;
+        char buffer[4096];
+        for (;;)
+        {
+            ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+            if (received <= 0)
+                break;
+            line.append(buffer, received);
+            size_t end = line.find('\n');
+            if (end != std::string::npos)
+            {
+                line.resize(end);
+                break;
+            }
+            if (line.size() > 65536)
+                break;
+        }
+        std::string reply = HandleCommand(line);
+        if (reply.empty() || reply.back() != '\n')
+            reply += "\n";
+        for (size_t sent = 0; sent < reply.size(); )
+        {
+            ssize_t count = send(client, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+            if (count <= 0)
+                break;
+            sent += count;
+        }
+        close(client);
+        std::lock_guard<std::mutex> guard(lock);
+        activeClients--;
+        jobsChanged.notify_all();
+    }
+public:
+    // sceneCacheCap: bytes of the frame buffers and renderers kept for later jobs
+    RenderServer(const String & socketPath, const String & statsPath, const VideoOptions & defaults, int workers, CoreLib::Int64 sceneCacheCap)
+        : defaults(defaults), socketPath(socketPath), statsPath(statsPath), sceneCacheCap(sceneCacheCap), workerCount(Math::Max(workers, 1)),
+          startTime(PerformanceCounter::Start()), nextJobId(1), runningJobs(0), completedJobs(0), failedJobs(0), activeClients(0),
+          stopping(false), listenSocket(-1), useCounter(0), playHits(0), playMisses(0), sceneHits(0), sceneMisses(0)
+    {}
+    // Serves until a shutdown command has been handled and the queued jobs are done
+    int Run()
+    {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(socketPath.ToMultiByteString()) >= sizeof(address.sun_path))
+        {
+            printf("Socket path too long: %s\n", socketPath.ToMultiByteString());
+            return 1;
+        }
+        strcpy(address.sun_path, socketPath.ToMultiByteString());
+        listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+        // a socket file left by a server that did not exit cleanly would fail the bind
+        unlink(address.sun_path);
+        if (listenSocket == -1 || bind(listenSocket, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenSocket, 64) != 0)
+        {
+            printf("Cannot listen on %s: %s\n", socketPath.ToMultiByteString(), strerror(errno));
+            if (listenSocket != -1)
+                close(listenSocket);
+            return 1;
+        }
+        printf("Render server listening on %s with %d workers\n", socketPath.ToMultiByteString(), workerCount);
+        fflush(stdout);
+        WriteStats();
+        std::vector<std::thread> workers;
+        for (int i = 0; i < workerCount; i++)
+            workers.push_back(std::thread([this] { RunWorker(); }));
+        for (;;)
+        {
+            int client = accept(listenSocket, nullptr, nullptr);
+            if (client == -1)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (stopping)
+                    break;
+                continue;
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            activeClients++;
+            std::thread([this, client] { HandleClient(client); }).detach();
+        }
+        printf("Render server stopping, finishing %d queued jobs\n", (int)queue.size());
+        fflush(stdout);
+        for (auto & worker : workers)
+            worker.join();
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            jobsChanged.wait(guard, [&] { return activeClients == 0; });
+        }
+        close(listenSocket);
+        unlink(socketPath.ToMultiByteString());
+        WriteStats();
+        for (auto & cached : idleSlots)
+            DestroySlots(cached.second.Slots);
+        printf("Render server stopped: %d jobs done, %d failed\n", completedJobs, failedJobs);
+        return 0;
+    }
+};
+
+// Sends one command to a render server and reads its reply; false, with errno set, if the server
+// could not be reached
+static bool SendToRenderServer(const String & socketPath, const std::string & command, std::string & reply)
+{
+    reply.clear();
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.ToMultiByteString(), sizeof(address.sun_path) - 1);
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server == -1 || connect(server, (sockaddr*)&address, sizeof(address)) != 0)
+    {
+        int error = errno;
+        if (server != -1)
+            close(server);
+        errno = error;
+        return false;
+    }
+    std::string line = command + "\n";
+    bool sent = send(server, line.data(), line.size(), MSG_NOSIGNAL) == (ssize_t)line.size();
+    char buffer[4096];
+    ssize_t received;
+    while (sent && (received = recv(server, buffer, sizeof(buffer), 0)) > 0)
+        reply.append(buffer, received);
+    close(server);
+    return true;
+}
+
+// Sends one command to a render server and prints the reply; 1 if the server could not be
+// reached, replied an error or reports a failed job
+static int SubmitToRenderServer(const String & socketPath, const std::string & command)
+{
+    std::string reply;
+    if (!SendToRenderServer(socketPath, command, reply))
+    {
+        printf("Cannot connect to %s: %s\n", socketPath.ToMultiByteString(), strerror(errno));
+        return 1;
+    }
+    fwrite(reply.data(), 1, reply.size(), stdout);
+    return (reply.empty() || reply.compare(0, 6, "error ") == 0 || reply.find("state=failed") != std::string::npos) ? 1 : 0;
+}
+
+// Runs a render server on a socket of its own and checks that a job whose frame throws fails and
+// leaves the server usable: the next job, with texture residency updates between its waves, which
+// wait for every wave to end, must still finish. 0 if it does.
+static int RenderServerCheck(const String & trackingCsv, const String & gamePlay, const String & stadiumModel, const String & outputDir)
+{
+    if (CoreLib::Imaging::TextureResidency::Budget <= 0)
+        CoreLib::Imaging::TextureResidency::Budget = (CoreLib::Int64)256 << 20;
+    VideoOptions defaults;
+    defaults.Width = 160;
+    defaults.Height = 90;
+    defaults.FramesInFlight = 2;
+    // the first frame to render throws, which fails the first job
+    static std::atomic<bool> frameFailed(false);
+    frameCheckHook = [](int frameIndex)
+    {
+        if (!frameFailed.exchange(true))
+            throw Exception(L"Frame " + String(frameIndex) + L" failed on purpose");
+    };
+    String socketPath = String(L"/tmp/nfl_server_check_") + String((int)getpid()) + L".sock";
+    ResourceManager::Enabled = true;
+    RenderServer server(socketPath, String(), defaults, 1, (CoreLib::Int64)256 << 20);
+    std::atomic<bool> serverDone(false);
+    std::thread serverThread([&] { server.Run(); serverDone = true; });
+
+    // a stuck worker cannot be joined, so a check that runs out of time exits at once
+    auto deadline = PerformanceCounter::Start();
+    auto check = [&](const std::string & command, std::string & reply)
+    {
+        for (;;)
+        {
+            if (PerformanceCounter::ToSeconds(PerformanceCounter::End(deadline)) > 60.0)
+            {
+                printf("FAIL: no reply to \"%s\" within 60 s\n%s", command.c_str(), reply.c_str());
+                fflush(stdout);
+                _exit(1);
+            }
+            if (serverDone)
+            {
+                printf("FAIL: the render server stopped\n");
+                fflush(stdout);
+                _exit(1);
+            }
+            if (SendToRenderServer(socketPath, command, reply) && reply.find("state=queued") == std::string::npos &&
+                reply.find("state=running") == std::string::npos)
+                return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    };
+    std::string common = std::string(" tracking=") + trackingCsv.ToMultiByteString() + " play=" + gamePlay.ToMultiByteString() +
+        " stadium=" + stadiumModel.ToMultiByteString() + " output=" + outputDir.ToMultiByteString();
+    std::string reply;
+    bool passed = true;
+    check("render" + common, reply);
+    std::string failedId = reply.compare(0, 7, "queued ") == 0 ? reply.substr(7, reply.find(' ', 7) - 7) : std::string();
+    check("render" + common, reply);
+    std::string doneId = reply.compare(0, 7, "queued ") == 0 ? reply.substr(7, reply.find(' ', 7) - 7) : std::string();
+    if (!failedId.size() || !doneId.size())
+    {
+        printf("FAIL: render not queued: %s", reply.c_str());
+        passed = false;
+    }
+    else
+    {
+        check("status " + failedId, reply);
+        printf("%s", reply.c_str());
+        if (reply.find("state=failed") == std::string::npos)
+        {
+            printf("FAIL: job %s should fail at its first frame\n", failedId.c_str());
+            passed = false;
+        }
+        check("status " + doneId, reply);
+        printf("%s", reply.c_str());
+        if (reply.find("state=done") == std::string::npos)
+        {
+            printf("FAIL: job %s should render after the failed one\n", doneId.c_str());
+            passed = false;
+        }
+    }
+    check("shutdown", reply);
+    serverThread.join();
+    printf("%s\n", passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+    // Only the server's reply goes to stdout, for scripts that submit jobs
+    if (argc > 3 && strcmp(argv[1], "--submit") == 0)
+    {
+#ifdef _WIN32
+        printf("The render server needs Unix domain sockets, which this build does not support\n");
+        return 1;
+#else
+        std::string command = argv[3];
+        for (int i = 4; i < argc; i++)
+            command += std::string(" ") + argv[i];
+        return SubmitToRenderServer(argv[2], command);
+#endif
+    }
+    
+    // A video streamed to stdout gets it from the first byte, and the messages go to stderr
+    if (argc > 1 && strcmp(argv[1], "--server") != 0)
+    {
+        bool stream = false;
+        const char * target = "-";
+        for (int i = 1; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--stream") == 0)
+                stream = true;
+            else if (strcmp(argv[i], "--stream-to") == 0 && i + 1 < argc)
+                target = argv[++i];
+        }
+        if (stream && strcmp(target, "-") == 0)
+            FrameWriter::DivertStdout();
+    }
+
+    printf("=== NFL Video Renderer Starting ===\n");
     fflush(stdout);
-    FrameBuffer frameBuffer(width, height);
-    printf("  FrameBuffer created\n");
+    
+    if (argc > 2 && strcmp(argv[1], "--csv-bench") == 0)
+    {
+        String gamePlay = (argc > 3) ? String(argv[3]) : String(L"58580_001136");
+        double gigabytes = (argc > 4) ? atof(argv[4]) : 2.0;
+        String outputCsv = (argc > 5) ? String(argv[5]) : String(L"tracking_bench.csv");
+        return TrackingCsvBenchmark(argv[2], gamePlay, gigabytes, outputCsv);
+    }
+    if (argc > 3 && strcmp(argv[1], "--build-index") == 0)
+    {
+        String gamePlay = (argc > 4) ? String(argv[4]) : String(L"58580_001136");
+        return PlayIndexBenchmark(argv[2], argv[3], gamePlay);
+    }
+    if (argc > 2 && strcmp(argv[1], "--server") == 0)
+    {
+#ifdef _WIN32
+        printf("The render server needs Unix domain sockets, which this build does not support\n");
+        return 1;
+#else
+        VideoOptions defaults;
+        String statsPath;
+        int workers = 2;
+        CoreLib::Int64 sceneCacheCap = (CoreLib::Int64)1024 << 20;
+        for (int i = 3; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+                workers = atoi(argv[++i]);
+            else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+                statsPath = argv[++i];
+            else if (strcmp(argv[i], "--scene-cache") == 0 && i + 1 < argc)
+                sceneCacheCap = (CoreLib::Int64)(atof(argv[++i]) * 1024.0 * 1024.0);
+            else
+                ParseVideoOption(argc, argv, i, defaults);
+        }
+        ResourceManager::Enabled = true;
+        RenderServer server(argv[2], statsPath, defaults, workers, sceneCacheCap);
+        return server.Run();
+#endif
+    }
+    if (argc > 4 && strcmp(argv[1], "--server-check") == 0)
+    {
+#ifdef _WIN32
+        printf("The render server needs Unix domain sockets, which this build does not support\n");
+        return 1;
+#else
+        return RenderServerCheck(argv[2], argv[3], argv[4], argc > 5 ? String(argv[5]) : String(L"server_check"));
+#endif
+    }
+    
+    if (argc < 4)
+    {
+        printf("Usage: %s <tracking_csv> <game_play> <stadium_model.obj> [output_dir] [width] [height] [--texture-cache]\n"
+               "          [--texture-cache-dir dir] [--texture-budget MB] [--model-cache] [--model-cache-dir dir]\n"
+               "          [--fps rate] [--interpolation nearest|linear|catmull-rom] [--frames-in-flight count|auto]\n"
+               "          [--frame-memory MB] [--static-layer] [--dirty-tiles] [--frame-format bmp|png|qoi]\n"
+               "          [--stream rgb|y4m|i420|nv12] [--stream-to target] [--stream-queue count] [--stream-threads count]\n"
+               "          [--yuv-range limited|full] [--yuv-gamma]\n", argv[0]);
+        printf("Example: %s tracking.csv 58580_001136 stadium.obj output/ 1920 1080\n", argv[0]);
+        printf("  --texture-cache: keep decoded stadium textures in .texcache files next to the images for later runs\n");
+        printf("  --texture-cache-dir: the same, with the cache files in the given directory\n");
+        printf("  --texture-budget: page stadium mip levels in on first use and evict the least recently used\n"
+               "                    ones to keep the resident texture memory within the given size\n");
+        printf("  --model-cache: keep the processed stadium model in a .mdlcache file next to it for later runs\n");
+        printf("  --model-cache-dir: the same, with the cache file in the given directory\n");
+        printf("  --fps: output frame rate; tracking data is sampled at 10 Hz, and by default each step is one frame\n");
+        printf("  --interpolation nearest|linear|catmull-rom: player positions and orientations between steps (linear)\n");
+        printf("  --frames-in-flight: render this many frames at once, each with its own frame buffer and renderer (1);\n"
+               "                      auto starts from one and adds frames while that raises the frames per second\n");
+        printf("  --frame-memory: cap on the frame buffers and renderer buffers of the frames in flight\n");
+        printf("  --static-layer: draw the stadium once per camera and lighting setup and restore its color and depth\n"
+               "                  for each frame before drawing the players\n");
+        printf("  --dirty-tiles: with the static layer, restore and convert only the tiles the players covered in\n"
+               "                 the frame or the one before it (implies --static-layer)\n");
+        printf("  --frame-format bmp|png|qoi: file format of the frames (bmp); PNG and QOI are lossless and encoded in\n"
+               "                              strips on the worker pool, QOI fastest, PNG smallest\n");
+        printf("  --stream rgb|y4m|i420|nv12: write the frames as one rgb24, YUV4MPEG2 or raw 4:2:0 stream instead of\n"
+               "                              image files, written on a thread of its own while later frames render; YUV\n"
+               "                              is BT.709, so tell the encoder, e.g. -colorspace bt709 -color_trc bt709\n");
+        printf("  --stream-to target: - for stdout (the default; messages go to stderr), |command for an encoder that\n"
+               "                      reads the stream, e.g. \"|ffmpeg -y -i - -c:v libx264 out.mp4\", or a file or FIFO\n");
+        printf("  --stream-queue count: frames waiting for conversion or writing at most (4)\n");
+        printf("  --stream-threads count: rgb24 conversion threads (2)\n");
+        printf("  --yuv-range limited|full: code values of a YUV stream (limited)\n");
+        printf("  --yuv-gamma: the rendered color is linear light; apply the BT.709 transfer function to it\n");
+        printf("\nUsage: %s --server <socket> [--workers count] [--stats file] [--scene-cache MB] [render options]\n", argv[0]);
+        printf("  Serves render jobs on a Unix domain socket, keeping tracking data, models, textures and the scenes and\n"
+               "  buffers of recent jobs loaded between them; the render options above are the jobs' defaults\n");
+        printf("  --workers: jobs rendered at once (2); --stats: file rewritten with the queue and job timings as they\n"
+               "  change; --scene-cache: cap on the frame buffers and renderers kept for later jobs (1024)\n");
+        printf("Usage: %s --submit <socket> <command...>\n", argv[0]);
+        printf("  Sends a command to a render server and prints the reply:\n"
+               "    render tracking=file play=game_play stadium=obj output=dir [width=W] [height=H] [fps=F] [priority=P]\n"
+               "           [camera=x,y,z,targetX,targetY,targetZ] [interpolation=nearest|linear|catmull-rom]\n"
+               "           [format=bmp|png|qoi] [stream=rgb|y4m|i420|nv12]\n"
+               "    status id | wait id | stats | shutdown\n");
+        printf("Usage: %s --server-check <tracking_csv> <game_play> <stadium_model.obj> [output_dir]\n", argv[0]);
+        printf("  Starts a render server, renders a job whose first frame throws and then a good one at 160x90, with\n"
+               "  texture residency updates between waves, and checks that the first fails and the second finishes\n");
+        printf("\nUsage: %s --csv-bench <tracking_csv> [game_play] [GB] [output_csv]\n", argv[0]);
+        printf("  Times tracking CSV loading on a file of the given size (2 GB by default) made from the rows of\n"
+               "  tracking_csv under new game_play values, and on one an eighth of that size, at most 256 MB\n");
+        printf("\nUsage: %s --build-index <tracking_csv> <index_file> [game_play]\n", argv[0]);
+        printf("  Converts tracking_csv to a play index, which can be given in place of the tracking CSV to load one\n"
+               "  play without scanning the file, checks that every play reads back the same, and times loads of\n"
+               "  game_play from both files\n");
+        return 1;
+    }
+    
+    printf("Step 1: Parsing arguments...\n");
+    String trackingCsv = argv[1];
+    String gamePlay = argv[2];
+    String stadiumModel = argv[3];
+    VideoOptions options;
+    if (argc > 4)
+        options.OutputDir = argv[4];
+    if (argc > 5)
+        options.Width = StringToInt(argv[5]);
+    if (argc > 6)
+        options.Height = StringToInt(argv[6]);
+    for (int i = 4; i < argc; i++)
+        ParseVideoOption(argc, argv, i, options);
+    String outputDir = options.OutputDir;
+    int width = options.Width, height = options.Height;
+    // Players of a team share one box model, and the stadium is loaded once
+    ResourceManager::Enabled = true;
+    
+    printf("  Tracking CSV: %s\n", trackingCsv.ToMultiByteString());
+    printf("  Game Play: %s\n", gamePlay.ToMultiByteString());
+    printf("  Stadium Model: %s\n", stadiumModel.ToMultiByteString());
+    printf("  Output Dir: %s\n", outputDir.ToMultiByteString());
+    printf("  Resolution: %dx%d\n", width, height);
+    if (options.AdaptiveFramesInFlight)
+        printf("  Frames in flight: auto, up to %d\n", options.FramesInFlight);
+    else
+        printf("  Frames in flight: %d\n", options.FramesInFlight);
+    if (options.FrameMemoryCap > 0)
+        printf("  Frame memory cap: %.1f MB\n", options.FrameMemoryCap / 1048576.0);
+    if (options.UseStaticLayer)
+        printf("  Static layer: on%s\n", options.TrackDirtyTiles ? ", dirty tiles only" : "");
+    
+    // Load play data
+    printf("\nStep 2: Loading play data...\n");
+    PlayData playData;
+    try {
+        printf("  Calling TrackingDataLoader::GetPlay...\n");
+        fflush(stdout);
+        playData = TrackingDataLoader::GetPlay(trackingCsv, gamePlay);
+        printf("  GetPlay returned, checking playData...\n");
+        fflush(stdout);
+        printf("  playData.steps.size() = %d\n", (int)playData.steps.size());
+        fflush(stdout);
+        printf("  playData.players.size() = %d\n", (int)playData.players.size());
+        fflush(stdout);
+    }
+    catch (Exception& ex) {
+        printf("Exception loading play data: %s\n", ex.Message.ToMultiByteString());
+        return 1;
+    }
+    catch (std::exception& ex) {
+        printf("std::exception loading play data: %s\n", ex.what());
+        return 1;
+    }
+    catch (...) {
+        printf("Unknown exception loading play data\n");
+        return 1;
+    }
+    
+    printf("  Play data loaded: %d steps, %d players\n", (int)playData.steps.size(), (int)playData.players.size());
+    fflush(stdout);
+    
+    if (playData.steps.size() == 0)
+    {
+        printf("Error: Play not found or has no data\n");
+        fflush(stdout);
+        return 1;
+    }
+    
+    printf("\nStep 3: Creating view settings...\n");
     fflush(stdout);
-    printf("  Creating TiledRenderer...\n");
+    // Create view settings
+    ViewSettings viewSettings;
+    printf("  ViewSettings object created\n");
+    fflush(stdout);
+    viewSettings.WindowWidth = width;
+    viewSettings.WindowHeight = height;
+    viewSettings.FovY = 60.0f;
+    viewSettings.zNear = 0.1f;
+    viewSettings.zFar = 500.0f;
+    printf("  ViewSettings configured\n");
     fflush(stdout);
-    IRasterRenderer* renderer = CreateTiledRenderer();
-    printf("  TiledRenderer created\n");
+    
+    printf("\nStep 4: Creating scene...\n");
     fflush(stdout);
-    printf("  Setting FrameBuffer on renderer...\n");
+    // Create scene
+    NFLPlayScene* scene = nullptr;
+    try {
+        printf("  Creating NFLPlayScene with stadium: %s\n", stadiumModel.ToMultiByteString());
+        fflush(stdout);
+        scene = new NFLPlayScene(viewSettings, stadiumModel, playData);
+        scene->SetInterpolation(options.Interpolation);
+        printf("  Scene created successfully\n");
+        auto & resources = ResourceManager::Global().GetStatistics();
+        printf("  Shared resources: %d models and %d textures loaded, %d requests served from shared copies\n",
+            resources.ModelLoads, resources.TextureLoads, resources.ModelHits + resources.TextureHits);
+        fflush(stdout);
+        printf("  Scene pointer: %p\n", (void*)scene);
+        fflush(stdout);
+    }
+    catch (Exception& ex) {
+        printf("Exception creating scene: %s\n", ex.Message.ToMultiByteString());
+        fflush(stdout);
+        return 1;
+    }
+    catch (std::exception& ex) {
+        printf("std::exception creating scene: %s\n", ex.what());
+        fflush(stdout);
+        return 1;
+    }
+    catch (...) {
+        printf("Unknown exception creating scene\n");
+        fflush(stdout);
+        return 1;
+    }
+    
+    printf("  After scene creation, before lighting setup\n");
     fflush(stdout);
-    renderer->SetFrameBuffer(&frameBuffer);
-    printf("  FrameBuffer set on renderer\n");
+    
+    printf("\nStep 5: Setting up lighting...\n");
     fflush(stdout);
+    try {
+        scene->SetShader(CreateFieldShader());
+        printf("  Shader set on scene successfully\n");
+        fflush(stdout);
+    } catch (Exception& ex) {
+        printf("  Exception setting shader: %s\n", ex.Message.ToMultiByteString());
+        fflush(stdout);
+        return 1;
+    } catch (...) {
+        printf("  Unknown exception setting shader\n");
+        fflush(stdout);
+        return 1;
+    }
     
-    printf("  Checking playData.steps.size()...\n");
+    printf("\nStep 6: Creating renderer...\n");
+    fflush(stdout);
+    std::vector<std::unique_ptr<FrameSlot>> slots;
+    slots.push_back(std::unique_ptr<FrameSlot>(new FrameSlot(scene, width, height, options.TrackDirtyTiles)));
+    printf("  FrameBuffer (%dx%d) and TiledRenderer created\n", width, height);
     fflush(stdout);
+    
     int numSteps = (int)playData.steps.size();
     printf("  numSteps = %d\n", numSteps);
     fflush(stdout);
+    std::vector<float> frameTimes = GetFrameTimes(playData, options.Fps);
+    int numFrames = (int)frameTimes.size();
     
     // Render each frame
-    printf("\nStep 7: Rendering %d frames...\n", numSteps);
-    fflush(stdout);
-    printf("  Entering rendering loop...\n");
+    printf("\nStep 7: Rendering %d frames...\n", numFrames);
     fflush(stdout);
     
-    for (size_t i = 0; i < playData.steps.size(); i++)
+    // Slots for further frames in flight are added when the schedule first asks for them
+    auto createSlot = [&]() -> FrameSlot *
     {
-        int step = playData.steps[i];
-        scene->SetStep(step);
-        
-        // Render frame
-        renderer->Clear(scene->ClearColor);
-        scene->Draw(renderer);
-        renderer->Finish();
-        
-        // Save frame - use zero-padded frame numbers for proper sorting
-        char frameNumStr[32];
-        snprintf(frameNumStr, sizeof(frameNumStr), "%05d", (int)i);
-        String framePath = Path::Combine(outputDir, String(L"frame_") + String(frameNumStr) + L".bmp");
-        try {
-            frameBuffer.SaveColorBuffer(framePath);
-        } catch (Exception& ex) {
-            printf("Error saving frame %d: %s\n", (int)i, ex.Message.ToMultiByteString());
-            fflush(stdout);
-            // Continue with next frame
-        }
-        
-        if ((i + 1) % 10 == 0 || i == 0)
-        {
-            printf("Rendered %d/%d frames (step %d)\n", (int)(i + 1), (int)playData.steps.size(), step);
-            fflush(stdout);
-        }
+        NFLPlayScene * slotScene = new NFLPlayScene(viewSettings, stadiumModel, playData);
+        slotScene->SetInterpolation(options.Interpolation);
+        slotScene->SetShader(CreateFieldShader());
+        return new FrameSlot(slotScene, width, height, options.TrackDirtyTiles);
+    };
+    VideoStats stats;
+    try {
+        stats = RenderFrames(options, frameTimes, slots, createSlot, true);
+    } catch (IOException& ex) {
+        printf("%s\n", ex.Message.ToMultiByteString());
+        return 1;
     }
     
-    printf("\nRendering complete! Rendered %d frames total.\n", (int)playData.steps.size());
+    printf("\nRendering complete! Rendered %d frames total.\n", numFrames);
+    printf("%.1f frames per second, up to %d frames in flight (%d at the end), %.2f MB per frame in flight\n",
+           numFrames / Math::Max(stats.Seconds, 1e-9), stats.MaxFramesInFlight, stats.FinalFramesInFlight, stats.SlotBytes / 1048576.0);
+    if (CoreLib::Imaging::TextureResidency::Budget > 0)
+        printf("Peak resident texture memory: %.2f MB (budget %.2f MB)\n", stats.PeakTextureBytes / 1048576.0,
+               CoreLib::Imaging::TextureResidency::Budget / 1048576.0);
     fflush(stdout);
+    if (options.Stream)
+    {
+        printf("Streamed %.1f MB of %s to %s, %.2f s of it in writes\n", stats.StreamBytes / 1048576.0,
+               options.StreamFormat == FrameStreamFormat::Rgb ? "rgb24" : (options.StreamFormat == FrameStreamFormat::Y4m ? "YUV4MPEG2" :
+               (options.StreamYuv.Layout == YuvLayout::Nv12 ? "NV12" : "I420")), options.StreamTarget.ToMultiByteString(),
+               stats.StreamWriteSeconds);
+        if (stats.StreamError.Length() || stats.FailedFrames)
+        {
+            printf("Stream failed: %s\n", stats.StreamError.Length() ? stats.StreamError.ToMultiByteString() : "frames were dropped");
+            return 1;
+        }
+        return 0;
+    }
     printf("Frames saved to %s\n", outputDir.ToMultiByteString());
     fflush(stdout);
     
     // Count actual files created
     int fileCount = 0;
-    for (int i = 0; i < (int)playData.steps.size(); i++)
+    for (int i = 0; i < numFrames; i++)
     {
-        char frameNumStr[32];
-        snprintf(frameNumStr, sizeof(frameNumStr), "%05d", i);
-        String framePath = Path::Combine(outputDir, String(L"frame_") + String(frameNumStr) + L".bmp");
-        if (File::Exists(framePath))
+        if (File::Exists(GetFramePath(options, i)))
         {
             fileCount++;
         }
     }
     printf("Actually created %d frame files\n", fileCount);
     fflush(stdout);
-    printf("To create video: ffmpeg -r 10 -i %s/frame_%%05d.bmp -c:v libx264 -pix_fmt yuv420p output.mp4\n", 
-           outputDir.ToMultiByteString());
-    
-    DestroyRenderer(renderer);
+    printf("To create video: ffmpeg -r %g -i %s/frame_%%05d.%s -c:v libx264 -pix_fmt yuv420p output.mp4\n", 
+           options.Fps > 0.0 ? options.Fps : 10.0, outputDir.ToMultiByteString(), options.FrameExtension.ToMultiByteString());
     return 0;
 }
 #endif // NFL_VIDEO_RENDERER_MAIN
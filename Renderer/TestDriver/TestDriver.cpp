@@ -4,9 +4,23 @@
 #include "ViewSettings.h"
 #include "CoreLib/PerformanceCounter.h"
 #include "CoreLib/LibIO.h"
+#include "CoreLib/Graphics/ObjModel.h"
+#include "Parallel.h"
+#include "Statistics.h"
+#include "ModelResource.h"
+#include "ResourceManager.h"
+#ifdef USE_TBB
+#include "../lib/tbb/task_scheduler_init.h"
+#endif
 #include <iostream>
 #include <iomanip>
 #include <string>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 using namespace CoreLib::Basic;
 using namespace CoreLib::Diagnostics;
@@ -24,10 +38,21 @@ private:
 
 public:
     ViewSettings viewSettings;
+    String modelFile;       // model drawn by the model test
+    bool scalarSampling;    // sample textures one fragment at a time instead of per quad
+    bool perPixelFootprint; // per-fragment texture filter footprint instead of one per quad
+    bool compareSampling;   // time scalar against quad texture sampling instead of a plain render
+    bool compareCompression; // compare uncompressed against block-compressed textures instead of a plain render
+    bool compareLoading;    // time texture loading over thread counts and mipmap filters instead of a plain render
 
     TestDriver(int Width, int Height, bool tiled, const String& test, const String& output, const String & baseDir)
         :testName(test), outputFileName(output), frameBuffer(Width, Height), baseDir(baseDir)
     {
+        scalarSampling = false;
+        perPixelFootprint = false;
+        compareSampling = false;
+        compareCompression = false;
+        compareLoading = false;
         if (tiled)
             renderer = CreateTiledRenderer();
         else
@@ -41,12 +66,9 @@ public:
         DestroyRenderer(renderer);
     }
 
-    void Run()
+    RefPtr<TestScene> LoadScene()
     {
         RefPtr<TestScene> scene;
-
-        printf("Loading scene...\n");
-
         if (testName == L"triangle")
             scene = CreateTestScene0(viewSettings);
         else if (testName == L"square")
@@ -65,18 +87,50 @@ public:
             scene = CreateTestScene7(viewSettings, baseDir);
         else if (testName == L"alpha_order")
             scene = CreateTestScene8(viewSettings);
-        else
+        else if (testName == L"model" && modelFile.Length())
+            scene = CreateTestSceneViewingModel(viewSettings, modelFile);
+        return scene;
+    }
+
+    void Run()
+    {
+        if (compareCompression)
+        {
+            CompareCompression();
+            return;
+        }
+        if (compareLoading)
+        {
+            CompareLoading();
+            return;
+        }
+
+        printf("Loading scene...\n");
+
+        RefPtr<TestScene> scene = LoadScene();
+        if (!scene)
         {
             printf("Unknown scene \"%s\".\n", testName.ToMultiByteString());
             return;
         }
 
+        if (compareSampling)
+        {
+            CompareSampling(scene);
+            return;
+        }
+        scene->State.ScalarTextureSampling = scalarSampling;
+        scene->State.PerPixelTextureFootprint = perPixelFootprint;
+
         printf("Rendering scene: %s (%dx%d)\n", testName.ToMultiByteString(), frameBuffer.GetWidth(), frameBuffer.GetHeight());
 
         // prime things with a render before starting the timer
+        Statistics::VertexShaderInvocations.store(0);
         renderer->Clear(Vec4(0.0f, 0.0f, 0.0f, 0.0f));
         scene->Draw(renderer);
         renderer->Finish();
+        int vertexShaderInvocations = Statistics::VertexShaderInvocations.load();
+        UpdateTextureResidency(0);
 
         // now render a few frames with timing, report the best time
         const int frameCount = 6;
@@ -89,13 +143,38 @@ public:
             renderer->Finish();
             auto elapsed = PerformanceCounter::ToSeconds(PerformanceCounter::End(counter));
             minTime = (elapsed < minTime) ? elapsed : minTime;
+            UpdateTextureResidency(i + 1);
         }
 
         printf("Frame render time: %lf ms\n", 1000.0 * minTime, frameCount);
+        printf("Vertex shader invocations: %d per frame\n", vertexShaderInvocations);
 
         frameBuffer.SaveColorBuffer(outputFileName);
     }
 
+    // Pages texture levels in and out after a frame when a residency budget is set, and
+    // reports the frame's texture memory against the budget
+    void UpdateTextureResidency(int frame)
+    {
+        using namespace CoreLib::Imaging;
+        if (TextureResidency::Budget == 0)
+            return;
+        auto counter = PerformanceCounter::Start();
+        TextureResidencyStats stats = TextureResidency::Update();
+        double elapsed = PerformanceCounter::ToSeconds(PerformanceCounter::End(counter));
+        const double mb = 1.0 / (1024.0 * 1024.0);
+        printf("Frame %d textures: %6.2f / %.2f MB resident, %d levels sampled (%.2f MB), paged in %.2f MB, evicted %.2f MB, deferred %d (%.2f ms)\n",
+            frame, stats.ResidentBytes * mb, TextureResidency::Budget * mb, stats.SampledLevels, stats.SampledBytes * mb,
+            stats.PagedInBytes * mb, stats.EvictedBytes * mb, stats.DeferredLevels, elapsed * 1000.0);
+    }
+
+    void RenderFrame(RefPtr<TestScene> scene)
+    {
+        renderer->Clear(scene->ClearColor);
+        scene->Draw(renderer);
+        renderer->Finish();
+    }
+
     double RenderScene(RefPtr<TestScene> scene) 
     {
 
@@ -123,15 +202,575 @@ public:
         return 1000.0 * minTime;
 
     }
+
+    // Renders the scene with per-fragment and per-quad texture sampling for every filter and
+    // address mode, and reports the frame times and the largest channel difference in 8-bit steps.
+    // The difference is taken on unlit texture output so lighting does not scale the sampling error
+    void CompareSampling(RefPtr<TestScene> scene)
+    {
+        const TextureFilter filters[] = {TextureFilter::Nearest, TextureFilter::Linear, TextureFilter::TriLinear,
+            TextureFilter::Anisotropic4x, TextureFilter::Anisotropic8x, TextureFilter::Anisotropic16x};
+        const char * filterNames[] = {"Nearest", "Linear", "TriLinear", "Anisotropic4x", "Anisotropic8x", "Anisotropic16x"};
+        const TextureAddressMode addressModes[] = {TextureAddressMode::Wrap, TextureAddressMode::Clamp};
+        const char * addressNames[] = {"Wrap", "Clamp"};
+
+        printf("Comparing texture sampling on %s (%dx%d)\n", testName.ToMultiByteString(), frameBuffer.GetWidth(), frameBuffer.GetHeight());
+        printf("Filter         | Address | Scalar ms | Quad ms | Speedup | Max diff (LSB)\n");
+        printf("---------------|---------|-----------|---------|---------|---------------\n");
+        TextureShader textureShader;
+        List<Vec4> reference;
+        int pixelCount = frameBuffer.GetWidth() * frameBuffer.GetHeight();
+        for (int f = 0; f < 6; f++)
+        {
+            for (int a = 0; a < 2; a++)
+            {
+                scene->State.TextureFilter = filters[f];
+                scene->State.TextureAddress = addressModes[a];
+                scene->State.ScalarTextureSampling = true;
+                double scalarTime = RenderScene(scene);
+                scene->State.ScalarTextureSampling = false;
+                double quadTime = RenderScene(scene);
+
+                scene->OverrideShader(&textureShader);
+                scene->State.ScalarTextureSampling = true;
+                RenderFrame(scene);
+                reference.SetSize(pixelCount);
+                memcpy(reference.Buffer(), frameBuffer.GetColorBuffer(), sizeof(Vec4) * pixelCount);
+                scene->State.ScalarTextureSampling = false;
+                RenderFrame(scene);
+                scene->OverrideShader(nullptr);
+                Vec4 * pixels = frameBuffer.GetColorBuffer();
+                float maxDiff = 0.0f;
+                for (int i = 0; i < pixelCount; i++)
+                {
+                    maxDiff = Math::Max(maxDiff, fabsf(pixels[i].x - reference[i].x));
+                    maxDiff = Math::Max(maxDiff, fabsf(pixels[i].y - reference[i].y));
+                    maxDiff = Math::Max(maxDiff, fabsf(pixels[i].z - reference[i].z));
+                    maxDiff = Math::Max(maxDiff, fabsf(pixels[i].w - reference[i].w));
+                }
+                printf("%-14s | %-7s | %9.2f | %7.2f | %6.2fx | %.3f\n", filterNames[f], addressNames[a],
+                    scalarTime, quadTime, scalarTime / quadTime, maxDiff * 255.0f);
+            }
+        }
+
+        // quad-uniform footprint against per-pixel derivatives and footprints (accuracy mode)
+        printf("\nFilter         | Per-pixel ms | Quad ms | Speedup | Mean diff (LSB) | Max diff (LSB)\n");
+        printf("---------------|--------------|---------|---------|-----------------|---------------\n");
+        scene->State.TextureAddress = TextureAddressMode::Wrap;
+        for (int f = 2; f < 6; f++)
+        {
+            scene->State.TextureFilter = filters[f];
+            scene->State.PerPixelTextureFootprint = true;
+            double perPixelTime = RenderScene(scene);
+            scene->State.PerPixelTextureFootprint = false;
+            double quadTime = RenderScene(scene);
+
+            scene->OverrideShader(&textureShader);
+            scene->State.PerPixelTextureFootprint = true;
+            RenderFrame(scene);
+            reference.SetSize(pixelCount);
+            memcpy(reference.Buffer(), frameBuffer.GetColorBuffer(), sizeof(Vec4) * pixelCount);
+            scene->State.PerPixelTextureFootprint = false;
+            RenderFrame(scene);
+            scene->OverrideShader(nullptr);
+            Vec4 * pixels = frameBuffer.GetColorBuffer();
+            float maxDiff = 0.0f;
+            double sumDiff = 0.0;
+            for (int i = 0; i < pixelCount; i++)
+            {
+                float diff = Math::Max(Math::Max(fabsf(pixels[i].x - reference[i].x), fabsf(pixels[i].y - reference[i].y)),
+                    Math::Max(fabsf(pixels[i].z - reference[i].z), fabsf(pixels[i].w - reference[i].w)));
+                maxDiff = Math::Max(maxDiff, diff);
+                sumDiff += diff;
+            }
+            printf("%-14s | %12.2f | %7.2f | %6.2fx | %15.3f | %.3f\n", filterNames[f], perPixelTime, quadTime,
+                perPixelTime / quadTime, sumDiff / pixelCount * 255.0, maxDiff * 255.0f);
+        }
+    }
+
+    // Loads the scene once with RGBA8 textures and once with BC1/BC3 textures, and reports the
+    // texture memory, frame time and PSNR of the compressed frame against the uncompressed one
+    void CompareCompression()
+    {
+        const char * formatNames[] = {"RGBA8", "BC1/BC3"};
+        double frameTime[2];
+        int memory[2];
+        List<Vec4> reference;
+        int pixelCount = frameBuffer.GetWidth() * frameBuffer.GetHeight();
+        double psnr = 0.0;
+        bool savedCompressOnLoad = CoreLib::Imaging::TextureData::CompressOnLoad;
+        for (int i = 0; i < 2; i++)
+        {
+            CoreLib::Imaging::TextureData::CompressOnLoad = (i == 1);
+            printf("Loading scene with %s textures...\n", formatNames[i]);
+            RefPtr<TestScene> scene = LoadScene();
+            if (!scene)
+            {
+                printf("Unknown scene \"%s\".\n", testName.ToMultiByteString());
+                CoreLib::Imaging::TextureData::CompressOnLoad = savedCompressOnLoad;
+                return;
+            }
+            memory[i] = scene->GetTextureMemory();
+            frameTime[i] = RenderScene(scene);
+            Vec4 * pixels = frameBuffer.GetColorBuffer();
+            if (i == 0)
+            {
+                reference.SetSize(pixelCount);
+                memcpy(reference.Buffer(), pixels, sizeof(Vec4) * pixelCount);
+                continue;
+            }
+            double squaredError = 0.0;
+            for (int p = 0; p < pixelCount; p++)
+            {
+                Vec3 diff = Vec3(Math::Clamp(pixels[p].x, 0.0f, 1.0f) - Math::Clamp(reference[p].x, 0.0f, 1.0f),
+                    Math::Clamp(pixels[p].y, 0.0f, 1.0f) - Math::Clamp(reference[p].y, 0.0f, 1.0f),
+                    Math::Clamp(pixels[p].z, 0.0f, 1.0f) - Math::Clamp(reference[p].z, 0.0f, 1.0f));
+                squaredError += diff.x * diff.x + diff.y * diff.y + diff.z * diff.z;
+            }
+            double mse = squaredError / (pixelCount * 3.0);
+            psnr = mse > 0.0 ? 10.0 * log10(1.0 / mse) : 99.0;
+        }
+        CoreLib::Imaging::TextureData::CompressOnLoad = savedCompressOnLoad;
+        printf("Scene %s (%dx%d)\n", testName.ToMultiByteString(), frameBuffer.GetWidth(), frameBuffer.GetHeight());
+        printf("Textures | Memory (MB) | Frame ms\n");
+        printf("---------|-------------|---------\n");
+        for (int i = 0; i < 2; i++)
+            printf("%-8s | %11.1f | %8.2f\n", formatNames[i], memory[i] / (1024.0 * 1024.0), frameTime[i]);
+        printf("Memory saving: %.1f%%, frame time change: %+.1f%%, frame PSNR: %.2f dB\n",
+            memory[0] ? 100.0 * (memory[0] - memory[1]) / memory[0] : 0.0,
+            100.0 * (frameTime[1] - frameTime[0]) / frameTime[0], psnr);
+    }
+
+    // Loads the scene with 1, 2, 4 ... worker threads up to the hardware thread count, once per
+    // mipmap filter, and reports the time spent decoding textures and building their mip chains
+    void CompareLoading()
+    {
+        using namespace CoreLib::Imaging;
+        const MipmapFilter filters[] = {MipmapFilter::Box, MipmapFilter::GammaBox, MipmapFilter::Kaiser};
+        const char * filterNames[] = {"Box", "GammaBox", "Kaiser"};
+        List<int> threadCounts;
+#ifdef USE_TBB
+        int maxThreads = tbb::task_scheduler_init::default_num_threads();
+        for (int threads = 1; threads < maxThreads; threads *= 2)
+            threadCounts.Add(threads);
+        threadCounts.Add(maxThreads);
+#else
+        threadCounts.Add(0);
+#endif
+        List<double> loadTime;
+        MipmapFilter savedFilter = TextureData::DefaultMipmapFilter;
+        for (int t = 0; t < threadCounts.Count(); t++)
+        {
+#ifdef USE_TBB
+            tbb::task_scheduler_init init(threadCounts[t]);
+#endif
+            for (int f = 0; f < 3; f++)
+            {
+                TextureData::DefaultMipmapFilter = filters[f];
+                // best of two loads, the first one also warms the file cache
+                double minTime = 1e10;
+                for (int run = 0; run < 2; run++)
+                {
+                    RefPtr<TestScene> scene = LoadScene();
+                    if (!scene)
+                    {
+                        printf("Unknown scene \"%s\".\n", testName.ToMultiByteString());
+                        TextureData::DefaultMipmapFilter = savedFilter;
+                        return;
+                    }
+                    minTime = Math::Min(minTime, scene->GetTextureLoadTime());
+                }
+                loadTime.Add(minTime);
+            }
+        }
+        TextureData::DefaultMipmapFilter = savedFilter;
+        printf("Scene %s, texture load time (ms) by mipmap filter\n", testName.ToMultiByteString());
+        printf("Threads | %9s | %9s | %9s | Speedup (Box/GammaBox/Kaiser)\n", filterNames[0], filterNames[1], filterNames[2]);
+        printf("--------|-----------|-----------|-----------|-----------------------------\n");
+        for (int t = 0; t < threadCounts.Count(); t++)
+        {
+            double * times = loadTime.Buffer() + t * 3;
+            printf("%7d | %9.1f | %9.1f | %9.1f | %.2fx / %.2fx / %.2fx\n", threadCounts[t], times[0] * 1000.0, times[1] * 1000.0,
+                times[2] * 1000.0, loadTime[0] / times[0], loadTime[1] / times[1], loadTime[2] / times[2]);
+        }
+    }
+};
+
+// Data cache miss counter for the calling thread; Read() returns -1 where hardware counters are unavailable
+class CacheMissCounter
+{
+private:
+    int fd;
+public:
+    CacheMissCounter(bool lastLevel)
+    {
+        fd = -1;
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        if (lastLevel)
+        {
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        }
+        else
+        {
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        }
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+    ~CacheMissCounter()
+    {
+#ifdef __linux__
+        if (fd != -1)
+            close(fd);
+#endif
+    }
+    void Start()
+    {
+#ifdef __linux__
+        if (fd != -1)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+    long long Read()
+    {
+        long long count = -1;
+#ifdef __linux__
+        if (fd != -1)
+        {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != sizeof(count))
+                count = -1;
+        }
+#endif
+        return count;
+    }
 };
 
+// keeps the benchmark results observable so the sampling loops are not optimized away
+volatile float benchmarkSink;
+
+// Samples a texture the way a 1024x1024 screen of anisotropic quads would, with the major
+// axis of the footprint rotated through several angles, once per texel layout. Reports
+// throughput and L1/last-level cache misses per fragment for trilinear and 16x anisotropic.
+void TextureSamplingBenchmark(const String & textureFile)
+{
+    using namespace CoreLib::Imaging;
+    RefPtr<TextureData> texture;
+    if (textureFile.Length())
+        texture = new TextureData(textureFile);
+    else
+    {
+        // 4K texture of hashed noise so neither layout benefits from repeated content
+        const int size = 4096;
+        List<Color> pixels;
+        pixels.SetSize(size * size);
+        for (int i = 0; i < size * size; i++)
+        {
+            unsigned int h = (unsigned int)i * 2654435761u;
+            h ^= h >> 15;
+            pixels[i] = Color(h & 255, (h >> 8) & 255, (h >> 16) & 255, 255);
+        }
+        texture = new TextureData(size, size, pixels.Buffer());
+    }
+    const int screenSize = 1024;
+    const float anisotropy = 8.0f;
+    const int angles[] = {0, 15, 30, 45, 60, 75, 90};
+    const TextureLayout layouts[] = {TextureLayout::Linear, TextureLayout::Tiled};
+    const char * layoutNames[] = {"Linear", "Tiled"};
+    const char * filterNames[] = {"TriLinear", "Anisotropic16x"};
+    float fragmentCount = (float)(screenSize * screenSize);
+
+    printf("Texture sampling benchmark (%dx%d texture, %dx%d fragments, %.0fx footprint)\n",
+        texture->Width, texture->Height, screenSize, screenSize, anisotropy);
+    printf("Filter         | Angle | Layout | Mfrag/s | L1 miss/frag | LLC miss/frag\n");
+    printf("---------------|-------|--------|---------|--------------|--------------\n");
+    CacheMissCounter l1Misses(false);
+    CacheMissCounter llcMisses(true);
+    for (int f = 0; f < 2; f++)
+    {
+        for (int a = 0; a < 7; a++)
+        {
+            // one screen pixel steps 'anisotropy' texels along the major axis and one along the minor axis
+            float angle = angles[a] * (Math::Pi / 180.0f);
+            float dudx = cos(angle) * anisotropy * texture->InvWidth;
+            float dvdx = sin(angle) * anisotropy * texture->InvHeight;
+            float dudy = -sin(angle) * texture->InvWidth;
+            float dvdy = cos(angle) * texture->InvHeight;
+            __m128 quadX = _mm_setr_ps(0.0f, 1.0f, 0.0f, 1.0f);
+            __m128 quadY = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+            for (int l = 0; l < 2; l++)
+            {
+                texture->SetLayout(layouts[l]);
+                __m128 checksum = _mm_setzero_ps();
+                double minTime = 1e10;
+                long long minL1 = -1, minLLC = -1;
+                for (int run = 0; run < 3; run++)
+                {
+                    auto counter = PerformanceCounter::Start();
+                    l1Misses.Start();
+                    llcMisses.Start();
+                    for (int y = 0; y < screenSize; y += 2)
+                    {
+                        __m128 py = _mm_add_ps(_mm_set1_ps((float)y), quadY);
+                        for (int x = 0; x < screenSize; x += 2)
+                        {
+                            __m128 px = _mm_add_ps(_mm_set1_ps((float)x), quadX);
+                            __m128 u = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(dudx)), _mm_mul_ps(py, _mm_set1_ps(dudy)));
+                            __m128 v = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(dvdx)), _mm_mul_ps(py, _mm_set1_ps(dvdy)));
+                            QuadColor color;
+                            QuadDerivatives derivatives;
+                            ComputeQuadDerivatives(derivatives, u, v);
+                            if (f == 0)
+                                TrilinearSamplingQuad(color, texture.Ptr(), derivatives, u, v);
+                            else
+                                AnisotropicSamplingQuad(color, texture.Ptr(), 16, derivatives, u, v);
+                            checksum = _mm_add_ps(checksum, color.R);
+                        }
+                    }
+                    long long l1 = l1Misses.Read();
+                    long long llc = llcMisses.Read();
+                    double elapsed = PerformanceCounter::ToSeconds(PerformanceCounter::End(counter));
+                    if (elapsed < minTime)
+                    {
+                        minTime = elapsed;
+                        minL1 = l1;
+                        minLLC = llc;
+                    }
+                }
+                CORE_LIB_ALIGN_16(float sum[4]);
+                _mm_store_ps(sum, checksum);
+                char l1Text[32], llcText[32];
+                if (minL1 >= 0)
+                    sprintf(l1Text, "%.2f", minL1 / fragmentCount);
+                else
+                    sprintf(l1Text, "n/a");
+                if (minLLC >= 0)
+                    sprintf(llcText, "%.3f", minLLC / fragmentCount);
+                else
+                    sprintf(llcText, "n/a");
+                benchmarkSink = benchmarkSink + sum[0] + sum[1] + sum[2] + sum[3];
+                printf("%-14s | %5d | %-6s | %7.1f | %12s | %13s\n", filterNames[f], angles[a], layoutNames[l],
+                    fragmentCount / minTime * 1e-6, l1Text, llcText);
+            }
+        }
+    }
+    if (textureFile.Length() == 0)
+        printf("(procedural texture; pass -texture file to benchmark an image)\n");
+}
+
+bool SameObjModel(CoreLib::Graphics::ObjModel & a, CoreLib::Graphics::ObjModel & b)
+{
+    if (a.Vertices.Count() != b.Vertices.Count() || a.Normals.Count() != b.Normals.Count() ||
+        a.TexCoords.Count() != b.TexCoords.Count() || a.Faces.Count() != b.Faces.Count() || a.Materials.Count() != b.Materials.Count())
+        return false;
+    return memcmp(a.Vertices.Buffer(), b.Vertices.Buffer(), a.Vertices.Count() * sizeof(Vec3)) == 0 &&
+        memcmp(a.Normals.Buffer(), b.Normals.Buffer(), a.Normals.Count() * sizeof(Vec3)) == 0 &&
+        memcmp(a.TexCoords.Buffer(), b.TexCoords.Buffer(), a.TexCoords.Count() * sizeof(Vec2)) == 0 &&
+        memcmp(a.Faces.Buffer(), b.Faces.Buffer(), a.Faces.Count() * sizeof(CoreLib::Graphics::ObjFace)) == 0 &&
+        a.Tangents.Count() == b.Tangents.Count() && a.TangentIds.Count() == b.TangentIds.Count() &&
+        memcmp(a.Tangents.Buffer(), b.Tangents.Buffer(), a.Tangents.Count() * sizeof(Vec4)) == 0 &&
+        memcmp(a.TangentIds.Buffer(), b.TangentIds.Buffer(), a.TangentIds.Count() * sizeof(int)) == 0;
+}
+
+// Writes an obj of a few 1 MB load chunks whose faces refer to vertices up to a few hundred back, and
+// every thousandth one to the first vertex, with ids either relative to the vertices so far or absolute
+static bool WriteIndexTestObj(const String & fileName, bool relative)
+{
+    FILE * f = fopen(fileName.ToMultiByteString(), "wb");
+    if (!f)
+        return false;
+    std::string text;
+    char line[256];
+    for (int i = 0; i < 30000; i++)
+    {
+        snprintf(line, sizeof(line), "v %.4f %.4f %.4f\nvt %.4f %.4f\nvn 0.0 0.0 1.0\n", i * 0.01f, (i % 97) * 0.5f, (i % 13) * 0.25f,
+            (i % 101) * 0.01f, (i % 89) * 0.01f);
+        text += line;
+        if (i < 3)
+            continue;
+        int ids[3] = {i, Math::Max(i - 1 - i * 7 % 300, 0), i % 1000 == 0 ? 0 : Math::Max(i - 2 - i * 13 % 400, 0)};
+        text += "f";
+        for (int v = 0; v < 3; v++)
+        {
+            int id = relative ? ids[v] - (i + 1) : ids[v] + 1;
+            if (i % 4 == 0)
+                snprintf(line, sizeof(line), " %d", id);
+            else if (i % 4 == 1)
+                snprintf(line, sizeof(line), " %d/%d", id, id);
+            else if (i % 4 == 2)
+                snprintf(line, sizeof(line), " %d//%d", id, id);
+            else
+                snprintf(line, sizeof(line), " %d/%d/%d", id, id, id);
+            text += line;
+        }
+        text += "\n";
+    }
+    bool written = fwrite(text.data(), 1, text.size(), f) == text.size();
+    return fclose(f) == 0 && written;
+}
+
+// Loads an obj with relative (negative) face ids, many of them to vertices of an earlier load chunk,
+// serially and on the worker pool, and checks it against the same file with absolute ids
+void CheckRelativeObjIndices()
+{
+    using namespace CoreLib::Graphics;
+    String relativeFile = CoreLib::IO::File::GetTemporaryName(L"objbench_relative.obj");
+    String absoluteFile = CoreLib::IO::File::GetTemporaryName(L"objbench_absolute.obj");
+    bool same = false;
+    if (WriteIndexTestObj(relativeFile, true) && WriteIndexTestObj(absoluteFile, false))
+    {
+        ObjModel absolute, relative, relativeParallel;
+        same = LoadObj(absolute, absoluteFile.ToMultiByteString()) && LoadObj(relative, relativeFile.ToMultiByteString()) &&
+            LoadObj(relativeParallel, relativeFile.ToMultiByteString(), PolygonType::Triangle, Parallel::Tasks()) &&
+            absolute.Faces.Count() > 0 && SameObjModel(relative, absolute) && SameObjModel(relativeParallel, absolute);
+    }
+    CoreLib::IO::File::Delete(relativeFile);
+    CoreLib::IO::File::Delete(absoluteFile);
+    printf("Relative face ids across load chunks, same as absolute ids: %s\n\n", same ? "yes" : "NO");
+}
+
+// Times LoadObj, RecomputeNormals and ComputeTangents on one file serially and on the worker pool from
+// 1 to all hardware threads, and checks that every parallel run produces the same model as the serial one
+void ObjLoadingBenchmark(const String & modelFile)
+{
+    using namespace CoreLib::Graphics;
+    String fileName = modelFile;
+    double fileSize;
+    {
+        CoreLib::IO::MemoryMappedFile file(fileName);
+        fileSize = (double)file.Size();
+    }
+    List<int> threadCounts;
+#ifdef USE_TBB
+    int maxThreads = tbb::task_scheduler_init::default_num_threads();
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+        threadCounts.Add(threads);
+    threadCounts.Add(maxThreads);
+#else
+    threadCounts.Add(0);
+#endif
+    // best of three loads, the first one also warms the file cache
+    ObjModel reference;
+    double serialTime = 1e10;
+    for (int run = 0; run < 3; run++)
+    {
+        ObjModel model;
+        auto counter = PerformanceCounter::Start();
+        if (!LoadObj(model, fileName.ToMultiByteString()))
+        {
+            printf("Cannot load model file \"%s\".\n", fileName.ToMultiByteString());
+            return;
+        }
+        serialTime = Math::Min(serialTime, PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)));
+        if (run == 0)
+            reference = _Move(model);
+    }
+    CheckRelativeObjIndices();
+    printf("%s: %.1f MB, %d vertices, %d faces, %d materials\n", fileName.ToMultiByteString(), fileSize / (1024.0 * 1024.0),
+        reference.Vertices.Count(), reference.Faces.Count(), reference.Materials.Count());
+    printf("Threads | Load (ms) |   MB/s | Speedup | Same as serial\n");
+    printf("--------|-----------|--------|---------|---------------\n");
+    printf(" serial | %9.1f | %6.1f |   1.00x |\n", serialTime * 1000.0, fileSize / (1024.0 * 1024.0) / serialTime);
+    for (int t = 0; t < threadCounts.Count(); t++)
+    {
+#ifdef USE_TBB
+        tbb::task_scheduler_init init(threadCounts[t]);
+#endif
+        double minTime = 1e10;
+        bool same = true;
+        for (int run = 0; run < 3; run++)
+        {
+            ObjModel model;
+            auto counter = PerformanceCounter::Start();
+            LoadObj(model, fileName.ToMultiByteString(), PolygonType::Triangle, Parallel::Tasks());
+            minTime = Math::Min(minTime, PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)));
+            same = same && SameObjModel(model, reference);
+        }
+        printf("%7d | %9.1f | %6.1f | %6.2fx | %s\n", threadCounts[t], minTime * 1000.0, fileSize / (1024.0 * 1024.0) / minTime,
+            serialTime / minTime, same ? "yes" : "NO");
+    }
+    // normals and tangents, each run on a fresh copy of the loaded model
+    ObjModel frameReference;
+    double serialNormalTime = 1e10, serialTangentTime = 1e10;
+    for (int run = 0; run < 3; run++)
+    {
+        ObjModel model = reference;
+        auto counter = PerformanceCounter::Start();
+        RecomputeNormals(model);
+        serialNormalTime = Math::Min(serialNormalTime, PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)));
+        counter = PerformanceCounter::Start();
+        ComputeTangents(model);
+        serialTangentTime = Math::Min(serialTangentTime, PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)));
+        if (run == 0)
+            frameReference = _Move(model);
+    }
+    printf("\n%d normals, %d tangents\n", frameReference.Normals.Count(), frameReference.Tangents.Count());
+    printf("Threads | Normals (ms) | Speedup | Tangents (ms) | Speedup | Same as serial\n");
+    printf("--------|--------------|---------|---------------|---------|---------------\n");
+    printf(" serial | %12.1f |   1.00x | %13.1f |   1.00x |\n", serialNormalTime * 1000.0, serialTangentTime * 1000.0);
+    for (int t = 0; t < threadCounts.Count(); t++)
+    {
+#ifdef USE_TBB
+        tbb::task_scheduler_init init(threadCounts[t]);
+#endif
+        double normalTime = 1e10, tangentTime = 1e10;
+        bool same = true;
+        for (int run = 0; run < 3; run++)
+        {
+            ObjModel model = reference;
+            auto counter = PerformanceCounter::Start();
+            RecomputeNormals(model, Parallel::Tasks());
+            normalTime = Math::Min(normalTime, PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)));
+            counter = PerformanceCounter::Start();
+            ComputeTangents(model, Parallel::Tasks());
+            tangentTime = Math::Min(tangentTime, PerformanceCounter::ToSeconds(PerformanceCounter::End(counter)));
+            same = same && SameObjModel(model, frameReference);
+        }
+        printf("%7d | %12.1f | %6.2fx | %13.1f | %6.2fx | %s\n", threadCounts[t], normalTime * 1000.0, serialNormalTime / normalTime,
+            tangentTime * 1000.0, serialTangentTime / tangentTime, same ? "yes" : "NO");
+    }
+}
+
 void Usage(char* binaryName)
 {
     printf("Renderer Test Driver\n"
            "Usage:\n"
-           "   %s testname [-w imagewidth] [-h imageweight] [-tiled] [-mediadir dir]\n\n"
-           "   testname can be: triangle, square, sibenik, bunny, sponza, warehouse, alphablend, station, alpha_order\n\n"
-           "   mediadir: base directory without trialing slash: e.g., ../../Media\n\n",
+           "   %s testname [-w imagewidth] [-h imageweight] [-tiled] [-mediadir dir] [-scalartex] [-perpixelfootprint] [-comparesampling]\n"
+           "      [-texlayout linear|tiled] [-texture file] [-texcompress] [-comparecompression] [-mipfilter box|gamma|kaiser]\n"
+           "      [-compareloading] [-texcache] [-texcachedir dir] [-texbudget MB] [-model file] [-modelcache] [-modelcachedir dir]\n\n"
+           "   testname can be: triangle, square, sibenik, bunny, sponza, warehouse, alphablend, station, alpha_order,\n"
+           "      model (the -model file, centered in view), all, texbench (texture sampling microbenchmark, no scene),\n"
+           "      objbench (obj loading, normal and tangent throughput)\n\n"
+           "   mediadir: base directory without trialing slash: e.g., ../../Media\n\n"
+           "   scalartex: sample textures one fragment at a time (reference path)\n\n"
+           "   comparesampling: time scalar vs. quad texture sampling for all filters and address modes,\n"
+           "      and quad-uniform vs. per-pixel filter footprints\n\n"
+           "   perpixelfootprint: per-fragment derivatives and filter footprint (reference path)\n\n"
+           "   texlayout: texel order of loaded textures, row-major (default) or 4x4 tiles\n\n"
+           "   texture: image used by texbench instead of a procedural 4K texture\n\n"
+           "   model: obj, gltf or glb file drawn by the model test, or obj file loaded by objbench (sponza from the\n"
+           "      media directory by default)\n\n"
+           "   texcompress: store textures as BC1 (opaque) or BC3 (alpha) and decode while sampling\n\n"
+           "   comparecompression: report texture memory, frame time and PSNR of compressed vs. RGBA8 textures\n\n"
+           "   mipfilter: 2x2 box on stored values (default), 2x2 box in linear light, or Kaiser-windowed sinc\n\n"
+           "   compareloading: report texture load time from 1 to all hardware threads for each mipmap filter\n\n"
+           "   texcache: keep decoded mip chains in .texcache files next to the images and map them on later runs\n\n"
+           "   texcachedir: like texcache, with the cache files in the given directory\n\n"
+           "   texbudget: page texture mip levels in on first use and evict the least recently used ones to\n"
+           "      stay within the given resident size; textures are backed by their cache files\n\n"
+           "   modelcache: keep processed models in .mdlcache files next to the models and map them on later runs\n\n"
+           "   modelcachedir: like modelcache, with the cache files in the given directory\n\n",
            binaryName);
 }
 
@@ -153,6 +792,13 @@ int main(int argc, char* argv[])
     String testOutput = L"";
     String baseDir = L"./Media";
     bool tiled = false;
+    bool scalarSampling = false;
+    bool perPixelFootprint = false;
+    bool compareSampling = false;
+    bool compareCompression = false;
+    bool compareLoading = false;
+    String textureFile;
+    String modelFile;
     // parse commandline
     int ptr = 1;
     if (argc >= 2)
@@ -181,11 +827,88 @@ int main(int argc, char* argv[])
                 ptr++;
                 baseDir = argv[ptr];
             }
+            else if (String(argv[ptr]) == L"-texlayout")
+            {
+                ptr++;
+                if (String(argv[ptr]) == L"tiled")
+                    CoreLib::Imaging::TextureData::DefaultLayout = CoreLib::Imaging::TextureLayout::Tiled;
+                else
+                    CoreLib::Imaging::TextureData::DefaultLayout = CoreLib::Imaging::TextureLayout::Linear;
+            }
+            else if (String(argv[ptr]) == L"-texture")
+            {
+                ptr++;
+                textureFile = argv[ptr];
+            }
+            else if (String(argv[ptr]) == L"-model")
+            {
+                ptr++;
+                modelFile = argv[ptr];
+            }
+            else if (String(argv[ptr]) == L"-texcachedir")
+            {
+                ptr++;
+                CoreLib::Imaging::TextureData::UseCache = true;
+                CoreLib::Imaging::TextureData::CacheDirectory = argv[ptr];
+            }
+            else if (String(argv[ptr]) == L"-modelcachedir")
+            {
+                ptr++;
+                ModelResource::UseCache = true;
+                ModelResource::CacheDirectory = argv[ptr];
+            }
+            else if (String(argv[ptr]) == L"-texbudget")
+            {
+                ptr++;
+                CoreLib::Imaging::TextureResidency::Budget = (CoreLib::Int64)(StringToDouble(argv[ptr]) * 1024.0 * 1024.0);
+            }
+            else if (String(argv[ptr]) == L"-mipfilter")
+            {
+                ptr++;
+                if (String(argv[ptr]) == L"gamma")
+                    CoreLib::Imaging::TextureData::DefaultMipmapFilter = CoreLib::Imaging::MipmapFilter::GammaBox;
+                else if (String(argv[ptr]) == L"kaiser")
+                    CoreLib::Imaging::TextureData::DefaultMipmapFilter = CoreLib::Imaging::MipmapFilter::Kaiser;
+                else
+                    CoreLib::Imaging::TextureData::DefaultMipmapFilter = CoreLib::Imaging::MipmapFilter::Box;
+            }
         }
         if (String(argv[ptr]) == L"-tiled")
         {
             tiled = true;
         }
+        else if (String(argv[ptr]) == L"-scalartex")
+        {
+            scalarSampling = true;
+        }
+        else if (String(argv[ptr]) == L"-perpixelfootprint")
+        {
+            perPixelFootprint = true;
+        }
+        else if (String(argv[ptr]) == L"-comparesampling")
+        {
+            compareSampling = true;
+        }
+        else if (String(argv[ptr]) == L"-texcompress")
+        {
+            CoreLib::Imaging::TextureData::CompressOnLoad = true;
+        }
+        else if (String(argv[ptr]) == L"-comparecompression")
+        {
+            compareCompression = true;
+        }
+        else if (String(argv[ptr]) == L"-compareloading")
+        {
+            compareLoading = true;
+        }
+        else if (String(argv[ptr]) == L"-texcache")
+        {
+            CoreLib::Imaging::TextureData::UseCache = true;
+        }
+        else if (String(argv[ptr]) == L"-modelcache")
+        {
+            ModelResource::UseCache = true;
+        }
         else if (String(argv[ptr]) == L"-help" ||
                  String(argv[ptr]) == L"--help" ||
                  String(argv[ptr]) == L"-?")
@@ -211,9 +934,18 @@ int main(int argc, char* argv[])
 
     try
     {   
-        if (testName == L"all")
+        if (testName == L"texbench")
+        {
+            TextureSamplingBenchmark(textureFile);
+        }
+        else if (testName == L"objbench")
         {
-            
+            ObjLoadingBenchmark(modelFile.Length() ? modelFile : baseDir + L"/crytek-sponza/sponza.obj");
+        }
+        else if (testName == L"all")
+        {
+            // the tiled pass reuses the models and textures of the first one
+            ResourceManager::Enabled = true;
             TestDriver driver(width, height, false, testName, testOutput, baseDir);
             printf("Square            | "); double square    = driver.RenderScene(CreateTestScene1(driver.viewSettings, baseDir));
             printf("Bunny             | "); double bunny     = driver.RenderScene(CreateTestScene3(driver.viewSettings, baseDir));
@@ -244,6 +976,14 @@ int main(int argc, char* argv[])
             std::cout << "station  " << "          " << std::right << std::setw(7) << rnd(station)   << "          " << std::right << std::setw(7) << rnd(station_tiled)   << "          " << std::setw(7) << rnd2(station   / station_tiled  ) << "x" << std::endl;
             std::cout << std::endl;
 
+            auto & resources = ResourceManager::Global().GetStatistics();
+            double loaded = resources.LoadedMemory / (1024.0 * 1024.0), shared = resources.SharedMemory / (1024.0 * 1024.0);
+            printf("Shared resources: %d models and %d textures loaded (%.1f MB), %d model and %d texture requests\n"
+                "served from shared copies; %.1f MB saved, %.0f%% of the %.1f MB private copies would take\n", resources.ModelLoads,
+                resources.TextureLoads, loaded, resources.ModelHits, resources.TextureHits, shared,
+                loaded + shared > 0.0 ? 100.0 * shared / (loaded + shared) : 0.0, loaded + shared);
+            ResourceManager::Global().Clear();
+
         } 
         else 
         {
@@ -252,6 +992,12 @@ int main(int argc, char* argv[])
             else
                 printf("*** Running TILED renderer implementation ***\n");
             TestDriver driver(width, height, tiled, testName, testOutput, baseDir);
+            driver.scalarSampling = scalarSampling;
+            driver.perPixelFootprint = perPixelFootprint;
+            driver.compareSampling = compareSampling;
+            driver.compareCompression = compareCompression;
+            driver.compareLoading = compareLoading;
+            driver.modelFile = modelFile;
             driver.Run();
         }
     }
@@ -1,5 +1,5 @@
 #include "TestScene.h"
-#include "ModelResource.h"
+#include "ResourceManager.h"
 
 namespace RasterRenderer
 {
@@ -8,20 +8,39 @@ namespace RasterRenderer
         class ModelTestScene : public TestScene
         {
         private:
-            ModelResource model;
+            RefPtr<ModelResource> model; // shared with other scenes through the ResourceManager when it is enabled
+            Shader * modelShader, * drawShader; // null for the model's own shader
         public:
             ModelTestScene(CoreLib::Basic::String fileName, ViewSettings & viewSettings)
-                : model(ModelResource::FromObjModel(fileName)), TestScene(viewSettings)
+                : model(ResourceManager::Global().LoadModel(fileName)), modelShader(nullptr), drawShader(nullptr), TestScene(viewSettings)
             {
-                printf("Loaded scene: %d triangles\n", model.TriangleCount());
+                printf("Loaded scene: %d triangles, %d vertices in %.1f ms%s\n", model->TriangleCount(), model->VertexCount(),
+                    model->LoadTime * 1000.0, model->LoadedFromCache ? " from the model cache" : "");
             }
             virtual void Draw(IRasterRenderer * renderer)
             {
-                model.Draw(State, renderer);
+                model->Draw(State, renderer, drawShader);
+            }
+            float GetRadius()
+            {
+                return model->Radius;
             }
             virtual void SetShader(Shader * shader)
             {
-                model.SetShader(shader);
+                modelShader = drawShader = shader;
+            }
+            virtual int GetTextureMemory()
+            {
+                return model->GetTextureMemory();
+            }
+            virtual double GetTextureLoadTime()
+            {
+                return model->TextureLoadTime;
+            }
+            virtual void OverrideShader(Shader * shader)
+            {
+                TestScene::OverrideShader(shader);
+                drawShader = shader ? shader : modelShader;
             }
         };
 
@@ -29,5 +48,16 @@ namespace RasterRenderer
         {
             return new ModelTestScene(fileName, viewSettings);
         }
+
+        TestScene * CreateTestSceneViewingModel(ViewSettings & viewSettings, CoreLib::Basic::String fileName)
+        {
+            auto rs = new ModelTestScene(fileName, viewSettings);
+            // Radius spans the bounding box, so the box fits at this distance for any field of view above 53 degrees
+            float distance = Math::Max(rs->GetRadius(), 1e-3f);
+            Matrix4 modelView;
+            Matrix4::LookAt(modelView, Vec3(0.5f, 0.4f, 0.75f) * distance, Vec3(0.0f, 0.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f));
+            rs->State.SetModelViewTransform(modelView);
+            return rs;
+        }
     }
 }
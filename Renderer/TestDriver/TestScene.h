@@ -42,6 +42,21 @@ namespace RasterRenderer
                 defaultShader = shader;
 				State.Shader = shader;
             }
+            // Bytes held by the scene's textures
+            virtual int GetTextureMemory()
+            {
+                return 0;
+            }
+            // Seconds spent loading the scene's textures
+            virtual double GetTextureLoadTime()
+            {
+                return 0.0;
+            }
+            // Draws with the given shader in place of the scene's own (not owned); nullptr restores them
+            virtual void OverrideShader(Shader * shader)
+            {
+                State.Shader = shader ? shader : defaultShader.Ptr();
+            }
         };
 
         TestScene * CreateTestScene0(ViewSettings & viewSettings);
@@ -54,6 +69,8 @@ namespace RasterRenderer
         TestScene * CreateTestScene7(ViewSettings & viewSettings, String baseDir);
 		TestScene * CreateTestScene8(ViewSettings & viewSettings);
         TestScene * CreateTestSceneFromModel(ViewSettings & viewSettings, CoreLib::Basic::String fileName);
+        // A .obj, .gltf or .glb model centered at the origin, seen from above its front right corner
+        TestScene * CreateTestSceneViewingModel(ViewSettings & viewSettings, CoreLib::Basic::String fileName);
     }
 }
 #endif
\ No newline at end of file
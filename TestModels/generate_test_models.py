@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+"""
+Writes the small glTF 2.0 models used to check the glTF loader. Only the standard library is
+needed, so the models can be rebuilt without network access:
+
+  textured_box.gltf  .gltf with an external .bin buffer and .png texture, 16-bit indices
+  hierarchy.glb      .glb with an embedded image, node hierarchy with TRS and matrix transforms,
+                     a mirrored instance, a triangle strip and a fan without normals, 8-bit indices
+  alpha_modes.gltf   buffer and image in data: URIs, OPAQUE, MASK and BLEND materials
+
+Render one with: render model -model TestModels/hierarchy.glb -o hierarchy.bmp
+"""
+import base64
+import json
+import math
+import os
+import struct
+import sys
+import zlib
+
+
+def png(width, height, pixel):
+    """Encode an RGBA8 PNG; pixel(x, y) returns (r, g, b, a) with y = 0 at the top."""
+    rows = b''.join(b'\x00' + b''.join(bytes(pixel(x, y)) for x in range(width)) for y in range(height))
+
+    def chunk(kind, data):
+        return struct.pack('>I', len(data)) + kind + data + struct.pack('>I', zlib.crc32(kind + data) & 0xffffffff)
+    return (b'\x89PNG\r\n\x1a\n' + chunk(b'IHDR', struct.pack('>IIBBBBB', width, height, 8, 6, 0, 0, 0)) +
+            chunk(b'IDAT', zlib.compress(rows, 9)) + chunk(b'IEND', b''))
+
+
+def checker(x, y):
+    # red marks the top left corner of the image, which glTF maps to uv (0, 0)
+    if x < 8 and y < 8:
+        return (230, 40, 40, 255)
+    return (235, 235, 235, 255) if (x // 4 + y // 4) % 2 == 0 else (40, 90, 200, 255)
+
+
+def stripes(x, y):
+    return (250, 200, 40, 255) if (x // 4) % 2 == 0 else (40, 160, 60, 120)
+
+
+class Builder:
+    """Collects buffer views and accessors into one binary buffer."""
+
+    def __init__(self):
+        self.data = bytearray()
+        self.views = []
+        self.accessors = []
+
+    def view(self, data, target=None):
+        while len(self.data) % 4:
+            self.data.append(0)
+        view = {'buffer': 0, 'byteOffset': len(self.data), 'byteLength': len(data)}
+        if target:
+            view['target'] = target
+        self.data += data
+        self.views.append(view)
+        return len(self.views) - 1
+
+    def accessor(self, values, kind, component):
+        formats = {5121: 'B', 5123: 'H', 5125: 'I', 5126: 'f'}
+        width = {'SCALAR': 1, 'VEC2': 2, 'VEC3': 3}[kind]
+        flat = [v for value in values for v in (value if width > 1 else (value,))]
+        target = 34963 if kind == 'SCALAR' else 34962
+        accessor = {'bufferView': self.view(struct.pack('<%d%s' % (len(flat), formats[component]), *flat), target),
+                    'componentType': component, 'count': len(values), 'type': kind}
+        if kind == 'VEC3' and component == 5126:
+            accessor['min'] = [min(v[i] for v in values) for i in range(3)]
+            accessor['max'] = [max(v[i] for v in values) for i in range(3)]
+        self.accessors.append(accessor)
+        return len(self.accessors) - 1
+
+    def gltf(self, **parts):
+        doc = {'asset': {'version': '2.0', 'generator': 'generate_test_models.py'}}
+        doc.update(parts)
+        doc['bufferViews'] = self.views
+        doc['accessors'] = self.accessors
+        return doc
+
+
+def box(size):
+    """24 vertices of a cube with one normal per face, and 36 counter-clockwise indices."""
+    positions, normals, uvs, indices = [], [], [], []
+    h = size / 2
+    for axis in range(3):
+        for sign in (1.0, -1.0):
+            normal = [0.0, 0.0, 0.0]
+            normal[axis] = sign
+            u = [0.0, 0.0, 0.0]
+            u[(axis + 1) % 3] = 1.0
+            v = [0.0, 0.0, 0.0]
+            v[(axis + 2) % 3] = 1.0
+            if sign < 0:
+                u, v = v, u
+            base = len(positions)
+            for s, t in ((-1, -1), (1, -1), (1, 1), (-1, 1)):
+                positions.append([h * (normal[i] + s * u[i] + t * v[i]) for i in range(3)])
+                normals.append(normal)
+                uvs.append([(s + 1) / 2, (1 - t) / 2])
+            indices += [base, base + 1, base + 2, base, base + 2, base + 3]
+    return positions, normals, uvs, indices
+
+
+def textured_box(directory):
+    b = Builder()
+    positions, normals, uvs, indices = box(2.0)
+    primitive = {'attributes': {'POSITION': b.accessor(positions, 'VEC3', 5126),
+                                'NORMAL': b.accessor(normals, 'VEC3', 5126),
+                                'TEXCOORD_0': b.accessor(uvs, 'VEC2', 5126)},
+                 'indices': b.accessor(indices, 'SCALAR', 5123), 'material': 0}
+    doc = b.gltf(scene=0, scenes=[{'nodes': [0]}], nodes=[{'mesh': 0}], meshes=[{'primitives': [primitive]}],
+                 materials=[{'pbrMetallicRoughness': {'baseColorTexture': {'index': 0}}}],
+                 textures=[{'source': 0, 'sampler': 0}], samplers=[{'magFilter': 9729, 'minFilter': 9987}],
+                 images=[{'uri': 'checker.png'}],
+                 buffers=[{'uri': 'textured_box.bin', 'byteLength': len(b.data)}])
+    with open(os.path.join(directory, 'checker.png'), 'wb') as f:
+        f.write(png(32, 32, checker))
+    with open(os.path.join(directory, 'textured_box.bin'), 'wb') as f:
+        f.write(b.data)
+    with open(os.path.join(directory, 'textured_box.gltf'), 'w') as f:
+        json.dump(doc, f, indent=1)
+
+
+def hierarchy(directory):
+    b = Builder()
+    positions, normals, uvs, indices = box(1.0)
+    boxPrimitive = {'attributes': {'POSITION': b.accessor(positions, 'VEC3', 5126),
+                                   'NORMAL': b.accessor(normals, 'VEC3', 5126),
+                                   'TEXCOORD_0': b.accessor(uvs, 'VEC2', 5126)},
+                    'indices': b.accessor(indices, 'SCALAR', 5121), 'material': 0}
+    # a ribbon as a triangle strip and a hexagon as a fan, both without normals
+    ribbon = [[x * 0.5, 0.0 if i % 2 == 0 else 0.6, 0.0] for i, x in enumerate(range(8))]
+    stripPrimitive = {'attributes': {'POSITION': b.accessor(ribbon, 'VEC3', 5126)}, 'mode': 5, 'material': 1}
+    hexagon = [[0.0, 0.0, 0.0]] + [[math.cos(a * math.pi / 3), math.sin(a * math.pi / 3), 0.0] for a in range(7)]
+    fanPrimitive = {'attributes': {'POSITION': b.accessor(hexagon, 'VEC3', 5126)},
+                    'indices': b.accessor(list(range(8)), 'SCALAR', 5123), 'mode': 6, 'material': 2}
+    image = png(16, 16, checker)
+    imageView = b.view(image)
+    angle = math.radians(30)
+    rotation = [0.0, math.sin(angle / 2), 0.0, math.cos(angle / 2)]
+    nodes = [
+        {'name': 'root', 'children': [1, 2, 3, 4], 'rotation': rotation, 'scale': [1.5, 1.5, 1.5]},
+        {'name': 'box', 'mesh': 0, 'translation': [-1.2, 0.0, 0.0]},
+        # mirrored in x, so its triangles have to be reversed to stay counter-clockwise
+        {'name': 'mirrored box', 'mesh': 0, 'matrix': [-1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 1.2, 0.0, 0.0, 1]},
+        {'name': 'ribbon', 'mesh': 1, 'translation': [-1.75, 0.8, 0.0], 'children': [5]},
+        {'name': 'hexagon', 'mesh': 2, 'translation': [0.0, -1.2, 0.0], 'scale': [0.6, 0.6, 0.6]},
+        {'name': 'small box', 'mesh': 0, 'translation': [1.75, 0.6, 0.0], 'scale': [0.4, 0.4, 0.4]},
+    ]
+    doc = b.gltf(scene=0, scenes=[{'nodes': [0]}], nodes=nodes,
+                 meshes=[{'primitives': [boxPrimitive]}, {'primitives': [stripPrimitive]}, {'primitives': [fanPrimitive]}],
+                 materials=[{'pbrMetallicRoughness': {'baseColorTexture': {'index': 0}}},
+                            {'pbrMetallicRoughness': {'baseColorFactor': [0.9, 0.5, 0.1, 1.0]}, 'doubleSided': True},
+                            {'pbrMetallicRoughness': {'baseColorFactor': [0.2, 0.7, 0.3, 1.0]}, 'doubleSided': True}],
+                 textures=[{'source': 0}], images=[{'bufferView': imageView, 'mimeType': 'image/png'}],
+                 buffers=[{'byteLength': len(b.data)}])
+    while len(b.data) % 4:
+        b.data.append(0)
+    doc['buffers'][0]['byteLength'] = len(b.data)
+    text = json.dumps(doc, separators=(',', ':')).encode()
+    text += b' ' * (-len(text) % 4)
+    body = (struct.pack('<II', len(text), 0x4E4F534A) + text +
+            struct.pack('<II', len(b.data), 0x004E4942) + bytes(b.data))
+    with open(os.path.join(directory, 'hierarchy.glb'), 'wb') as f:
+        f.write(struct.pack('<III', 0x46546C67, 2, 12 + len(body)) + body)
+
+
+def alpha_modes(directory):
+    b = Builder()
+    quad = [[-0.5, -0.5, 0.0], [0.5, -0.5, 0.0], [0.5, 0.5, 0.0], [-0.5, 0.5, 0.0]]
+    quadUvs = [[0.0, 1.0], [1.0, 1.0], [1.0, 0.0], [0.0, 0.0]]
+    normal = [[0.0, 0.0, 1.0]] * 4
+    attributes = {'POSITION': b.accessor(quad, 'VEC3', 5126), 'NORMAL': b.accessor(normal, 'VEC3', 5126),
+                  'TEXCOORD_0': b.accessor(quadUvs, 'VEC2', 5126)}
+    indices = b.accessor([0, 1, 2, 0, 2, 3], 'SCALAR', 5125)
+    meshes = [{'primitives': [{'attributes': attributes, 'indices': indices, 'material': m}]} for m in range(4)]
+    striped = {'baseColorTexture': {'index': 0}}
+    materials = [
+        {'name': 'backdrop', 'pbrMetallicRoughness': {'baseColorFactor': [0.3, 0.3, 0.8, 1.0]}},
+        {'name': 'opaque', 'pbrMetallicRoughness': dict(striped, baseColorFactor=[1.0, 1.0, 1.0, 0.2])},
+        {'name': 'mask', 'alphaMode': 'MASK', 'alphaCutoff': 0.5, 'pbrMetallicRoughness': striped},
+        {'name': 'blend', 'alphaMode': 'BLEND', 'pbrMetallicRoughness': dict(striped, baseColorFactor=[1.0, 1.0, 1.0, 0.5])},
+    ]
+    nodes = [{'mesh': 0, 'translation': [0.0, 0.0, -0.5], 'scale': [4.0, 2.0, 1.0]},
+             {'mesh': 1, 'translation': [-1.2, 0.0, 0.0]},
+             {'mesh': 2, 'translation': [0.0, 0.0, 0.0]},
+             {'mesh': 3, 'translation': [1.2, 0.0, 0.0]}]
+    uri = 'data:application/octet-stream;base64,' + base64.b64encode(bytes(b.data)).decode()
+    image = 'data:image/png;base64,' + base64.b64encode(png(16, 16, stripes)).decode()
+    doc = b.gltf(scenes=[{'nodes': [0, 1, 2, 3]}], nodes=nodes, meshes=meshes, materials=materials,
+                 textures=[{'source': 0}], images=[{'uri': image}],
+                 buffers=[{'uri': uri, 'byteLength': len(b.data)}])
+    with open(os.path.join(directory, 'alpha_modes.gltf'), 'w') as f:
+        json.dump(doc, f, indent=1)
+
+
+if __name__ == '__main__':
+    directory = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+    textured_box(directory)
+    hierarchy(directory)
+    alpha_modes(directory)